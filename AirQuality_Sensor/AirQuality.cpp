@@ -85,39 +85,49 @@ void AirQuality::init(int pin)
 int AirQuality::slope(void)
 {
   if (timer_index > 0) {
-    if(((first_vol - last_vol) > 400) || (first_vol > 700)) {
-      DEBUG_STREAM.println("High pollution! Force signal active.");		
-      timer_index=0;	
-      avgVoltage();	
-      return 0;	
-    }
-    else if ((((first_vol - last_vol) > 400) && (first_vol < 700)) || ((first_vol - vol_standard) > 150)) {	
-      DEBUG_STREAM.print("sensor_value:");		
-      DEBUG_STREAM.print(first_vol);      		
-      DEBUG_STREAM.println("\t High pollution!");		
-      timer_index=0;	
-      avgVoltage();
-      return 1;
-    }
-    else if((((first_vol - last_vol) > 200) && (first_vol < 700))|| ((first_vol - vol_standard) > 50)) {
-      //Serial.println(first_vol-last_vol);
-      DEBUG_STREAM.print("sensor_value:");
-      DEBUG_STREAM.print(first_vol);      		
-      DEBUG_STREAM.println("\t Low pollution!");		
-      timer_index=0;
-      avgVoltage();
-      return 2;	
-    }
-    else {
-      avgVoltage();	
-      DEBUG_STREAM.print("sensor_value:");
-      DEBUG_STREAM.print(first_vol);
-      DEBUG_STREAM.println("\t Air fresh");
-      timer_index=0;
-      return 3;
-    }
-	}
+    timer_index=0;
+    return classify();
+  }
  
   return -1;
 }
 
+//Classify a new sample, e.g. from the SamplingEngine, no timer_index needed.
+int AirQuality::slope(int sample)
+{
+  last_vol = first_vol;
+  first_vol = sample;
+  return classify();
+}
+
+int AirQuality::classify(void)
+{
+  if(((first_vol - last_vol) > 400) || (first_vol > 700)) {
+    DEBUG_STREAM.println("High pollution! Force signal active.");		
+    avgVoltage();	
+    return 0;	
+  }
+  else if ((((first_vol - last_vol) > 400) && (first_vol < 700)) || ((first_vol - vol_standard) > 150)) {	
+    DEBUG_STREAM.print("sensor_value:");		
+    DEBUG_STREAM.print(first_vol);      		
+    DEBUG_STREAM.println("\t High pollution!");		
+    avgVoltage();
+    return 1;
+  }
+  else if((((first_vol - last_vol) > 200) && (first_vol < 700))|| ((first_vol - vol_standard) > 50)) {
+    //Serial.println(first_vol-last_vol);
+    DEBUG_STREAM.print("sensor_value:");
+    DEBUG_STREAM.print(first_vol);      		
+    DEBUG_STREAM.println("\t Low pollution!");		
+    avgVoltage();
+    return 2;	
+  }
+  else {
+    avgVoltage();	
+    DEBUG_STREAM.print("sensor_value:");
+    DEBUG_STREAM.print(first_vol);
+    DEBUG_STREAM.println("\t Air fresh");
+    return 3;
+  }
+}
+
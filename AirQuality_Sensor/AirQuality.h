@@ -38,8 +38,10 @@ public:
     boolean error;
     void init(int pin);
     int slope(void);
+    int slope(int sample);
     
 private:
     void avgVoltage(void);
+    int classify(void);
 };
 #endif
@@ -0,0 +1,282 @@
+/*
+  SamplingEngine
+
+  Timer triggered ADC sampling for the SODAQ Autonomo (SAMD21).
+  See SamplingEngine.h
+*/
+#include "Arduino.h"
+#include "wiring_private.h"
+#include "SamplingEngine.h"
+
+#define GCLK_SRC                4
+#define DMA_CHANNEL             0
+#define EVENT_CHANNEL           0
+
+// The DMAC wants the descriptor of channel N at BASEADDR + N. The other
+// blocks of the ring are linked from there, the last one links back.
+static DmacDescriptor baseDescriptors[DMA_CHANNEL + 1] __attribute__((aligned(16)));
+static DmacDescriptor ringDescriptors[SAMPLING_NR_BLOCKS - 1] __attribute__((aligned(16)));
+static DmacDescriptor writeback[DMA_CHANNEL + 1] __attribute__((aligned(16)));
+
+SamplingEngine *SamplingEngine::_active;
+
+/*
+ * Start sampling the analog pin
+ *
+ * The rate is in Hz (1 .. 16384). Each read() is the average of
+ * decimation samples.
+ */
+bool SamplingEngine::begin(int pin, uint16_t rate, uint16_t decimation)
+{
+  if (rate == 0 || rate > SAMPLING_CLOCK || decimation == 0
+      || decimation * SAMPLING_NR_BLOCKS > SAMPLING_RING_SIZE) {
+    return false;
+  }
+  _period = (SAMPLING_CLOCK + rate / 2) / rate;
+  _decimation = decimation;
+  _nrBlocks = 0;
+  _readBlocks = 0;
+  _nrOverruns = 0;
+  _active = this;
+
+  configureClock();
+  configureADC(pin);
+  configureDMA();
+  configureEvents();
+  configureTimer();
+  return true;
+}
+
+void SamplingEngine::end()
+{
+  TC3->COUNT16.CTRLA.reg &= ~TC_CTRLA_ENABLE;
+  while (TC3->COUNT16.STATUS.reg & TC_STATUS_SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+
+  NVIC_DisableIRQ(DMAC_IRQn);
+  DMAC->CHID.reg = DMAC_CHID_ID(DMA_CHANNEL);
+  DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+
+  // analogRead() expects the ADC without the event input
+  ADC->EVCTRL.reg = 0;
+  ADC->CTRLA.bit.ENABLE = 0;
+  while (ADC->STATUS.bit.SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+  _active = 0;
+}
+
+/*
+ * Is there a completely filled block?
+ */
+bool SamplingEngine::available()
+{
+  return _nrBlocks != _readBlocks;
+}
+
+/*
+ * Return the average of the oldest unread block, or -1 if there is none
+ *
+ * If the consumer fell behind, the blocks that were overwritten by the
+ * DMAC are skipped and counted as overruns.
+ */
+int SamplingEngine::read()
+{
+  while (true) {
+    uint32_t lag = _nrBlocks - _readBlocks;
+    if (lag == 0) {
+      return -1;
+    }
+    if (lag > SAMPLING_NR_BLOCKS - 1) {
+      // The DMAC is (about to be) writing in our block
+      _nrOverruns += lag - (SAMPLING_NR_BLOCKS - 1);
+      _readBlocks += lag - (SAMPLING_NR_BLOCKS - 1);
+    }
+
+    const volatile uint16_t *ptr = &_ring[(_readBlocks % SAMPLING_NR_BLOCKS) * _decimation];
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < _decimation; ++i) {
+      sum += ptr[i];
+    }
+
+    // Check that the block wasn't overwritten while we were summing
+    if (_nrBlocks - _readBlocks > SAMPLING_NR_BLOCKS - 1) {
+      continue;
+    }
+    ++_readBlocks;
+    return (sum + _decimation / 2) / _decimation;
+  }
+}
+
+/*
+ * Sleep until the DMAC completes a block
+ *
+ * Other interrupts (SysTick, USB) also wake up the CPU, hence the loop.
+ */
+void SamplingEngine::sleepUntilAvailable()
+{
+  while (!available()) {
+    __WFI();
+  }
+}
+
+// The generic clock GCLK4 runs from XOSC32K, divided by 2
+void SamplingEngine::configureClock()
+{
+  GCLK->GENDIV.reg = GCLK_GENDIV_ID(GCLK_SRC) | GCLK_GENDIV_DIV(2);
+  while (GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+
+  GCLK->GENCTRL.reg = GCLK_GENCTRL_GENEN |
+          GCLK_GENCTRL_SRC_XOSC32K |
+          GCLK_GENCTRL_ID(GCLK_SRC) |
+          GCLK_GENCTRL_RUNSTDBY;
+  while (GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+
+  PM->APBCMASK.reg |= PM_APBCMASK_TC3;
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN |
+          GCLK_CLKCTRL_GEN(GCLK_SRC) |
+          GCLK_CLKCTRL_ID(GCM_TCC2_TC3);
+  while (GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+}
+
+/*
+ * TC3 counts to CC0 (match frequency mode) and generates an overflow event
+ * No interrupt is used, the event starts the ADC.
+ */
+void SamplingEngine::configureTimer()
+{
+  TC3->COUNT16.CTRLA.reg &= ~TC_CTRLA_ENABLE;
+  while (TC3->COUNT16.STATUS.reg & TC_STATUS_SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+
+  TC3->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 |
+          TC_CTRLA_WAVEGEN_MFRQ |
+          TC_CTRLA_RUNSTDBY |
+          TC_CTRLA_PRESCALER_DIV1;
+  while (TC3->COUNT16.STATUS.reg & TC_STATUS_SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+
+  TC3->COUNT16.CC[0].reg = _period - 1;
+  TC3->COUNT16.EVCTRL.reg = TC_EVCTRL_OVFEO;
+  TC3->COUNT16.INTENCLR.reg = TC_INTENCLR_MASK;
+  while (TC3->COUNT16.STATUS.reg & TC_STATUS_SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+
+  TC3->COUNT16.CTRLA.reg |= TC_CTRLA_ENABLE;
+  while (TC3->COUNT16.STATUS.reg & TC_STATUS_SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+}
+
+// Route the TC3 overflow to the ADC start of conversion
+void SamplingEngine::configureEvents()
+{
+  PM->APBCMASK.reg |= PM_APBCMASK_EVSYS;
+
+  // The user channel number is the event channel plus one
+  EVSYS->USER.reg = EVSYS_USER_CHANNEL(EVENT_CHANNEL + 1) |
+          EVSYS_USER_USER(EVSYS_ID_USER_ADC_START);
+  EVSYS->CHANNEL.reg = EVSYS_CHANNEL_CHANNEL(EVENT_CHANNEL) |
+          EVSYS_CHANNEL_EVGEN(EVSYS_ID_GEN_TC3_OVF) |
+          EVSYS_CHANNEL_PATH_ASYNCHRONOUS;
+}
+
+/*
+ * The ADC keeps the resolution, reference and prescaler from the core
+ * (see wiring.c), just the input and the event input are changed.
+ */
+void SamplingEngine::configureADC(int pin)
+{
+  pinPeripheral(pin, PIO_ANALOG);
+
+  ADC->CTRLA.bit.ENABLE = 0;
+  while (ADC->STATUS.bit.SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+
+  ADC->INPUTCTRL.bit.MUXPOS = g_APinDescription[pin].ulADCChannelNumber;
+  ADC->EVCTRL.reg = ADC_EVCTRL_STARTEI;
+  ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+  while (ADC->STATUS.bit.SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+
+  ADC->CTRLA.bit.ENABLE = 1;
+  while (ADC->STATUS.bit.SYNCBUSY) {
+    /* Wait for synchronization */
+  }
+}
+
+/*
+ * One beat per ADC result, one descriptor per block
+ *
+ * The descriptors form a ring, so the DMAC runs forever without help of
+ * the CPU. Each block ends with the block interrupt.
+ */
+void SamplingEngine::configureDMA()
+{
+  PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+  PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+
+  DMAC->CTRL.reg &= ~DMAC_CTRL_DMAENABLE;
+  DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+  while (DMAC->CTRL.reg & DMAC_CTRL_SWRST) {
+    /* Wait for reset */
+  }
+  DMAC->BASEADDR.reg = (uint32_t)baseDescriptors;
+  DMAC->WRBADDR.reg = (uint32_t)writeback;
+  DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+
+  for (uint8_t i = 0; i < SAMPLING_NR_BLOCKS; ++i) {
+    DmacDescriptor *desc = i == 0 ? &baseDescriptors[DMA_CHANNEL] : &ringDescriptors[i - 1];
+    DmacDescriptor *next = i == SAMPLING_NR_BLOCKS - 1 ? &baseDescriptors[DMA_CHANNEL] : &ringDescriptors[i];
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID |
+            DMAC_BTCTRL_BEATSIZE_HWORD |
+            DMAC_BTCTRL_DSTINC |
+            DMAC_BTCTRL_BLOCKACT_INT;
+    desc->BTCNT.reg = _decimation;
+    desc->SRCADDR.reg = (uint32_t)&ADC->RESULT.reg;
+    // With address increment the DMAC wants the address after the last beat
+    desc->DSTADDR.reg = (uint32_t)&_ring[(i + 1) * _decimation];
+    desc->DESCADDR.reg = (uint32_t)next;
+  }
+
+  DMAC->CHID.reg = DMAC_CHID_ID(DMA_CHANNEL);
+  DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+  while (DMAC->CHCTRLA.reg & DMAC_CHCTRLA_SWRST) {
+    /* Wait for reset */
+  }
+  DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) |
+          DMAC_CHCTRLB_TRIGSRC(ADC_DMAC_ID_RESRDY) |
+          DMAC_CHCTRLB_TRIGACT_BEAT;
+  DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+  DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL;
+  DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+
+  NVIC_EnableIRQ(DMAC_IRQn);
+  NVIC_SetPriority(DMAC_IRQn, 0x00);
+}
+
+// DMAC ISR, a block of samples is complete
+void DMAC_Handler()
+{
+  uint8_t chid = DMAC->CHID.reg;
+  DMAC->CHID.reg = DMAC_CHID_ID(DMA_CHANNEL);
+  DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL;
+  DMAC->CHID.reg = chid;
+
+  if (SamplingEngine::_active) {
+    ++SamplingEngine::_active->_nrBlocks;
+  }
+}
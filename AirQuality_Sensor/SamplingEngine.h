@@ -0,0 +1,62 @@
+/*
+  SamplingEngine
+
+  Timer triggered ADC sampling for the SODAQ Autonomo (SAMD21).
+
+  TC3 overflows at the sample rate and starts an ADC conversion through
+  the event system. The DMAC moves each result into a ring of blocks, one
+  block is "decimation" samples. The only interrupt is the DMAC block
+  complete, which just counts blocks. Averaging is done by read(), outside
+  of the interrupt.
+
+  The engine owns TC3, GCLK4, event channel 0 and the DMAC (channel 0 and
+  the descriptor base address). It can't be combined with other users of
+  the DMAC, such as Sodaq_DataflashDMASPI.
+*/
+#ifndef __SAMPLINGENGINE_H__
+#define __SAMPLINGENGINE_H__
+
+#include "Arduino.h"
+
+// The number of blocks in the ring, the consumer may lag this minus one
+#define SAMPLING_NR_BLOCKS      4
+// The total number of raw samples in the ring
+#define SAMPLING_RING_SIZE      128
+// The clock of TC3, XOSC32K divided by 2
+#define SAMPLING_CLOCK          16384
+
+class SamplingEngine
+{
+public:
+    bool begin(int pin, uint16_t rate, uint16_t decimation);
+    void end();
+
+    bool available();
+    int read();
+    void sleepUntilAvailable();
+
+    // The effective sample rate, after rounding of the timer period
+    float getSampleRate() const { return (float)SAMPLING_CLOCK / _period; }
+    uint32_t getNrBlocks() const { return _nrBlocks; }
+    uint32_t getNrOverruns() const { return _nrOverruns; }
+
+private:
+    friend void DMAC_Handler();
+
+    void configureClock();
+    void configureTimer();
+    void configureEvents();
+    void configureADC(int pin);
+    void configureDMA();
+
+    uint16_t _period;
+    uint16_t _decimation;
+    volatile uint32_t _nrBlocks;        // incremented in the DMAC interrupt
+    uint32_t _readBlocks;
+    uint32_t _nrOverruns;
+    volatile uint16_t _ring[SAMPLING_RING_SIZE];
+
+    static SamplingEngine *_active;
+};
+
+#endif
@@ -24,6 +24,8 @@
 #include <stdlib.h>
 
 #include "GPRSbee.h"
+#include "GPRSbeeMux.h"
+#include "GPRSbeePowerManager.h"
 
 #if ENABLE_GPRSBEE_DIAG
 #define diagPrint(...) { if (_diagStream) _diagStream->print(__VA_ARGS__); }
@@ -32,6 +34,11 @@
 #define diagPrint(...)
 #define diagPrintLn(...)
 #endif
+#if ENABLE_GPRSBEE_DIAG && GPRSBEE_DIAG_LEVEL >= 2
+#define diagEcho(c) { if (_diagStream) _diagStream->write(c); }
+#else
+#define diagEcho(c)
+#endif
 
 #define wdt_reset()
 
@@ -121,20 +128,76 @@ void GPRSbeeClass::initProlog(Stream &stream, size_t bufferSize)
   _SIM900_buffer = (char *)malloc(_bufSize);
   _myStream = &stream;
   _diagStream = 0;
+  _idleHandler = 0;
   _statusPin = -1;
   _powerPin = -1;
   _vbatPin = -1;
   _minSignalQuality = 10;
   _ftpMaxLength = 0;
+  _ftpReady = false;
+  _httpDataLen = 0;
+  _httpStatus = 0;
+  _nrCommands = 0;
+  _cmdHash = 0;
+  _cmdKey = 0;
+  _cmdHashLeft = 0;
+  _cmdStart = 0;
   _transMode = false;
+  _transLastTx = 0;
+  _quickSend = false;
+  _quickSendActive = false;
+  _tcpWritten = 0;
+  _tcpSent = 0;
+  _tcpAcked = 0;
+  _tcpSendFailed = false;
   _echoOff = false;
   _onoffMethod = onoff_toggle;
   _skipCGATT = false;
   _changedSkipCGATT = false;
   _productId = prodid_unknown;
+  for (uint8_t i = 0; i < GPRSBEE_CMD_QUEUE_SIZE; ++i) {
+    _cmdQueue[i].status = cmdstat_free;
+  }
+  _cmdHead = 0;
+  _cmdTail = 0;
+  _asyncBufCnt = 0;
+  _asyncSkipLF = false;
+  _nrURCHandlers = 0;
+  _cregStat = -1;
+  _tcpClosed = false;
+  _mux = 0;
+  _power = 0;
 }
 
+/*!
+ * \brief Get the SIMx00 ready for a transaction
+ *
+ * With a power manager attached this wakes it up from the idle state
+ * that off() left it in, which is not necessarily power down.
+ */
 bool GPRSbeeClass::on()
+{
+  if (_power) {
+    return _power->wake();
+  }
+  return powerOn();
+}
+
+/*!
+ * \brief End of a transaction
+ *
+ * With a power manager attached the SIMx00 goes to the idle state of its
+ * policy, otherwise it is switched off.
+ */
+bool GPRSbeeClass::off()
+{
+  if (_power) {
+    return _power->sleep();
+  }
+  return powerOff();
+}
+
+bool GPRSbeeClass::powerOn()
 {
   switch (_onoffMethod) {
   case onoff_mbili_jp2:
@@ -157,7 +220,7 @@ bool GPRSbeeClass::on()
   return isOn();
 }
 
-bool GPRSbeeClass::off()
+bool GPRSbeeClass::powerOff()
 {
   switch (_onoffMethod) {
   case onoff_mbili_jp2:
@@ -328,11 +391,24 @@ void GPRSbeeClass::switchEchoOff()
   }
 }
 
+/*
+ * \brief Read what came in since the last command, before sending the next one
+ *
+ * The complete lines go through readLine(), so a URC that came in between
+ * two commands still reaches dispatchURC(), and with CIPMUX=1 the data of
+ * the other links reaches the multiplexer. A line that has started is
+ * read up to its end. Only what is left after a timeout is thrown away.
+ */
 void GPRSbeeClass::flushInput()
 {
   int c;
+  while (_myStream->available() > 0) {
+    if (readLine(millis() + 1000) < 0) {
+      break;
+    }
+  }
   while ((c = _myStream->read()) >= 0) {
-    diagPrint((char)c);
+    diagEcho((char)c);
   }
 }
 
@@ -367,9 +443,12 @@ int GPRSbeeClass::readLine(uint32_t ts_max)
 
     c = _myStream->read();
     if (c < 0) {
+      if (_idleHandler) {
+        (*_idleHandler)();
+      }
       continue;
     }
-    diagPrint((char)c);                 // echo the char
+    diagEcho((char)c);                  // echo the char
     seenCR = c == '\r';
     if (c == '\r') {
       ts_waitLF = millis() + 50;        // Wait another .05 sec for an optional LF
@@ -389,10 +468,125 @@ int GPRSbeeClass::readLine(uint32_t ts_max)
 ok:
   _SIM900_buffer[bufcnt] = 0;     // Terminate with NUL byte
   //diagPrint(F(" ")); diagPrintLn(_SIM900_buffer);
+  dispatchURC(bufcnt);
   return bufcnt;
 
 }
 
+/*!
+ * \brief Register a handler for an unsolicited result code
+ *
+ * \param prefix  the start of the line, e.g. "+CMTI:" or "CLOSED". The
+ *    string is not copied, it must stay valid.
+ * \param handler the function that is called with the complete line
+ *
+ * \return false if there is no room for another handler
+ *
+ * The handler is called from the line reader, while a blocking function
+ * or .poll() is busy. It may only look at the line and remember things.
+ */
+bool GPRSbeeClass::addURCHandler(const char *prefix, urcHandler handler)
+{
+  return addURCHandlerLow(prefix, handler, false);
+}
+
+bool GPRSbeeClass::addURCHandler_P(const char *prefix, urcHandler handler)
+{
+  return addURCHandlerLow(prefix, handler, true);
+}
+
+bool GPRSbeeClass::addURCHandlerLow(const char *prefix, urcHandler handler, bool progmem)
+{
+  if (_nrURCHandlers >= GPRSBEE_URC_MAX_HANDLERS) {
+    return false;
+  }
+  urcEntry *entry = &_urcHandlers[_nrURCHandlers++];
+  entry->prefix = prefix;
+  entry->handler = handler;
+  entry->progmem = progmem;
+  if (progmem) {
+    entry->len = strlen_P(prefix);
+    entry->first = pgm_read_byte(prefix);
+  } else {
+    entry->len = strlen(prefix);
+    entry->first = prefix[0];
+  }
+  return true;
+}
+
+void GPRSbeeClass::removeURCHandler(urcHandler handler)
+{
+  for (uint8_t i = 0; i < _nrURCHandlers; ) {
+    if (_urcHandlers[i].handler == handler) {
+      _urcHandlers[i] = _urcHandlers[--_nrURCHandlers];
+    } else {
+      ++i;
+    }
+  }
+}
+
+/*
+ * \brief Offer the line in the line buffer to the URC handlers
+ *
+ * The first character and the length reject most of the handlers before
+ * the prefix itself is compared. The +CREG and CLOSED codes are also
+ * tracked by the driver itself, and with CIPMUX=1 the multiplexer gets
+ * to see each line.
+ */
+void GPRSbeeClass::dispatchURC(size_t len)
+{
+  if (len == 0) {
+    return;
+  }
+
+  char first = _SIM900_buffer[0];
+  if (first == '+' && strncmp_P(_SIM900_buffer, PSTR("+CREG:"), 6) == 0) {
+    parseCREG();
+  } else if (first == 'C' && strcmp_P(_SIM900_buffer, PSTR("CLOSED")) == 0) {
+    _tcpClosed = true;
+  } else if (first == 'D' && strncmp_P(_SIM900_buffer, PSTR("DATA ACCEPT:"), 12) == 0) {
+    // Quick send mode, the SIMx00 has taken a block of data
+    _tcpSent += strtoul(_SIM900_buffer + 12, NULL, 0);
+  } else if (first == 'S' && strcmp_P(_SIM900_buffer, PSTR("SEND FAIL")) == 0) {
+    _tcpSendFailed = true;
+  }
+  if (_mux) {
+    _mux->handleLine(_SIM900_buffer);
+  }
+
+  for (uint8_t i = 0; i < _nrURCHandlers; ++i) {
+    urcEntry *entry = &_urcHandlers[i];
+    if (entry->first != first || entry->len > len) {
+      continue;
+    }
+    bool match;
+    if (entry->progmem) {
+      match = strncmp_P(_SIM900_buffer, entry->prefix, entry->len) == 0;
+    } else {
+      match = strncmp(_SIM900_buffer, entry->prefix, entry->len) == 0;
+    }
+    if (match) {
+      entry->handler(_SIM900_buffer);
+    }
+  }
+}
+
+/*
+ * \brief Pick the <stat> from a +CREG line
+ *
+ * The reply of AT+CREG? is "+CREG: <n>,<stat>[,<lac>,<ci>]", the URC
+ * is "+CREG: <stat>[,<lac>,<ci>]" where <lac> is a quoted string.
+ */
+void GPRSbeeClass::parseCREG()
+{
+  const char *ptr = skipWhiteSpace(_SIM900_buffer + 6);
+  const char *comma = strchr(ptr, ',');
+  if (comma && isdigit(comma[1])) {
+    ptr = comma + 1;
+  }
+  _cregStat = strtoul(ptr, NULL, 0);
+}
+
 /*
  * \brief Read a number of bytes from SIM900
  *
@@ -410,6 +604,9 @@ int GPRSbeeClass::readBytes(size_t len, uint8_t *buffer, size_t buflen, uint32_t
     wdt_reset();
     int c = _myStream->read();
     if (c < 0) {
+      if (_idleHandler) {
+        (*_idleHandler)();
+      }
       continue;
     }
     // Each character is stored in the buffer
@@ -426,61 +623,142 @@ int GPRSbeeClass::readBytes(size_t len, uint8_t *buffer, size_t buflen, uint32_t
   return len;
 }
 
+/*
+ * \brief Pass a number of bytes from SIM900 straight on to a sink
+ *
+ * Read <len> bytes from SIM900 and hand each one to <sink> (if not NULL)
+ * or to the <write> function (if not NULL). Nothing is buffered in here.
+ *
+ * Return 0 if <len> bytes were read from SIM900, else return the remaining number
+ * that wasn't read due to the timeout.
+ */
+int GPRSbeeClass::forwardBytes(size_t len, Print *sink, void (*write)(uint8_t), uint32_t ts_max)
+{
+  while (!isTimedOut(ts_max) && len > 0) {
+    wdt_reset();
+    int c = _myStream->read();
+    if (c < 0) {
+      if (_idleHandler) {
+        (*_idleHandler)();
+      }
+      continue;
+    }
+    --len;
+    if (sink) {
+      sink->write((uint8_t)c);
+    }
+    if (write) {
+      (*write)((uint8_t)c);
+    }
+  }
+  return len;
+}
+
+/*
+ * \brief Shorten the deadline of a wait for a reply to the last command
+ *
+ * Only with adaptive timeouts, see GPRSbeeLatency::adapt(). The latency
+ * is counted from the moment the command was sent. The new deadline is at
+ * least GPRSBEE_LATENCY_MIN_TIMEOUT from now and never later than ts_max.
+ * A wait without a key, see clearCommandKey(), keeps ts_max.
+ */
+uint32_t GPRSbeeClass::adaptTimeout(uint16_t key, uint32_t ts_max)
+{
+  if (!_latency.isAdaptive() || key == 0) {
+    return ts_max;
+  }
+  uint32_t adapted = _cmdStart + _latency.adapt(key, ts_max - _cmdStart);
+  uint32_t ts_min = millis() + GPRSBEE_LATENCY_MIN_TIMEOUT;
+  if ((int32_t)(adapted - ts_min) < 0) {
+    adapted = ts_min;
+  }
+  if ((int32_t)(adapted - ts_max) > 0) {
+    adapted = ts_max;
+  }
+  return adapted;
+}
+
+void GPRSbeeClass::addLatency(uint16_t key, bool seen)
+{
+  if (key == 0) {
+    return;
+  }
+  if (seen) {
+    _latency.add(key, millis() - _cmdStart);
+  } else {
+    _latency.addTimeout(key);
+  }
+}
+
 bool GPRSbeeClass::waitForOK(uint16_t timeout)
 {
   int len;
-  uint32_t ts_max = millis() + timeout;
+  uint32_t ts_max = adaptTimeout(_cmdKey, millis() + timeout);
   while ((len = readLine(ts_max)) >= 0) {
     if (len == 0) {
       // Skip empty lines
       continue;
     }
     if (strcmp_P(_SIM900_buffer, PSTR("OK")) == 0) {
+      addLatency(_cmdKey, true);
       return true;
     }
     else if (strcmp_P(_SIM900_buffer, PSTR("ERROR")) == 0) {
+      addLatency(_cmdKey, true);
       return false;
     }
     // Other input is skipped.
   }
+  addLatency(_cmdKey, false);
   return false;
 }
 
 bool GPRSbeeClass::waitForMessage(const char *msg, uint32_t ts_max)
 {
   int len;
+  uint16_t key = _cmdHash ? GPRSbeeLatency::key(GPRSbeeLatency::hash(_cmdHash, msg)) : 0;
   //diagPrint(F("waitForMessage: ")); diagPrintLn(msg);
+  ts_max = adaptTimeout(key, ts_max);
   while ((len = readLine(ts_max)) >= 0) {
     if (len == 0) {
       // Skip empty lines
       continue;
     }
     if (strncmp(_SIM900_buffer, msg, strlen(msg)) == 0) {
+      addLatency(key, true);
       return true;
     }
   }
+  addLatency(key, false);
   return false;         // This indicates: timed out
 }
 bool GPRSbeeClass::waitForMessage_P(const char *msg, uint32_t ts_max)
 {
   int len;
+  uint16_t key = _cmdHash ? GPRSbeeLatency::key(GPRSbeeLatency::hash_P(_cmdHash, msg)) : 0;
   //diagPrint(F("waitForMessage: ")); diagPrintLn(msg);
+  ts_max = adaptTimeout(key, ts_max);
   while ((len = readLine(ts_max)) >= 0) {
     if (len == 0) {
       // Skip empty lines
       continue;
     }
     if (strncmp_P(_SIM900_buffer, msg, strlen_P(msg)) == 0) {
+      addLatency(key, true);
       return true;
     }
   }
+  addLatency(key, false);
   return false;         // This indicates: timed out
 }
 
 int GPRSbeeClass::waitForMessages(PGM_P msgs[], size_t nrMsgs, uint32_t ts_max)
 {
   int len;
+  // The first reply identifies the whole set
+  uint16_t key = _cmdHash ? GPRSbeeLatency::key(GPRSbeeLatency::hash_P(_cmdHash, msgs[0])) : 0;
   //diagPrint(F("waitForMessages: ")); diagPrintLn(msgs[0]);
+  ts_max = adaptTimeout(key, ts_max);
   while ((len = readLine(ts_max)) >= 0) {
     if (len == 0) {
       // Skip empty lines
@@ -491,21 +769,27 @@ int GPRSbeeClass::waitForMessages(PGM_P msgs[], size_t nrMsgs, uint32_t ts_max)
       //diagPrint(F("  checking \"")); diagPrint(msgs[i]); diagPrintLn("\"");
       if (strcmp_P(_SIM900_buffer, msgs[i]) == 0) {
         //diagPrint(F("  found i=")); diagPrint((int)i); diagPrintLn("");
+        addLatency(key, true);
         return i;
       }
     }
   }
+  addLatency(key, false);
   return -1;         // This indicates: timed out
 }
 
 /*
  * \brief Wait for a prompt, or timeout
  *
+ * The lines that come before the prompt are offered to dispatchURC(), e.g.
+ * the "DATA ACCEPT:<n>" of an earlier send in quick send mode.
+ *
  * \return true if succeeded (the reply received), false if otherwise (timed out)
  */
 bool GPRSbeeClass::waitForPrompt(const char *prompt, uint32_t ts_max)
 {
   const char * ptr = prompt;
+  size_t bufcnt = 0;
 
   while (*ptr != '\0') {
     wdt_reset();
@@ -515,19 +799,30 @@ bool GPRSbeeClass::waitForPrompt(const char *prompt, uint32_t ts_max)
 
     int c = _myStream->read();
     if (c < 0) {
+      if (_idleHandler) {
+        (*_idleHandler)();
+      }
       continue;
     }
 
-    diagPrint((char)c);
+    diagEcho((char)c);
     switch (c) {
     case '\r':
       // Ignore
       break;
     case '\n':
+      if (_SIM900_buffer) {
+        _SIM900_buffer[bufcnt] = 0;
+        dispatchURC(bufcnt);
+      }
+      bufcnt = 0;
       // Start all over
       ptr = prompt;
       break;
     default:
+      if (_SIM900_buffer && bufcnt < (_bufSize - 1)) {
+        _SIM900_buffer[bufcnt++] = c;
+      }
       if (*ptr == c) {
         ptr++;
       } else {
@@ -538,7 +833,7 @@ bool GPRSbeeClass::waitForPrompt(const char *prompt, uint32_t ts_max)
     }
   }
 
-  return true;
+  return *ptr == '\0';
 }
 
 /*
@@ -549,6 +844,26 @@ void GPRSbeeClass::sendCommandProlog()
   flushInput();
   mydelay(50);
   diagPrint(F(">> "));
+  _cmdHash = GPRSbeeLatency::seed;
+  _cmdKey = GPRSbeeLatency::key(_cmdHash);
+  _cmdHashLeft = 16;
+}
+
+/*
+ * \brief Hash the name of the command, up to and including '=' or '?'
+ *
+ * The parameters are not part of the key of the latency histogram.
+ */
+void GPRSbeeClass::hashCommand(char c)
+{
+  if (_cmdHashLeft > 0) {
+    _cmdHash = GPRSbeeLatency::hash(_cmdHash, c);
+    _cmdKey = GPRSbeeLatency::key(_cmdHash);
+    --_cmdHashLeft;
+    if (c == '=' || c == '?') {
+      _cmdHashLeft = 0;
+    }
+  }
 }
 
 /*
@@ -556,6 +871,7 @@ void GPRSbeeClass::sendCommandProlog()
  */
 void GPRSbeeClass::sendCommandAdd(char c)
 {
+  hashCommand(c);
   diagPrint(c);
   _myStream->print(c);
 }
@@ -566,19 +882,47 @@ void GPRSbeeClass::sendCommandAdd(int i)
 }
 void GPRSbeeClass::sendCommandAdd(const char *cmd)
 {
-  diagPrint(cmd);
-  _myStream->print(cmd);
-}
-void GPRSbeeClass::sendCommandAdd(const String & cmd)
-{
+  for (const char *ptr = cmd; *ptr && _cmdHashLeft > 0; ++ptr) {
+    hashCommand(*ptr);
+  }
   diagPrint(cmd);
   _myStream->print(cmd);
 }
 void GPRSbeeClass::sendCommandAdd_P(const char *cmd)
 {
+  char c;
+  for (const char *ptr = cmd; _cmdHashLeft > 0 && (c = pgm_read_byte(ptr)) != '\0'; ++ptr) {
+    hashCommand(c);
+  }
   diagPrint(reinterpret_cast<const __FlashStringHelper *>(cmd));
   _myStream->print(reinterpret_cast<const __FlashStringHelper *>(cmd));
 }
+void GPRSbeeClass::sendCommandAddBuf(const char *buf, size_t len)
+{
+  for (size_t i = 0; i < len && _cmdHashLeft > 0; ++i) {
+    hashCommand(buf[i]);
+  }
+#if ENABLE_GPRSBEE_DIAG
+  if (_diagStream) {
+    _diagStream->write((const uint8_t *)buf, len);
+  }
+#endif
+  _myStream->write((const uint8_t *)buf, len);
+}
+
+/*
+ * \brief The data of the last command has been written
+ *
+ * The wait for the reply now depends on the size of the data, not on the
+ * command. So it gets no latency key: no histogram and no adaptive
+ * timeout.
+ */
+void GPRSbeeClass::clearCommandKey()
+{
+  _cmdHash = 0;
+  _cmdKey = 0;
+  _cmdHashLeft = 0;
+}
 
 /*
  * \brief Send the final CR of the command
@@ -587,6 +931,8 @@ void GPRSbeeClass::sendCommandEpilog()
 {
   diagPrintLn();
   _myStream->print('\r');
+  ++_nrCommands;
+  _cmdStart = millis();
 }
 
 void GPRSbeeClass::sendCommand(const char *cmd)
@@ -602,6 +948,208 @@ void GPRSbeeClass::sendCommand_P(const char *cmd)
   sendCommandEpilog();
 }
 
+/*
+ * Can the string be a quoted AT parameter? The SIMx00 has no escape for
+ * a double quote, and a control character would end the command.
+ */
+static bool isQuotable(const char *str)
+{
+  for (; str && *str; ++str) {
+    if (*str == '"' || (uint8_t)*str < ' ') {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Parse the conversion after a '%' in a PROGMEM format
+ *
+ * Returns the conversion char, ptr is left at it.
+ */
+static char parseConversion(const char *&ptr, uint8_t &width, bool &isLong)
+{
+  char c = pgm_read_byte(++ptr);
+  width = 0;
+  isLong = false;
+  if (c == '0') {
+    c = pgm_read_byte(++ptr);
+    if (c >= '1' && c <= '9') {
+      width = c - '0';
+      c = pgm_read_byte(++ptr);
+    }
+  }
+  if (c == 'l') {
+    isLong = true;
+    c = pgm_read_byte(++ptr);
+  }
+  return c;
+}
+
+/*!
+ * \brief Send a command, built from a format in PROGMEM and the arguments
+ *
+ * The command goes straight to the SIMx00, there is no buffer that can
+ * overflow and nothing is allocated. The conversions are
+ *  - %s  a string
+ *  - %q  a string between double quotes, a NULL pointer gives ""
+ *  - %S  a string in PROGMEM
+ *  - %d, %u  an int or unsigned int, %ld and %lu for long
+ *  - %0Nd, %0Nu  with leading zeros up to width N (1..9)
+ *  - %%  a percent sign
+ *
+ * Return false, and send nothing, if a %q string contains a double quote
+ * or a control character.
+ */
+bool GPRSbeeClass::sendCommandFormat_P(const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  bool retval = sendCommandFormatV_P(fmt, args);
+  va_end(args);
+  return retval;
+}
+
+bool GPRSbeeClass::sendCommandFormatV_P(const char *fmt, va_list args)
+{
+  const char *ptr;
+  char c;
+  uint8_t width;
+  bool isLong;
+  bool valid = true;
+  va_list check;
+
+  // First make sure the quoted strings are valid
+  va_copy(check, args);
+  for (ptr = fmt; (c = pgm_read_byte(ptr)) != '\0'; ++ptr) {
+    if (c != '%') {
+      continue;
+    }
+    switch (parseConversion(ptr, width, isLong)) {
+    case 's':
+    case 'S':
+      va_arg(check, const char *);
+      break;
+    case 'q':
+      valid = valid && isQuotable(va_arg(check, const char *));
+      break;
+    case 'd':
+    case 'u':
+      if (isLong) {
+        va_arg(check, long);
+      } else {
+        va_arg(check, int);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  va_end(check);
+  if (!valid) {
+    diagPrintLn(F("sendCommandFormat: invalid parameter"));
+    return false;
+  }
+
+  // The literal parts and the numbers are collected in buf, so that they
+  // go to the SIMx00 in as few writes as possible. A string parameter is
+  // written as it is, after what is in buf.
+  char buf[GPRSBEE_FORMAT_CHUNK];
+  size_t len = 0;
+  sendCommandProlog();
+  for (ptr = fmt; (c = pgm_read_byte(ptr)) != '\0'; ++ptr) {
+    // Room for the longest conversion: a sign, width zeros and the digits
+    if (len > sizeof(buf) - (1 + 9 + 3 * sizeof(unsigned long))) {
+      sendCommandAddBuf(buf, len);
+      len = 0;
+    }
+    if (c != '%') {
+      buf[len++] = c;
+      continue;
+    }
+    c = parseConversion(ptr, width, isLong);
+    switch (c) {
+    case 's':
+    case 'q':
+    case 'S': {
+      const char *str = va_arg(args, const char *);
+      if (c == 'q') {
+        buf[len++] = '"';
+      }
+      if (len > 0) {
+        sendCommandAddBuf(buf, len);
+        len = 0;
+      }
+      if (c == 'S') {
+        sendCommandAdd_P(str);
+      } else if (str) {
+        sendCommandAdd(str);
+      }
+      if (c == 'q') {
+        buf[len++] = '"';
+      }
+      break;
+    }
+    case 'd':
+    case 'u': {
+      unsigned long value;
+      if (isLong) {
+        long l = va_arg(args, long);
+        value = c == 'd' && l < 0 ? -(unsigned long)l : l;
+        if (c == 'd' && l < 0) {
+          buf[len++] = '-';
+        }
+      } else {
+        int i = va_arg(args, int);
+        value = c == 'd' && i < 0 ? -(unsigned long)i : (unsigned int)i;
+        if (c == 'd' && i < 0) {
+          buf[len++] = '-';
+        }
+      }
+      // The digits, least significant first
+      char digits[3 * sizeof(unsigned long)];
+      uint8_t nr = 0;
+      do {
+        digits[nr++] = '0' + value % 10;
+        value /= 10;
+      } while (value > 0);
+      while (width > nr) {
+        buf[len++] = '0';
+        --width;
+      }
+      while (nr > 0) {
+        buf[len++] = digits[--nr];
+      }
+      break;
+    }
+    case '\0':
+      // A lone '%' at the end
+      --ptr;
+      break;
+    default:
+      buf[len++] = c;
+      break;
+    }
+  }
+  if (len > 0) {
+    sendCommandAddBuf(buf, len);
+  }
+  sendCommandEpilog();
+  return true;
+}
+
+/*!
+ * \brief Send a formatted command, see sendCommandFormat_P(), and wait for "OK"
+ */
+bool GPRSbeeClass::sendCommandWaitForOKFormat_P(const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  bool retval = sendCommandFormatV_P(fmt, args);
+  va_end(args);
+  return retval && waitForOK();
+}
+
 /*
  * \brief Send a command to the SIM900 and wait for "OK"
  *
@@ -614,11 +1162,6 @@ bool GPRSbeeClass::sendCommandWaitForOK(const char *cmd, uint16_t timeout)
   sendCommand(cmd);
   return waitForOK(timeout);
 }
-bool GPRSbeeClass::sendCommandWaitForOK(const String & cmd, uint16_t timeout)
-{
-  sendCommand(cmd.c_str());
-  return waitForOK(timeout);
-}
 bool GPRSbeeClass::sendCommandWaitForOK_P(const char *cmd, uint16_t timeout)
 {
   sendCommand_P(cmd);
@@ -626,43 +1169,277 @@ bool GPRSbeeClass::sendCommandWaitForOK_P(const char *cmd, uint16_t timeout)
 }
 
 /*
- * \brief Get SIM900 integer value
+ * \brief Read a line of input from SIM900, without waiting
  *
- * Send the SIM900 command and wait for the reply. The reply
- * also contains the value that we want. We use the first value
- * upto the comma or the end
- * Finally the SIM900 should give "OK"
+ * Only the characters that are available right now are consumed. The
+ * partial line is kept in the line buffer until the next call.
  *
- * An example is:
- *   >> AT+CSQ
- *   << +CSQ: 18,0
- *   <<
- *   << OK
+ * Return the length of the line when a complete line is available in
+ * the line buffer, else return -1.
  */
-bool GPRSbeeClass::getIntValue(const char *cmd, const char *reply, int * value, uint32_t ts_max)
+int GPRSbeeClass::readLineAsync()
 {
-  sendCommand(cmd);
+  if (_SIM900_buffer == NULL) {
+    return -1;
+  }
 
-  // First we expect the reply
-  if (waitForMessage(reply, ts_max)) {
-    const char *ptr = _SIM900_buffer + strlen(reply);
-    char *bufend;
-    *value = strtoul(ptr, &bufend, 0);
-    if (bufend == ptr) {
-      // Invalid number
-      return false;
+  int c;
+  while ((c = _myStream->read()) >= 0) {
+    diagEcho((char)c);                  // echo the char
+    if (c == '\n' && _asyncSkipLF) {
+      // The LF of a CR-LF pair. The line was already delivered.
+      _asyncSkipLF = false;
+      continue;
+    }
+    _asyncSkipLF = c == '\r';
+    if (c == '\r' || c == '\n') {
+      size_t bufcnt = _asyncBufCnt;
+      _SIM900_buffer[bufcnt] = 0;       // Terminate with NUL byte
+      _asyncBufCnt = 0;
+      dispatchURC(bufcnt);
+      return bufcnt;
+    }
+    // Any other character is stored in the line buffer
+    if (_asyncBufCnt < (_bufSize - 1)) {        // Leave room for the terminating NUL
+      _SIM900_buffer[_asyncBufCnt++] = c;
     }
-    // Wait for "OK"
-    return waitForOK();
   }
-  return false;
+  return -1;
 }
 
-bool GPRSbeeClass::getIntValue_P(const char *cmd, const char *reply, int * value, uint32_t ts_max)
-{
-  sendCommand_P(cmd);
-
-  // First we expect the reply
+/*!
+ * \brief Queue an AT command without waiting for the reply
+ *
+ * \param cmd      the AT command (without the <CR>). The string is not
+ *    copied, it must stay valid until the command is sent.
+ * \param reply    the prefix of the expected intermediate reply (e.g. "+CSQ:"),
+ *    or 0 to capture the first line that is not the echo of the command
+ * \param timeout  the maximum time in milliseconds to wait for "OK" or "ERROR",
+ *    counted from the moment the command is sent
+ * \param callback an optional function that is called when the command has
+ *    completed. The slot is released right after the callback.
+ *
+ * \return a handle (>= 0) to query the command status, or -1 if the queue is full
+ *
+ * The command is sent and its reply is processed by .poll(), which must be
+ * called regularly from loop(). Nothing in here waits for the SIMx00.
+ */
+int8_t GPRSbeeClass::submitCommand(const char *cmd, const char *reply, uint16_t timeout,
+    cmdCallback callback)
+{
+  return submitCommandLow(cmd, reply, timeout, callback, false);
+}
+
+int8_t GPRSbeeClass::submitCommand_P(const char *cmd, const char *reply, uint16_t timeout,
+    cmdCallback callback)
+{
+  return submitCommandLow(cmd, reply, timeout, callback, true);
+}
+
+int8_t GPRSbeeClass::submitCommandLow(const char *cmd, const char *reply, uint16_t timeout,
+    cmdCallback callback, bool progmem)
+{
+  cmdSlot *slot = &_cmdQueue[_cmdTail];
+  if (slot->status != cmdstat_free) {
+    // The queue is full
+    return -1;
+  }
+  slot->cmd = cmd;
+  slot->reply = reply;
+  slot->callback = callback;
+  slot->timeout = timeout;
+  slot->progmem = progmem;
+  slot->replyBuf[0] = '\0';
+  slot->status = cmdstat_queued;
+
+  int8_t handle = _cmdTail;
+  _cmdTail = (_cmdTail + 1) % GPRSBEE_CMD_QUEUE_SIZE;
+  return handle;
+}
+
+/*!
+ * \brief Drive the non-blocking command engine
+ *
+ * Process the input that is available, complete the command that is
+ * waiting for its reply, and send the next queued command. This function
+ * never waits, it returns as soon as there is nothing more to do.
+ */
+void GPRSbeeClass::poll()
+{
+  int len;
+  while ((len = readLineAsync()) >= 0) {
+    handleAsyncLine(len);
+  }
+
+  cmdSlot *slot = &_cmdQueue[_cmdHead];
+  if (slot->status == cmdstat_busy && isTimedOut(slot->ts_max)) {
+    diagPrintLn(F("poll: command timed out"));
+    completeCommand(cmdstat_timeout);
+    slot = &_cmdQueue[_cmdHead];
+  }
+
+  if (slot->status == cmdstat_queued) {
+    // Unlike sendCommandProlog() the input is not flushed, it may contain
+    // the beginning of a line that we still want to see.
+    diagPrint(F(">> "));
+    if (slot->progmem) {
+      sendCommandAdd_P(slot->cmd);
+    } else {
+      sendCommandAdd(slot->cmd);
+    }
+    sendCommandEpilog();
+    slot->ts_max = millis() + slot->timeout;
+    slot->status = cmdstat_busy;
+  }
+}
+
+/*
+ * \brief Handle one line of input for the command that is waiting for its reply
+ */
+void GPRSbeeClass::handleAsyncLine(size_t len)
+{
+  cmdSlot *slot = &_cmdQueue[_cmdHead];
+  if (len == 0 || slot->status != cmdstat_busy) {
+    // Skip empty lines, and lines that nobody is waiting for
+    return;
+  }
+
+  if (strcmp_P(_SIM900_buffer, PSTR("OK")) == 0) {
+    completeCommand(cmdstat_ok);
+    return;
+  }
+  if (strcmp_P(_SIM900_buffer, PSTR("ERROR")) == 0
+      || strncmp_P(_SIM900_buffer, PSTR("+CME ERROR"), 10) == 0) {
+    completeCommand(cmdstat_error);
+    return;
+  }
+
+  bool match;
+  if (slot->reply) {
+    if (slot->progmem) {
+      match = strncmp_P(_SIM900_buffer, slot->reply, strlen_P(slot->reply)) == 0;
+    } else {
+      match = strncmp(_SIM900_buffer, slot->reply, strlen(slot->reply)) == 0;
+    }
+  } else {
+    // Take the first line, but not the echo of the command
+    if (slot->progmem) {
+      match = strcmp_P(_SIM900_buffer, slot->cmd) != 0;
+    } else {
+      match = strcmp(_SIM900_buffer, slot->cmd) != 0;
+    }
+    match = match && slot->replyBuf[0] == '\0';
+  }
+  if (match) {
+    strncpy(slot->replyBuf, _SIM900_buffer, sizeof(slot->replyBuf) - 1);
+    slot->replyBuf[sizeof(slot->replyBuf) - 1] = '\0';
+  }
+  // Other input is skipped.
+}
+
+/*
+ * \brief Finish the command at the head of the queue and move on to the next
+ */
+void GPRSbeeClass::completeCommand(enum cmdStatusKind status)
+{
+  int8_t handle = _cmdHead;
+  cmdSlot *slot = &_cmdQueue[handle];
+  slot->status = status;
+  _cmdHead = (_cmdHead + 1) % GPRSBEE_CMD_QUEUE_SIZE;
+
+  if (slot->callback) {
+    slot->callback(handle, status, slot->replyBuf);
+    slot->status = cmdstat_free;
+  }
+}
+
+bool GPRSbeeClass::isCommandDone(int8_t handle) const
+{
+  enum cmdStatusKind status = getCommandStatus(handle);
+  return status == cmdstat_ok || status == cmdstat_error || status == cmdstat_timeout;
+}
+
+enum GPRSbeeClass::cmdStatusKind GPRSbeeClass::getCommandStatus(int8_t handle) const
+{
+  if (handle < 0 || handle >= GPRSBEE_CMD_QUEUE_SIZE) {
+    return cmdstat_free;
+  }
+  return (enum cmdStatusKind)_cmdQueue[handle].status;
+}
+
+/*!
+ * \brief Get the intermediate reply of a command
+ *
+ * The result is an empty string if no reply was seen. It stays valid
+ * until the command is released.
+ */
+const char * GPRSbeeClass::getCommandReply(int8_t handle) const
+{
+  if (handle < 0 || handle >= GPRSBEE_CMD_QUEUE_SIZE) {
+    return "";
+  }
+  return _cmdQueue[handle].replyBuf;
+}
+
+/*!
+ * \brief Give the queue slot of a completed command back
+ *
+ * Commands that are still queued or busy cannot be released.
+ */
+void GPRSbeeClass::releaseCommand(int8_t handle)
+{
+  if (isCommandDone(handle)) {
+    _cmdQueue[handle].status = cmdstat_free;
+  }
+}
+
+/*!
+ * \brief Check that no submitted command is waiting to be sent or completed
+ */
+bool GPRSbeeClass::isCommandQueueIdle() const
+{
+  uint8_t status = _cmdQueue[_cmdHead].status;
+  return status != cmdstat_queued && status != cmdstat_busy;
+}
+
+/*
+ * \brief Get SIM900 integer value
+ *
+ * Send the SIM900 command and wait for the reply. The reply
+ * also contains the value that we want. We use the first value
+ * upto the comma or the end
+ * Finally the SIM900 should give "OK"
+ *
+ * An example is:
+ *   >> AT+CSQ
+ *   << +CSQ: 18,0
+ *   <<
+ *   << OK
+ */
+bool GPRSbeeClass::getIntValue(const char *cmd, const char *reply, int * value, uint32_t ts_max)
+{
+  sendCommand(cmd);
+
+  // First we expect the reply
+  if (waitForMessage(reply, ts_max)) {
+    const char *ptr = _SIM900_buffer + strlen(reply);
+    char *bufend;
+    *value = strtoul(ptr, &bufend, 0);
+    if (bufend == ptr) {
+      // Invalid number
+      return false;
+    }
+    // Wait for "OK"
+    return waitForOK();
+  }
+  return false;
+}
+
+bool GPRSbeeClass::getIntValue_P(const char *cmd, const char *reply, int * value, uint32_t ts_max)
+{
+  sendCommand_P(cmd);
+
+  // First we expect the reply
   if (waitForMessage_P(reply, ts_max)) {
     const char *ptr = _SIM900_buffer + strlen_P(reply);
     char *bufend;
@@ -801,36 +1578,53 @@ bool GPRSbeeClass::waitForCREG()
 {
   // TODO This timeout is maybe too long.
   uint32_t ts_max = millis() + 120000;
-  int value;
-  while (!isTimedOut(ts_max)) {
-    sendCommand_P(PSTR("AT+CREG?"));
-    // Reply is:
-    // +CREG: <n>,<stat>[,<lac>,<ci>]   mostly this is +CREG: 0,1
-    // we want the second number, the <stat>
-    // 0 = Not registered, MT is not currently searching an operator to register to
-    // 1 = Registered, home network
-    // 2 = Not registered, but MT is currently trying to attach...
-    // 3 = Registration denied
-    // 4 = Unknown
-    // 5 = Registered, roaming
-    value = 0;
-    if (waitForMessage_P(PSTR("+CREG:"), millis() + 12000)) {
-      const char *ptr = strchr(_SIM900_buffer, ',');
-      if (ptr) {
-        ++ptr;
-        value = strtoul(ptr, NULL, 0);
-      }
-    }
-    waitForOK();
-    if (value == 1 || value == 5) {
-      return true;
+  bool retval = false;
+
+  // Reply is:
+  // +CREG: <n>,<stat>[,<lac>,<ci>]   mostly this is +CREG: 0,1
+  // we want the second number, the <stat>
+  // 0 = Not registered, MT is not currently searching an operator to register to
+  // 1 = Registered, home network
+  // 2 = Not registered, but MT is currently trying to attach...
+  // 3 = Registration denied
+  // 4 = Unknown
+  // 5 = Registered, roaming
+  // The line is picked up by dispatchURC().
+  _cregStat = -1;
+  if (!sendCommandWaitForOK_P(PSTR("AT+CREG?"))) {
+    goto ending;
+  }
+  if (isRegistered()) {
+    retval = true;
+    goto ending;
+  }
+
+  // Let the SIMx00 tell us when the registration changes, instead of
+  // asking for it over and over again.
+  if (!sendCommandWaitForOK_P(PSTR("AT+CREG=1"))) {
+    goto ending;
+  }
+  while (!isTimedOut(ts_max) && !isRegistered()) {
+    uint32_t ts = millis() + 10000;
+    if ((int32_t)(ts - ts_max) > 0) {
+      ts = ts_max;
     }
-    mydelay(500);
-    if (!isAlive()) {
-      break;
+    if (readLine(ts) < 0) {
+      // Nothing heard for a while. Ask again, it also tells if the
+      // SIMx00 is still alive, and covers a missed URC.
+      if (!sendCommandWaitForOK_P(PSTR("AT+CREG?"))) {
+        break;
+      }
     }
   }
-  return false;
+  retval = isRegistered();
+  sendCommandWaitForOK_P(PSTR("AT+CREG=0"));
+
+ending:
+  if (retval && _power) {
+    _power->registered();
+  }
+  return retval;
 }
 
 /*!
@@ -896,7 +1690,6 @@ bool GPRSbeeClass::openTCP(const char *apn, const char *apnuser, const char *apn
 {
   uint32_t ts_max;
   boolean retval = false;
-  char cmdbuf[60];              // big enough for AT+CIPSTART="TCP","server",8500
   PGM_P CIPSTART_replies[] = {
       PSTR("CONNECT OK"),
       PSTR("CONNECT"),
@@ -915,10 +1708,7 @@ bool GPRSbeeClass::openTCP(const char *apn, const char *apnuser, const char *apn
   }
 
   // AT+CSTT=<apn>,<username>,<password>
-  strcpy_P(cmdbuf, PSTR("AT+CSTT=\""));
-  strcat(cmdbuf, apn);
-  strcat(cmdbuf, "\"");
-  if (!sendCommandWaitForOK(cmdbuf)) {
+  if (!sendCommandWaitForOKFormat_P(PSTR("AT+CSTT=%q"), apn)) {
     goto cmd_error;
   }
 
@@ -951,13 +1741,19 @@ bool GPRSbeeClass::openTCP(const char *apn, const char *apnuser, const char *apn
     }
   }
 
+  // AT+CIPQSEND=0  normal send mode (reply after each data send will be SEND OK)
+  // AT+CIPQSEND=1  quick send mode (reply after each data send will be DATA ACCEPT:<n>)
+  _quickSendActive = false;
+  if (!transMode && _quickSend) {
+    if (!sendCommandWaitForOK_P(PSTR("AT+CIPQSEND=1"))) {
+      goto cmd_error;
+    }
+    _quickSendActive = true;
+  }
+
   // Start up the connection
   // AT+CIPSTART="TCP","server",8500
-  strcpy_P(cmdbuf, PSTR("AT+CIPSTART=\"TCP\",\""));
-  strcat(cmdbuf, server);
-  strcat_P(cmdbuf, PSTR("\","));
-  itoa(port, cmdbuf + strlen(cmdbuf), 10);
-  if (!sendCommandWaitForOK(cmdbuf)) {
+  if (!sendCommandWaitForOKFormat_P(PSTR("AT+CIPSTART=\"TCP\",%q,%d"), server, port)) {
     goto cmd_error;
   }
   ts_max = millis() + 15000;            // Is this enough?
@@ -974,17 +1770,20 @@ bool GPRSbeeClass::openTCP(const char *apn, const char *apnuser, const char *apn
     goto cmd_error;
   }
 
-  // AT+CIPQSEND=0  normal send mode (reply after each data send will be SEND OK)
-  if (false && !sendCommandWaitForOK_P(PSTR("AT+CIPQSEND=0"))) {
-    goto cmd_error;
-  }
-
+  _tcpWritten = 0;
+  _tcpSent = 0;
+  _tcpAcked = 0;
+  _tcpSendFailed = false;
   _transMode = transMode;
+  _transLastTx = millis();
+  _tcpClosed = false;
   retval = true;
   goto ending;
 
 cmd_error:
   diagPrintLn(F("openTCP failed!"));
+  _transMode = false;
+  _quickSendActive = false;
   off();
 
 ending:
@@ -997,11 +1796,10 @@ void GPRSbeeClass::closeTCP()
   // AT+CIPSHUT
   // Maybe we should do AT+CIPCLOSE=1
   if (_transMode) {
-    mydelay(1000);
-    _myStream->print(F("+++"));
-    mydelay(500);
-    // TODO Will the SIM900 answer with "OK"?
+    escapeTransparent();
+    _transMode = false;
   }
+  _quickSendActive = false;
   sendCommand_P(PSTR("AT+CIPSHUT"));
   ts_max = millis() + 4000;             // Is this enough?
   if (!waitForMessage_P(PSTR("SHUT OK"), ts_max)) {
@@ -1020,13 +1818,13 @@ bool GPRSbeeClass::isTCPConnected()
   if (!isOn()) {
     goto end;
   }
+  if (_tcpClosed) {
+    // The SIMx00 already told us, no need to ask
+    goto end;
+  }
 
   if (_transMode) {
-    // We need to send +++
-    mydelay(1000);
-    _myStream->print(F("+++"));
-    mydelay(500);
-    if (!waitForOK()) {
+    if (!escapeTransparent()) {
       goto end;
     }
   }
@@ -1052,10 +1850,7 @@ bool GPRSbeeClass::isTCPConnected()
 
   if (_transMode) {
     // We must switch back to transparent mode
-    sendCommand_P(PSTR("ATO0"));
-    // TODO wait for "CONNECT" or "NO CARRIER"
-    ts_max = millis() + 4000;             // Is this enough? Or too much
-    if (!waitForMessage_P(PSTR("CONNECT"), ts_max)) {
+    if (!resumeTransparent()) {
       goto end;
     }
   }
@@ -1074,6 +1869,14 @@ bool GPRSbeeClass::sendDataTCP(const uint8_t *data, int data_len)
   uint32_t ts_max;
   bool retval = false;
 
+  if (_transMode) {
+    // No AT+CIPSEND in transparent mode, the data goes straight through
+    return writeTransparent(data, data_len) == (size_t)data_len;
+  }
+  if (_quickSendActive) {
+    return sendDataTCPquick(data, data_len);
+  }
+
   mydelay(500);
   flushInput();
   _myStream->print(F("AT+CIPSEND="));
@@ -1087,6 +1890,7 @@ bool GPRSbeeClass::sendDataTCP(const uint8_t *data, int data_len)
   for (int i = 0; i < data_len; ++i) {
     _myStream->print((char)*data++);
   }
+  clearCommandKey();
   //
   ts_max = millis() + 4000;             // Is this enough?
   if (!waitForMessage_P(PSTR("SEND OK"), ts_max)) {
@@ -1101,6 +1905,101 @@ ending:
   return retval;
 }
 
+/*
+ * \brief Send some data over the TCP connection in quick send mode
+ *
+ * The SIMx00 answers with "DATA ACCEPT:<n>" as soon as the data is in its
+ * own buffer, it doesn't wait for the server like with "SEND OK". We don't
+ * even wait for the "DATA ACCEPT:<n>", the line reader counts them when
+ * they come by. So several sends are in flight, up to
+ * GPRSBEE_TCP_SEND_WINDOW bytes that the server has not yet acknowledged.
+ * Beyond that we wait for AT+CIPACK to report progress.
+ *
+ * A "SEND FAIL" of an earlier send makes this and waitForTCPAck() fail.
+ */
+bool GPRSbeeClass::sendDataTCPquick(const uint8_t *data, int data_len)
+{
+  uint32_t ts_max;
+  bool retval = false;
+
+  if (_tcpSendFailed) {
+    goto error;
+  }
+
+  // Wait until the data fits in the window
+  ts_max = millis() + 10000;
+  while (_tcpWritten - _tcpAcked + data_len > GPRSBEE_TCP_SEND_WINDOW) {
+    if (isTimedOut(ts_max) || !updateTCPAck() || _tcpSendFailed) {
+      goto error;
+    }
+    if (_tcpWritten - _tcpAcked + data_len > GPRSBEE_TCP_SEND_WINDOW) {
+      mydelay(100);
+    }
+  }
+
+  // Unlike sendCommandProlog() the input is not flushed, it may contain
+  // data from the server.
+  diagPrint(F(">> "));
+  sendCommandAdd_P(PSTR("AT+CIPSEND="));
+  sendCommandAdd(data_len);
+  sendCommandEpilog();
+  ts_max = millis() + 4000;             // Is this enough?
+  if (!waitForPrompt("> ", ts_max)) {
+    goto error;
+  }
+  _myStream->write(data, data_len);
+  _tcpWritten += data_len;
+  clearCommandKey();
+
+  retval = true;
+  goto ending;
+error:
+  diagPrintLn(F("sendDataTCP failed!"));
+ending:
+  return retval;
+}
+
+/*!
+ * \brief Ask the SIMx00 how much of the sent data the server has acknowledged
+ *
+ * The reply of AT+CIPACK is "+CIPACK: <txlen>,<acklen>,<nacklen>".
+ */
+bool GPRSbeeClass::updateTCPAck()
+{
+  uint32_t ts_max = millis() + 4000;
+  sendCommand_P(PSTR("AT+CIPACK"));
+  if (!waitForMessage_P(PSTR("+CIPACK:"), ts_max)) {
+    return false;
+  }
+  char *ptr = _SIM900_buffer + 8;
+  _tcpSent = strtoul(ptr, &ptr, 0);
+  if (*ptr == ',') {
+    _tcpAcked = strtoul(ptr + 1, NULL, 0);
+  }
+  return waitForOK();
+}
+
+/*!
+ * \brief Wait until the server has acknowledged all the data that was sent
+ *
+ * In quick send mode, use this before closeTCP() to be sure that nothing
+ * is lost.
+ */
+bool GPRSbeeClass::waitForTCPAck(uint16_t timeout)
+{
+  uint32_t ts_max = millis() + timeout;
+  while (!isTimedOut(ts_max)) {
+    if (!updateTCPAck() || _tcpSendFailed) {
+      return false;
+    }
+    if (_tcpAcked >= _tcpWritten) {
+      return true;
+    }
+    mydelay(200);
+  }
+  return false;
+}
+
 bool GPRSbeeClass::receiveLineTCP(const char **buffer, uint16_t timeout)
 {
   uint32_t ts_max;
@@ -1119,6 +2018,59 @@ ending:
   return retval;
 }
 
+/*!
+ * \brief Write data to a TCP connection in transparent mode
+ *
+ * The data is written to the UART in one go. The time is remembered for
+ * the guard time of escapeTransparent().
+ */
+size_t GPRSbeeClass::writeTransparent(const uint8_t *data, size_t size)
+{
+  if (!_transMode) {
+    return 0;
+  }
+  size_t written = _myStream->write(data, size);
+  _transLastTx = millis();
+  return written;
+}
+
+/*!
+ * \brief Leave the data mode of a transparent TCP connection
+ *
+ * The "+++" must be preceded and followed by the guard time without data.
+ * The first part is only waited for as far as it hasn't passed yet since
+ * the last writeTransparent(). Received data that is still in the UART is
+ * discarded while waiting for the "OK".
+ *
+ * After this the SIMx00 accepts AT commands, the connection stays open.
+ */
+bool GPRSbeeClass::escapeTransparent()
+{
+  // One more millisecond, the last byte may have gone out late in the millisecond of _transLastTx
+  int32_t wait = (int32_t)(_transLastTx + GPRSBEE_ESCAPE_GUARD_TIME + 1 - millis());
+  if (wait > 0) {
+    mydelay(wait);
+  }
+  _myStream->print(F("+++"));
+  mydelay(GPRSBEE_ESCAPE_GUARD_TIME / 2);
+  return waitForOK(GPRSBEE_ESCAPE_GUARD_TIME);
+}
+
+/*!
+ * \brief Go back to the data mode after escapeTransparent()
+ */
+bool GPRSbeeClass::resumeTransparent()
+{
+  sendCommand_P(PSTR("ATO0"));
+  // TODO wait for "CONNECT" or "NO CARRIER"
+  uint32_t ts_max = millis() + 4000;    // Is this enough? Or too much
+  if (!waitForMessage_P(PSTR("CONNECT"), ts_max)) {
+    return false;
+  }
+  _transLastTx = millis();
+  return true;
+}
+
 /*
  * \brief Open a (FTP) session
  */
@@ -1131,8 +2083,6 @@ bool GPRSbeeClass::openFTP(const char *apn,
 bool GPRSbeeClass::openFTP(const char *apn, const char *apnuser, const char *apnpwd,
     const char *server, const char *username, const char *password)
 {
-  char cmd[64];
-
   if (!on()) {
     goto ending;
   }
@@ -1150,27 +2100,15 @@ bool GPRSbeeClass::openFTP(const char *apn, const char *apnuser, const char *apn
   }
 
   // connect to FTP server
-  //snprintf(cmd, sizeof(cmd), "AT+FTPSERV=\"%s\"", server);
-  strcpy_P(cmd, PSTR("AT+FTPSERV=\""));
-  strcat(cmd, server);
-  strcat(cmd, "\"");
-  if (!sendCommandWaitForOK(cmd)) {
+  if (!sendCommandWaitForOKFormat_P(PSTR("AT+FTPSERV=%q"), server)) {
     goto cmd_error;
   }
 
   // optional "AT+FTPPORT=21";
-  //snprintf(cmd, sizeof(cmd), "AT+FTPUN=\"%s\"", username);
-  strcpy_P(cmd, PSTR("AT+FTPUN=\""));
-  strcat(cmd, username);
-  strcat(cmd, "\"");
-  if (!sendCommandWaitForOK(cmd)) {
+  if (!sendCommandWaitForOKFormat_P(PSTR("AT+FTPUN=%q"), username)) {
     goto cmd_error;
   }
-  //snprintf(cmd, sizeof(cmd), "AT+FTPPW=\"%s\"", password);
-  strcpy_P(cmd, PSTR("AT+FTPPW=\""));
-  strcat(cmd, password);
-  strcat(cmd, "\"");
-  if (!sendCommandWaitForOK(cmd)) {
+  if (!sendCommandWaitForOKFormat_P(PSTR("AT+FTPPW=%q"), password)) {
     goto cmd_error;
   }
 
@@ -1195,24 +2133,19 @@ bool GPRSbeeClass::closeFTP()
  */
 bool GPRSbeeClass::openFTPfile(const char *fname, const char *path)
 {
-  char cmd[64];
-  const char * ptr;
   int retry;
+  uint8_t mode;
+  uint16_t code;
+  uint16_t length;
   uint32_t ts_max;
 
+  _ftpReady = false;
+
   // Open FTP file
-  //snprintf(cmd, sizeof(cmd), "AT+FTPPUTNAME=\"%s\"", fname);
-  strcpy_P(cmd, PSTR("AT+FTPPUTNAME=\""));
-  strcat(cmd, fname);
-  strcat(cmd, "\"");
-  if (!sendCommandWaitForOK(cmd)) {
+  if (!sendCommandWaitForOKFormat_P(PSTR("AT+FTPPUTNAME=%q"), fname)) {
     goto ending;
   }
-  //snprintf(cmd, sizeof(cmd), "AT+FTPPUTPATH=\"%s\"", FTPPATH);
-  strcpy_P(cmd, PSTR("AT+FTPPUTPATH=\""));
-  strcat(cmd, path);
-  strcat(cmd, "\"");
-  if (!sendCommandWaitForOK(cmd)) {
+  if (!sendCommandWaitForOKFormat_P(PSTR("AT+FTPPUTPATH=%q"), path)) {
     goto ending;
   }
 
@@ -1229,23 +2162,12 @@ bool GPRSbeeClass::openFTPfile(const char *fname, const char *path)
         isAlive();
         continue;
       }
-      // Skip 8 for "+FTPPUT:"
-      ptr = _SIM900_buffer + 8;
-      ptr = skipWhiteSpace(ptr);
-      if (strncmp_P(ptr, PSTR("1,"), 2) != 0) {
-        // We did NOT get "+FTPPUT:1,1,", it might be an error.
-        goto ending;
-      }
-      ptr += 2;
-
-      if (strncmp_P(ptr, PSTR("1,"), 2) != 0) {
+      if (!parseFTPPUT(&mode, &code, &length) || mode != 1 || code != 1 || length == 0) {
         // We did NOT get "+FTPPUT:1,1,", it might be an error.
         goto ending;
       }
-      ptr += 2;
-
-      _ftpMaxLength = strtoul(ptr, NULL, 0);
-
+      _ftpMaxLength = length;
+      _ftpReady = true;
       break;
     }
   }
@@ -1259,12 +2181,33 @@ ending:
   return false;
 }
 
+/*
+ * \brief Close the FTP file, after all data is sent
+ *
+ * sendFTPdata() doesn't wait for the "+FTPPUT: 1,1,<maxlength>" (or the
+ * error) of the last chunk, that is done here first. The flush before the
+ * next command would throw it away. The SIMx00 reports "+FTPPUT: 1,0"
+ * when the file is closed on the server.
+ */
 bool GPRSbeeClass::closeFTPfile()
 {
-  // Close file
-  if (!sendCommandWaitForOK_P(PSTR("AT+FTPPUT=2,0"))) {
-    return false;
-  }
+  uint8_t mode;
+  uint16_t code;
+  uint16_t length;
+  uint32_t ts_max;
+
+  if (!_ftpReady) {
+    // +FTPPUT:1,1,1360 or +FTPPUT:1,<error> of the last chunk
+    if (!waitForFTPready(millis() + 30000, 0, 0, 0, 0)) {
+      return false;
+    }
+  }
+  _ftpReady = false;
+
+  // Close file
+  if (!sendCommandWaitForOK_P(PSTR("AT+FTPPUT=2,0"))) {
+    return false;
+  }
 
   /*
    * FIXME
@@ -1273,118 +2216,174 @@ bool GPRSbeeClass::closeFTPfile()
    * message +FTPPUT:1,nn message comes in, right before AT-OK or
    * +SAPBR 1: DEACT
    *
-   * It is such a waste to wait that long (battery life and such).
-   * The FTP file seems to be closed properly, so why bother?
+   * We return as soon as the reply is there. The file seems to be closed
+   * properly without it, so a timeout is not an error.
    */
   // +FTPPUT:1,0
-  uint32_t ts_max = millis() + 20000;
-  if (!waitForMessage_P(PSTR("+FTPPUT:"), ts_max)) {
-    // How bad is it if we ignore this
-    //diagPrintLn(F("Timeout while waiting for +FTPPUT:1,"));
+  ts_max = millis() + GPRSBEE_FTP_CLOSE_TIMEOUT;
+  while (waitForMessage_P(PSTR("+FTPPUT:"), ts_max)) {
+    if (!parseFTPPUT(&mode, &code, &length) || mode != 1) {
+      continue;
+    }
+    if (code == 1) {
+      // The SIMx00 is ready for more data, not yet closed
+      continue;
+    }
+    if (code != 0) {
+      diagPrint(F("closeFTPfile: error ")); diagPrintLn(code);
+      return false;
+    }
+    break;
   }
 
   return true;
 }
 
 /*
- * \brief Lower layer function to insert a number of bytes in the FTP session
+ * \brief Parse the +FTPPUT line in the line buffer
+ *
+ *   +FTPPUT: 1,1,<maxlength>   ready for (more) data
+ *   +FTPPUT: 1,0               file closed
+ *   +FTPPUT: 1,<error>
+ *   +FTPPUT: 2,<cnflength>     the number of bytes that can be sent now
  *
- * The function sendBuffer() is the one to use. It takes care of splitting up
- * in chunks not bigger than maxlength
+ * The <length> is 0 if it isn't there.
  */
-bool GPRSbeeClass::sendFTPdata_low(uint8_t *buffer, size_t size)
+bool GPRSbeeClass::parseFTPPUT(uint8_t *mode, uint16_t *code, uint16_t *length)
 {
-  char cmd[20];         // Should be enough for "AT+FTPPUT=2,<num>"
-  uint32_t ts_max;
-  uint8_t *ptr = buffer;
-
-  // Send some data
-  //snprintf(cmd, sizeof(cmd), "AT+FTPPUT=2,%d", size);
-  strcpy_P(cmd, PSTR("AT+FTPPUT=2,"));
-  itoa(size, cmd + strlen(cmd), 10);
-  sendCommand(cmd);
+  const char *ptr;
+  char *bufend;
 
-  ts_max = millis() + 10000;
-  // +FTPPUT:2,22
-  if (!waitForMessage_P(PSTR("+FTPPUT:"), ts_max)) {
-    // How bad is it if we ignore this
+  if (strncmp_P(_SIM900_buffer, PSTR("+FTPPUT:"), 8) != 0) {
     return false;
   }
-  mydelay(100);           // TODO Find out if we can drop this
-
-  // Send data ...
-  for (size_t i = 0; i < size; ++i) {
-    _myStream->print((char)*ptr++);
+  ptr = skipWhiteSpace(_SIM900_buffer + 8);
+  *mode = strtoul(ptr, &bufend, 10);
+  if (bufend == ptr || *bufend != ',') {
+    return false;
   }
-  //_myStream->print('\r');          // dummy <CR>, not sure if this is needed
-
-  // Expected reply:
-  // +FTPPUT:2,22
-  // OK
-  // +FTPPUT:1,1,1360
-
-  if (!waitForOK(5000)) {
+  ptr = bufend + 1;
+  *code = strtoul(ptr, &bufend, 10);
+  if (bufend == ptr) {
     return false;
   }
-
-  // The SIM900 informs again what the new max length is
-  ts_max = millis() + 4000;
-  // +FTPPUT:1,1,1360
-  if (!waitForMessage_P(PSTR("+FTPPUT:"), ts_max)) {
-    // How bad is it if we ignore this?
-    // It informs us about the _ftpMaxLength
+  *length = 0;
+  if (*bufend == ',') {
+    *length = strtoul(bufend + 1, NULL, 10);
   }
-
   return true;
 }
 
-bool GPRSbeeClass::sendFTPdata_low(uint8_t (*read)(), size_t size)
+/*
+ * \brief Wait until the SIMx00 is ready for the next chunk of FTP data
+ *
+ * That is when it reports "+FTPPUT: 1,1,<maxlength>", with a new maxlength.
+ * In the mean time the next bytes of the source are read into the prefetch
+ * buffer, if there is a read function.
+ */
+bool GPRSbeeClass::waitForFTPready(uint32_t ts_max, uint8_t (*read)(), uint8_t *prefetch,
+    size_t *prefetchLen, size_t prefetchMax)
 {
-  char cmd[20];         // Should be enough for "AT+FTPPUT=2,<num>"
-  const char * ptr;
-  uint32_t ts_max;
-
-  // Send some data
-  //snprintf(cmd, sizeof(cmd), "AT+FTPPUT=2,%d", size);
-  strcpy_P(cmd, PSTR("AT+FTPPUT=2,"));
-  itoa(size, cmd + strlen(cmd), 10);
-  sendCommand(cmd);
+  uint8_t mode;
+  uint16_t code;
+  uint16_t length;
 
-  ts_max = millis() + 10000;
-  // +FTPPUT:2,22
-  if (!waitForMessage_P(PSTR("+FTPPUT:"), ts_max)) {
-    ptr = _SIM900_buffer + 8;
-    if (strncmp_P(ptr, PSTR("2,"), 2) != 0) {
-      // We did NOT get "+FTPPUT:2,", it might be an error.
-      return false;
+  while (!isTimedOut(ts_max)) {
+    if (_myStream->available() > 0) {
+      if (readLine(ts_max) <= 0) {
+        continue;
+      }
+      if (!parseFTPPUT(&mode, &code, &length) || mode != 1) {
+        continue;
+      }
+      if (code != 1) {
+        diagPrint(F("sendFTPdata: error ")); diagPrintLn(code);
+        return false;
+      }
+      if (length > 0) {
+        _ftpMaxLength = length;
+      }
+      _ftpReady = true;
+      return true;
+    }
+    if (read && *prefetchLen < prefetchMax) {
+      prefetch[(*prefetchLen)++] = (*read)();
     }
-    ptr += 2;
-    // TODO Check for the number
-    // How bad is it if we ignore this
-    return false;
   }
-  mydelay(100);           // TODO Find out if we can drop this
+  return false;
+}
 
-  // Send data ...
-  for (size_t i = 0; i < size; ++i) {
-    _myStream->print((char)(*read)());
-  }
+/*
+ * \brief Lower layer function to insert a number of bytes in the FTP session
+ *
+ * The data comes either from a buffer or from a read function. It is sent
+ * in chunks of at most the maxlength that the SIMx00 reports after each
+ * chunk. Nothing waits longer than needed: the data goes out as soon as
+ * +FTPPUT: 2,<cnflength> is there and the next chunk as soon as the SIMx00
+ * is ready for it. After the last chunk it does not wait, the next
+ * .sendFTPdata() or .closeFTPfile() does.
+ */
+bool GPRSbeeClass::sendFTPdata_low(const uint8_t *data, uint8_t (*read)(), size_t size)
+{
+  uint8_t prefetch[GPRSBEE_FTP_PREFETCH_SIZE];
+  size_t prefetchLen = 0;
+  uint8_t mode;
+  uint16_t code;
+  uint16_t length;
 
-  // Expected reply:
-  // +FTPPUT:2,22
-  // OK
-  // +FTPPUT:1,1,1360
+  while (size > 0) {
+    if (!_ftpReady) {
+      // +FTPPUT:1,1,1360
+      if (!waitForFTPready(millis() + 30000, read, prefetch, &prefetchLen,
+          size < sizeof(prefetch) ? size : sizeof(prefetch))) {
+        return false;
+      }
+    }
 
-  if (!waitForOK(5000)) {
-    return false;
-  }
+    size_t chunk = size;
+    if (chunk > _ftpMaxLength) {
+      chunk = _ftpMaxLength;
+    }
+    sendCommandFormat_P(PSTR("AT+FTPPUT=2,%u"), (unsigned int)chunk);
+
+    // +FTPPUT:2,22 (or ERROR)
+    uint32_t ts_max = millis() + 10000;
+    while (true) {
+      if (readLine(ts_max) < 0 || strcmp_P(_SIM900_buffer, PSTR("ERROR")) == 0) {
+        return false;
+      }
+      if (parseFTPPUT(&mode, &code, &length)) {
+        break;
+      }
+    }
+    if (mode != 2 || code == 0 || code > chunk) {
+      return false;
+    }
+    chunk = code;
+    _ftpReady = false;
+
+    // Send data ...
+    if (data) {
+      _myStream->write(data, chunk);
+      data += chunk;
+    } else {
+      size_t n = prefetchLen < chunk ? prefetchLen : chunk;
+      _myStream->write(prefetch, n);
+      prefetchLen -= n;
+      memmove(prefetch, prefetch + n, prefetchLen);
+      for (; n < chunk; ++n) {
+        _myStream->write((*read)());
+      }
+    }
+    size -= chunk;
+    clearCommandKey();
 
-  // The SIM900 informs again what the new max length is
-  ts_max = millis() + 30000;
-  // +FTPPUT:1,1,1360
-  if (!waitForMessage_P(PSTR("+FTPPUT:"), ts_max)) {
-    // How bad is it if we ignore this?
-    // It informs us about the _ftpMaxLength
+    // Expected reply:
+    // OK
+    // +FTPPUT:1,1,1360
+    if (!waitForOK(5000)) {
+      return false;
+    }
   }
 
   return true;
@@ -1392,41 +2391,16 @@ bool GPRSbeeClass::sendFTPdata_low(uint8_t (*read)(), size_t size)
 
 bool GPRSbeeClass::sendFTPdata(uint8_t *data, size_t size)
 {
-  // Send the bytes in chunks that are maximized by the maximum
-  // FTP length
-  while (size > 0) {
-    size_t my_size = size;
-    if (my_size > _ftpMaxLength) {
-      my_size = _ftpMaxLength;
-    }
-    if (!sendFTPdata_low(data, my_size)) {
-      return false;
-    }
-    data += my_size;
-    size -= my_size;
-  }
-  return true;
+  return sendFTPdata_low(data, 0, size);
 }
+
 bool GPRSbeeClass::sendFTPdata(uint8_t (*read)(), size_t size)
 {
-  // Send the bytes in chunks that are maximized by the maximum
-  // FTP length
-  while (size > 0) {
-    size_t my_size = size;
-    if (my_size > _ftpMaxLength) {
-      my_size = _ftpMaxLength;
-    }
-    if (!sendFTPdata_low(read, my_size)) {
-      return false;
-    }
-    size -= my_size;
-  }
-  return true;
+  return sendFTPdata_low(0, read, size);
 }
 
 bool GPRSbeeClass::sendSMS(const char *telno, const char *text)
 {
-  char cmd[64];
   uint32_t ts_max;
   bool retval = false;
 
@@ -1451,16 +2425,16 @@ bool GPRSbeeClass::sendSMS(const char *telno, const char *text)
     goto cmd_error;
   }
 
-  strcpy_P(cmd, PSTR("AT+CMGS=\""));
-  strcat(cmd, telno);
-  strcat(cmd, "\"");
-  sendCommand(cmd);
+  if (!sendCommandFormat_P(PSTR("AT+CMGS=%q"), telno)) {
+    goto cmd_error;
+  }
   ts_max = millis() + 4000;
   if (!waitForPrompt("> ", ts_max)) {
     goto cmd_error;
   }
   _myStream->print(text); //the message itself
   _myStream->print((char)26); //the ASCII code of ctrl+z is 26, this is needed to end the send modus and send the message.
+  clearCommandKey();
   if (!waitForOK(30000)) {
     goto cmd_error;
   }
@@ -1486,51 +2460,147 @@ ending:
  */
 bool GPRSbeeClass::doHTTPPOSTmiddle(const char *url, const char *buffer, size_t len)
 {
-  uint32_t ts_max;
   bool retval = false;
-  char num_bytes[16];
 
-  // set http param URL value
-  sendCommandProlog();
-  sendCommandAdd_P(PSTR("AT+HTTPPARA=\"URL\",\""));
-  sendCommandAdd(url);
-  sendCommandAdd('"');
-  sendCommandEpilog();
-  if (!waitForOK()) {
+  if (!doHTTPDATAprolog(url, len)) {
     goto ending;
   }
 
-  sendCommandProlog();
-  sendCommandAdd_P(PSTR("AT+HTTPDATA="));
-  itoa(len, num_bytes, 10);
-  sendCommandAdd(num_bytes);
-  sendCommandAdd_P(PSTR(",10000"));
-  sendCommandEpilog();
-  ts_max = millis() + 4000;
-  if (!waitForMessage_P(PSTR("DOWNLOAD"), ts_max)) {
+  // Send data ...
+  _myStream->write((const uint8_t *)buffer, len);
+
+  if (!doHTTPDATAepilog()) {
     goto ending;
   }
 
-  // Send data ...
-  for (size_t i = 0; i < len; ++i) {
-    _myStream->print(*buffer++);
-  }
+  // All is well if we get here.
+  retval = true;
 
-  if (!waitForOK()) {
+ending:
+  return retval;
+}
+
+/*!
+ * \brief The middle part of the whole HTTP POST, with the body from a Stream
+ *
+ * Exactly pdlen bytes are read from the source, with the timeout of
+ * the source, and written to the SIMx00 in chunks of at most
+ * GPRSBEE_HTTPDATA_CHUNK_SIZE. The body can be a lot bigger than RAM,
+ * up to GPRSBEE_HTTPDATA_MAX_SIZE.
+ */
+bool GPRSbeeClass::doHTTPPOSTmiddle(const char *url, Stream &source, uint32_t pdlen)
+{
+  return doHTTPPOSTmiddle(url, &source, 0, pdlen);
+}
+
+/*!
+ * \brief The middle part of the whole HTTP POST, with the body from a callback
+ *
+ * The callback is called repeatedly to fill a chunk buffer, until it has
+ * produced pdlen bytes in total. If it returns 0 before that, the POST fails.
+ * The rest of the body is then sent as zero bytes, to end the DOWNLOAD,
+ * without a HTTPACTION.
+ */
+bool GPRSbeeClass::doHTTPPOSTmiddle(const char *url, bodyPull pull, uint32_t pdlen)
+{
+  return doHTTPPOSTmiddle(url, 0, pull, pdlen);
+}
+
+bool GPRSbeeClass::doHTTPPOSTmiddle(const char *url, Stream *source, bodyPull pull, uint32_t pdlen)
+{
+  uint8_t chunk[GPRSBEE_HTTPDATA_CHUNK_SIZE];
+  bool retval = false;
+
+  if (!doHTTPDATAprolog(url, pdlen)) {
     goto ending;
   }
 
-  if (!doHTTPACTION(1)) {
+  // Send data ... during the DOWNLOAD window
+  while (pdlen > 0) {
+    size_t size = pdlen < sizeof(chunk) ? pdlen : sizeof(chunk);
+    size_t n;
+    if (source) {
+      n = source->readBytes(chunk, size);
+    } else {
+      n = (*pull)(chunk, size);
+    }
+    if (n == 0 || n > size) {
+      goto body_short;
+    }
+    _myStream->write(chunk, n);
+    pdlen -= n;
+  }
+
+  if (!doHTTPDATAepilog()) {
     goto ending;
   }
 
   // All is well if we get here.
   retval = true;
+  goto ending;
+
+body_short:
+  // The SIMx00 takes everything up to the length as body, until the
+  // window is over. Fill it up, so that the next command is a command
+  // again, and don't do the POST.
+  diagPrintLn(F("POST body ended early"));
+  memset(chunk, 0, sizeof(chunk));
+  while (pdlen > 0) {
+    size_t size = pdlen < sizeof(chunk) ? pdlen : sizeof(chunk);
+    _myStream->write(chunk, size);
+    pdlen -= size;
+  }
+  clearCommandKey();
+  waitForOK();
 
 ending:
   return retval;
 }
 
+/*
+ * \brief Set the URL and start the HTTPDATA, ready to send the body
+ *
+ * The SIMx00 gives us a time window to send the body. It is big enough
+ * for a slow source, assuming at least 2 bytes per millisecond.
+ */
+bool GPRSbeeClass::doHTTPDATAprolog(const char *url, uint32_t len)
+{
+  uint32_t ts_max;
+  uint32_t window;
+
+  _httpStatus = 0;
+
+  if (len > GPRSBEE_HTTPDATA_MAX_SIZE) {
+    diagPrintLn(F("POST body too big"));
+    return false;
+  }
+
+  // set http param URL value
+  if (!sendCommandWaitForOKFormat_P(PSTR("AT+HTTPPARA=\"URL\",%q"), url)) {
+    return false;
+  }
+
+  window = 10000 + len / 2;
+  if (window > 120000) {
+    window = 120000;
+  }
+  sendCommandFormat_P(PSTR("AT+HTTPDATA=%lu,%lu"), (unsigned long)len, (unsigned long)window);
+  ts_max = millis() + 4000;
+  return waitForMessage_P(PSTR("DOWNLOAD"), ts_max);
+}
+
+/*
+ * \brief The body has been sent, wait for the OK and do the POST
+ */
+bool GPRSbeeClass::doHTTPDATAepilog()
+{
+  clearCommandKey();
+  if (!waitForOK()) {
+    return false;
+  }
+  return doHTTPACTION(1);
+}
+
 /*!
  * \brief The middle part of the whole HTTP POST, with a READ
  *
@@ -1570,13 +2640,10 @@ bool GPRSbeeClass::doHTTPGETmiddle(const char *url, char *buffer, size_t len)
 {
   bool retval = false;
 
+  _httpStatus = 0;
+
   // set http param URL value
-  sendCommandProlog();
-  sendCommandAdd_P(PSTR("AT+HTTPPARA=\"URL\",\""));
-  sendCommandAdd(url);
-  sendCommandAdd('"');
-  sendCommandEpilog();
-  if (!waitForOK()) {
+  if (!sendCommandWaitForOKFormat_P(PSTR("AT+HTTPPARA=\"URL\",%q"), url)) {
     goto ending;
   }
 
@@ -1596,6 +2663,39 @@ ending:
   return retval;
 }
 
+/*!
+ * \brief The middle part of the whole HTTP GET, streaming the body to a sink
+ *
+ * Same as doHTTPGETmiddle(), but the body is written to <sink> as it
+ * arrives. There is no limit to the size of the body.
+ */
+bool GPRSbeeClass::doHTTPGETmiddle(const char *url, Print &sink)
+{
+  bool retval = false;
+
+  _httpStatus = 0;
+
+  // set http param URL value
+  if (!sendCommandWaitForOKFormat_P(PSTR("AT+HTTPPARA=\"URL\",%q"), url)) {
+    goto ending;
+  }
+
+  if (!doHTTPACTION(0)) {
+    goto ending;
+  }
+
+  // Read all data
+  if (!doHTTPREAD(sink)) {
+    goto ending;
+  }
+
+  // All is well if we get here.
+  retval = true;
+
+ending:
+  return retval;
+}
+
 bool GPRSbeeClass::doHTTPprolog(const char *apn)
 {
   return doHTTPprolog(apn, 0, 0);
@@ -1613,21 +2713,33 @@ bool GPRSbeeClass::doHTTPprolog(const char *apn, const char *apnuser, const char
     goto ending;
   }
 
+  if (!doHTTPINIT()) {
+    goto ending;
+  }
+
+  retval = true;
+
+ending:
+  return retval;
+}
+
+/*!
+ * \brief Initialize the HTTP service on an already opened bearer
+ */
+bool GPRSbeeClass::doHTTPINIT()
+{
   // initialize http service
   if (!sendCommandWaitForOK_P(PSTR("AT+HTTPINIT"))) {
-    goto ending;
+    return false;
   }
 
   // set http param CID value
   // FIXME Do we really need this?
   if (!sendCommandWaitForOK_P(PSTR("AT+HTTPPARA=\"CID\",1"))) {
-    goto ending;
+    return false;
   }
 
-  retval = true;
-
-ending:
-  return retval;
+  return true;
 }
 
 void GPRSbeeClass::doHTTPepilog()
@@ -1686,11 +2798,126 @@ ending:
   return retval;
 }
 
+/*!
+ * \brief Read the data from a GET or POST and pass it on to a Stream (or any Print)
+ *
+ * \param sink      where each byte of the body is written to, as it arrives
+ * \param chunkSize the maximum number of bytes asked for with each AT+HTTPREAD
+ *
+ * Unlike doHTTPREAD(buffer, len) the body is not limited by the size of a
+ * RAM buffer. If the length of the body is known (from +HTTPACTION) it is
+ * read with a series of AT+HTTPREAD=<start>,<size> requests.
+ */
+bool GPRSbeeClass::doHTTPREAD(Print &sink, size_t chunkSize)
+{
+  return doHTTPREADstream(&sink, 0, chunkSize);
+}
+
+/*!
+ * \brief Read the data from a GET or POST and pass each byte to a function
+ *
+ * See doHTTPREAD(Print &sink, size_t chunkSize)
+ */
+bool GPRSbeeClass::doHTTPREAD(void (*write)(uint8_t), size_t chunkSize)
+{
+  return doHTTPREADstream(0, write, chunkSize);
+}
+
+bool GPRSbeeClass::doHTTPREADstream(Print *sink, void (*write)(uint8_t), size_t chunkSize)
+{
+  size_t got;
+
+  if (_httpDataLen == 0 || chunkSize == 0) {
+    // We don't know how much there is. Just get it all in one go.
+    return doHTTPREADrange(0, 0, sink, write, &got);
+  }
+
+  size_t start = 0;
+  while (start < _httpDataLen) {
+    size_t size = _httpDataLen - start;
+    if (size > chunkSize) {
+      size = chunkSize;
+    }
+    if (!doHTTPREADrange(start, size, sink, write, &got)) {
+      return false;
+    }
+    if (got == 0) {
+      // No progress, the SIMx00 has nothing more for us.
+      break;
+    }
+    start += got;
+  }
+  return true;
+}
+
+/*
+ * \brief Read (a part of) the data from a GET or POST
+ *
+ * If <size> is 0 then plain AT+HTTPREAD is used, else it is
+ * AT+HTTPREAD=<start>,<size>
+ * The number of bytes that the SIMx00 announced is returned in <got>.
+ */
+bool GPRSbeeClass::doHTTPREADrange(size_t start, size_t size, Print *sink, void (*write)(uint8_t),
+    size_t *got)
+{
+  uint32_t ts_max;
+  size_t getLength = 0;
+  bool retval = false;
+
+  *got = 0;
+
+  // Expect
+  //   +HTTPREAD:<date_len>
+  //   <data>
+  //   OK
+  sendCommandProlog();
+  sendCommandAdd_P(PSTR("AT+HTTPREAD"));
+  if (size > 0) {
+    sendCommandAdd('=');
+    sendCommandAdd((int)start);
+    sendCommandAdd(',');
+    sendCommandAdd((int)size);
+  }
+  sendCommandEpilog();
+  ts_max = millis() + 8000;
+  if (waitForMessage_P(PSTR("+HTTPREAD:"), ts_max)) {
+    const char *ptr = _SIM900_buffer + 10;
+    char *bufend;
+    getLength = strtoul(ptr, &bufend, 0);
+    if (bufend == ptr) {
+      // Invalid number
+      goto ending;
+    }
+  } else {
+    // Hmm. Why didn't we get this?
+    goto ending;
+  }
+  // Pass the data on
+  retval = true;                // assume this will succeed
+  ts_max = millis() + 4000;
+  if (forwardBytes(getLength, sink, write, ts_max) != 0) {
+    // We didn't get the bytes that we expected
+    // Still wait for OK
+    retval = false;
+  } else {
+    *got = getLength;
+  }
+  if (!waitForOK()) {
+    // This is an error, but we can still return success.
+  }
+
+ending:
+  return retval;
+}
+
 bool GPRSbeeClass::doHTTPACTION(char num)
 {
   uint32_t ts_max;
   bool retval = false;
 
+  _httpDataLen = 0;
+  _httpStatus = 0;
+
   // set http action type 0 = GET, 1 = POST, 2 = HEAD
   sendCommandProlog();
   sendCommandAdd_P(PSTR("AT+HTTPACTION="));
@@ -1714,11 +2941,16 @@ bool GPRSbeeClass::doHTTPACTION(char num)
     ++ptr;              // The digit
     ++ptr;              // The comma
     char *bufend;
-    uint8_t replycode = strtoul(ptr, &bufend, 0);
+    uint16_t replycode = strtoul(ptr, &bufend, 0);
     if (bufend == ptr) {
       // Invalid number
       goto ending;
     }
+    _httpStatus = replycode;
+    // The <DataLen> is needed to read a large body in chunks
+    if (*bufend == ',') {
+      _httpDataLen = strtoul(bufend + 1, NULL, 0);
+    }
     // TODO Which result codes are allowed to pass?
     if (replycode == 200) {
       retval = true;
@@ -1768,6 +3000,59 @@ ending:
 }
 
 
+/*!
+ * \brief Do a HTTP POST, with the body from a Stream
+ *
+ * See doHTTPPOSTmiddle(url, source, pdlen)
+ */
+bool GPRSbeeClass::doHTTPPOST(const char *apn, const char *apnuser, const char *apnpwd,
+    const char *url, Stream &source, uint32_t pdlen)
+{
+  return doHTTPPOST(apn, apnuser, apnpwd, url, &source, 0, pdlen);
+}
+
+/*!
+ * \brief Do a HTTP POST, with the body from a callback
+ *
+ * See doHTTPPOSTmiddle(url, pull, pdlen)
+ */
+bool GPRSbeeClass::doHTTPPOST(const char *apn, const char *apnuser, const char *apnpwd,
+    const char *url, bodyPull pull, uint32_t pdlen)
+{
+  return doHTTPPOST(apn, apnuser, apnpwd, url, 0, pull, pdlen);
+}
+
+bool GPRSbeeClass::doHTTPPOST(const char *apn, const char *apnuser, const char *apnpwd,
+    const char *url, Stream *source, bodyPull pull, uint32_t pdlen)
+{
+  bool retval = false;
+
+  if (!on()) {
+    goto ending;
+  }
+
+  if (!doHTTPprolog(apn, apnuser, apnpwd)) {
+    goto cmd_error;
+  }
+
+  if (!doHTTPPOSTmiddle(url, source, pull, pdlen)) {
+    goto cmd_error;
+  }
+
+  retval = true;
+  doHTTPepilog();
+  goto ending;
+
+cmd_error:
+  diagPrintLn(F("doHTTPPOST failed!"));
+  doHTTPepilog();
+
+ending:
+  off();
+  return retval;
+}
+
+
 bool GPRSbeeClass::doHTTPPOSTWithReply(const char *apn,
     const char *url, const char *postdata, size_t pdlen, char *buffer, size_t len)
 {
@@ -1808,11 +3093,6 @@ bool GPRSbeeClass::doHTTPGET(const char *apn, const char *url, char *buffer, siz
   return doHTTPGET(apn, 0, 0, url, buffer, len);
 }
 
-bool GPRSbeeClass::doHTTPGET(const char *apn, const String & url, char *buffer, size_t len)
-{
-  return doHTTPGET(apn, 0, 0, url.c_str(), buffer, len);
-}
-
 bool GPRSbeeClass::doHTTPGET(const char *apn, const char *apnuser, const char *apnpwd,
     const char *url, char *buffer, size_t len)
 {
@@ -1844,7 +3124,6 @@ ending:
 
 bool GPRSbeeClass::setBearerParms(const char *apn, const char *user, const char *pwd)
 {
-  char cmd[64];
   bool retval = false;
   int retry;
 
@@ -1854,29 +3133,27 @@ bool GPRSbeeClass::setBearerParms(const char *apn, const char *user, const char
   }
 
   // SAPBR=3 Set bearer parameters
-  strcpy_P(cmd, PSTR("AT+SAPBR=3,1,\"APN\",\""));
-  strcat(cmd, apn);
-  strcat(cmd, "\"");
-  if (!sendCommandWaitForOK(cmd)) {
+  if (!sendCommandWaitForOKFormat_P(PSTR("AT+SAPBR=3,1,\"APN\",%q"), apn)) {
     goto ending;
   }
   if (user && user[0]) {
-    strcpy_P(cmd, PSTR("AT+SAPBR=3,1,\"USER\",\""));
-    strcat(cmd, user);
-    strcat(cmd, "\"");
-    if (!sendCommandWaitForOK(cmd)) {
+    if (!sendCommandWaitForOKFormat_P(PSTR("AT+SAPBR=3,1,\"USER\",%q"), user)) {
       goto ending;
     }
   }
   if (pwd && pwd[0]) {
-    strcpy_P(cmd, PSTR("AT+SAPBR=3,1,\"PWD\",\""));
-    strcat(cmd, pwd);
-    strcat(cmd, "\"");
-    if (!sendCommandWaitForOK(cmd)) {
+    if (!sendCommandWaitForOKFormat_P(PSTR("AT+SAPBR=3,1,\"PWD\",%q"), pwd)) {
       goto ending;
     }
   }
 
+  // A low power idle state may have kept the bearer from the previous
+  // transaction, and then SAPBR=1 gives an ERROR
+  if (_power && isBearerOpen()) {
+    retval = true;
+    goto ending;
+  }
+
   // SAPBR=1 Open bearer
   // This command can fail if signal quality is low, or if we're too fast
   for (retry = 0; retry < 5; retry++) {
@@ -1900,6 +3177,29 @@ ending:
   return retval;
 }
 
+/*!
+ * \brief Check if bearer 1 is open, with a single AT+SAPBR=2,1
+ *
+ * Expect +SAPBR: <cid>,<Status>,<IP_Addr>
+ * where <Status> 1 means "connected"
+ */
+bool GPRSbeeClass::isBearerOpen()
+{
+  uint32_t ts_max = millis() + 4000;
+  int value = 0;
+
+  sendCommand_P(PSTR("AT+SAPBR=2,1"));
+  if (waitForMessage_P(PSTR("+SAPBR:"), ts_max)) {
+    const char *ptr = strchr(_SIM900_buffer, ',');
+    if (ptr) {
+      ++ptr;
+      value = strtoul(ptr, NULL, 0);
+    }
+  }
+  waitForOK();
+  return value == 1;
+}
+
 bool GPRSbeeClass::getIMEI(char *buffer, size_t buflen)
 {
   switchEchoOff();
@@ -1951,16 +3251,10 @@ bool GPRSbeeClass::getCOPS(char *buffer, size_t buflen)
 
 bool GPRSbeeClass::setCCLK(const SIMDateTime & dt)
 {
-  String str;
-  str.reserve(30);
-  dt.addToString(str);
   switchEchoOff();
-  sendCommandProlog();
-  sendCommandAdd_P(PSTR("AT+CCLK=\""));
-  sendCommandAdd(str);
-  sendCommandAdd('"');
-  sendCommandEpilog();
-  return waitForOK();
+  // The format is "yy/MM/dd,hh:mm:ss±zz", for the time being in UTC
+  return sendCommandWaitForOKFormat_P(PSTR("AT+CCLK=\"%02u/%02u/%02u,%02u:%02u:%02u+00\""),
+      dt.year() - 2000, dt.month(), dt.day(), dt.hour(), dt.minute(), dt.second());
 }
 
 bool GPRSbeeClass::getCCLK(char *buffer, size_t buflen)
@@ -2144,7 +3438,7 @@ SIMDateTime::SIMDateTime(uint32_t ts)
   // Extract hour, minute, and second from the fractional day
   ldiv_t lresult = ldiv(fract, 60L);
   _ss = lresult.rem;
-  div_t result = div(lresult.quot, 60);
+  div_t result = div((int)lresult.quot, 60);
   _mm = result.rem;
   _hh = result.quot;
 
@@ -20,14 +20,37 @@
  * <http://www.gnu.org/licenses/>.
  */
 
+#include <stdarg.h>
 #include <stdint.h>
 #include <Arduino.h>
 #include <Stream.h>
 
+#include "GPRSbeeLatency.h"
+
 // Comment this line, or make it an undef to disable
 // diagnostic
 #define ENABLE_GPRSBEE_DIAG     1
 
+// The amount of diagnostic, when enabled
+// 1 messages and the commands that are sent
+// 2 also an echo of each character received from the SIMx00
+#ifndef GPRSBEE_DIAG_LEVEL
+#define GPRSBEE_DIAG_LEVEL      2
+#endif
+
+/*!
+ * \def GPRSBEE_DEPRECATED
+ *
+ * Marks the functions that take an Arduino String. Each call of such a
+ * function makes the sketch build a String on the heap, the driver itself
+ * doesn't need one. They will be removed, use the const char * versions.
+ */
+#if defined(__GNUC__)
+#define GPRSBEE_DEPRECATED(msg) __attribute__((deprecated(msg)))
+#else
+#define GPRSBEE_DEPRECATED(msg)
+#endif
+
 /*!
  * \def SIM900_DEFAULT_BUFFER_SIZE
  *
@@ -47,6 +70,99 @@
  */
 #define SIM900_DEFAULT_BUFFER_SIZE      64
 
+/*!
+ * \def GPRSBEE_CMD_QUEUE_SIZE
+ *
+ * The maximum number of AT commands that can be queued with
+ * .submitCommand(). A slot stays occupied until the command has completed
+ * and the result has been collected with .releaseCommand() (or until the
+ * callback has been called).
+ */
+#define GPRSBEE_CMD_QUEUE_SIZE          4
+
+/*!
+ * \def GPRSBEE_CMD_REPLY_SIZE
+ *
+ * The size of the buffer in each queue slot that holds the intermediate
+ * reply of a submitted command, e.g. "+CSQ: 18,0".
+ */
+#define GPRSBEE_CMD_REPLY_SIZE          40
+
+/*!
+ * \def GPRSBEE_FORMAT_CHUNK
+ *
+ * The size of the stack buffer of .sendCommandFormat_P() that collects the
+ * literal parts and the numbers of a command, so that they are written to
+ * the SIMx00 in one go. Larger means fewer writes.
+ */
+#define GPRSBEE_FORMAT_CHUNK            48
+
+/*!
+ * \def GPRSBEE_HTTPREAD_CHUNK_SIZE
+ *
+ * The streaming versions of .doHTTPREAD() fetch a large body with a series
+ * of ranged AT+HTTPREAD=<start>,<size> requests, this is the <size>.
+ */
+#define GPRSBEE_HTTPREAD_CHUNK_SIZE     512
+
+/*!
+ * \def GPRSBEE_HTTPDATA_CHUNK_SIZE
+ *
+ * The streaming versions of .doHTTPPOST() collect this many bytes of the
+ * body from the source (on the stack) before writing them to the SIMx00.
+ */
+#define GPRSBEE_HTTPDATA_CHUNK_SIZE     64
+
+/*!
+ * \def GPRSBEE_HTTPDATA_MAX_SIZE
+ *
+ * The largest body that AT+HTTPDATA accepts.
+ */
+#define GPRSBEE_HTTPDATA_MAX_SIZE       318976UL
+
+/*!
+ * \def GPRSBEE_FTP_PREFETCH_SIZE
+ *
+ * While the SIMx00 transfers a chunk of FTP data to the server, .sendFTPdata()
+ * with a read function already reads this many bytes of the next chunk (on
+ * the stack).
+ */
+#define GPRSBEE_FTP_PREFETCH_SIZE       128
+
+/*!
+ * \def GPRSBEE_FTP_CLOSE_TIMEOUT
+ *
+ * The maximum time that .closeFTPfile() waits for the SIMx00 to report that
+ * the file is closed (+FTPPUT: 1,0).
+ */
+#define GPRSBEE_FTP_CLOSE_TIMEOUT       20000
+
+/*!
+ * \def GPRSBEE_ESCAPE_GUARD_TIME
+ *
+ * The time in milliseconds without data that the SIMx00 wants before
+ * and after the "+++" that leaves the data mode of a transparent TCP
+ * connection.
+ */
+#define GPRSBEE_ESCAPE_GUARD_TIME       1000
+
+/*!
+ * \def GPRSBEE_TCP_SEND_WINDOW
+ *
+ * In quick send mode (see .setQuickSend()) the number of bytes that may be
+ * sent but not yet acknowledged by the server. Beyond this .sendDataTCP()
+ * waits for AT+CIPACK to report progress.
+ */
+#define GPRSBEE_TCP_SEND_WINDOW         2920
+
+/*!
+ * \def GPRSBEE_URC_MAX_HANDLERS
+ *
+ * The maximum number of handlers that can be registered with
+ * .addURCHandler().
+ */
+#define GPRSBEE_URC_MAX_HANDLERS        6
+
 /*
  * \brief A class to store clock values
  */
@@ -67,18 +183,19 @@ public:
     SATURDAY
   };
 
-  uint16_t      year() { return _yOff + 2000; }
-  uint8_t       month() { return _m + 1; }
-  uint8_t       day() { return _d + 1; }
-  uint8_t       hour() { return _hh; }
-  uint8_t       minute() { return _mm; }
-  uint8_t       second() { return _ss; }
+  uint16_t      year() const { return _yOff + 2000; }
+  uint8_t       month() const { return _m + 1; }
+  uint8_t       day() const { return _d + 1; }
+  uint8_t       hour() const { return _hh; }
+  uint8_t       minute() const { return _mm; }
+  uint8_t       second() const { return _ss; }
 
   // 32-bit number of seconds since Unix epoch (1970-01-01)
   uint32_t getUnixEpoch() const;
   // 32-bit number of seconds since Y2K epoch (2000-01-01)
   uint32_t getY2KEpoch() const;
 
+  GPRSBEE_DEPRECATED("use GPRSbeeClass::setCCLK()")
   void addToString(String & str) const;
 
 private:
@@ -94,49 +211,92 @@ private:
   int8_t        _tz;            // timezone (multiple of 15 minutes)
 };
 
+class GPRSbeeMux;
+class GPRSbeePowerManager;
+
 class GPRSbeeClass
 {
+  friend class GPRSbeeMux;
+  friend class GPRSbeePowerManager;
+  friend class GPRSbeeResumableUpload;
 public:
+  enum cmdStatusKind {
+    cmdstat_free,
+    cmdstat_queued,
+    cmdstat_busy,
+    cmdstat_ok,
+    cmdstat_error,
+    cmdstat_timeout,
+  };
+  typedef void (*cmdCallback)(int8_t handle, enum cmdStatusKind status, const char *reply);
+  typedef void (*urcHandler)(const char *line);
+  // Fill the buffer with at most size bytes of a POST body, return the number of bytes
+  typedef size_t (*bodyPull)(uint8_t *buffer, size_t size);
+  // Called while a blocking function waits for the SIMx00, e.g. to drain a GPRSbeeDiagSink
+  typedef void (*idleHandler)();
+
   void init(Stream &stream, int ctsPin, int powerPin,
       int bufferSize=SIM900_DEFAULT_BUFFER_SIZE);
   void initNdogoSIM800(Stream &stream, int pwrkeyPin, int vbatPin, int statusPin,
       int bufferSize=SIM900_DEFAULT_BUFFER_SIZE);
   bool on();
   bool off();
+  bool isOn();
   void setPowerSwitchedOnOff(bool x) { _onoffMethod = onoff_mbili_jp2; }
   void setDiag(Stream &stream) { _diagStream = &stream; }
   void setDiag(Stream *stream) { _diagStream = stream; }
+  void setIdleHandler(idleHandler handler) { _idleHandler = handler; }
 
   void setSkipCGATT(bool x=true)        { _skipCGATT = x; _changedSkipCGATT = true; }
+  void setQuickSend(bool x=true)        { _quickSend = x; }
 
   void setMinSignalQuality(int q) { _minSignalQuality = q; }
   uint8_t getLastCSQ() const { return _lastCSQ; }
   uint8_t getCSQtime() const { return _CSQtime; }
 
   bool doHTTPPOST(const char *apn, const char *url, const char *postdata, size_t pdlen);
-  bool doHTTPPOST(const char *apn, const String & url, const char *postdata, size_t pdlen);
+  GPRSBEE_DEPRECATED("use the const char * url")
+  bool doHTTPPOST(const char *apn, const String & url, const char *postdata, size_t pdlen)
+  { return doHTTPPOST(apn, url.c_str(), postdata, pdlen); }
   bool doHTTPPOST(const char *apn, const char *apnuser, const char *apnpwd,
       const char *url, const char *postdata, size_t pdlen);
+  bool doHTTPPOST(const char *apn, const char *apnuser, const char *apnpwd,
+      const char *url, Stream &source, uint32_t pdlen);
+  bool doHTTPPOST(const char *apn, const char *apnuser, const char *apnpwd,
+      const char *url, bodyPull pull, uint32_t pdlen);
   bool doHTTPPOSTmiddle(const char *url, const char *postdata, size_t pdlen);
+  bool doHTTPPOSTmiddle(const char *url, Stream &source, uint32_t pdlen);
+  bool doHTTPPOSTmiddle(const char *url, bodyPull pull, uint32_t pdlen);
   bool doHTTPPOSTmiddleWithReply(const char *url, const char *postdata, size_t pdlen, char *buffer, size_t len);
 
   bool doHTTPPOSTWithReply(const char *apn, const char *url, const char *postdata, size_t pdlen, char *buffer, size_t len);
-  bool doHTTPPOSTWithReply(const char *apn, const String & url, const char *postdata, size_t pdlen, char *buffer, size_t len);
+  GPRSBEE_DEPRECATED("use the const char * url")
+  bool doHTTPPOSTWithReply(const char *apn, const String & url, const char *postdata, size_t pdlen, char *buffer, size_t len)
+  { return doHTTPPOSTWithReply(apn, url.c_str(), postdata, pdlen, buffer, len); }
   bool doHTTPPOSTWithReply(const char *apn, const char *apnuser, const char *apnpwd,
       const char *url, const char *postdata, size_t pdlen, char *buffer, size_t len);
 
   bool doHTTPGET(const char *apn, const char *url, char *buffer, size_t len);
-  bool doHTTPGET(const char *apn, const String & url, char *buffer, size_t len);
+  GPRSBEE_DEPRECATED("use the const char * url")
+  bool doHTTPGET(const char *apn, const String & url, char *buffer, size_t len)
+  { return doHTTPGET(apn, url.c_str(), buffer, len); }
   bool doHTTPGET(const char *apn, const char *apnuser, const char *apnpwd,
       const char *url, char *buffer, size_t len);
   bool doHTTPGETmiddle(const char *url, char *buffer, size_t len);
+  bool doHTTPGETmiddle(const char *url, Print &sink);
 
   bool doHTTPREAD(char *buffer, size_t len);
+  bool doHTTPREAD(Print &sink, size_t chunkSize=GPRSBEE_HTTPREAD_CHUNK_SIZE);
+  bool doHTTPREAD(void (*write)(uint8_t), size_t chunkSize=GPRSBEE_HTTPREAD_CHUNK_SIZE);
+  size_t getHTTPDataLength() const { return _httpDataLen; }
   bool doHTTPACTION(char num);
+  uint16_t getHTTPStatus() const { return _httpStatus; }
 
   bool doHTTPprolog(const char *apn);
   bool doHTTPprolog(const char *apn, const char *apnuser, const char *apnpwd);
+  bool doHTTPINIT();
   void doHTTPepilog();
+  bool isBearerOpen();
 
   bool openTCP(const char *apn, const char *server, int port, bool transMode=false);
   bool openTCP(const char *apn, const char *apnuser, const char *apnpwd,
@@ -146,6 +306,22 @@ public:
   bool sendDataTCP(const uint8_t *data, int data_len);
   bool receiveLineTCP(const char **buffer, uint16_t timeout=4000);
 
+  // Quick send mode, the bytes written to, accepted by the SIMx00 and acknowledged by the server
+  uint32_t getTCPWritten() const { return _tcpWritten; }
+  uint32_t getTCPSent() const { return _tcpSent; }
+  uint32_t getTCPAcked() const { return _tcpAcked; }
+  bool updateTCPAck();
+  bool waitForTCPAck(uint16_t timeout=10000);
+
+  // Transparent mode (openTCP with transMode=true)
+  bool isTransparent() const { return _transMode; }
+  size_t writeTransparent(const uint8_t *data, size_t size);
+  Stream * getTransparentStream() const { return _transMode ? _myStream : 0; }
+  bool escapeTransparent();
+  bool resumeTransparent();
+  // The peer closed the connection, the SIMx00 is back in command mode
+  void transparentClosed() { _transMode = false; _tcpClosed = true; }
+
   bool openFTP(const char *apn, const char *server,
       const char *username, const char *password);
   bool openFTP(const char *apn, const char *apnuser, const char *apnpwd,
@@ -180,9 +356,41 @@ public:
   void disableLTS();
 
   bool sendCommandWaitForOK(const char *cmd, uint16_t timeout=4000);
-  bool sendCommandWaitForOK(const String & cmd, uint16_t timeout=4000);
+  GPRSBEE_DEPRECATED("use the const char * or the _P version")
+  bool sendCommandWaitForOK(const String & cmd, uint16_t timeout=4000)
+  { return sendCommandWaitForOK(cmd.c_str(), timeout); }
   bool sendCommandWaitForOK_P(const char *cmd, uint16_t timeout=4000);
 
+  // Non-blocking command engine. Don't mix with the blocking functions
+  // while commands are pending.
+  int8_t submitCommand(const char *cmd, const char *reply=0, uint16_t timeout=4000,
+      cmdCallback callback=0);
+  int8_t submitCommand_P(const char *cmd, const char *reply=0, uint16_t timeout=4000,
+      cmdCallback callback=0);
+  void poll();
+  bool isCommandDone(int8_t handle) const;
+  enum cmdStatusKind getCommandStatus(int8_t handle) const;
+  const char * getCommandReply(int8_t handle) const;
+  void releaseCommand(int8_t handle);
+  bool isCommandQueueIdle() const;
+
+  // Unsolicited result codes. Every line read from the SIMx00 is offered
+  // to the handlers with a matching prefix, also the lines that a blocking
+  // function skips. A handler must not send commands itself.
+  bool addURCHandler(const char *prefix, urcHandler handler);
+  bool addURCHandler_P(const char *prefix, urcHandler handler);
+  void removeURCHandler(urcHandler handler);
+  // The <stat> of the last +CREG seen, -1 if unknown
+  int8_t getCREGStatus() const { return _cregStat; }
+  bool isRegistered() const { return _cregStat == 1 || _cregStat == 5; }
+
+  // The number of AT commands sent so far, useful to count round-trips
+  uint32_t getCommandCount() const { return _nrCommands; }
+  // The latency histograms of the AT commands and replies, see GPRSbeeLatency
+  GPRSbeeLatency & getLatency() { return _latency; }
+  // Shorten the fixed timeouts to the 99th percentile latency times margin
+  void setAdaptiveTimeouts(bool x=true, uint8_t margin=2) { _latency.setAdaptive(x, margin); }
+
   // Using CCLK, get 32-bit number of seconds since Unix epoch (1970-01-01)
   uint32_t getUnixEpoch() const;
   // Using CCLK, get 32-bit number of seconds since Y2K epoch (2000-01-01)
@@ -190,35 +398,45 @@ public:
 
 private:
   void initProlog(Stream &stream, size_t bufferSize);
+  bool powerOn();
+  bool powerOff();
   void onToggle();
   void offToggle();
   void onSwitchMbiliJP2();
   void offSwitchMbiliJP2();
   void onSwitchNdogoSIM800();
   void offSwitchNdogoSIM800();
-  bool isOn();
   void toggle();
   bool isAlive();
   void switchEchoOff();
   void flushInput();
   int readLine(uint32_t ts_max);
+  int readLineAsync();
   int readBytes(size_t len, uint8_t *buffer, size_t buflen, uint32_t ts_max);
+  int forwardBytes(size_t len, Print *sink, void (*write)(uint8_t), uint32_t ts_max);
+  uint32_t adaptTimeout(uint16_t key, uint32_t ts_max);
+  void addLatency(uint16_t key, bool seen);
   bool waitForOK(uint16_t timeout=4000);
   bool waitForMessage(const char *msg, uint32_t ts_max);
   bool waitForMessage_P(const char *msg, uint32_t ts_max);
   int waitForMessages(const char *msgs[], size_t nrMsgs, uint32_t ts_max);
   bool waitForPrompt(const char *prompt, uint32_t ts_max);
 
+  void hashCommand(char c);
+  void clearCommandKey();
   void sendCommandProlog();
   void sendCommandAdd(char c);
   void sendCommandAdd(int i);
   void sendCommandAdd(const char *cmd);
-  void sendCommandAdd(const String & cmd);
   void sendCommandAdd_P(const char *cmd);
+  void sendCommandAddBuf(const char *buf, size_t len);
   void sendCommandEpilog();
 
   void sendCommand(const char *cmd);
   void sendCommand_P(const char *cmd);
+  bool sendCommandFormat_P(const char *fmt, ...);
+  bool sendCommandFormatV_P(const char *fmt, va_list args);
+  bool sendCommandWaitForOKFormat_P(const char *fmt, ...);
 
   bool getIntValue(const char *cmd, const char *reply, int * value, uint32_t ts_max);
   bool getIntValue_P(const char *cmd, const char *reply, int * value, uint32_t ts_max);
@@ -227,6 +445,11 @@ private:
   bool getStrValue(const char *cmd, char * str, size_t size, uint32_t ts_max);
 
   bool connectProlog();
+  bool doHTTPDATAprolog(const char *url, uint32_t len);
+  bool doHTTPDATAepilog();
+  bool doHTTPPOSTmiddle(const char *url, Stream *source, bodyPull pull, uint32_t pdlen);
+  bool doHTTPPOST(const char *apn, const char *apnuser, const char *apnpwd,
+      const char *url, Stream *source, bodyPull pull, uint32_t pdlen);
   bool waitForSignalQuality();
   bool waitForCREG();
   bool setBearerParms(const char *apn, const char *user, const char *pwd);
@@ -235,12 +458,29 @@ private:
   void setProductId();
 
   // Small utility to see if we timed out
-  bool isTimedOut(uint32_t ts) { return (long)(millis() - ts) >= 0; }
+  bool isTimedOut(uint32_t ts) { return (int32_t)(millis() - ts) >= 0; }
 
   const char * skipWhiteSpace(const char * txt);
 
-  bool sendFTPdata_low(uint8_t *buffer, size_t size);
-  bool sendFTPdata_low(uint8_t (*read)(), size_t size);
+  bool doHTTPREADstream(Print *sink, void (*write)(uint8_t), size_t chunkSize);
+  bool doHTTPREADrange(size_t start, size_t size, Print *sink, void (*write)(uint8_t),
+      size_t *got);
+
+  bool sendDataTCPquick(const uint8_t *data, int data_len);
+
+  bool sendFTPdata_low(const uint8_t *data, uint8_t (*read)(), size_t size);
+  bool waitForFTPready(uint32_t ts_max, uint8_t (*read)(), uint8_t *prefetch,
+      size_t *prefetchLen, size_t prefetchMax);
+  bool parseFTPPUT(uint8_t *mode, uint16_t *code, uint16_t *length);
+
+  int8_t submitCommandLow(const char *cmd, const char *reply, uint16_t timeout,
+      cmdCallback callback, bool progmem);
+  void handleAsyncLine(size_t len);
+  void completeCommand(enum cmdStatusKind status);
+
+  bool addURCHandlerLow(const char *prefix, urcHandler handler, bool progmem);
+  void dispatchURC(size_t len);
+  void parseCREG();
 
   enum onoffKind {
     onoff_toggle,
@@ -251,12 +491,29 @@ private:
   size_t _bufSize;
   Stream *_myStream;
   Stream *_diagStream;
+  idleHandler _idleHandler;     // called when a wait loop finds no input
   int8_t _statusPin;
   int8_t _powerPin;
   int8_t _vbatPin;
   int _minSignalQuality;
-  size_t _ftpMaxLength;
+  size_t _ftpMaxLength;         // the <maxlength> of the last +FTPPUT: 1,1,<maxlength>
+  bool _ftpReady;               // the SIMx00 is ready for the next AT+FTPPUT=2,<len>
+  size_t _httpDataLen;          // the <DataLen> of the last +HTTPACTION
+  uint16_t _httpStatus;         // the <StatusCode> of the last +HTTPACTION
+  uint32_t _nrCommands;
+  GPRSbeeLatency _latency;
+  uint32_t _cmdHash;            // the hash of the name of the last command, 0 if none
+  uint16_t _cmdKey;             // the latency key of the last command, 0 if none
+  uint8_t _cmdHashLeft;         // the number of chars of the command still to hash
+  uint32_t _cmdStart;           // when the last command was sent
   bool _transMode;
+  uint32_t _transLastTx;        // when data was last written in transparent mode
+  bool _quickSend;              // use AT+CIPQSEND=1 for the next openTCP
+  bool _quickSendActive;        // the current TCP connection is in quick send mode
+  uint32_t _tcpWritten;         // bytes written after an AT+CIPSEND prompt
+  uint32_t _tcpSent;            // bytes accepted by the SIMx00 (DATA ACCEPT)
+  uint32_t _tcpAcked;           // bytes acknowledged by the server (AT+CIPACK)
+  bool _tcpSendFailed;          // "SEND FAIL" was seen since the last openTCP
   bool _echoOff;
   enum onoffKind _onoffMethod;
   bool _skipCGATT;
@@ -269,6 +526,36 @@ private:
     prodid_SIM800,
   };
   enum productIdKind _productId;
+
+  struct cmdSlot {
+    const char *cmd;
+    const char *reply;          // prefix of the expected intermediate reply
+    cmdCallback callback;
+    uint32_t ts_max;
+    uint16_t timeout;
+    uint8_t status;
+    bool progmem;               // cmd and reply are PROGMEM strings
+    char replyBuf[GPRSBEE_CMD_REPLY_SIZE];
+  };
+  cmdSlot _cmdQueue[GPRSBEE_CMD_QUEUE_SIZE];
+  uint8_t _cmdHead;             // the oldest command that is not yet completed
+  uint8_t _cmdTail;             // where the next command is submitted
+  size_t _asyncBufCnt;          // number of chars of the partial line in _SIM900_buffer
+  bool _asyncSkipLF;            // a CR ended the previous line, skip a following LF
+
+  struct urcEntry {
+    const char *prefix;
+    urcHandler handler;
+    uint8_t len;                // the length of the prefix
+    char first;                 // the first char of the prefix, for a quick reject
+    bool progmem;               // prefix is a PROGMEM string
+  };
+  urcEntry _urcHandlers[GPRSBEE_URC_MAX_HANDLERS];
+  uint8_t _nrURCHandlers;
+  int8_t _cregStat;             // the <stat> of the last +CREG, -1 if unknown
+  bool _tcpClosed;              // "CLOSED" was seen since the last openTCP
+  GPRSbeeMux *_mux;             // gets the CIPMUX=1 lines, while it is active
+  GPRSbeePowerManager *_power;  // decides what off() means, while it is attached
 };
 
 extern GPRSbeeClass gprsbee;
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include "GPRSbeeDiagSink.h"
+
+#define RING_MASK       (GPRSBEE_DIAG_RING_SIZE - 1)
+
+GPRSbeeDiagSink::GPRSbeeDiagSink(Print *out)
+{
+  _out = out;
+  _head = 0;
+  _tail = 0;
+  _nrWritten = 0;
+  _nrDropped = 0;
+  _nrReported = 0;
+}
+
+void GPRSbeeDiagSink::setOutput(Print *out)
+{
+  _out = out;
+  // Without an output there was nothing to drain, start from here
+  _tail = _head;
+}
+
+size_t GPRSbeeDiagSink::write(uint8_t c)
+{
+  uint16_t head = _head;
+  if (!_out) {
+    // Flight recorder, overwrite the oldest byte
+    _ring[head & RING_MASK] = c;
+    _head = head + 1;
+    _tail = head + 1;
+  } else if ((uint16_t)(head - _tail) >= GPRSBEE_DIAG_RING_SIZE) {
+    ++_nrDropped;
+    // Pretend it was written, the caller must not notice anything
+    return 1;
+  } else {
+    _ring[head & RING_MASK] = c;
+    _head = head + 1;
+  }
+  if (_nrWritten < GPRSBEE_DIAG_RING_SIZE) {
+    ++_nrWritten;
+  }
+  return 1;
+}
+
+/*!
+ * \brief Write at most max bytes of complete lines to the output
+ *
+ * It never writes more than the output can take without blocking
+ * (availableForWrite()), and returns at once if that is 0, e.g. while the
+ * serial monitor is not open. A partial line is only written if the ring
+ * is more than three quarters full, otherwise it waits for its end. A
+ * report of dropped bytes goes first. Returns the number of bytes written.
+ */
+size_t GPRSbeeDiagSink::drain(size_t max)
+{
+  if (!_out) {
+    return 0;
+  }
+  int room = _out->availableForWrite();
+  if (room <= 0) {
+    return 0;
+  }
+  if (max > (size_t)room) {
+    max = room;
+  }
+
+  size_t count = 0;
+  if (_nrDropped != _nrReported) {
+    if (max < GPRSBEE_DIAG_DROP_REPORT_SIZE) {
+      return 0;
+    }
+    uint32_t dropped = _nrDropped;
+    count += _out->print(F("\r\n[diag dropped "));
+    count += _out->print(dropped - _nrReported);
+    count += _out->println(']');
+    _nrReported = dropped;
+    max -= count;
+  }
+
+  uint16_t tail = _tail;
+  uint16_t pending = _head - tail;
+  if (pending > max) {
+    pending = max;
+  }
+  uint16_t len = pending;
+  if ((uint16_t)(_head - tail) <= GPRSBEE_DIAG_RING_SIZE / 4 * 3) {
+    // Up to and including the last LF
+    while (len > 0 && _ring[(tail + len - 1) & RING_MASK] != '\n') {
+      --len;
+    }
+    if (len == 0 && (uint16_t)(_head - tail) > max) {
+      // A line longer than max, don't wait for its end
+      len = pending;
+    }
+  }
+  // At most two pieces, the ring may wrap
+  uint16_t done = 0;
+  while (done < len) {
+    uint16_t ix = (tail + done) & RING_MASK;
+    uint16_t piece = len - done;
+    if (piece > GPRSBEE_DIAG_RING_SIZE - ix) {
+      piece = GPRSBEE_DIAG_RING_SIZE - ix;
+    }
+    _out->write(&_ring[ix], piece);
+    done += piece;
+  }
+  _tail = tail + len;
+  return count + len;
+}
+
+/*!
+ * \brief Write the recent history, drained or not, e.g. after a failure
+ *
+ * Unlike drain() this writes everything at once, it may block.
+ */
+void GPRSbeeDiagSink::dump(Print &out)
+{
+  uint16_t head = _head;
+  for (uint16_t i = head - _nrWritten; i != head; ++i) {
+    out.write(_ring[i & RING_MASK]);
+  }
+}
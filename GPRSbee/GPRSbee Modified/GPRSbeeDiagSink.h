@@ -0,0 +1,98 @@
+#ifndef GPRSBEEDIAGSINK_H_
+#define GPRSBEEDIAGSINK_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <Arduino.h>
+#include <Stream.h>
+
+/*!
+ * \def GPRSBEE_DIAG_RING_SIZE
+ *
+ * The size of the ring buffer of GPRSbeeDiagSink, a power of two.
+ */
+#define GPRSBEE_DIAG_RING_SIZE          512
+
+/*!
+ * \def GPRSBEE_DIAG_DRAIN_CHUNK
+ *
+ * The maximum number of bytes that one drain() writes. It writes less if
+ * the output has less room, see availableForWrite().
+ */
+#define GPRSBEE_DIAG_DRAIN_CHUNK        48
+
+/*!
+ * \def GPRSBEE_DIAG_DROP_REPORT_SIZE
+ *
+ * The room that drain() wants in the output before it writes the
+ * "[diag dropped <n>]" report, the longest report fits.
+ */
+#define GPRSBEE_DIAG_DROP_REPORT_SIZE   32
+
+/*!
+ * \brief A diagnostic stream that never blocks GPRSbeeClass
+ *
+ * Use it with gprsbee.setDiag(sink). The diagnostic output goes into a
+ * ring buffer. drain() moves complete lines to the real output, no more
+ * than the output can take without blocking, see availableForWrite(). An
+ * output that doesn't implement availableForWrite() (it returns 0) gets
+ * nothing. Call drain() from an idle handler, see
+ * gprsbee.setIdleHandler(), so that it also runs while a blocking function
+ * such as doHTTPGET() waits for the SIMx00, and from loop().
+ *
+ * If the ring is full, new bytes are dropped and counted. Drained bytes
+ * stay in the ring until they are overwritten, so dump() can show the
+ * recent history after a failure. Without an output the sink is just a
+ * flight recorder that keeps the last GPRSBEE_DIAG_RING_SIZE bytes.
+ *
+ * There is one writer (GPRSbeeClass) and one reader (drain). Call drain()
+ * from the main context only, it prints to the output.
+ */
+class GPRSbeeDiagSink : public Stream
+{
+public:
+  GPRSbeeDiagSink(Print *out=0);
+
+  void setOutput(Print *out);
+  size_t drain(size_t max=GPRSBEE_DIAG_DRAIN_CHUNK);
+  void dump(Print &out);
+
+  uint32_t getNrDropped() const { return _nrDropped; }
+  size_t getPending() const { return (uint16_t)(_head - _tail); }
+
+  size_t write(uint8_t c);
+  using Print::write;
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+  void flush() { }
+
+private:
+  Print *_out;
+  volatile uint16_t _head;      // free running, the next byte is written here
+  volatile uint16_t _tail;      // free running, the next byte to drain
+  uint16_t _nrWritten;          // saturates at the ring size, for dump()
+  uint32_t _nrDropped;
+  uint32_t _nrReported;         // the drops that drain() has reported
+  uint8_t _ring[GPRSBEE_DIAG_RING_SIZE];
+};
+
+#endif /* GPRSBEEDIAGSINK_H_ */
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include "GPRSbeeHTTPSession.h"
+
+GPRSbeeHTTPSession::GPRSbeeHTTPSession(GPRSbeeClass &modem)
+{
+  _modem = &modem;
+  _apn = 0;
+  _apnuser = 0;
+  _apnpwd = 0;
+  _open = false;
+  _nrRequests = 0;
+  _nrReconnects = 0;
+}
+
+/*!
+ * \brief Switch on the SIMx00, open the bearer and initialize the HTTP service
+ *
+ * The APN strings are not copied, they must stay valid until end().
+ */
+bool GPRSbeeHTTPSession::begin(const char *apn, const char *apnuser, const char *apnpwd)
+{
+  _apn = apn;
+  _apnuser = apnuser;
+  _apnpwd = apnpwd;
+  _open = false;
+
+  if (!_modem->on()) {
+    return false;
+  }
+  if (!_modem->doHTTPprolog(_apn, _apnuser, _apnpwd)) {
+    _modem->off();
+    return false;
+  }
+  _open = true;
+  return true;
+}
+
+/*!
+ * \brief Terminate the HTTP service and switch off the SIMx00
+ */
+void GPRSbeeHTTPSession::end()
+{
+  if (_open) {
+    _modem->doHTTPepilog();
+  }
+  _modem->off();
+  _open = false;
+}
+
+bool GPRSbeeHTTPSession::doHTTPGET(const char *url, char *buffer, size_t len)
+{
+  for (uint8_t attempt = 0; attempt < 2; ++attempt) {
+    if (!ensureOpen()) {
+      return false;
+    }
+    ++_nrRequests;
+    if (_modem->doHTTPGETmiddle(url, buffer, len)) {
+      return true;
+    }
+    if (!retryNeeded()) {
+      break;
+    }
+  }
+  return false;
+}
+
+bool GPRSbeeHTTPSession::doHTTPGET(const char *url, Print &sink)
+{
+  // Don't retry. Part of the body may already have gone to the sink.
+  if (!ensureOpen()) {
+    return false;
+  }
+  ++_nrRequests;
+  if (_modem->doHTTPGETmiddle(url, sink)) {
+    return true;
+  }
+  retryNeeded();
+  return false;
+}
+
+bool GPRSbeeHTTPSession::doHTTPPOST(const char *url, const char *postdata, size_t pdlen)
+{
+  for (uint8_t attempt = 0; attempt < 2; ++attempt) {
+    if (!ensureOpen()) {
+      return false;
+    }
+    ++_nrRequests;
+    if (_modem->doHTTPPOSTmiddle(url, postdata, pdlen)) {
+      return true;
+    }
+    if (!retryNeeded()) {
+      break;
+    }
+  }
+  return false;
+}
+
+bool GPRSbeeHTTPSession::doHTTPPOSTWithReply(const char *url, const char *postdata, size_t pdlen,
+    char *buffer, size_t len)
+{
+  for (uint8_t attempt = 0; attempt < 2; ++attempt) {
+    if (!ensureOpen()) {
+      return false;
+    }
+    ++_nrRequests;
+    if (_modem->doHTTPPOSTmiddleWithReply(url, postdata, pdlen, buffer, len)) {
+      return true;
+    }
+    if (!retryNeeded()) {
+      break;
+    }
+  }
+  return false;
+}
+
+/*
+ * \brief Make sure the session can be used, the cheap way
+ *
+ * Only the status pin is looked at, that costs no AT round-trip.
+ */
+bool GPRSbeeHTTPSession::ensureOpen()
+{
+  if (_open && _modem->isOn()) {
+    return true;
+  }
+  return reopen();
+}
+
+/*
+ * \brief Decide what to do after a failed request
+ *
+ * If the server gave an HTTP status code then the link is fine and trying
+ * again won't help. The SIMx00 reports its own failures as 6xx status
+ * codes (601 network error, 603 DNS error, 604 stack busy, ...), those and
+ * no status at all mean that the session must be checked before it is
+ * used again.
+ */
+bool GPRSbeeHTTPSession::retryNeeded()
+{
+  uint16_t status = _modem->getHTTPStatus();
+  if (status != 0 && status < 600) {
+    return false;
+  }
+  _open = false;
+  return true;
+}
+
+/*
+ * \brief Re-establish as little as needed
+ *
+ * - the SIMx00 is off: switch it on and do the full prolog
+ * - the bearer is still open: only restart the HTTP service
+ * - else: stop the HTTP service and do the full prolog (network attach,
+ *   bearer, HTTP service), AT+HTTPINIT fails if it is still running
+ */
+bool GPRSbeeHTTPSession::reopen()
+{
+  if (!_apn) {
+    // begin() was never called
+    return false;
+  }
+  ++_nrReconnects;
+
+  if (!_modem->isOn()) {
+    if (!_modem->on()) {
+      return false;
+    }
+  } else if (_modem->isBearerOpen()) {
+    _modem->doHTTPepilog();             // Ignore errors, it may not be initialized
+    _open = _modem->doHTTPINIT();
+    return _open;
+  } else {
+    _modem->doHTTPepilog();             // Ignore errors, it may not be initialized
+  }
+
+  _open = _modem->doHTTPprolog(_apn, _apnuser, _apnpwd);
+  return _open;
+}
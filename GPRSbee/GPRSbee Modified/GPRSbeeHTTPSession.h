@@ -0,0 +1,84 @@
+#ifndef GPRSBEEHTTPSESSION_H_
+#define GPRSBEEHTTPSESSION_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "GPRSbee.h"
+
+/*!
+ * \brief An HTTP session that keeps the modem, the bearer and the HTTP
+ * service open across a batch of requests
+ *
+ * The doHTTPGET/doHTTPPOST functions of GPRSbeeClass switch the SIMx00 on,
+ * attach to the network, open the bearer and switch it all off again for
+ * each single request. With a session this is done once in begin() and
+ * undone in end().
+ *
+ * Before each request only the status pin is checked. If a request fails
+ * without an HTTP status code, or with a 6xx code of the SIMx00 itself
+ * (e.g. 601 network error), the link is checked (AT+SAPBR=2,1) and
+ * re-established as far as needed, and the request is tried once more.
+ *
+ * Example:
+ *   GPRSbeeHTTPSession session;
+ *   if (session.begin(APN)) {
+ *     for (...) {
+ *       session.doHTTPPOST(url, data, len);
+ *     }
+ *     session.end();
+ *   }
+ */
+class GPRSbeeHTTPSession
+{
+public:
+  GPRSbeeHTTPSession(GPRSbeeClass &modem=gprsbee);
+
+  bool begin(const char *apn, const char *apnuser=0, const char *apnpwd=0);
+  void end();
+  bool isOpen() const { return _open; }
+
+  bool doHTTPGET(const char *url, char *buffer, size_t len);
+  bool doHTTPGET(const char *url, Print &sink);
+  bool doHTTPPOST(const char *url, const char *postdata, size_t pdlen);
+  bool doHTTPPOSTWithReply(const char *url, const char *postdata, size_t pdlen,
+      char *buffer, size_t len);
+
+  // Statistics, e.g. to compare with the one-shot functions
+  uint16_t getNrRequests() const { return _nrRequests; }
+  uint16_t getNrReconnects() const { return _nrReconnects; }
+
+private:
+  bool ensureOpen();
+  bool reopen();
+  bool retryNeeded();
+
+  GPRSbeeClass *_modem;
+  const char *_apn;
+  const char *_apnuser;
+  const char *_apnpwd;
+  bool _open;
+  uint16_t _nrRequests;
+  uint16_t _nrReconnects;
+};
+
+#endif /* GPRSBEEHTTPSESSION_H_ */
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include "GPRSbeeLZ.h"
+
+#if GPRSBEE_LZ_WINDOW_BITS < 9 || GPRSBEE_LZ_WINDOW_BITS > 12
+#error "GPRSBEE_LZ_WINDOW_BITS must be 9 .. 12"
+#endif
+
+/*
+ * Start a new compressed stream, the header is written immediately
+ */
+void GPRSbeeLZCompressor::begin(Print &out)
+{
+  _out = &out;
+  _pos = 0;
+  _pending = 0;
+  _nrBytesIn = 0;
+  _nrBytesOut = 0;
+  _groupLen = 1;
+  _group[0] = 0;
+  _groupBit = 0;
+  // Positions are stored in 16 bits, 0 is as good as any for "none",
+  // candidates are verified anyway
+  memset(_head, 0, sizeof(_head));
+
+  uint8_t header[4] = { 'L', 'Z', GPRSBEE_LZ_VERSION, GPRSBEE_LZ_WINDOW_BITS };
+  _out->write(header, sizeof(header));
+  _nrBytesOut += sizeof(header);
+}
+
+/*
+ * Encode the lookahead, write the end marker and the last group
+ */
+void GPRSbeeLZCompressor::end()
+{
+  while (_pending > 0) {
+    encode();
+  }
+  putMatch(GPRSBEE_LZ_END_MARKER);
+  flushGroup();
+}
+
+size_t GPRSbeeLZCompressor::write(uint8_t c)
+{
+  _ring[(_pos + _pending) & windowMask] = c;
+  ++_pending;
+  ++_nrBytesIn;
+  if (_pending >= GPRSBEE_LZ_MAX_MATCH) {
+    encode();
+  }
+  return 1;
+}
+
+/*
+ * Encode one literal or one match at _pos
+ */
+void GPRSbeeLZCompressor::encode()
+{
+  uint16_t distance;
+  uint16_t len = findMatch(_pending, &distance);
+  if (len >= GPRSBEE_LZ_MIN_MATCH) {
+    putMatch(((distance - 1) << 4) | (len - GPRSBEE_LZ_MIN_MATCH));
+  } else {
+    len = 1;
+    putLiteral(_ring[_pos & windowMask]);
+  }
+  while (len-- > 0) {
+    insert(_pos);
+    ++_pos;
+    --_pending;
+  }
+}
+
+/*
+ * Find the longest match for the bytes at _pos in the hash chain
+ *
+ * The chain is not cleaned up, the positions may be stale or even from
+ * another hash. That is harmless because each candidate is compared.
+ */
+uint16_t GPRSbeeLZCompressor::findMatch(uint16_t maxLen, uint16_t *distance)
+{
+  if (maxLen < GPRSBEE_LZ_MIN_MATCH) {
+    return 0;
+  }
+  uint16_t bestLen = 0;
+  uint16_t lastDist = 0;
+  uint16_t cand = _head[hash(_pos)];
+  for (uint8_t chain = 0; chain < GPRSBEE_LZ_MAX_CHAIN; ++chain) {
+    uint16_t dist = (uint16_t)_pos - cand;
+    if (dist <= lastDist || dist > maxDistance || dist > _pos) {
+      break;
+    }
+    lastDist = dist;
+    // Both the candidate and the lookahead can wrap around the ring
+    uint16_t len = 0;
+    while (len < maxLen
+        && _ring[(cand + len) & windowMask] == _ring[(_pos + len) & windowMask]) {
+      ++len;
+    }
+    if (len > bestLen) {
+      bestLen = len;
+      *distance = dist;
+      if (len == maxLen) {
+        break;
+      }
+    }
+    cand = _prev[cand & windowMask];
+  }
+  return bestLen;
+}
+
+void GPRSbeeLZCompressor::insert(uint32_t pos)
+{
+  if (pos + GPRSBEE_LZ_MIN_MATCH > _pos + _pending) {
+    // Not enough bytes to hash, only at the end
+    return;
+  }
+  uint16_t h = hash(pos);
+  _prev[pos & windowMask] = _head[h];
+  _head[h] = pos;
+}
+
+uint16_t GPRSbeeLZCompressor::hash(uint32_t pos) const
+{
+  uint8_t a = _ring[pos & windowMask];
+  uint8_t b = _ring[(pos + 1) & windowMask];
+  uint8_t c = _ring[(pos + 2) & windowMask];
+  return ((a << 5) ^ (b << 3) ^ c ^ (a >> 4)) & (hashSize - 1);
+}
+
+void GPRSbeeLZCompressor::putLiteral(uint8_t c)
+{
+  _group[_groupLen++] = c;
+  if (++_groupBit == 8) {
+    flushGroup();
+  }
+}
+
+void GPRSbeeLZCompressor::putMatch(uint16_t code)
+{
+  _group[0] |= 1 << _groupBit;
+  _group[_groupLen++] = code >> 8;
+  _group[_groupLen++] = code;
+  if (++_groupBit == 8) {
+    flushGroup();
+  }
+}
+
+void GPRSbeeLZCompressor::flushGroup()
+{
+  if (_groupBit == 0) {
+    return;
+  }
+  _out->write(_group, _groupLen);
+  _nrBytesOut += _groupLen;
+  _group[0] = 0;
+  _groupLen = 1;
+  _groupBit = 0;
+}
@@ -0,0 +1,116 @@
+#ifndef GPRSBEELZ_H_
+#define GPRSBEELZ_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <Arduino.h>
+
+/*
+ * \def GPRSBEE_LZ_WINDOW_BITS
+ *
+ * The size of the history window is 2^GPRSBEE_LZ_WINDOW_BITS bytes (9 .. 12).
+ * The compressor needs 3 times the window plus 1 KB of RAM, e.g. 4 KB with
+ * the default of 10, 13 KB with 12.
+ */
+#ifndef GPRSBEE_LZ_WINDOW_BITS
+#define GPRSBEE_LZ_WINDOW_BITS          10
+#endif
+
+/*
+ * \def GPRSBEE_LZ_MAX_CHAIN
+ *
+ * The number of earlier positions that are tried for each match. More is
+ * a (slightly) better ratio at the cost of CPU time.
+ */
+#ifndef GPRSBEE_LZ_MAX_CHAIN
+#define GPRSBEE_LZ_MAX_CHAIN            8
+#endif
+
+#define GPRSBEE_LZ_VERSION              1
+#define GPRSBEE_LZ_MIN_MATCH            3
+#define GPRSBEE_LZ_MAX_MATCH            18
+#define GPRSBEE_LZ_HASH_BITS            9
+#define GPRSBEE_LZ_END_MARKER           0xFFFF
+
+/*!
+ * \brief A streaming LZSS compressor, to put between a record source and
+ * the upload
+ *
+ * Everything that is written to it (it is a Print) comes out compressed on
+ * the output Print, a group at a time. For example with a TCP connection
+ *   lz.begin(tcpStream);
+ *   lz.print(temperature); ...
+ *   lz.end();
+ * For a HTTP POST, the compressed size must be known in advance, so compress
+ * to DataFlash or RAM first.
+ *
+ * The format, see also GPRSbee/tools/gprsbee-unlz.cpp:
+ *   'L' 'Z' <version> <window bits>
+ *   groups of a flag byte, followed by 8 items, bit 0 of the flag for the
+ *   first item. A 0 bit is a literal byte, a 1 bit a match of 2 bytes,
+ *   big endian: the distance minus 1 (12 bits) and the length minus 3 (4 bits).
+ *   The match 0xFFFF marks the end of the data, the group ends there.
+ */
+class GPRSbeeLZCompressor : public Print
+{
+public:
+  void begin(Print &out);
+  void end();
+
+  size_t write(uint8_t c);
+  using Print::write;
+
+  uint32_t getNrBytesIn() const { return _nrBytesIn; }
+  uint32_t getNrBytesOut() const { return _nrBytesOut; }
+
+private:
+  enum {
+    windowSize = 1 << GPRSBEE_LZ_WINDOW_BITS,
+    windowMask = windowSize - 1,
+    // The lookahead is in the ring too, it must not overwrite a match source
+    maxDistance = windowSize - GPRSBEE_LZ_MAX_MATCH,
+    hashSize = 1 << GPRSBEE_LZ_HASH_BITS,
+  };
+
+  void encode();
+  uint16_t findMatch(uint16_t maxLen, uint16_t *distance);
+  void insert(uint32_t pos);
+  uint16_t hash(uint32_t pos) const;
+  void putLiteral(uint8_t c);
+  void putMatch(uint16_t code);
+  void flushGroup();
+
+  Print *_out;
+  uint32_t _pos;                // the stream position of the next byte to encode
+  uint8_t _pending;             // lookahead bytes in the ring after _pos
+  uint32_t _nrBytesIn;
+  uint32_t _nrBytesOut;
+
+  uint8_t _group[1 + 8 * 2];    // flag byte and up to 8 items
+  uint8_t _groupLen;
+  uint8_t _groupBit;
+
+  uint8_t _ring[windowSize];
+  uint16_t _head[hashSize];     // the most recent position (low 16 bits) for each hash
+  uint16_t _prev[windowSize];   // the previous position with the same hash
+};
+
+#endif /* GPRSBEELZ_H_ */
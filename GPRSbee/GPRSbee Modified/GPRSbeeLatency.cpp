@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include "GPRSbeeLatency.h"
+
+#define BLOB_VERSION            1
+#define BLOB_HEADER_SIZE        7
+#define BLOB_ENTRY_SIZE         (3 + GPRSBEE_LATENCY_NR_BUCKETS)
+
+GPRSbeeLatency::GPRSbeeLatency()
+{
+  reset();
+  _adaptive = false;
+  _margin = 2;
+}
+
+void GPRSbeeLatency::reset()
+{
+  memset(_entries, 0, sizeof(_entries));
+  _next = 0;
+}
+
+uint32_t GPRSbeeLatency::hash(uint32_t h, const char *str)
+{
+  while (*str) {
+    h = hash(h, *str++);
+  }
+  return h;
+}
+
+uint32_t GPRSbeeLatency::hash_P(uint32_t h, const char *str)
+{
+  char c;
+  while ((c = pgm_read_byte(str++)) != '\0') {
+    h = hash(h, c);
+  }
+  return h;
+}
+
+GPRSbeeLatency::entry *GPRSbeeLatency::find(uint16_t key) const
+{
+  for (uint8_t i = 0; i < GPRSBEE_LATENCY_MAX_KEYS; ++i) {
+    if (_entries[i].key == key) {
+      return const_cast<entry *>(&_entries[i]);
+    }
+  }
+  return 0;
+}
+
+GPRSbeeLatency::entry *GPRSbeeLatency::findOrAdd(uint16_t key)
+{
+  entry *e = find(key);
+  if (!e) {
+    e = &_entries[_next];
+    _next = (_next + 1) % GPRSBEE_LATENCY_MAX_KEYS;
+    memset(e, 0, sizeof(*e));
+    e->key = key;
+  }
+  return e;
+}
+
+void GPRSbeeLatency::increment(entry *e, uint8_t *count)
+{
+  if (*count == 0xFF) {
+    // Halve the whole histogram, the distribution stays about the same
+    e->timeouts /= 2;
+    for (uint8_t i = 0; i < GPRSBEE_LATENCY_NR_BUCKETS; ++i) {
+      e->counts[i] /= 2;
+    }
+  }
+  ++*count;
+}
+
+void GPRSbeeLatency::add(uint16_t key, uint32_t ms)
+{
+  if (key == 0) {
+    return;
+  }
+  entry *e = findOrAdd(key);
+  uint8_t bucket = 0;
+  uint32_t limit = GPRSBEE_LATENCY_BUCKET0_MS;
+  while (ms >= limit && bucket < GPRSBEE_LATENCY_NR_BUCKETS - 1) {
+    ++bucket;
+    limit *= 2;
+  }
+  increment(e, &e->counts[bucket]);
+}
+
+void GPRSbeeLatency::addTimeout(uint16_t key)
+{
+  if (key == 0) {
+    return;
+  }
+  entry *e = findOrAdd(key);
+  increment(e, &e->timeouts);
+}
+
+uint16_t GPRSbeeLatency::getNrSamples(uint16_t key) const
+{
+  const entry *e = find(key);
+  if (!e || key == 0) {
+    return 0;
+  }
+  uint16_t total = e->timeouts;
+  for (uint8_t i = 0; i < GPRSBEE_LATENCY_NR_BUCKETS; ++i) {
+    total += e->counts[i];
+  }
+  return total;
+}
+
+/*!
+ * \brief The upper bound in ms of the bucket that holds the given percentile
+ *
+ * Returns 0 if there are no samples and UINT32_MAX if the percentile is in
+ * the last bucket or in the timeouts, which have no upper bound.
+ */
+uint32_t GPRSbeeLatency::getPercentile(uint16_t key, uint8_t percent) const
+{
+  uint16_t total = getNrSamples(key);
+  if (total == 0) {
+    return 0;
+  }
+  const entry *e = find(key);
+  uint32_t needed = ((uint32_t)total * percent + 99) / 100;
+  uint32_t seen = 0;
+  uint32_t limit = GPRSBEE_LATENCY_BUCKET0_MS;
+  for (uint8_t i = 0; i < GPRSBEE_LATENCY_NR_BUCKETS - 1; ++i) {
+    seen += e->counts[i];
+    if (seen >= needed) {
+      return limit;
+    }
+    limit *= 2;
+  }
+  return UINT32_MAX;
+}
+
+/*!
+ * \brief Shorten a timeout to what this transaction usually needs
+ *
+ * That is the 99th percentile times the margin, but never shorter than
+ * GPRSBEE_LATENCY_MIN_TIMEOUT and never longer than the given timeout.
+ * Without enough samples, or if adaptive timeouts are off, the timeout
+ * is returned unchanged.
+ */
+uint32_t GPRSbeeLatency::adapt(uint16_t key, uint32_t timeout) const
+{
+  if (!_adaptive || getNrSamples(key) < GPRSBEE_LATENCY_MIN_SAMPLES) {
+    return timeout;
+  }
+  uint32_t p99 = getPercentile(key, 99);
+  if (p99 == UINT32_MAX || p99 >= timeout / _margin) {
+    return timeout;
+  }
+  uint32_t adapted = p99 * _margin;
+  if (adapted < GPRSBEE_LATENCY_MIN_TIMEOUT) {
+    adapted = GPRSBEE_LATENCY_MIN_TIMEOUT;
+  }
+  return adapted < timeout ? adapted : timeout;
+}
+
+size_t GPRSbeeLatency::getBlobSize() const
+{
+  uint8_t nr = 0;
+  for (uint8_t i = 0; i < GPRSBEE_LATENCY_MAX_KEYS; ++i) {
+    if (_entries[i].key != 0) {
+      ++nr;
+    }
+  }
+  return BLOB_HEADER_SIZE + nr * BLOB_ENTRY_SIZE;
+}
+
+/*!
+ * \brief Serialize the histograms, for a diagnostic upload
+ *
+ * The layout, multi-byte values are big endian:
+ *   'G' 'L'
+ *   version (1)
+ *   number of buckets
+ *   width of bucket 0 in ms (2 bytes)
+ *   number of entries
+ * followed by each entry:
+ *   key (2 bytes), number of timeouts, the counts of the buckets
+ *
+ * The key of a command is key(hash(seed, "AT+CSQ")), and of a reply to
+ * it key(hash(hash(seed, "AT+HTTPACTION="), "+HTTPACTION:")). The hash is
+ * 32 bits, key() folds it to the 16 bits in the blob.
+ *
+ * Returns the size of the blob, or 0 if the buffer is too small.
+ */
+size_t GPRSbeeLatency::getBlob(uint8_t *buffer, size_t size) const
+{
+  size_t blobSize = getBlobSize();
+  if (size < blobSize) {
+    return 0;
+  }
+  uint8_t *ptr = buffer;
+  *ptr++ = 'G';
+  *ptr++ = 'L';
+  *ptr++ = BLOB_VERSION;
+  *ptr++ = GPRSBEE_LATENCY_NR_BUCKETS;
+  *ptr++ = GPRSBEE_LATENCY_BUCKET0_MS >> 8;
+  *ptr++ = GPRSBEE_LATENCY_BUCKET0_MS & 0xFF;
+  *ptr++ = (blobSize - BLOB_HEADER_SIZE) / BLOB_ENTRY_SIZE;
+  for (uint8_t i = 0; i < GPRSBEE_LATENCY_MAX_KEYS; ++i) {
+    const entry *e = &_entries[i];
+    if (e->key == 0) {
+      continue;
+    }
+    *ptr++ = e->key >> 8;
+    *ptr++ = e->key & 0xFF;
+    *ptr++ = e->timeouts;
+    memcpy(ptr, e->counts, GPRSBEE_LATENCY_NR_BUCKETS);
+    ptr += GPRSBEE_LATENCY_NR_BUCKETS;
+  }
+  return blobSize;
+}
+
+/*!
+ * \brief Write the blob of getBlob() to a stream, e.g. SerialUSB
+ */
+size_t GPRSbeeLatency::writeBlob(Print &out) const
+{
+  uint8_t buffer[BLOB_HEADER_SIZE + GPRSBEE_LATENCY_MAX_KEYS * BLOB_ENTRY_SIZE];
+  size_t size = getBlob(buffer, sizeof(buffer));
+  return out.write(buffer, size);
+}
@@ -0,0 +1,111 @@
+#ifndef GPRSBEELATENCY_H_
+#define GPRSBEELATENCY_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <Arduino.h>
+
+/*!
+ * \def GPRSBEE_LATENCY_MAX_KEYS
+ *
+ * The number of commands (or command/reply pairs) that have a latency
+ * histogram. When all are in use the oldest entry is recycled.
+ */
+#define GPRSBEE_LATENCY_MAX_KEYS        16
+
+/*!
+ * \def GPRSBEE_LATENCY_NR_BUCKETS
+ *
+ * Bucket 0 counts the latencies below GPRSBEE_LATENCY_BUCKET0_MS, each next
+ * bucket is twice as wide. The last bucket counts everything above.
+ */
+#define GPRSBEE_LATENCY_NR_BUCKETS      12
+#define GPRSBEE_LATENCY_BUCKET0_MS      32
+
+// Adaptive timeouts need this many samples of a command before they kick in
+#define GPRSBEE_LATENCY_MIN_SAMPLES     20
+// An adaptive timeout is never shorter than this
+#define GPRSBEE_LATENCY_MIN_TIMEOUT     500
+
+/*!
+ * \brief Latency histograms of AT transactions
+ *
+ * A transaction is identified by a 16 bit key. It is the 32 bit FNV-1a
+ * hash of the command name (up to and including the '=' or '?') and, when
+ * waiting for a specific reply, of the reply, folded to 16 bits by key().
+ *
+ * The counts are 8 bits. When one would overflow, all counts of that
+ * entry are halved, so the histogram slowly forgets the past.
+ *
+ * The latency is measured from the moment the command was sent. That
+ * doesn't fit a wait whose length depends on the data that follows the
+ * command: the OK after the body of AT+HTTPDATA, after the data of
+ * AT+FTPPUT=2,<len> or AT+CIPSEND=<len>, and the reply to an SMS text.
+ * GPRSbeeClass gives those waits no key, so they have no histogram and
+ * keep their fixed timeout.
+ *
+ * The histograms can be exported as a binary blob, see getBlob().
+ */
+class GPRSbeeLatency
+{
+public:
+  GPRSbeeLatency();
+
+  void reset();
+  void add(uint16_t key, uint32_t ms);
+  void addTimeout(uint16_t key);
+
+  uint32_t getPercentile(uint16_t key, uint8_t percent) const;
+  uint16_t getNrSamples(uint16_t key) const;
+  void setAdaptive(bool on=true, uint8_t margin=2) { _adaptive = on; _margin = margin ? margin : 1; }
+  bool isAdaptive() const { return _adaptive; }
+  uint32_t adapt(uint16_t key, uint32_t timeout) const;
+
+  size_t getBlobSize() const;
+  size_t getBlob(uint8_t *buffer, size_t size) const;
+  size_t writeBlob(Print &out) const;
+
+  // FNV-1a (32 bits) to compute the keys, start with seed. key() folds
+  // the hash to 16 bits with an XOR of the two halves, a key is never 0,
+  // which means "no key". E.g. the key of AT+CSQ is key(hash(seed, "AT+CSQ")).
+  static uint32_t hash(uint32_t h, char c) { return (h ^ (uint8_t)c) * 16777619UL; }
+  static uint32_t hash(uint32_t h, const char *str);
+  static uint32_t hash_P(uint32_t h, const char *str);
+  static uint16_t key(uint32_t h) { uint16_t k = (h >> 16) ^ h; return k ? k : 1; }
+  static const uint32_t seed = 2166136261UL;
+
+private:
+  struct entry {
+    uint16_t key;               // 0 if the entry is free
+    uint8_t timeouts;
+    uint8_t counts[GPRSBEE_LATENCY_NR_BUCKETS];
+  };
+  entry *find(uint16_t key) const;
+  entry *findOrAdd(uint16_t key);
+  static void increment(entry *e, uint8_t *count);
+
+  entry _entries[GPRSBEE_LATENCY_MAX_KEYS];
+  uint8_t _next;                // the entry to recycle next
+  bool _adaptive;
+  uint8_t _margin;
+};
+
+#endif /* GPRSBEELATENCY_H_ */
@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include "GPRSbeeMux.h"
+
+GPRSbeeMux::GPRSbeeMux(GPRSbeeClass &modem)
+{
+  _modem = &modem;
+  _open = false;
+  memset(_links, 0, sizeof(_links));
+}
+
+/*!
+ * \brief Switch on the SIMx00, select CIPMUX=1 and bring up the bearer
+ *
+ * No connection is opened yet, see open().
+ */
+bool GPRSbeeMux::begin(const char *apn, const char *apnuser, const char *apnpwd)
+{
+  uint32_t ts_max;
+  bool ok;
+
+  _open = false;
+  memset(_links, 0, sizeof(_links));
+
+  if (!_modem->on()) {
+    return false;
+  }
+  if (!_modem->connectProlog()) {
+    goto cmd_error;
+  }
+
+  // CIPMUX can only be changed in the state IP INITIAL
+  _modem->sendCommand_P(PSTR("AT+CIPSHUT"));
+  if (!_modem->waitForMessage_P(PSTR("SHUT OK"), millis() + 4000)) {
+    goto cmd_error;
+  }
+  if (!_modem->sendCommandWaitForOK_P(PSTR("AT+CIPMUX=1"))) {
+    goto cmd_error;
+  }
+
+  // AT+CSTT=<apn>,<username>,<password>
+  if (apnuser) {
+    ok = _modem->sendCommandWaitForOKFormat_P(PSTR("AT+CSTT=%q,%q,%q"), apn, apnuser, apnpwd);
+  } else {
+    ok = _modem->sendCommandWaitForOKFormat_P(PSTR("AT+CSTT=%q"), apn);
+  }
+  if (!ok) {
+    goto cmd_error;
+  }
+  if (!_modem->sendCommandWaitForOK_P(PSTR("AT+CIICR"), 30000)) {
+    goto cmd_error;
+  }
+
+  // AT+CIFSR replies with the local IP address, without OK
+  _modem->sendCommand_P(PSTR("AT+CIFSR"));
+  ts_max = millis() + 4000;
+  int len;
+  while ((len = _modem->readLine(ts_max)) == 0) {
+    // Skip empty lines
+  }
+  if (len < 0 || strcmp_P(_modem->_SIM900_buffer, PSTR("ERROR")) == 0) {
+    goto cmd_error;
+  }
+
+  _modem->_mux = this;
+  _open = true;
+  return true;
+
+cmd_error:
+  _modem->off();
+  return false;
+}
+
+/*!
+ * \brief Send what is still queued, shut down the bearer and switch off the SIMx00
+ */
+void GPRSbeeMux::end()
+{
+  if (_open) {
+    for (uint8_t link = 0; link < GPRSBEE_MUX_MAX_LINKS; ++link) {
+      if (_links[link].state == link_connected) {
+        flush(link);
+      }
+    }
+    _modem->sendCommand_P(PSTR("AT+CIPSHUT"));
+    _modem->waitForMessage_P(PSTR("SHUT OK"), millis() + 4000);
+  }
+  _modem->_mux = 0;
+  _modem->off();
+  _open = false;
+}
+
+/*!
+ * \brief Open a TCP (or UDP) connection on a free link
+ *
+ * \return the link number, or -1 if there is no free link or the
+ *    connection failed
+ */
+int8_t GPRSbeeMux::open(bool udp, const char *server, int port, uint16_t timeout)
+{
+  uint32_t ts_max;
+  uint8_t link;
+
+  if (!_open) {
+    return -1;
+  }
+  for (link = 0; link < GPRSBEE_MUX_MAX_LINKS; ++link) {
+    if (_links[link].state == link_free) {
+      break;
+    }
+  }
+  if (link >= GPRSBEE_MUX_MAX_LINKS) {
+    return -1;
+  }
+  muxLink *lnk = &_links[link];
+  memset(lnk, 0, sizeof(*lnk));
+  lnk->state = link_connecting;
+
+  // AT+CIPSTART=<n>,"TCP","server",8500
+  if (!_modem->sendCommandWaitForOKFormat_P(PSTR("AT+CIPSTART=%u,%S,%q,%d"),
+      link, udp ? PSTR("\"UDP\"") : PSTR("\"TCP\""), server, port)) {
+    lnk->state = link_free;
+    return -1;
+  }
+
+  // "<n>, CONNECT OK" comes later, handleLine() picks it up
+  ts_max = millis() + timeout;
+  while (lnk->state == link_connecting && !_modem->isTimedOut(ts_max)) {
+    _modem->readLine(ts_max);
+  }
+  if (lnk->state != link_connected) {
+    lnk->state = link_free;
+    return -1;
+  }
+  return link;
+}
+
+/*!
+ * \brief Close one link, the bearer and the other links stay open
+ */
+void GPRSbeeMux::close(uint8_t link)
+{
+  if (link >= GPRSBEE_MUX_MAX_LINKS || _links[link].state == link_free) {
+    return;
+  }
+  if (_links[link].state == link_connected) {
+    // AT+CIPCLOSE=<n>,1  quick close
+    char reply[12];
+    reply[0] = '0' + link;
+    strcpy_P(reply + 1, PSTR(", CLOSE"));
+    _modem->sendCommandProlog();
+    _modem->sendCommandAdd_P(PSTR("AT+CIPCLOSE="));
+    _modem->sendCommandAdd((int)link);
+    _modem->sendCommandAdd_P(PSTR(",1"));
+    _modem->sendCommandEpilog();
+    _modem->waitForMessage(reply, millis() + 4000);
+  }
+  _links[link].state = link_free;
+}
+
+bool GPRSbeeMux::isConnected(uint8_t link) const
+{
+  return link < GPRSBEE_MUX_MAX_LINKS && _links[link].state == link_connected;
+}
+
+int GPRSbeeMux::available(uint8_t link) const
+{
+  return link < GPRSBEE_MUX_MAX_LINKS ? _links[link].rxCnt : 0;
+}
+
+int GPRSbeeMux::read(uint8_t link)
+{
+  uint8_t c;
+  return read(link, &c, 1) == 1 ? c : -1;
+}
+
+size_t GPRSbeeMux::read(uint8_t link, uint8_t *buffer, size_t size)
+{
+  if (link >= GPRSBEE_MUX_MAX_LINKS) {
+    return 0;
+  }
+  muxLink *lnk = &_links[link];
+  size_t n = 0;
+  while (n < size && lnk->rxCnt > 0) {
+    buffer[n++] = lnk->rx[lnk->rxHead];
+    lnk->rxHead = (lnk->rxHead + 1) % GPRSBEE_MUX_RX_BUFFER_SIZE;
+    --lnk->rxCnt;
+  }
+  if (lnk->state == link_closed && lnk->rxCnt == 0) {
+    // All data of the closed connection has been read
+    lnk->state = link_free;
+  }
+  return n;
+}
+
+/*!
+ * \brief Queue data for a link
+ *
+ * When the queue is full it is sent first. The data goes out with the
+ * next flush() or poll().
+ *
+ * \return the number of bytes queued
+ */
+size_t GPRSbeeMux::write(uint8_t link, const uint8_t *data, size_t size)
+{
+  if (!isConnected(link)) {
+    return 0;
+  }
+  muxLink *lnk = &_links[link];
+  size_t done = 0;
+  while (done < size) {
+    if (lnk->txCnt == GPRSBEE_MUX_TX_BUFFER_SIZE && !flush(link)) {
+      break;
+    }
+    lnk->tx[(lnk->txHead + lnk->txCnt) % GPRSBEE_MUX_TX_BUFFER_SIZE] = data[done++];
+    ++lnk->txCnt;
+  }
+  return done;
+}
+
+/*!
+ * \brief Send the queued data of a link
+ *
+ * The queue is sent in at most two chunks, because of the wrap around of
+ * the ring buffer. What could not be sent stays queued.
+ */
+bool GPRSbeeMux::flush(uint8_t link)
+{
+  if (!isConnected(link)) {
+    return false;
+  }
+  muxLink *lnk = &_links[link];
+  while (lnk->txCnt > 0) {
+    size_t n = GPRSBEE_MUX_TX_BUFFER_SIZE - lnk->txHead;
+    if (n > lnk->txCnt) {
+      n = lnk->txCnt;
+    }
+    if (!sendChunk(link, &lnk->tx[lnk->txHead], n)) {
+      return false;
+    }
+    lnk->txHead = (lnk->txHead + n) % GPRSBEE_MUX_TX_BUFFER_SIZE;
+    lnk->txCnt -= n;
+  }
+  return true;
+}
+
+/*!
+ * \brief Process the input that is available and send the queued data
+ *
+ * Call this regularly from loop().
+ */
+void GPRSbeeMux::poll()
+{
+  if (!_open) {
+    return;
+  }
+  // With the multiplexer active this hands every line to handleLine()
+  _modem->flushInput();
+  for (uint8_t link = 0; link < GPRSBEE_MUX_MAX_LINKS; ++link) {
+    if (_links[link].state == link_connected && _links[link].txCnt > 0) {
+      flush(link);
+    }
+  }
+}
+
+uint16_t GPRSbeeMux::getNrDropped(uint8_t link) const
+{
+  return link < GPRSBEE_MUX_MAX_LINKS ? _links[link].nrDropped : 0;
+}
+
+/*
+ * \brief Look at a line from the SIMx00, called by the line reader
+ *
+ * "+RECEIVE,<n>,<len>:" is followed by <len> bytes of data. The other
+ * lines of interest are "<n>, CONNECT OK", "<n>, CLOSED" etc.
+ */
+void GPRSbeeMux::handleLine(const char *line)
+{
+  if (strncmp_P(line, PSTR("+RECEIVE,"), 9) == 0) {
+    char *ptr;
+    uint8_t link = strtoul(line + 9, &ptr, 10);
+    if (*ptr == ',') {
+      receiveData(link, strtoul(ptr + 1, NULL, 10));
+    }
+    return;
+  }
+
+  if (line[0] < '0' || line[0] >= '0' + GPRSBEE_MUX_MAX_LINKS || line[1] != ',' || line[2] != ' ') {
+    return;
+  }
+  muxLink *lnk = &_links[line[0] - '0'];
+  const char *msg = line + 3;
+  if (strcmp_P(msg, PSTR("CONNECT OK")) == 0 || strcmp_P(msg, PSTR("ALREADY CONNECT")) == 0) {
+    if (lnk->state == link_connecting) {
+      lnk->state = link_connected;
+    }
+  } else if (strcmp_P(msg, PSTR("CONNECT FAIL")) == 0) {
+    if (lnk->state == link_connecting) {
+      lnk->state = link_failed;
+    }
+  } else if (strcmp_P(msg, PSTR("CLOSED")) == 0) {
+    // Closed by the peer. The received data can still be read, the
+    // link is only reused when that is done.
+    lnk->state = lnk->rxCnt > 0 ? link_closed : link_free;
+  }
+}
+
+/*
+ * \brief Move the data of a +RECEIVE into the ring buffer of the link
+ */
+void GPRSbeeMux::receiveData(uint8_t link, size_t len)
+{
+  Stream *uart = _modem->_myStream;
+  uint32_t ts_max = millis() + 2000;
+
+  // readLineAsync() returns at the CR, the LF may still be in the UART
+  if (_modem->_asyncSkipLF) {
+    while (uart->peek() < 0 && !_modem->isTimedOut(ts_max)) {
+    }
+    if (uart->peek() == '\n') {
+      uart->read();
+    }
+    _modem->_asyncSkipLF = false;
+  }
+
+  muxLink *lnk = link < GPRSBEE_MUX_MAX_LINKS ? &_links[link] : 0;
+  while (len > 0 && !_modem->isTimedOut(ts_max)) {
+    int c = uart->read();
+    if (c < 0) {
+      continue;
+    }
+    --len;
+    if (!lnk) {
+      continue;
+    }
+    if (lnk->rxCnt < GPRSBEE_MUX_RX_BUFFER_SIZE) {
+      lnk->rx[(lnk->rxHead + lnk->rxCnt) % GPRSBEE_MUX_RX_BUFFER_SIZE] = c;
+      ++lnk->rxCnt;
+    } else {
+      ++lnk->nrDropped;
+    }
+  }
+}
+
+/*
+ * \brief Send one chunk with AT+CIPSEND=<n>,<len> and wait for "<n>, SEND OK"
+ */
+bool GPRSbeeMux::sendChunk(uint8_t link, const uint8_t *data, size_t size)
+{
+  char reply[12];
+  reply[0] = '0' + link;
+  strcpy_P(reply + 1, PSTR(", SEND "));
+
+  _modem->sendCommandProlog();
+  _modem->sendCommandAdd_P(PSTR("AT+CIPSEND="));
+  _modem->sendCommandAdd((int)link);
+  _modem->sendCommandAdd(',');
+  _modem->sendCommandAdd((int)size);
+  _modem->sendCommandEpilog();
+  if (!_modem->waitForPrompt("> ", millis() + 4000)) {
+    return false;
+  }
+  _modem->_myStream->write(data, size);
+
+  // "<n>, SEND OK" or "<n>, SEND FAIL"
+  if (!_modem->waitForMessage(reply, millis() + 10000)) {
+    return false;
+  }
+  return strcmp_P(_modem->_SIM900_buffer + strlen(reply), PSTR("OK")) == 0;
+}
@@ -0,0 +1,126 @@
+#ifndef GPRSBEEMUX_H_
+#define GPRSBEEMUX_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "GPRSbee.h"
+
+/*!
+ * \def GPRSBEE_MUX_MAX_LINKS
+ *
+ * The number of connections the SIMx00 supports with AT+CIPMUX=1
+ */
+#define GPRSBEE_MUX_MAX_LINKS           6
+
+/*!
+ * \def GPRSBEE_MUX_RX_BUFFER_SIZE
+ *
+ * The size of the receive ring buffer of each link. Received data that
+ * doesn't fit is dropped and counted.
+ */
+#define GPRSBEE_MUX_RX_BUFFER_SIZE      128
+
+/*!
+ * \def GPRSBEE_MUX_TX_BUFFER_SIZE
+ *
+ * The size of the send queue of each link
+ */
+#define GPRSBEE_MUX_TX_BUFFER_SIZE      128
+
+/*!
+ * \brief Several TCP/UDP connections at the same time, with AT+CIPMUX=1
+ *
+ * The connections share one bearer, which is set up in begin() and shut
+ * down in end(). Each connection is a numbered link (0 .. 5).
+ *
+ * Received data ("+RECEIVE,<n>,<len>:") is picked up by the line reader of
+ * GPRSbeeClass, whatever function is reading at that moment, and put in
+ * the ring buffer of the link. Data written to a link is queued and sent
+ * with AT+CIPSEND=<n>,<len> by flush() or poll().
+ *
+ * Example:
+ *   GPRSbeeMux mux;
+ *   if (mux.begin(APN)) {
+ *     int8_t telemetry = mux.open(false, "example.com", 8500);
+ *     int8_t config = mux.open(false, "example.com", 8501);
+ *     ...
+ *     mux.write(telemetry, data, len);
+ *     mux.poll();
+ *     while (mux.available(config)) {
+ *       handleConfig(mux.read(config));
+ *     }
+ *     ...
+ *     mux.end();
+ *   }
+ */
+class GPRSbeeMux
+{
+  friend class GPRSbeeClass;
+public:
+  GPRSbeeMux(GPRSbeeClass &modem=gprsbee);
+
+  bool begin(const char *apn, const char *apnuser=0, const char *apnpwd=0);
+  void end();
+
+  int8_t open(bool udp, const char *server, int port, uint16_t timeout=15000);
+  void close(uint8_t link);
+  bool isConnected(uint8_t link) const;
+
+  int available(uint8_t link) const;
+  int read(uint8_t link);
+  size_t read(uint8_t link, uint8_t *buffer, size_t size);
+  size_t write(uint8_t link, const uint8_t *data, size_t size);
+  bool flush(uint8_t link);
+  void poll();
+
+  uint16_t getNrDropped(uint8_t link) const;
+
+private:
+  enum linkStateKind {
+    link_free,
+    link_connecting,
+    link_connected,
+    link_failed,
+    link_closed,                // closed by the peer, with received data still to read
+  };
+  struct muxLink {
+    uint8_t state;
+    uint16_t nrDropped;
+    uint16_t rxHead;            // index of the oldest byte
+    uint16_t rxCnt;
+    uint16_t txHead;
+    uint16_t txCnt;
+    uint8_t rx[GPRSBEE_MUX_RX_BUFFER_SIZE];
+    uint8_t tx[GPRSBEE_MUX_TX_BUFFER_SIZE];
+  };
+
+  void handleLine(const char *line);
+  void receiveData(uint8_t link, size_t len);
+  bool sendChunk(uint8_t link, const uint8_t *data, size_t size);
+
+  GPRSbeeClass *_modem;
+  bool _open;
+  muxLink _links[GPRSBEE_MUX_MAX_LINKS];
+};
+
+#endif /* GPRSBEEMUX_H_ */
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include "GPRSbeePowerManager.h"
+
+// Initial guesses of the wake-to-ready latency, until it is measured
+#define LATENCY_OFF_MS          10000
+#define LATENCY_CFUN_MS         4000
+#define LATENCY_SLEEP_MS        200
+
+GPRSbeePowerManager::GPRSbeePowerManager(GPRSbeeClass &modem)
+{
+  _modem = &modem;
+  _dtrPin = -1;
+  _policy = policy_off;
+  _idlePolicy = policy_off;
+  _idle = false;
+  _wakeMeasure = false;
+  _wakeFrom = policy_off;
+  _wakeStart = 0;
+  _measured = 0;
+  _latency[policy_off] = LATENCY_OFF_MS;
+  _latency[policy_cfun0] = LATENCY_CFUN_MS;
+  _latency[policy_cfun4] = LATENCY_CFUN_MS;
+  _latency[policy_sleep] = LATENCY_SLEEP_MS;
+  _current[policy_off] = GPRSBEE_CURRENT_OFF_UA;
+  _current[policy_cfun0] = GPRSBEE_CURRENT_CFUN_UA;
+  _current[policy_cfun4] = GPRSBEE_CURRENT_CFUN_UA;
+  _current[policy_sleep] = GPRSBEE_CURRENT_SLEEP_UA;
+  _activeCurrent = GPRSBEE_CURRENT_ACTIVE_UA;
+}
+
+/*!
+ * \brief Let the power manager handle on() and off() of the modem
+ *
+ * The dtrPin is the MCU output connected to DTR of the SIMx00, it is
+ * needed for policy_sleep. Notice that the pin named DTR on the Bee
+ * socket is the power key, not the DTR of the SIMx00.
+ */
+void GPRSbeePowerManager::begin(int dtrPin)
+{
+  _dtrPin = dtrPin;
+  if (_dtrPin >= 0) {
+    pinMode(_dtrPin, OUTPUT);
+    digitalWrite(_dtrPin, LOW);
+  }
+  _idle = false;
+  _modem->_power = this;
+}
+
+/*!
+ * \brief Detach from the modem, a low power idle state is ended by a power down
+ */
+void GPRSbeePowerManager::end()
+{
+  _modem->_power = 0;
+  if (_dtrPin >= 0) {
+    digitalWrite(_dtrPin, LOW);
+  }
+  if (_idle && _idlePolicy != policy_off) {
+    _modem->powerOff();
+  }
+  _idle = false;
+}
+
+void GPRSbeePowerManager::setPolicy(enum policyKind policy)
+{
+  if (isAvailable(policy)) {
+    _policy = policy;
+  }
+}
+
+bool GPRSbeePowerManager::isAvailable(enum policyKind policy) const
+{
+  switch (policy) {
+  case policy_off:
+  case policy_cfun0:
+  case policy_cfun4:
+    return true;
+  case policy_sleep:
+    return _dtrPin >= 0;
+  default:
+    return false;
+  }
+}
+
+/*!
+ * \brief Select the policy with the lowest estimated charge for the interval
+ *
+ * The interval is the time in seconds from one transaction to the next.
+ */
+enum GPRSbeePowerManager::policyKind GPRSbeePowerManager::choosePolicy(uint32_t interval)
+{
+  enum policyKind best = policy_off;
+  uint32_t bestCharge = getEstimatedCharge(policy_off, interval);
+  for (uint8_t i = policy_off + 1; i < policy_count; ++i) {
+    enum policyKind policy = (enum policyKind)i;
+    if (!isAvailable(policy)) {
+      continue;
+    }
+    uint32_t charge = getEstimatedCharge(policy, interval);
+    if (charge < bestCharge) {
+      best = policy;
+      bestCharge = charge;
+    }
+  }
+  _policy = best;
+  return best;
+}
+
+/*!
+ * \brief Estimate the charge in microampere-seconds of one interval, excluding the transaction
+ *
+ * That is the idle current until the next transaction, plus the active
+ * current during the wake-to-ready latency. Divide by 3600 for uAh.
+ */
+uint32_t GPRSbeePowerManager::getEstimatedCharge(enum policyKind policy, uint32_t interval) const
+{
+  uint32_t latency = _latency[policy];
+  uint32_t idle = interval * 1000 > latency ? interval * 1000 - latency : 0;
+  return _current[policy] * (idle / 1000) + _activeCurrent / 100 * (latency / 10);
+}
+
+void GPRSbeePowerManager::printReport(Print &out, uint32_t interval) const
+{
+  static const char * const names[policy_count] = { "off", "cfun0", "cfun4", "sleep" };
+  for (uint8_t i = 0; i < policy_count; ++i) {
+    enum policyKind policy = (enum policyKind)i;
+    out.print(names[i]);
+    if (!isAvailable(policy)) {
+      out.println(F(": n/a"));
+      continue;
+    }
+    out.print(F(": wake "));
+    out.print(_latency[i]);
+    out.print(_measured & (1 << i) ? F(" ms") : F(" ms (guess)"));
+    out.print(F(", "));
+    out.print(getEstimatedCharge(policy, interval) / 3600);
+    out.print(F(" uAh per interval"));
+    out.println(policy == _policy ? F(" *") : F(""));
+  }
+}
+
+/*
+ * Called by off(), put the SIMx00 in the idle state of the policy
+ *
+ * If the SIMx00 doesn't accept the low power command it is switched off,
+ * that is always a safe state to start the next transaction from.
+ * off() is also called when on() failed, then the SIMx00 is off already
+ * and there is no point in sending it commands.
+ */
+bool GPRSbeePowerManager::sleep()
+{
+  _wakeMeasure = false;
+  if (!_modem->isOn()) {
+    _idle = true;
+    _idlePolicy = policy_off;
+    return true;
+  }
+
+  switch (_policy) {
+  case policy_cfun0:
+  case policy_cfun4:
+    // It may take a while before the radio is down
+    if (_modem->sendCommandWaitForOK_P(_policy == policy_cfun0 ? PSTR("AT+CFUN=0") : PSTR("AT+CFUN=4"), 10000)) {
+      _idle = true;
+      _idlePolicy = _policy;
+      return true;
+    }
+    break;
+  case policy_sleep:
+    if (_modem->sendCommandWaitForOK_P(PSTR("AT+CSCLK=1"))) {
+      // The SIMx00 sleeps as soon as DTR is high and the UART is quiet
+      digitalWrite(_dtrPin, HIGH);
+      _idle = true;
+      _idlePolicy = _policy;
+      return true;
+    }
+    break;
+  default:
+    break;
+  }
+
+  _idle = true;
+  _idlePolicy = policy_off;
+  return _modem->powerOff();
+}
+
+/*
+ * Called by on(), bring the SIMx00 back from the idle state until it
+ * answers
+ *
+ * The registration is left to the transaction (waitForCREG() in
+ * connectProlog() and friends). When it succeeds registered() is called,
+ * which completes the latency measurement.
+ */
+bool GPRSbeePowerManager::wake()
+{
+  uint32_t start = millis();
+  enum policyKind from = _idle ? _idlePolicy : policy_off;
+  // Only a real power up says something about the latency of policy_off
+  bool measure = _idle || !_modem->isOn();
+  bool ok = false;
+
+  _idle = false;
+  if (from != policy_off && !_modem->isOn()) {
+    // Someone switched it off behind our back
+    from = policy_off;
+  }
+
+  switch (from) {
+  case policy_cfun0:
+  case policy_cfun4:
+    ok = _modem->sendCommandWaitForOK_P(PSTR("AT+CFUN=1"), 10000);
+    break;
+  case policy_sleep:
+    digitalWrite(_dtrPin, LOW);
+    // The UART is available 50 ms after DTR goes low
+    delay(60);
+    ok = _modem->isAlive() && _modem->sendCommandWaitForOK_P(PSTR("AT+CSCLK=0"));
+    break;
+  default:
+    break;
+  }
+  if (!ok) {
+    if (from != policy_off) {
+      // Start all over
+      _modem->powerOff();
+      from = policy_off;
+      measure = true;
+    }
+    if (!_modem->powerOn()) {
+      return false;
+    }
+  }
+
+  _modem->switchEchoOff();
+  _wakeMeasure = measure;
+  _wakeFrom = from;
+  _wakeStart = start;
+  return true;
+}
+
+/*
+ * Called by waitForCREG() when the SIMx00 is registered
+ */
+void GPRSbeePowerManager::registered()
+{
+  if (_wakeMeasure) {
+    updateLatency(_wakeFrom, millis() - _wakeStart);
+    _wakeMeasure = false;
+  }
+}
+
+// A running average, the first measurement replaces the initial guess
+void GPRSbeePowerManager::updateLatency(enum policyKind policy, uint32_t ms)
+{
+  if (_measured & (1 << policy)) {
+    _latency[policy] = (_latency[policy] * 3 + ms) / 4;
+  } else {
+    _latency[policy] = ms;
+    _measured |= 1 << policy;
+  }
+}
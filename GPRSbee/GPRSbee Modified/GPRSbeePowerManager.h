@@ -0,0 +1,107 @@
+#ifndef GPRSBEEPOWERMANAGER_H_
+#define GPRSBEEPOWERMANAGER_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "GPRSbee.h"
+
+/*
+ * Rough current figures of a SIM900 in microampere, used to estimate the
+ * charge per upload interval. They are from the datasheet, measure your
+ * own board and use setCurrent() for better estimates.
+ */
+#define GPRSBEE_CURRENT_ACTIVE_UA       80000   // waking up, registering, transmitting
+#define GPRSBEE_CURRENT_OFF_UA          30      // power down
+#define GPRSBEE_CURRENT_CFUN_UA         1000    // minimum functionality (AT+CFUN=0/4)
+#define GPRSBEE_CURRENT_SLEEP_UA        1500    // AT+CSCLK=1 sleep, registered
+
+/*!
+ * \brief Decides what the SIMx00 does between transactions
+ *
+ * Without a power manager every high level function of GPRSbeeClass ends
+ * with off() and starts with on(), and the next transaction pays for the
+ * power up, the network registration and the GPRS attach again.
+ *
+ * Once begin() is called, off() and on() of the modem go through the
+ * power manager. Depending on the policy the SIMx00 is
+ *  - switched off (policy_off, the same as without a power manager)
+ *  - put in minimum functionality (AT+CFUN=0 or AT+CFUN=4, the radio is
+ *    off but the SIMx00 stays powered and configured)
+ *  - put to sleep with AT+CSCLK=1 and the DTR pin of the SIMx00 high. It
+ *    stays registered to the network. This needs a board where the
+ *    SIMx00 DTR pin is wired to an output, see begin().
+ *
+ * The wake-to-ready latency is measured for each policy, from on() until
+ * the transaction sees the SIMx00 registered to the network. Together with the current figures it is
+ * used to estimate the charge per upload interval, and choosePolicy()
+ * picks the policy with the lowest estimate.
+ */
+class GPRSbeePowerManager
+{
+  friend class GPRSbeeClass;
+public:
+  enum policyKind {
+    policy_off,
+    policy_cfun0,
+    policy_cfun4,
+    policy_sleep,
+    policy_count,
+  };
+
+  GPRSbeePowerManager(GPRSbeeClass &modem=gprsbee);
+
+  void begin(int dtrPin=-1);
+  void end();
+
+  void setPolicy(enum policyKind policy);
+  enum policyKind getPolicy() const { return _policy; }
+  bool isAvailable(enum policyKind policy) const;
+  enum policyKind choosePolicy(uint32_t interval);
+
+  void setCurrent(enum policyKind policy, uint32_t microAmps) { _current[policy] = microAmps; }
+  void setActiveCurrent(uint32_t microAmps) { _activeCurrent = microAmps; }
+  uint32_t getWakeLatency(enum policyKind policy) const { return _latency[policy]; }
+  uint32_t getEstimatedCharge(enum policyKind policy, uint32_t interval) const;
+  void printReport(Print &out, uint32_t interval) const;
+
+private:
+  bool wake();
+  bool sleep();
+  void registered();
+  void updateLatency(enum policyKind policy, uint32_t ms);
+
+  GPRSbeeClass *_modem;
+  int8_t _dtrPin;
+  enum policyKind _policy;
+  enum policyKind _idlePolicy;          // how off() left the SIMx00
+  bool _idle;
+  bool _wakeMeasure;                    // measure the latency at the next registered()
+  enum policyKind _wakeFrom;            // the idle state of the last wake()
+  uint32_t _wakeStart;                  // millis() of the last wake()
+  uint8_t _measured;                    // bit mask of policies with a measured latency
+  uint32_t _latency[policy_count];      // ms, measured, or an initial guess
+  uint32_t _current[policy_count];      // uA while idle
+  uint32_t _activeCurrent;              // uA while waking up
+};
+
+#endif /* GPRSBEEPOWERMANAGER_H_ */
@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include "GPRSbeeResumableUpload.h"
+
+GPRSbeeResumableUpload *GPRSbeeResumableUpload::_active;
+
+GPRSbeeResumableUpload::GPRSbeeResumableUpload(GPRSbeeClass &modem)
+{
+  _modem = &modem;
+  _source = 0;
+  _load = 0;
+  _save = 0;
+  _maxAttempts = 3;
+  _nrAttempts = 0;
+  _nrBytesSent = 0;
+  _sourceError = false;
+  memset(&_checkpoint, 0, sizeof(_checkpoint));
+}
+
+/*!
+ * \brief Prepare the upload of size bytes, identified by id
+ *
+ * If the checkpoint store has a checkpoint of the same upload (same id
+ * and size), the upload continues from its offset.
+ */
+void GPRSbeeResumableUpload::begin(uint32_t id, uint32_t size, readAt source)
+{
+  GPRSbeeCheckpoint saved;
+
+  _source = source;
+  _nrAttempts = 0;
+  _nrBytesSent = 0;
+  _sourceError = false;
+  _checkpoint.id = id;
+  _checkpoint.size = size;
+  _checkpoint.offset = 0;
+  if (_load && _load(&saved) && saved.id == id && saved.size == size
+      && saved.offset <= size) {
+    _checkpoint.offset = saved.offset;
+  }
+}
+
+/*!
+ * \brief Upload the rest of the data to an FTP server
+ *
+ * The upload is tried at most the maximum number of attempts, each time
+ * with a fresh FTP session. Returns true if the server has all the data.
+ * If the source can't give the data it stops, see hasSourceError().
+ */
+bool GPRSbeeResumableUpload::sendFTP(const char *apn, const char *apnuser, const char *apnpwd,
+    const char *server, const char *username, const char *password,
+    const char *path, const char *fname)
+{
+  for (uint8_t attempt = 0; attempt < _maxAttempts && !_sourceError; ++attempt) {
+    ++_nrAttempts;
+    if (sendFTPattempt(apn, apnuser, apnpwd, server, username, password, path, fname)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool GPRSbeeResumableUpload::sendFTPattempt(const char *apn, const char *apnuser, const char *apnpwd,
+    const char *server, const char *username, const char *password,
+    const char *path, const char *fname)
+{
+  uint32_t size;
+
+  if (!_modem->openFTP(apn, apnuser, apnpwd, server, username, password)) {
+    return false;
+  }
+
+  if (_checkpoint.offset > 0) {
+    // Appending at an offset that the server doesn't have would leave a
+    // hole or a duplicate, so without an answer this attempt fails
+    if (!getFTPsize(path, fname, &size)) {
+      goto cmd_error;
+    }
+    // The server knows best, unless it is a different file
+    setOffset(size <= _checkpoint.size ? size : 0);
+  }
+  if (isDone()) {
+    _modem->closeFTP();
+    return true;
+  }
+
+  // Append to what the server has, or start a new file
+  if (!_modem->sendCommandWaitForOKFormat_P(PSTR("AT+FTPPUTOPT=%S"),
+      _checkpoint.offset > 0 ? PSTR("\"APPE\"") : PSTR("\"STOR\""))) {
+    goto cmd_error;
+  }
+  if (!_modem->openFTPfile(fname, path)) {
+    goto cmd_error;
+  }
+
+  while (!isDone()) {
+    uint32_t segment = _checkpoint.size - _checkpoint.offset;
+    if (segment > GPRSBEE_RESUME_SEGMENT_SIZE) {
+      segment = GPRSBEE_RESUME_SEGMENT_SIZE;
+    }
+    if (!checkSource(segment)) {
+      goto cmd_error;
+    }
+    seek(_checkpoint.offset);
+    _active = this;
+    if (!_modem->sendFTPdata(readByte, segment) || _sourceError) {
+      goto source_error;
+    }
+    setOffset(_checkpoint.offset + segment);
+  }
+
+  if (!_modem->closeFTPfile()) {
+    goto cmd_error;
+  }
+  _modem->closeFTP();
+  return true;
+
+source_error:
+  if (_sourceError) {
+    // What went out of this segment is not the data, don't leave a file
+    // that a resume would append to. The next try starts all over.
+    setOffset(0);
+  }
+cmd_error:
+  _modem->closeFTP();
+  return false;
+}
+
+/*
+ * \brief Ask the server the size of the file
+ *
+ * The reply is "+FTPSIZE: 1,0,<size>", or "+FTPSIZE: 1,<error>,0". An
+ * error means the server can't tell, e.g. because there is no such file.
+ * That counts as size 0, so the upload starts over. Return false if there
+ * is no reply.
+ */
+bool GPRSbeeResumableUpload::getFTPsize(const char *path, const char *fname, uint32_t *size)
+{
+  const char *ptr;
+  char *bufend;
+
+  if (!_modem->sendCommandWaitForOKFormat_P(PSTR("AT+FTPGETNAME=%q"), fname)) {
+    return false;
+  }
+  if (!_modem->sendCommandWaitForOKFormat_P(PSTR("AT+FTPGETPATH=%q"), path)) {
+    return false;
+  }
+  if (!_modem->sendCommandWaitForOK_P(PSTR("AT+FTPSIZE"))) {
+    return false;
+  }
+  if (!_modem->waitForMessage_P(PSTR("+FTPSIZE:"), millis() + 30000)) {
+    return false;
+  }
+  // Skip 9 for "+FTPSIZE:"
+  ptr = _modem->skipWhiteSpace(_modem->_SIM900_buffer + 9);
+  if (strncmp_P(ptr, PSTR("1,"), 2) != 0) {
+    return false;
+  }
+  if (strncmp_P(ptr, PSTR("1,0,"), 4) != 0) {
+    *size = 0;
+    return true;
+  }
+  ptr += 4;
+  *size = strtoul(ptr, &bufend, 10);
+  return bufend != ptr;
+}
+
+/*!
+ * \brief Upload the rest of the data with HTTP POSTs, a segment each
+ *
+ * The upload is tried at most the maximum number of attempts, each time
+ * with a fresh HTTP service. Returns true if the server has all the data.
+ * If the source can't give the data it stops, see hasSourceError().
+ */
+bool GPRSbeeResumableUpload::sendHTTP(const char *apn, const char *apnuser, const char *apnpwd,
+    const char *url)
+{
+  for (uint8_t attempt = 0; attempt < _maxAttempts && !_sourceError; ++attempt) {
+    ++_nrAttempts;
+    if (sendHTTPattempt(apn, apnuser, apnpwd, url)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool GPRSbeeResumableUpload::sendHTTPattempt(const char *apn, const char *apnuser, const char *apnpwd,
+    const char *url)
+{
+  bool retval = false;
+
+  if (!_modem->on()) {
+    goto ending;
+  }
+
+  if (!_modem->doHTTPprolog(apn, apnuser, apnpwd)) {
+    goto cmd_error;
+  }
+
+  while (!isDone()) {
+    uint32_t segment = _checkpoint.size - _checkpoint.offset;
+    if (segment > GPRSBEE_RESUME_SEGMENT_SIZE) {
+      segment = GPRSBEE_RESUME_SEGMENT_SIZE;
+    }
+    if (!checkSource(segment)) {
+      goto cmd_error;
+    }
+    if (!_modem->sendCommandWaitForOKFormat_P(
+        PSTR("AT+HTTPPARA=\"USERDATA\",\"Content-Range: bytes %lu-%lu/%lu\""),
+        (unsigned long)_checkpoint.offset, (unsigned long)(_checkpoint.offset + segment - 1),
+        (unsigned long)_checkpoint.size)) {
+      goto cmd_error;
+    }
+    seek(_checkpoint.offset);
+    _active = this;
+    if (!_modem->doHTTPPOSTmiddle(url, pull, segment)) {
+      goto cmd_error;
+    }
+    uint16_t status = _modem->getHTTPStatus();
+    if (status < 200 || status > 299) {
+      goto cmd_error;
+    }
+    setOffset(_checkpoint.offset + segment);
+  }
+
+  retval = true;
+  _modem->doHTTPepilog();
+  goto ending;
+
+cmd_error:
+  _modem->doHTTPepilog();
+
+ending:
+  _modem->off();
+  return retval;
+}
+
+/*
+ * Update the offset that the server has, and save the checkpoint
+ */
+void GPRSbeeResumableUpload::setOffset(uint32_t offset)
+{
+  _checkpoint.offset = offset;
+  if (_save) {
+    _save(&_checkpoint);
+  }
+}
+
+/*
+ * Can the source give the whole segment at the current offset? Its last
+ * byte is read to find out, before anything is sent.
+ */
+bool GPRSbeeResumableUpload::checkSource(uint32_t segment)
+{
+  uint8_t last;
+  if ((*_source)(_checkpoint.offset + segment - 1, &last, 1) != 1) {
+    _sourceError = true;
+  }
+  return !_sourceError;
+}
+
+void GPRSbeeResumableUpload::seek(uint32_t offset)
+{
+  _readPos = offset;
+  _cacheIx = 0;
+  _cacheLen = 0;
+}
+
+// The read function for sendFTPdata()
+uint8_t GPRSbeeResumableUpload::readByte()
+{
+  GPRSbeeResumableUpload *self = _active;
+  if (self->_cacheIx >= self->_cacheLen) {
+    uint32_t left = self->_checkpoint.size - self->_readPos;
+    size_t n = left < sizeof(self->_cache) ? left : sizeof(self->_cache);
+    self->_cacheLen = (*self->_source)(self->_readPos, self->_cache, n);
+    self->_cacheIx = 0;
+    self->_readPos += self->_cacheLen;
+    if (self->_cacheLen == 0) {
+      // The source ended early after all. The SIMx00 still wants the rest
+      // of the chunk, the upload is aborted when sendFTPdata() returns.
+      self->_sourceError = true;
+      return 0;
+    }
+  }
+  ++self->_nrBytesSent;
+  return self->_cache[self->_cacheIx++];
+}
+
+// The pull function for doHTTPPOSTmiddle()
+size_t GPRSbeeResumableUpload::pull(uint8_t *buffer, size_t size)
+{
+  GPRSbeeResumableUpload *self = _active;
+  size_t n = (*self->_source)(self->_readPos, buffer, size);
+  if (n == 0) {
+    // doHTTPPOSTmiddle() fails the POST
+    self->_sourceError = true;
+  }
+  self->_readPos += n;
+  self->_nrBytesSent += n;
+  return n;
+}
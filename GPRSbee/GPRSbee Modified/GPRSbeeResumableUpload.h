@@ -0,0 +1,133 @@
+#ifndef GPRSBEERESUMABLEUPLOAD_H_
+#define GPRSBEERESUMABLEUPLOAD_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "GPRSbee.h"
+
+/*!
+ * \def GPRSBEE_RESUME_SEGMENT_SIZE
+ *
+ * The progress of an upload is saved after each segment of this many
+ * bytes. For HTTP each segment is a separate POST.
+ */
+#define GPRSBEE_RESUME_SEGMENT_SIZE     4096
+
+/*!
+ * \brief The progress of an upload, as saved in persistent memory
+ */
+struct GPRSbeeCheckpoint
+{
+  uint32_t id;                  // identifies the upload, chosen by the application
+  uint32_t size;                // the total size of the upload
+  uint32_t offset;              // the number of bytes that the server has
+};
+
+/*!
+ * \brief An upload that continues where it stopped after a lost link
+ *
+ * The data is read with a function that takes an offset, so that any part
+ * can be (re)sent, e.g. from DataFlash. After each segment the offset that
+ * the server has confirmed is saved with the checkpoint store, so even
+ * after a reset the upload continues from there instead of from the start.
+ * If the source gives less than the size, the upload is aborted rather
+ * than padded, see hasSourceError().
+ *
+ * FTP: a resumed upload appends to the file (AT+FTPPUTOPT="APPE"). The
+ * server has the final say in how much it has: its file size (AT+FTPSIZE)
+ * overrides the checkpoint, which can be behind (or ahead, by the last
+ * segment) because FTP doesn't confirm data before the file is closed.
+ * Without an answer to AT+FTPSIZE the attempt fails. If the server has no
+ * such file it starts over with AT+FTPPUTOPT="STOR".
+ *
+ * HTTP: each segment is a POST with a header
+ *   Content-Range: bytes <first>-<last>/<size>
+ * A segment is confirmed by a 2xx status. The server puts the segments
+ * together.
+ *
+ * Example, with a Sodaq_Checkpoint as the store (see testResumableUpload):
+ *   upload.setCheckpointStore(loadCheckpoint, saveCheckpoint);
+ *   upload.begin(fileId, fileSize, readFile);
+ *   if (!upload.sendFTP(APN, 0, 0, server, user, password, "/", "log.bin")) {
+ *     // Try again later, with the same id and size, it will resume
+ *   }
+ */
+class GPRSbeeResumableUpload
+{
+public:
+  typedef size_t (*readAt)(uint32_t offset, uint8_t *buffer, size_t size);
+  typedef bool (*checkpointLoad)(GPRSbeeCheckpoint *checkpoint);
+  typedef void (*checkpointSave)(const GPRSbeeCheckpoint *checkpoint);
+
+  GPRSbeeResumableUpload(GPRSbeeClass &modem=gprsbee);
+
+  void setCheckpointStore(checkpointLoad load, checkpointSave save) { _load = load; _save = save; }
+  void setMaxAttempts(uint8_t nr) { _maxAttempts = nr; }
+
+  void begin(uint32_t id, uint32_t size, readAt source);
+  bool sendFTP(const char *apn, const char *apnuser, const char *apnpwd,
+      const char *server, const char *username, const char *password,
+      const char *path, const char *fname);
+  bool sendHTTP(const char *apn, const char *apnuser, const char *apnpwd,
+      const char *url);
+
+  bool isDone() const { return _checkpoint.offset >= _checkpoint.size; }
+  uint32_t getOffset() const { return _checkpoint.offset; }
+  uint32_t getNrBytesSent() const { return _nrBytesSent; }
+  uint8_t getNrAttempts() const { return _nrAttempts; }
+  bool hasSourceError() const { return _sourceError; }
+
+private:
+  bool sendFTPattempt(const char *apn, const char *apnuser, const char *apnpwd,
+      const char *server, const char *username, const char *password,
+      const char *path, const char *fname);
+  bool getFTPsize(const char *path, const char *fname, uint32_t *size);
+  bool sendHTTPattempt(const char *apn, const char *apnuser, const char *apnpwd,
+      const char *url);
+  void setOffset(uint32_t offset);
+  bool checkSource(uint32_t segment);
+  void seek(uint32_t offset);
+  static uint8_t readByte();
+  static size_t pull(uint8_t *buffer, size_t size);
+
+  GPRSbeeClass *_modem;
+  readAt _source;
+  checkpointLoad _load;
+  checkpointSave _save;
+  GPRSbeeCheckpoint _checkpoint;
+  uint8_t _maxAttempts;
+  uint8_t _nrAttempts;
+  uint32_t _nrBytesSent;        // including what was sent again
+  bool _sourceError;            // the source gave less than the size, the upload is aborted
+
+  // The read position, with a small cache
+  uint32_t _readPos;
+  uint8_t _cache[32];
+  uint8_t _cacheIx;
+  uint8_t _cacheLen;
+
+  // The upload that readByte() and pull() read from
+  static GPRSbeeResumableUpload *_active;
+};
+
+#endif /* GPRSBEERESUMABLEUPLOAD_H_ */
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+//#include <avr/wdt.h>
+
+#include "GPRSbeeTCPStream.h"
+
+#define wdt_reset()
+
+// In the data of transparent mode when the peer has closed the connection
+static const char closedMsg[] PROGMEM = "\r\nCLOSED\r\n";
+#define CLOSED_MSG_LEN  (sizeof(closedMsg) - 1)
+
+GPRSbeeTCPStream::GPRSbeeTCPStream(GPRSbeeClass &modem)
+{
+  _modem = &modem;
+  _uart = 0;
+  _txCnt = 0;
+  _threshold = sizeof(_txBuf);
+  _open = false;
+  _peerClosed = false;
+  _rxHead = 0;
+  _rxCnt = 0;
+  _rxMatch = 0;
+  _rxMatchAt = 0;
+  _nrBytes = 0;
+  _nrUARTWrites = 0;
+}
+
+bool GPRSbeeTCPStream::connect(const char *apn, const char *server, int port)
+{
+  return connect(apn, 0, 0, server, port);
+}
+
+/*!
+ * \brief Switch on the SIMx00 and open a transparent TCP connection
+ */
+bool GPRSbeeTCPStream::connect(const char *apn, const char *apnuser, const char *apnpwd,
+    const char *server, int port)
+{
+  _txCnt = 0;
+  _peerClosed = false;
+  _rxCnt = 0;
+  _rxMatch = 0;
+  _open = _modem->openTCP(apn, apnuser, apnpwd, server, port, true);
+  _uart = _open ? _modem->getTransparentStream() : 0;
+  return _open;
+}
+
+/*!
+ * \brief Flush the pending data, close the connection and switch off the SIMx00
+ *
+ * If the peer already closed the connection the SIMx00 is only shut down.
+ */
+void GPRSbeeTCPStream::stop()
+{
+  if (_open) {
+    flush();
+    _modem->closeTCP();
+  }
+  _open = false;
+  _peerClosed = false;
+  _rxCnt = 0;
+  _rxMatch = 0;
+  _uart = 0;
+}
+
+/*!
+ * \brief Set the number of bytes at which the collected writes go out
+ *
+ * A lower threshold gives less latency, a higher one fewer and bigger
+ * writes to the UART. It is at most GPRSBEE_TCP_TX_BUFFER_SIZE.
+ */
+void GPRSbeeTCPStream::setFlushThreshold(size_t threshold)
+{
+  if (threshold == 0 || threshold > sizeof(_txBuf)) {
+    threshold = sizeof(_txBuf);
+  }
+  _threshold = threshold;
+  if (_txCnt >= _threshold) {
+    flush();
+  }
+}
+
+/*
+ * Of the bytes in the UART at most one CLOSED message is not data
+ */
+int GPRSbeeTCPStream::available()
+{
+  if (!fillRx()) {
+    return 0;
+  }
+  int n = _peerClosed ? 0 : _uart->available() - (int)CLOSED_MSG_LEN;
+  return _rxCnt + (n > 0 ? n : 0);
+}
+
+int GPRSbeeTCPStream::read()
+{
+  if (!fillRx()) {
+    return -1;
+  }
+  --_rxCnt;
+  return _rxBuf[_rxHead++];
+}
+
+int GPRSbeeTCPStream::peek()
+{
+  return fillRx() ? _rxBuf[_rxHead] : -1;
+}
+
+void GPRSbeeTCPStream::flush()
+{
+  if (_txCnt > 0) {
+    if (!_peerClosed) {
+      writeUART(_txBuf, _txCnt);
+    }
+    _txCnt = 0;
+  }
+}
+
+/*
+ * \brief Move received bytes from the UART to the receive buffer
+ *
+ * The bytes that can be the start of the CLOSED message are held back.
+ * When the message is complete the connection is closed, and the UART is
+ * not read anymore, the SIMx00 is in command mode.
+ *
+ * \return true if there is a byte to read
+ */
+bool GPRSbeeTCPStream::fillRx()
+{
+  while (_rxCnt == 0 && _uart && !_peerClosed) {
+    _rxHead = 0;
+    int c = _uart->read();
+    if (c < 0) {
+      if (_rxMatch > 0 && millis() - _rxMatchAt >= GPRSBEE_TCP_CLOSED_GAP) {
+        // Nothing more came, it was data
+        releaseRx();
+      }
+      break;
+    }
+    if (c == pgm_read_byte(&closedMsg[_rxMatch])) {
+      _rxMatchAt = millis();
+      if (++_rxMatch == CLOSED_MSG_LEN) {
+        _rxMatch = 0;
+        _peerClosed = true;
+        _modem->transparentClosed();
+      }
+      continue;
+    }
+    // Not the message after all, what was held back is data. The byte
+    // itself can be the start of the message again.
+    releaseRx();
+    if (c == pgm_read_byte(&closedMsg[0])) {
+      _rxMatch = 1;
+      _rxMatchAt = millis();
+    } else {
+      _rxBuf[_rxCnt++] = c;
+    }
+  }
+  return _rxCnt > 0;
+}
+
+/*
+ * Move the held back part of the message to the (empty) receive buffer
+ */
+void GPRSbeeTCPStream::releaseRx()
+{
+  memcpy_P(_rxBuf, closedMsg, _rxMatch);
+  _rxHead = 0;
+  _rxCnt = _rxMatch;
+  _rxMatch = 0;
+}
+
+size_t GPRSbeeTCPStream::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t GPRSbeeTCPStream::write(const uint8_t *buffer, size_t size)
+{
+  if (!_open || _peerClosed) {
+    return 0;
+  }
+  size_t todo = size;
+  while (todo > 0) {
+    if (_txCnt == 0 && todo >= _threshold) {
+      // Big enough by itself, no need to copy
+      writeUART(buffer, todo);
+      break;
+    }
+    size_t n = _threshold - _txCnt;
+    if (n > todo) {
+      n = todo;
+    }
+    memcpy(_txBuf + _txCnt, buffer, n);
+    _txCnt += n;
+    buffer += n;
+    todo -= n;
+    if (_txCnt >= _threshold) {
+      flush();
+    }
+  }
+  return size;
+}
+
+/*!
+ * \brief Send a binary message with its length in front of it
+ *
+ * The length and the data go out in the same flush.
+ */
+bool GPRSbeeTCPStream::writeFrame(const uint8_t *data, uint16_t size)
+{
+  uint8_t hdr[2];
+  hdr[0] = size >> 8;
+  hdr[1] = size;
+  if (write(hdr, sizeof(hdr)) != sizeof(hdr) || write(data, size) != size) {
+    return false;
+  }
+  flush();
+  return true;
+}
+
+/*!
+ * \brief Receive a binary message sent with a 16 bits length in front of it
+ *
+ * \return the length of the message, or -1 if it did not completely
+ *    arrive within the timeout. If the message is bigger than the buffer
+ *    the remainder is read and dropped.
+ */
+int GPRSbeeTCPStream::readFrame(uint8_t *buffer, size_t size, uint32_t timeout)
+{
+  uint32_t ts_max = millis() + timeout;
+  uint8_t hdr[2];
+  if (!readBlock(hdr, sizeof(hdr), 0, ts_max)) {
+    return -1;
+  }
+  size_t len = ((size_t)hdr[0] << 8) | hdr[1];
+  size_t n = len < size ? len : size;
+  if (!readBlock(buffer, n, len - n, ts_max)) {
+    return -1;
+  }
+  return len;
+}
+
+/*
+ * Read size bytes into the buffer, then skip another number of bytes
+ */
+bool GPRSbeeTCPStream::readBlock(uint8_t *buffer, size_t size, size_t skip, uint32_t ts_max)
+{
+  if (!_uart) {
+    return false;
+  }
+  while (size > 0 || skip > 0) {
+    if ((int32_t)(millis() - ts_max) >= 0) {
+      return false;
+    }
+    wdt_reset();
+    int c = read();
+    if (c < 0) {
+      if (_peerClosed) {
+        return false;
+      }
+      continue;
+    }
+    if (size > 0) {
+      *buffer++ = c;
+      --size;
+    } else {
+      --skip;
+    }
+  }
+  return true;
+}
+
+void GPRSbeeTCPStream::writeUART(const uint8_t *data, size_t size)
+{
+  _nrBytes += _modem->writeTransparent(data, size);
+  ++_nrUARTWrites;
+}
@@ -0,0 +1,124 @@
+#ifndef GPRSBEETCPSTREAM_H_
+#define GPRSBEETCPSTREAM_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <Arduino.h>
+#include <Stream.h>
+
+#include "GPRSbee.h"
+
+/*!
+ * \def GPRSBEE_TCP_TX_BUFFER_SIZE
+ *
+ * The size of the buffer in which GPRSbeeTCPStream collects small writes
+ * before they go to the UART.
+ */
+#define GPRSBEE_TCP_TX_BUFFER_SIZE      64
+
+/*!
+ * \def GPRSBEE_TCP_CLOSED_GAP
+ *
+ * Received data that looks like the start of "\r\nCLOSED\r\n" is held
+ * back until it is complete, turns out to be data, or nothing more came
+ * for this many milliseconds. The SIMx00 sends the message in one go.
+ */
+#define GPRSBEE_TCP_CLOSED_GAP          20
+
+/*!
+ * \brief A TCP connection in transparent mode, as a Stream
+ *
+ * In transparent mode (AT+CIPMODE=1) everything written to the UART goes
+ * to the peer and everything the peer sends comes out of the UART. There
+ * is no AT+CIPSEND, no "> " prompt and no "SEND OK" per block.
+ *
+ * Writes are collected in a small buffer and written to the UART when the
+ * flush threshold is reached, or with flush(). Blocks of at least the
+ * threshold are written directly. Reads come straight from the UART, the
+ * line buffer of GPRSbeeClass is not used.
+ *
+ * When the peer closes the connection the SIMx00 puts "\r\nCLOSED\r\n"
+ * in the data and goes back to command mode. That message is taken out
+ * of the data, connected() becomes false and stop() only shuts down. Data
+ * that contains the message itself is cut off there.
+ *
+ * Beware that the SIMx00 may see a "+++", with the guard time without
+ * data before and after, as the escape sequence.
+ *
+ * Example:
+ *   GPRSbeeTCPStream tcp;
+ *   if (tcp.connect(APN, "example.com", 8500)) {
+ *     tcp.print(value);
+ *     tcp.flush();
+ *     tcp.stop();
+ *   }
+ */
+class GPRSbeeTCPStream : public Stream
+{
+public:
+  GPRSbeeTCPStream(GPRSbeeClass &modem=gprsbee);
+
+  bool connect(const char *apn, const char *server, int port);
+  bool connect(const char *apn, const char *apnuser, const char *apnpwd,
+      const char *server, int port);
+  void stop();
+  bool connected() const { return _open && !_peerClosed; }
+  void setFlushThreshold(size_t threshold);
+
+  int available();
+  int read();
+  int peek();
+  void flush();
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  using Print::write;
+
+  // Binary messages, framed with a 16 bits length (big endian)
+  bool writeFrame(const uint8_t *data, uint16_t size);
+  int readFrame(uint8_t *buffer, size_t size, uint32_t timeout=4000);
+
+  // Statistics, e.g. to check the write coalescing
+  uint32_t getNrBytesWritten() const { return _nrBytes; }
+  uint32_t getNrUARTWrites() const { return _nrUARTWrites; }
+
+private:
+  bool fillRx();
+  void releaseRx();
+  bool readBlock(uint8_t *buffer, size_t size, size_t skip, uint32_t ts_max);
+  void writeUART(const uint8_t *data, size_t size);
+
+  GPRSbeeClass *_modem;
+  Stream *_uart;
+  uint8_t _txBuf[GPRSBEE_TCP_TX_BUFFER_SIZE];
+  size_t _txCnt;
+  size_t _threshold;
+  bool _open;
+  bool _peerClosed;
+  uint8_t _rxBuf[10];           // received data, the length of "\r\nCLOSED\r\n"
+  uint8_t _rxHead;
+  uint8_t _rxCnt;
+  uint8_t _rxMatch;             // the bytes of "\r\nCLOSED\r\n" seen so far, held back
+  uint32_t _rxMatchAt;          // when the last of them came
+  uint32_t _nrBytes;
+  uint32_t _nrUARTWrites;
+};
+
+#endif /* GPRSBEETCPSTREAM_H_ */
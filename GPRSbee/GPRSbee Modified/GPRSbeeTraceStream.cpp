@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include "GPRSbeeTraceStream.h"
+
+GPRSbeeTraceStream::GPRSbeeTraceStream(Stream &stream)
+{
+  _stream = &stream;
+  _trace = 0;
+  _traceSize = 0;
+  _traceLen = 0;
+  _traceLost = 0;
+  _dir = 0;
+  _lastTs = 0;
+  reset();
+}
+
+/*!
+ * \brief Start recording the trace in the buffer, or stop if it is NULL
+ */
+void GPRSbeeTraceStream::setTrace(char *buffer, size_t size)
+{
+  _trace = buffer;
+  _traceSize = buffer ? size : 0;
+  _traceLen = 0;
+  _traceLost = 0;
+  _dir = 0;
+}
+
+/*!
+ * \brief Write the recorded trace and empty the buffer
+ */
+void GPRSbeeTraceStream::printTrace(Print &out)
+{
+  out.write((const uint8_t *)_trace, _traceLen);
+  if (_dir) {
+    out.println();
+  }
+  if (_traceLost > 0) {
+    out.print(F("; trace buffer full, lost "));
+    out.print(_traceLost);
+    out.println(F(" bytes"));
+  }
+  _traceLen = 0;
+  _traceLost = 0;
+  _dir = 0;
+}
+
+int GPRSbeeTraceStream::read()
+{
+  int c = _stream->read();
+  if (c >= 0) {
+    ++_nrBytesReceived;
+    trace('<', c);
+  }
+  return c;
+}
+
+size_t GPRSbeeTraceStream::write(uint8_t c)
+{
+  size_t n = _stream->write(c);
+  if (n > 0) {
+    ++_nrBytesSent;
+    trace('>', c);
+  }
+  return n;
+}
+
+void GPRSbeeTraceStream::traceAdd(const char *str, size_t len)
+{
+  if (_traceLost > 0 || _traceLen + len > _traceSize) {
+    // Once something is lost the rest of the trace is useless
+    _traceLost += len;
+    return;
+  }
+  memcpy(_trace + _traceLen, str, len);
+  _traceLen += len;
+}
+
+void GPRSbeeTraceStream::trace(char dir, uint8_t c)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  char buf[16];
+
+  if (!_trace) {
+    return;
+  }
+  uint32_t ts = millis();
+  if (dir != _dir || ts - _lastTs > GPRSBEE_TRACE_PAUSE) {
+    if (_dir) {
+      traceAdd("\r\n", 2);
+    }
+    // The timestamp, the direction and a space
+    char *ptr = &buf[sizeof(buf)];
+    *--ptr = ' ';
+    *--ptr = dir;
+    *--ptr = ' ';
+    do {
+      *--ptr = '0' + ts % 10;
+      ts /= 10;
+    } while (ts > 0);
+    traceAdd(ptr, &buf[sizeof(buf)] - ptr);
+    _dir = dir;
+  }
+  _lastTs = millis();
+
+  switch (c) {
+  case '\r':
+    traceAdd("\\r", 2);
+    break;
+  case '\n':
+    traceAdd("\\n", 2);
+    break;
+  case '\\':
+    traceAdd("\\\\", 2);
+    break;
+  default:
+    if (c >= ' ' && c < 0x7F) {
+      buf[0] = c;
+      traceAdd(buf, 1);
+    } else {
+      buf[0] = '\\';
+      buf[1] = 'x';
+      buf[2] = hex[c >> 4];
+      buf[3] = hex[c & 0xF];
+      traceAdd(buf, 4);
+    }
+    break;
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef GPRSBEETRACESTREAM_H_
+#define GPRSBEETRACESTREAM_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <Arduino.h>
+#include <Stream.h>
+
+/*
+ * A new trace line is started after a pause of this many milliseconds, so
+ * that a replay can reproduce the time it took the SIMx00 to answer.
+ */
+#define GPRSBEE_TRACE_PAUSE     20
+
+/*!
+ * \brief A Stream between GPRSbeeClass and the UART that counts and records
+ *
+ * Pass it to gprsbee.init() instead of the UART itself. It counts the bytes
+ * in both directions and, with setTrace(), records the conversation with
+ * timestamps so it can be replayed by the modem emulator (see host/). Each
+ * change of direction, or a pause, starts a new trace line
+ *   <millis> > <bytes sent>
+ *   <millis> < <bytes received>
+ * where CR, LF, backslash and other non printable bytes are written as
+ * \r, \n, \\ and \xNN.
+ *
+ * The trace goes into a RAM buffer, printing it while the modem talks would
+ * change the timing that is being recorded. Call printTrace() when the
+ * transaction is done. What doesn't fit in the buffer is lost, and
+ * printTrace() says so.
+ */
+class GPRSbeeTraceStream : public Stream
+{
+public:
+  GPRSbeeTraceStream(Stream &stream);
+
+  void setTrace(char *buffer, size_t size);
+  void printTrace(Print &out);
+  void reset() { _nrBytesSent = 0; _nrBytesReceived = 0; }
+  uint32_t getNrBytesSent() const { return _nrBytesSent; }
+  uint32_t getNrBytesReceived() const { return _nrBytesReceived; }
+
+  int available() { return _stream->available(); }
+  int read();
+  int peek() { return _stream->peek(); }
+  void flush() { _stream->flush(); }
+  size_t write(uint8_t c);
+  using Print::write;
+
+private:
+  void trace(char dir, uint8_t c);
+  void traceAdd(const char *str, size_t len);
+
+  Stream *_stream;
+  char *_trace;
+  size_t _traceSize;
+  size_t _traceLen;
+  uint32_t _traceLost;          // the number of bytes that didn't fit
+  char _dir;                    // the direction of the current trace line, 0 if none
+  uint32_t _lastTs;             // millis() of the last byte in the trace
+  uint32_t _nrBytesSent;
+  uint32_t _nrBytesReceived;
+};
+
+#endif /* GPRSBEETRACESTREAM_H_ */
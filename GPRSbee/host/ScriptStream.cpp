@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "ScriptStream.h"
+
+void ScriptStream::inject(uint32_t ms, const std::string &text)
+{
+  put(hostNanos() + (uint64_t)ms * 1000000, text);
+}
+
+void ScriptStream::expect(const std::string &cmd, uint32_t ms, const std::string &reply)
+{
+  Step step;
+  step.cmd = cmd;
+  _script.push_back(step);
+  thenReply(ms, reply);
+}
+
+void ScriptStream::thenReply(uint32_t ms, const std::string &reply)
+{
+  Reply r;
+  r.ms = ms;
+  r.text = reply;
+  _script.back().replies.push_back(r);
+}
+
+void ScriptStream::clear()
+{
+  _line.clear();
+  _script.clear();
+  _rx.clear();
+  _commands.clear();
+  _mismatches.clear();
+}
+
+/*
+ * The bytes are kept in time order, the line can't pass bytes that are
+ * already on it
+ */
+void ScriptStream::put(uint64_t at, const std::string &text)
+{
+  std::deque<std::pair<uint64_t, uint8_t> >::iterator it = _rx.end();
+  while (it != _rx.begin() && (it - 1)->first > at) {
+    --it;
+  }
+  for (size_t i = 0; i < text.size(); ++i) {
+    it = _rx.insert(it, std::make_pair(at, (uint8_t)text[i])) + 1;
+  }
+}
+
+int ScriptStream::available()
+{
+  int nr = 0;
+  for (size_t i = 0; i < _rx.size() && _rx[i].first <= hostNanos(); ++i) {
+    ++nr;
+  }
+  if (nr == 0) {
+    hostIdle();
+  }
+  return nr;
+}
+
+int ScriptStream::read()
+{
+  if (_rx.empty() || _rx.front().first > hostNanos()) {
+    hostIdle();
+    return -1;
+  }
+  int c = _rx.front().second;
+  _rx.pop_front();
+  return c;
+}
+
+int ScriptStream::peek()
+{
+  if (_rx.empty() || _rx.front().first > hostNanos()) {
+    hostIdle();
+    return -1;
+  }
+  return _rx.front().second;
+}
+
+size_t ScriptStream::write(uint8_t c)
+{
+  if (_echo) {
+    put(hostNanos(), std::string(1, c));
+  }
+  if (c != '\r') {
+    if (c != '\n') {
+      _line += c;
+    }
+    return 1;
+  }
+
+  std::string cmd = _line;
+  _line.clear();
+  _commands.push_back(cmd);
+  if (_script.empty() || _script.front().cmd != cmd) {
+    _mismatches.push_back(cmd);
+    return 1;
+  }
+  const Step &step = _script.front();
+  for (size_t i = 0; i < step.replies.size(); ++i) {
+    inject(step.replies[i].ms, step.replies[i].text);
+  }
+  _script.pop_front();
+  return 1;
+}
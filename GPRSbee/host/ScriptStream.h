@@ -0,0 +1,92 @@
+#ifndef SCRIPTSTREAM_H_
+#define SCRIPTSTREAM_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <Arduino.h>
+#include <Stream.h>
+
+/*!
+ * \brief A fake SIMx00 UART that plays a script, for tests of the line handling
+ *
+ * Unlike SimModem it knows no commands. A test says which command it
+ * expects next and what comes back, in pieces at chosen times, and it can
+ * put any text on the line at any time, e.g. a URC in the middle of a
+ * reply or a line that stops halfway. Time is the simulated clock of the
+ * host Arduino core; a read that finds nothing advances it with
+ * hostIdle().
+ *
+ * A command that isn't the expected one is recorded as a mismatch and
+ * gets no answer.
+ */
+class ScriptStream : public Stream
+{
+public:
+  ScriptStream() : _echo(false) {}
+
+  void setEcho(bool echo) { _echo = echo; }
+  // Put the text on the line, ms from now
+  void inject(uint32_t ms, const std::string &text);
+  // When the command (without the CR) has been written, put the reply on
+  // the line after ms. More replies to the same command can follow with
+  // thenReply(), their ms also count from the command.
+  void expect(const std::string &cmd, uint32_t ms, const std::string &reply);
+  void thenReply(uint32_t ms, const std::string &reply);
+
+  bool isDone() const { return _script.empty(); }
+  const std::vector<std::string> &getCommands() const { return _commands; }
+  const std::vector<std::string> &getMismatches() const { return _mismatches; }
+  // The bytes on the line, also the ones that are not there yet
+  size_t getPending() const { return _rx.size(); }
+  void clear();
+
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t c);
+  using Print::write;
+
+private:
+  struct Reply
+  {
+    uint32_t ms;
+    std::string text;
+  };
+  struct Step
+  {
+    std::string cmd;
+    std::vector<Reply> replies;
+  };
+
+  void put(uint64_t at, const std::string &text);
+
+  bool _echo;
+  std::string _line;
+  std::deque<Step> _script;
+  std::deque<std::pair<uint64_t, uint8_t> > _rx;
+  std::vector<std::string> _commands;
+  std::vector<std::string> _mismatches;
+};
+
+#endif /* SCRIPTSTREAM_H_ */
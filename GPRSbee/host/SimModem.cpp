@@ -0,0 +1,1244 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <stdio.h>
+
+#include "SimModem.h"
+
+#define MAX_LINE        556     // the longest command line of the SIMx00
+#define CTRL_Z          0x1A
+#define ESC             0x1B
+#define ESCAPE_GUARD_MS 1000    // the guard time of "+++", the default of AT+CIPCCFG
+
+const SimProfile simSIM900 = {
+  "SIM900",
+  "SIM900 R11.0",
+  false,                        // "+HTTPACTION:0,200,5"
+  false,                        // needs AT+CGATT=1
+  1000,                         // keyMs
+  2200,                         // statusMs
+  3000,                         // bootMs
+  1700,                         // powerDownMs
+  6000,                         // registerMs
+  1500,                         // attachMs
+  1200,                         // cfunOffMs
+  400,                          // cfunOnMs
+  50,                           // wakeMs
+  20,                           // cmdMs
+  1800,                         // bearerMs
+  1500,                         // ciicrMs
+  300,                          // shutMs
+  1500,                         // connectMs
+  400,                          // sendMs
+  2500,                         // httpActionMs
+  3000,                         // ftpOpenMs
+  800,                          // ftpChunkMs
+  1500,                         // ftpCloseMs
+  3000,                         // smsMs
+  1360,                         // ftpMaxLength
+};
+
+const SimProfile simSIM800 = {
+  "SIM800",
+  "SIM800 R14.18",
+  true,                         // "+HTTPACTION: 0,200,5"
+  true,                         // attaches by itself
+  1000,                         // keyMs
+  1600,                         // statusMs
+  2500,                         // bootMs
+  1500,                         // powerDownMs
+  5000,                         // registerMs
+  3000,                         // attachMs
+  1000,                         // cfunOffMs
+  300,                          // cfunOnMs
+  50,                           // wakeMs
+  20,                           // cmdMs
+  1500,                         // bearerMs
+  1200,                         // ciicrMs
+  250,                          // shutMs
+  1200,                         // connectMs
+  350,                          // sendMs
+  2000,                         // httpActionMs
+  2500,                         // ftpOpenMs
+  700,                          // ftpChunkMs
+  1200,                         // ftpCloseMs
+  2500,                         // smsMs
+  1360,                         // ftpMaxLength
+};
+
+static std::string toString(unsigned long value)
+{
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%lu", value);
+  return buf;
+}
+
+static std::string escape(const std::string &data)
+{
+  std::string str;
+  for (size_t i = 0; i < data.size(); ++i) {
+    uint8_t c = data[i];
+    if (c == '\r') {
+      str += "\\r";
+    } else if (c == '\n') {
+      str += "\\n";
+    } else if (c == '\\') {
+      str += "\\\\";
+    } else if (c >= ' ' && c < 0x7F) {
+      str += c;
+    } else {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\x%02X", c);
+      str += buf;
+    }
+  }
+  return str;
+}
+
+static std::string unescape(const char *ptr)
+{
+  std::string data;
+  while (*ptr) {
+    if (*ptr != '\\' || ptr[1] == '\0') {
+      data += *ptr++;
+      continue;
+    }
+    ++ptr;
+    switch (*ptr) {
+    case 'r':
+      data += '\r';
+      ++ptr;
+      break;
+    case 'n':
+      data += '\n';
+      ++ptr;
+      break;
+    case 'x':
+      if (isxdigit(ptr[1]) && isxdigit(ptr[2])) {
+        char hex[3] = { ptr[1], ptr[2], '\0' };
+        data += (char)strtoul(hex, NULL, 16);
+        ptr += 3;
+        break;
+      }
+      data += *ptr++;
+      break;
+    default:
+      data += *ptr++;
+      break;
+    }
+  }
+  return data;
+}
+
+/*
+ * Split the parameters of a command at the commas, without the quotes
+ */
+static std::vector<std::string> splitParams(const std::string &params)
+{
+  std::vector<std::string> list;
+  std::string param;
+  bool quoted = false;
+  for (size_t i = 0; i < params.size(); ++i) {
+    char c = params[i];
+    if (c == '"') {
+      quoted = !quoted;
+    } else if (c == ',' && !quoted) {
+      list.push_back(param);
+      param.clear();
+    } else {
+      param += c;
+    }
+  }
+  if (!params.empty()) {
+    list.push_back(param);
+  }
+  return list;
+}
+
+static unsigned long intParam(const std::vector<std::string> &params, size_t ix, unsigned long dflt=0)
+{
+  if (ix >= params.size() || params[ix].empty()) {
+    return dflt;
+  }
+  return strtoul(params[ix].c_str(), NULL, 10);
+}
+
+SimModem::SimModem(const SimProfile &profile, uint32_t baud)
+{
+  _profile = &profile;
+  // 8N1, ten bits per byte
+  _byteNs = 10000000000ULL / baud;
+  _powerKeyPin = -1;
+  _supplyPin = -1;
+  _statusPin = -1;
+  _dtrPin = -1;
+  _keyDown = false;
+  _keyDone = false;
+  _keyDownAt = 0;
+  _dtrHigh = false;
+  _dtrLowAt = 0;
+  _powered = false;
+  _poweredAt = 0;
+  _offAt = 0;
+  _csq = 18;
+  _httpBodyLen = 220;
+  _httpStatus = 200;
+  _ftpAppend = false;
+  _ftpFileExists = false;
+  _ftpError = 0;
+  _linkLossLeft = 0;
+  _linkLost = false;
+  _txFree = 0;
+  _replaying = false;
+  _suppress = false;
+  _seg = 0;
+  _segOff = 0;
+  _nrPowerUps = 0;
+  _nrLinkLosses = 0;
+  _nrReceives = 0;
+  _cipMux = false;
+  _muxLinks = 0;
+  _promptLink = -1;
+  _nrCommands = 0;
+  _nrUnknown = 0;
+  powerDown();
+}
+
+void SimModem::setPins(int powerKeyPin, int supplyPin, int statusPin, int dtrPin)
+{
+  _powerKeyPin = powerKeyPin;
+  _supplyPin = supplyPin;
+  _statusPin = statusPin;
+  _dtrPin = dtrPin;
+  hostAttachDevice(this);
+}
+
+/*
+ * Let the time based things happen: the power key, a power down, and the
+ * replies that are due go into the receive buffer of the MCU
+ */
+void SimModem::update()
+{
+  uint64_t t = now();
+
+  if (_keyDown && !_keyDone && t - _keyDownAt >= ms(_profile->keyMs)) {
+    uint64_t at = _keyDownAt + ms(_profile->keyMs);
+    _keyDone = true;
+    if (!_powered) {
+      powerUp(at);
+    } else if (_offAt == 0) {
+      emit(at + ms(_profile->powerDownMs), "\r\nNORMAL POWER DOWN\r\n");
+      _offAt = at + ms(_profile->powerDownMs) + ms(100);
+    }
+  }
+
+  size_t nr = 0;
+  while (nr < _out.size() && _out[nr].at <= t) {
+    const Output &out = _out[nr++];
+    for (size_t i = 0; i < out.data.size(); ++i) {
+      _txFree = std::max(out.at, _txFree) + _byteNs;
+      _rx.push_back(std::make_pair(_txFree, (uint8_t)out.data[i]));
+    }
+  }
+  _out.erase(_out.begin(), _out.begin() + nr);
+
+  if (_dataUntil != 0 && t >= _dataUntil) {
+    // The DOWNLOAD window is over, the SIMx00 takes what it has
+    dataDone();
+  }
+
+  if (_offAt != 0 && t >= _offAt) {
+    powerDown();
+  }
+}
+
+void SimModem::powerUp(uint64_t at)
+{
+  _powered = true;
+  _poweredAt = at;
+  ++_nrPowerUps;
+  _offAt = 0;
+  _echo = true;
+  _csclk = 0;
+  _cregMode = 0;
+  _cgattAt = 0;
+  _bearerOpen = false;
+  _ipActive = false;
+  _tcpConnected = false;
+  _quickSend = false;
+  _cipMode = false;
+  _tcpSent = 0;
+  _escapePlus = 0;
+  _cipMux = false;
+  _muxLinks = 0;
+  _httpInit = false;
+  _ftpPut = false;
+  _inputKind = input_command;
+  _line.clear();
+  _cfun = 0;
+  radioOn(at + ms(_profile->bootMs));
+
+  uint64_t ready = at + ms(_profile->bootMs);
+  emit(ready, "\r\nRDY\r\n");
+  emit(ready, "\r\n+CFUN: 1\r\n");
+  emit(ready, "\r\n+CPIN: READY\r\n");
+}
+
+void SimModem::powerDown()
+{
+  _powered = false;
+  _offAt = 0;
+  _cfun = 0;
+  _csclk = 0;
+  _bearerOpen = false;
+  _ipActive = false;
+  _tcpConnected = false;
+  _muxLinks = 0;
+  _httpInit = false;
+  _ftpPut = false;
+  _inputKind = input_command;
+  _dataKind = data_none;
+  _dataLeft = 0;
+  _dataUntil = 0;
+  _dataLen = 0;
+  _linkLost = false;
+  _line.clear();
+  _out.clear();
+}
+
+bool SimModem::isAwake()
+{
+  update();
+  uint64_t t = now();
+  if (!_powered || t < _poweredAt + ms(_profile->bootMs)) {
+    return false;
+  }
+  if (_csclk == 1 && (_dtrHigh || t < _dtrLowAt + ms(_profile->wakeMs))) {
+    return false;
+  }
+  return true;
+}
+
+bool SimModem::isRegistered()
+{
+  return _powered && _cfun == 1 && now() >= registeredAt();
+}
+
+/*
+ * When it is (or will be) attached to GPRS. AT+CIICR and AT+SAPBR=1,1
+ * wait for this, they start the attach themselves if nobody did.
+ */
+uint64_t SimModem::attachedAt()
+{
+  if (_profile->autoAttach) {
+    return std::max(now(), registeredAt() + ms(_profile->attachMs));
+  }
+  if (_cgattAt == 0) {
+    _cgattAt = std::max(now(), registeredAt()) + ms(_profile->attachMs);
+  }
+  return std::max(now(), _cgattAt);
+}
+
+bool SimModem::isAttached()
+{
+  if (!isRegistered()) {
+    return false;
+  }
+  if (_profile->autoAttach) {
+    return now() >= registeredAt() + ms(_profile->attachMs);
+  }
+  return _cgattAt != 0 && now() >= _cgattAt;
+}
+
+void SimModem::radioOn(uint64_t at)
+{
+  _cfun = 1;
+  _radioOnAt = at;
+  emit(registeredAt(), "\r\nCall Ready\r\n", tag_radio);
+  emit(registeredAt(), "\r\nSMS Ready\r\n", tag_radio);
+  if (_cregMode == 1) {
+    emit(registeredAt(), "\r\n+CREG: 1\r\n", tag_creg);
+  }
+}
+
+void SimModem::radioOff()
+{
+  for (size_t i = 0; i < _out.size(); ) {
+    if (_out[i].tag == tag_radio || _out[i].tag == tag_creg) {
+      _out.erase(_out.begin() + i);
+    } else {
+      ++i;
+    }
+  }
+  _cgattAt = 0;
+  _bearerOpen = false;
+  _ipActive = false;
+  _tcpConnected = false;
+  _muxLinks = 0;
+}
+
+/*
+ * Schedule output of the model, unless the replies come from a trace
+ */
+void SimModem::emit(uint64_t at, const std::string &data, uint8_t tag)
+{
+  if (_replaying || _suppress) {
+    return;
+  }
+  emitRaw(at, data, tag);
+}
+
+void SimModem::emitRaw(uint64_t at, const std::string &data, uint8_t tag)
+{
+  Output out;
+  out.at = at;
+  out.data = data;
+  out.tag = tag;
+  std::vector<Output>::iterator it = _out.begin();
+  while (it != _out.end() && it->at <= at) {
+    ++it;
+  }
+  _out.insert(it, out);
+}
+
+void SimModem::reply(uint32_t delayMs, const std::string &data)
+{
+  emit(now() + ms(delayMs), "\r\n" + data + "\r\n");
+}
+
+/*
+ * The SIMCom specific replies of the SIM800 have a space after the colon
+ */
+std::string SimModem::prefix(const char *name) const
+{
+  return std::string(name) + (_profile->spaceAfterColon ? ": " : ":");
+}
+
+int SimModem::available()
+{
+  update();
+  int nr = 0;
+  for (size_t i = 0; i < _rx.size() && _rx[i].first <= now(); ++i) {
+    ++nr;
+  }
+  if (nr == 0) {
+    hostIdle();
+  }
+  return nr;
+}
+
+int SimModem::read()
+{
+  update();
+  if (_rx.empty() || _rx.front().first > now()) {
+    hostIdle();
+    return -1;
+  }
+  int c = _rx.front().second;
+  _rx.pop_front();
+  return c;
+}
+
+int SimModem::peek()
+{
+  update();
+  if (_rx.empty() || _rx.front().first > now()) {
+    hostIdle();
+    return -1;
+  }
+  return _rx.front().second;
+}
+
+size_t SimModem::write(uint8_t c)
+{
+  // The byte is on the wire
+  hostAdvance(_byteNs);
+  bool replayed = _replaying && replayByte(c);
+  if (isAwake()) {
+    // The trace has the answer to what it replayed
+    _suppress = replayed;
+    receive(c);
+    _suppress = false;
+  }
+  return 1;
+}
+
+void SimModem::pinWrite(uint8_t pin, uint8_t value)
+{
+  update();
+  if (pin == _powerKeyPin) {
+    if (value && !_keyDown) {
+      _keyDown = true;
+      _keyDone = false;
+      _keyDownAt = now();
+    } else if (!value) {
+      _keyDown = false;
+    }
+  }
+  if (pin == _supplyPin) {
+    if (value && !_powered) {
+      powerUp(now());
+    } else if (!value && _powered) {
+      powerDown();
+    }
+  }
+  if (pin == _dtrPin) {
+    if (value) {
+      _dtrHigh = true;
+    } else if (_dtrHigh) {
+      _dtrHigh = false;
+      _dtrLowAt = now();
+    }
+  }
+}
+
+int SimModem::pinRead(uint8_t pin)
+{
+  if (pin != _statusPin) {
+    return -1;
+  }
+  update();
+  return _powered && now() >= _poweredAt + ms(_profile->statusMs) ? HIGH : LOW;
+}
+
+void SimModem::receive(uint8_t c)
+{
+  switch (_inputKind) {
+  case input_command:
+    if (_echo) {
+      emit(now(), std::string(1, c));
+    }
+    if (c == '\r') {
+      std::string line = _line;
+      _line.clear();
+      command(line);
+    } else if (c == '\b') {
+      if (!_line.empty()) {
+        _line.erase(_line.size() - 1);
+      }
+    } else if (c != '\n' && _line.size() < MAX_LINE) {
+      _line += c;
+    }
+    break;
+  case input_count:
+    ++_dataLen;
+    if (_dataKind == data_tcp && _cipMux) {
+      _data += c;
+    } else if (_dataKind == data_ftp || _dataKind == data_http) {
+      if (_linkLossLeft > 0 && --_linkLossLeft == 0) {
+        _linkLost = true;
+        ++_nrLinkLosses;
+      }
+      if (!_linkLost) {
+        _data += c;
+      }
+    }
+    if (--_dataLeft == 0) {
+      dataDone();
+    }
+    break;
+  case input_transparent:
+    transparent(c);
+    break;
+  case input_ctrlz:
+    if (c == CTRL_Z) {
+      dataDone();
+    } else if (c == ESC) {
+      _inputKind = input_command;
+      _dataKind = data_none;
+    } else {
+      ++_dataLen;
+    }
+    break;
+  }
+}
+
+void SimModem::command(const std::string &line)
+{
+  const SimProfile &p = *_profile;
+  size_t start = line.find_first_not_of(' ');
+  if (start == std::string::npos || line.size() < start + 2 ||
+      toupper(line[start]) != 'A' || toupper(line[start + 1]) != 'T') {
+    // Not a command, the SIMx00 ignores it
+    return;
+  }
+  ++_nrCommands;
+
+  std::string cmd = line.substr(start + 2);
+  size_t end = cmd.find_first_of("=?");
+  std::string name = cmd.substr(0, end);
+  for (size_t i = 0; i < name.size(); ++i) {
+    name[i] = toupper(name[i]);
+  }
+  bool query = end != std::string::npos && cmd[end] == '?';
+  bool set = end != std::string::npos && cmd[end] == '=' && (end + 1 >= cmd.size() || cmd[end + 1] != '?');
+  std::vector<std::string> params = set ? splitParams(cmd.substr(end + 1)) : std::vector<std::string>();
+
+  if (name == "") {
+    replyOK(p.cmdMs);
+  } else if (name == "E0" || name == "E1") {
+    _echo = name == "E1";
+    replyOK(p.cmdMs);
+  } else if (name == "I") {
+    reply(p.cmdMs, std::string(p.ati) + "\r\n\r\nOK");
+  } else if (name == "+GSN") {
+    reply(p.cmdMs, "861785005921311\r\n\r\nOK");
+  } else if (name == "+CIMI") {
+    reply(p.cmdMs, "204080123456789\r\n\r\nOK");
+  } else if (name == "+GCAP") {
+    reply(p.cmdMs, "+GCAP: +CGSM,+FCLASS,+DS\r\n\r\nOK");
+  } else if (name == "+CPIN" && query) {
+    reply(p.cmdMs, "+CPIN: READY\r\n\r\nOK");
+  } else if (name == "+CSQ") {
+    bool radio = _cfun == 1 && now() >= _radioOnAt;
+    reply(p.cmdMs, "+CSQ: " + toString(radio ? _csq : 99) + ",0\r\n\r\nOK");
+  } else if (name == "+CREG" && query) {
+    int stat = isRegistered() ? 1 : _cfun == 1 ? 2 : 0;
+    reply(p.cmdMs, "+CREG: " + toString(_cregMode) + "," + toString(stat) + "\r\n\r\nOK");
+  } else if (name == "+CREG" && set) {
+    _cregMode = intParam(params, 0);
+    for (size_t i = 0; i < _out.size(); ) {
+      if (_out[i].tag == tag_creg) {
+        _out.erase(_out.begin() + i);
+      } else {
+        ++i;
+      }
+    }
+    if (_cregMode == 1 && _cfun == 1 && !isRegistered()) {
+      emit(registeredAt(), "\r\n+CREG: 1\r\n", tag_creg);
+    }
+    replyOK(p.cmdMs);
+  } else if (name == "+CGATT" && query) {
+    reply(p.cmdMs, std::string("+CGATT: ") + (isAttached() ? "1" : "0") + "\r\n\r\nOK");
+  } else if (name == "+CGATT" && set) {
+    if (_cfun != 1 || intParam(params, 0) != 1) {
+      replyError(p.cmdMs);
+    } else {
+      emit(attachedAt() + ms(p.cmdMs), "\r\nOK\r\n");
+    }
+  } else if (name == "+CFUN" && query) {
+    reply(p.cmdMs, "+CFUN: " + toString(_cfun) + "\r\n\r\nOK");
+  } else if (name == "+CFUN" && set) {
+    uint8_t fun = intParam(params, 0);
+    if (fun == 1) {
+      if (_cfun != 1) {
+        radioOn(now() + ms(p.cfunOnMs));
+        replyOK(p.cfunOnMs);
+      } else {
+        replyOK(p.cmdMs);
+      }
+    } else if (fun == 0 || fun == 4) {
+      if (_cfun == 1) {
+        radioOff();
+        if (_cregMode == 1) {
+          reply(p.cfunOffMs, "+CREG: 0");
+        }
+      }
+      _cfun = fun;
+      replyOK(p.cfunOffMs);
+    } else {
+      replyError(p.cmdMs);
+    }
+  } else if (name == "+CSCLK" && set) {
+    _csclk = intParam(params, 0);
+    replyOK(p.cmdMs);
+  } else if (name == "+COPS" && query) {
+    reply(p.cmdMs, std::string(isRegistered() ? "+COPS: 0,0,\"NL KPN\"" : "+COPS: 0") + "\r\n\r\nOK");
+  } else if (name == "+CCLK" && query) {
+    reply(p.cmdMs, "+CCLK: \"16/10/01,12:00:00+08\"\r\n\r\nOK");
+  } else if (name == "+CIPMUX" && set) {
+    if (_ipActive) {
+      // Only in the state IP INITIAL
+      replyError(p.cmdMs);
+    } else {
+      _cipMux = intParam(params, 0) == 1;
+      replyOK(p.cmdMs);
+    }
+  } else if (name == "+CIPMODE" && set) {
+    _cipMode = intParam(params, 0) == 1;
+    replyOK(p.cmdMs);
+  } else if (name == "O0" || name == "O") {
+    if (_cipMode && _tcpConnected) {
+      reply(p.cmdMs, "CONNECT");
+      _inputKind = input_transparent;
+      _transLastRx = now();
+    } else {
+      reply(p.cmdMs, "NO CARRIER");
+    }
+  } else if (name == "+CCLK" || name == "+CLTS" || name == "+CIURC" || name == "+CMGF" ||
+      name == "+CIPMODE" || name == "+CIPCCFG" || name == "+CIPMUX" || name == "+CSTT" ||
+      name == "+FTPCID" || name == "+FTPSERV" || name == "+FTPPORT" || name == "+FTPUN" ||
+      name == "+FTPPW" || name == "+FTPPUTNAME" || name == "+FTPPUTPATH" ||
+      name == "+FTPGETNAME" || name == "+FTPGETPATH") {
+    replyOK(p.cmdMs);
+  } else if (name == "+SAPBR" && set) {
+    switch (intParam(params, 0)) {
+    case 0:
+      _bearerOpen = false;
+      replyOK(p.shutMs);
+      break;
+    case 1:
+      if (_bearerOpen || _cfun != 1) {
+        replyError(p.bearerMs);
+      } else {
+        // Like AT+CIICR it attaches first if it has to
+        _bearerOpen = true;
+        emit(attachedAt() + ms(p.bearerMs), "\r\nOK\r\n");
+      }
+      break;
+    case 2:
+      reply(p.cmdMs, std::string("+SAPBR: ") +
+          (_bearerOpen ? "1,1,\"10.64.12.34\"" : "1,3,\"0.0.0.0\"") + "\r\n\r\nOK");
+      break;
+    case 3:
+      replyOK(p.cmdMs);
+      break;
+    default:
+      replyError(p.cmdMs);
+      break;
+    }
+  } else if (name == "+CIICR") {
+    if (_cfun == 1) {
+      _ipActive = true;
+      emit(attachedAt() + ms(p.ciicrMs), "\r\nOK\r\n");
+    } else {
+      replyError(p.ciicrMs);
+    }
+  } else if (name == "+CIFSR") {
+    reply(p.cmdMs, _ipActive ? "10.64.12.35" : "ERROR");
+  } else if (name == "+CIPSHUT") {
+    _ipActive = false;
+    _tcpConnected = false;
+    _muxLinks = 0;
+    reply(p.shutMs, "SHUT OK");
+  } else if (name == "+CIPQSEND" && set) {
+    _quickSend = intParam(params, 0) == 1;
+    replyOK(p.cmdMs);
+  } else if (name == "+CIPSTART" && set && _cipMux) {
+    unsigned long link = intParam(params, 0, 99);
+    std::string n = toString(link) + ", ";
+    if (link >= 6) {
+      replyError(p.cmdMs);
+    } else if (_muxLinks & (1 << link)) {
+      replyOK(p.cmdMs);
+      reply(p.cmdMs, n + "ALREADY CONNECT");
+    } else if (!isAttached()) {
+      replyOK(p.cmdMs);
+      reply(p.connectMs, n + "CONNECT FAIL");
+    } else {
+      _ipActive = true;
+      _muxLinks |= 1 << link;
+      replyOK(p.cmdMs);
+      reply(p.connectMs, n + "CONNECT OK");
+    }
+  } else if (name == "+CIPSEND" && set && _cipMux) {
+    unsigned long link = intParam(params, 0, 99);
+    if (link >= 6 || !(_muxLinks & (1 << link))) {
+      replyError(p.cmdMs);
+    } else {
+      uint64_t at = now() + ms(p.cmdMs);
+      if (_promptLink >= 0) {
+        muxReceive(at, _promptLink, _promptData);
+        _promptLink = -1;
+      }
+      emit(at, "\r\n> ");
+      _dataKind = data_tcp;
+      _muxSendLink = link;
+      _data.clear();
+      _dataLen = 0;
+      _dataLeft = intParam(params, 1);
+      _inputKind = _dataLeft > 0 ? input_count : input_ctrlz;
+    }
+  } else if (name == "+CIPCLOSE" && _cipMux) {
+    unsigned long link = intParam(params, 0, 99);
+    if (link >= 6 || !(_muxLinks & (1 << link))) {
+      replyError(p.cmdMs);
+    } else {
+      _muxLinks &= ~(1 << link);
+      reply(p.cmdMs, toString(link) + ", CLOSE OK");
+    }
+  } else if (name == "+CIPSTART" && set) {
+    if (_tcpConnected) {
+      reply(p.cmdMs, "ERROR\r\n\r\nALREADY CONNECT");
+    } else if (!isAttached()) {
+      replyOK(p.cmdMs);
+      reply(p.connectMs, "CONNECT FAIL");
+    } else {
+      _ipActive = true;
+      _tcpConnected = true;
+      _tcpSent = 0;
+      replyOK(p.cmdMs);
+      if (_cipMode) {
+        // The UART is the connection from here on
+        reply(p.connectMs, "CONNECT");
+        _inputKind = input_transparent;
+        _transLastRx = now();
+        _escapePlus = 0;
+      } else {
+        reply(p.connectMs, "CONNECT OK");
+      }
+    }
+  } else if (name == "+CIPSEND") {
+    if (!_tcpConnected) {
+      replyError(p.cmdMs);
+    } else {
+      emit(now() + ms(p.cmdMs), "\r\n> ");
+      _dataKind = data_tcp;
+      _dataLen = 0;
+      _dataLeft = set ? intParam(params, 0) : 0;
+      _inputKind = _dataLeft > 0 ? input_count : input_ctrlz;
+    }
+  } else if (name == "+CIPCLOSE") {
+    _tcpConnected = false;
+    reply(p.cmdMs, "CLOSE OK");
+  } else if (name == "+CIPACK") {
+    reply(p.cmdMs, "+CIPACK: " + toString(_tcpSent) + "," + toString(_tcpSent) + ",0\r\n\r\nOK");
+  } else if (name == "+CIPSTATUS") {
+    const char *state = _tcpConnected ? "CONNECT OK" : _ipActive ? "IP GPRSACT" : "IP INITIAL";
+    reply(p.cmdMs, std::string("OK\r\n\r\nSTATE: ") + state);
+  } else if (name == "+HTTPINIT") {
+    if (_httpInit) {
+      replyError(p.cmdMs);
+    } else {
+      _httpInit = true;
+      _httpUserData.clear();
+      replyOK(p.cmdMs);
+    }
+  } else if (name == "+HTTPTERM") {
+    if (_httpInit) {
+      _httpInit = false;
+      replyOK(p.cmdMs);
+    } else {
+      replyError(p.cmdMs);
+    }
+  } else if (name == "+HTTPPARA" && set) {
+    if (_httpInit) {
+      if (params.size() > 1 && params[0] == "USERDATA") {
+        _httpUserData = params[1];
+      }
+      replyOK(p.cmdMs);
+    } else {
+      replyError(p.cmdMs);
+    }
+  } else if (name == "+HTTPDATA" && set) {
+    if (!_httpInit) {
+      replyError(p.cmdMs);
+    } else {
+      emit(now() + ms(p.cmdMs), "\r\nDOWNLOAD\r\n");
+      _dataKind = data_http;
+      _dataLen = 0;
+      _data.clear();
+      _dataLeft = intParam(params, 0);
+      _dataUntil = now() + ms(p.cmdMs) + ms(intParam(params, 1, 100000));
+      _inputKind = input_count;
+      if (_dataLeft == 0) {
+        dataDone();
+      }
+    }
+  } else if (name == "+HTTPACTION" && set) {
+    unsigned long method = intParam(params, 0);
+    if (!_httpInit || method > 2) {
+      replyError(p.cmdMs);
+    } else {
+      replyOK(p.cmdMs);
+      if (_bearerOpen && !_linkLost) {
+        if (method == 1 && _httpStatus / 100 == 2) {
+          httpUpload();
+        }
+        _httpReplyLen = method == 2 ? 0 : _httpBodyLen;
+        reply(p.httpActionMs, prefix("+HTTPACTION") + toString(method) + "," + toString(_httpStatus) +
+            "," + toString(_httpReplyLen));
+      } else {
+        // The body lost the link, or there is no bearer
+        _linkLost = false;
+        _httpReplyLen = 0;
+        reply(p.httpActionMs, prefix("+HTTPACTION") + toString(method) + ",601,0");
+      }
+    }
+  } else if (name == "+HTTPREAD") {
+    if (!_httpInit) {
+      replyError(p.cmdMs);
+    } else {
+      size_t from = intParam(params, 0);
+      size_t size = intParam(params, 1, _httpReplyLen);
+      if (from > _httpReplyLen) {
+        from = _httpReplyLen;
+      }
+      if (size > _httpReplyLen - from) {
+        size = _httpReplyLen - from;
+      }
+      reply(p.cmdMs, prefix("+HTTPREAD") + toString(size) + "\r\n" + httpBody(from, size) + "\r\nOK");
+    }
+  } else if (name == "+FTPPUTOPT" && set) {
+    _ftpAppend = params.size() > 0 && params[0] == "APPE";
+    replyOK(p.cmdMs);
+  } else if (name == "+FTPPUT" && set) {
+    unsigned long mode = intParam(params, 0);
+    unsigned long len = intParam(params, 1);
+    if (mode == 1) {
+      replyOK(p.cmdMs);
+      if (_bearerOpen) {
+        _ftpPut = true;
+        if (!_ftpAppend) {
+          _ftpFile.clear();
+        }
+        _ftpFileExists = true;
+        reply(p.ftpOpenMs, prefix("+FTPPUT") + "1,1," + toString(p.ftpMaxLength));
+      } else {
+        reply(p.ftpOpenMs, prefix("+FTPPUT") + "1,61");
+      }
+    } else if (mode == 2 && _ftpPut && len == 0) {
+      _ftpPut = false;
+      replyOK(p.cmdMs);
+      reply(p.ftpCloseMs, prefix("+FTPPUT") + "1,0");
+    } else if (mode == 2 && _ftpPut) {
+      if (len > p.ftpMaxLength) {
+        len = p.ftpMaxLength;
+      }
+      reply(p.cmdMs, prefix("+FTPPUT") + "2," + toString(len));
+      _dataKind = data_ftp;
+      _dataLen = 0;
+      _data.clear();
+      _dataLeft = len;
+      _inputKind = input_count;
+    } else {
+      replyError(p.cmdMs);
+    }
+  } else if (name == "+FTPSIZE") {
+    replyOK(p.cmdMs);
+    if (_bearerOpen && _ftpFileExists) {
+      reply(p.ftpOpenMs, prefix("+FTPSIZE") + "1,0," + toString(_ftpFile.size()));
+    } else if (_bearerOpen) {
+      // 77, operate error
+      reply(p.ftpOpenMs, prefix("+FTPSIZE") + "1,77");
+    } else {
+      reply(p.ftpOpenMs, prefix("+FTPSIZE") + "1,61");
+    }
+  } else if (name == "+CMGS" && set) {
+    if (!isRegistered()) {
+      reply(p.cmdMs, "+CMS ERROR: 331");
+    } else {
+      emit(now() + ms(p.cmdMs), "\r\n> ");
+      _dataKind = data_sms;
+      _dataLen = 0;
+      _inputKind = input_ctrlz;
+    }
+  } else {
+    ++_nrUnknown;
+    _lastUnknown = line;
+    replyError(p.cmdMs);
+  }
+}
+
+/*
+ * A byte in the data mode of a transparent connection
+ *
+ * A "+++" after a guard time of silence goes back to the command mode.
+ * The guard time after it isn't checked, the OK comes when it is over.
+ */
+void SimModem::transparent(uint8_t c)
+{
+  uint64_t t = now();
+  if (c == '+' && (_escapePlus > 0 || t - _transLastRx >= ms(ESCAPE_GUARD_MS))) {
+    _transLastRx = t;
+    if (++_escapePlus == 3) {
+      _escapePlus = 0;
+      _inputKind = input_command;
+      emit(t + ms(ESCAPE_GUARD_MS), "\r\nOK\r\n");
+    }
+    return;
+  }
+  // Not an escape after all
+  for (; _escapePlus > 0; --_escapePlus) {
+    toPeer('+');
+  }
+  toPeer(c);
+  _transLastRx = t;
+}
+
+/*
+ * A byte for the TCP peer, it echoes it. What it gets within a few
+ * milliseconds goes back in one packet.
+ */
+void SimModem::toPeer(uint8_t c)
+{
+  uint64_t at = now() + ms(_profile->sendMs);
+  ++_tcpSent;
+  if (!_out.empty() && _out.back().tag == tag_peer && at - _out.back().at < ms(10)) {
+    _out.back().data += (char)c;
+  } else {
+    emit(at, std::string(1, c), tag_peer);
+  }
+}
+
+void SimModem::closeTCPByPeer()
+{
+  update();
+  if (!_tcpConnected) {
+    return;
+  }
+  _tcpConnected = false;
+  if (_inputKind == input_transparent) {
+    _inputKind = input_command;
+    _escapePlus = 0;
+  }
+  // After the data that the peer sent before it closed
+  uint64_t at = now();
+  for (size_t i = 0; i < _out.size(); ++i) {
+    if (_out[i].tag == tag_peer && _out[i].at > at) {
+      at = _out[i].at;
+    }
+  }
+  emit(at, "\r\nCLOSED\r\n");
+}
+
+/*
+ * Data of the peer of a link, with AT+CIPMUX=1
+ */
+void SimModem::muxReceive(uint64_t at, uint8_t link, const std::string &data)
+{
+  if (!(_muxLinks & (1 << link)) || data.empty()) {
+    return;
+  }
+  ++_nrReceives;
+  emit(at, "\r\n+RECEIVE," + toString(link) + "," + toString(data.size()) + ":\r\n" + data);
+}
+
+void SimModem::peerSend(uint8_t link, const std::string &data, uint32_t ms)
+{
+  update();
+  muxReceive(now() + SimModem::ms(ms), link, data);
+}
+
+void SimModem::peerSendAtPrompt(uint8_t link, const std::string &data)
+{
+  _promptLink = link;
+  _promptData = data;
+}
+
+/*
+ * The data after a prompt (or a DOWNLOAD) is complete
+ */
+void SimModem::dataDone()
+{
+  const SimProfile &p = *_profile;
+  _inputKind = input_command;
+  _dataUntil = 0;
+  switch (_dataKind) {
+  case data_http:
+    _httpDataLen = _dataLen;
+    _httpData = _data;
+    replyOK(p.cmdMs);
+    break;
+  case data_ftp:
+    replyOK(p.cmdMs);
+    if (_linkLost) {
+      // What came before the loss is in the file
+      _ftpFile += _data;
+      _linkLost = false;
+      reply(p.ftpChunkMs, prefix("+FTPPUT") + "1,61");
+      _ftpPut = false;
+      break;
+    }
+    if (_ftpError) {
+      // The server gave up, the session is over
+      reply(p.ftpChunkMs, prefix("+FTPPUT") + "1," + toString(_ftpError));
+      _ftpPut = false;
+      _ftpError = 0;
+      break;
+    }
+    _ftpFile += _data;
+    reply(p.ftpChunkMs, prefix("+FTPPUT") + "1,1," + toString(p.ftpMaxLength));
+    break;
+  case data_tcp:
+    _tcpSent += _dataLen;
+    if (_cipMux) {
+      reply(p.sendMs, toString(_muxSendLink) + ", SEND OK");
+      // The echo takes the way back as well
+      muxReceive(now() + ms(2 * p.sendMs), _muxSendLink, _data);
+      _data.clear();
+      break;
+    }
+    reply(p.sendMs, _quickSend ? "DATA ACCEPT:" + toString(_dataLen) : std::string("SEND OK"));
+    break;
+  case data_sms:
+    reply(p.smsMs, "+CMGS: 17\r\n\r\nOK");
+    break;
+  default:
+    break;
+  }
+  _dataKind = data_none;
+}
+
+/*
+ * The server accepts the body of the POST. With a Content-Range header it
+ * goes at that offset, otherwise it is the whole upload. At offset 0 a new
+ * upload starts.
+ */
+void SimModem::httpUpload()
+{
+  unsigned long first = 0;
+  if (sscanf(_httpUserData.c_str(), "Content-Range: bytes %lu-", &first) != 1 || first == 0) {
+    _httpUpload.clear();
+  }
+  if (_httpUpload.size() < first + _httpData.size()) {
+    _httpUpload.resize(first + _httpData.size());
+  }
+  _httpUpload.replace(first, _httpData.size(), _httpData);
+}
+
+/*
+ * A body that is easy to check: each byte is its own offset modulo 64,
+ * mapped on a printable character
+ */
+std::string SimModem::httpBody(size_t start, size_t size) const
+{
+  static const char chars[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-_";
+  std::string body;
+  for (size_t i = 0; i < size; ++i) {
+    body += chars[(start + i) % 64];
+  }
+  return body;
+}
+
+/*!
+ * \brief Take the replies from a trace recorded by GPRSbeeTraceStream
+ *
+ * A trace file can hold several traces, each one after a line
+ *   # <section>
+ * Lines that don't start with a digit or a '#' are comments. Without a
+ * section the first trace in the file is used.
+ */
+bool SimModem::loadTrace(const char *path, const char *section)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return false;
+  }
+
+  std::vector<Segment> trace;
+  bool inSection = !section || !*section;
+  bool done = false;
+  std::string line;
+  int c;
+  do {
+    c = fgetc(fp);
+    if (c != EOF && c != '\n') {
+      line += (char)c;
+      continue;
+    }
+    while (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    if (!line.empty() && line[0] == '#') {
+      size_t pos = line.find_first_not_of("# ");
+      std::string label = pos == std::string::npos ? "" : line.substr(pos);
+      if (!section || !*section) {
+        done = !trace.empty();
+      } else {
+        inSection = label == section;
+        done = !inSection && !trace.empty();
+      }
+    } else if (inSection && !line.empty() && isdigit(line[0])) {
+      char *ptr;
+      Segment seg;
+      seg.ms = strtoul(line.c_str(), &ptr, 10);
+      if (ptr[0] == ' ' && (ptr[1] == '<' || ptr[1] == '>') && ptr[2] == ' ') {
+        seg.dir = ptr[1];
+        seg.data = unescape(ptr + 3);
+        if (!seg.data.empty()) {
+          trace.push_back(seg);
+        }
+      }
+    }
+    line.clear();
+  } while (c != EOF && !done);
+  fclose(fp);
+
+  if (trace.empty()) {
+    return false;
+  }
+  _trace = trace;
+  _seg = 0;
+  _segOff = 0;
+  _replayError.clear();
+  _replaying = true;
+  // Drop what the model still had to say
+  _out.clear();
+  replayReleaseReplies();
+  return true;
+}
+
+/*
+ * Compare a byte from the driver with the trace. Return true if it
+ * matched, then the trace gives the answer.
+ */
+bool SimModem::replayByte(uint8_t c)
+{
+  const Segment &seg = _trace[_seg];
+  if ((uint8_t)seg.data[_segOff] != c) {
+    replayDiverge("expected \"" + escape(seg.data.substr(_segOff, 20)) +
+        "\" but the driver sent \"" + escape(_line + (char)c) + "\"");
+    return false;
+  }
+  if (++_segOff >= seg.data.size()) {
+    _segOff = 0;
+    ++_seg;
+    replayReleaseReplies();
+  }
+  return true;
+}
+
+/*
+ * Schedule the recorded replies that come next in the trace
+ *
+ * The first one comes after the recorded delay since the end of what the
+ * driver sent, the ones after that keep their distance.
+ */
+void SimModem::replayReleaseReplies()
+{
+  uint64_t at = now();
+  if (_seg > 0 && _seg < _trace.size() && _trace[_seg].dir == '<') {
+    const Segment &sent = _trace[_seg - 1];
+    uint64_t sentEnd = ms(sent.ms) + sent.data.size() * _byteNs;
+    if (ms(_trace[_seg].ms) > sentEnd) {
+      at += ms(_trace[_seg].ms) - sentEnd;
+    }
+  }
+  for (size_t first = _seg; _seg < _trace.size() && _trace[_seg].dir == '<'; ++_seg) {
+    if (_seg > first && _trace[_seg].ms > _trace[_seg - 1].ms) {
+      at += ms(_trace[_seg].ms - _trace[_seg - 1].ms);
+    }
+    emitRaw(at, _trace[_seg].data);
+  }
+  if (_seg >= _trace.size()) {
+    // The end of the recording, the model takes over
+    _replaying = false;
+  }
+}
+
+void SimModem::replayDiverge(const std::string &why)
+{
+  char buf[40];
+  snprintf(buf, sizeof(buf), "trace segment %u (%u ms): ", (unsigned)_seg + 1, (unsigned)_trace[_seg].ms);
+  _replayError = buf + why;
+  _replaying = false;
+}
@@ -0,0 +1,295 @@
+#ifndef SIMMODEM_H_
+#define SIMMODEM_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <Arduino.h>
+#include <Stream.h>
+
+/*
+ * The timing and the quirks of one kind of SIMx00
+ *
+ * The times are rough figures from the SIMCom hardware design and AT
+ * command manuals and from watching a GPRSbee, not measurements. For real
+ * numbers record a trace on the device (testBenchmark with TRACE set) and
+ * replay it, see SimModem::loadTrace().
+ */
+struct SimProfile
+{
+  const char *name;
+  const char *ati;              // the reply to ATI, setProductId() looks at it
+  bool spaceAfterColon;         // "+HTTPACTION: 0,200,5" instead of "+HTTPACTION:0,200,5"
+  bool autoAttach;              // attaches to GPRS by itself after registration
+  uint32_t keyMs;               // how long the power key must be pressed
+  uint32_t statusMs;            // power on until the STATUS pin is high
+  uint32_t bootMs;              // power on until the UART works
+  uint32_t powerDownMs;         // power key until NORMAL POWER DOWN
+  uint32_t registerMs;          // radio on until registered to the network
+  uint32_t attachMs;            // registered (or AT+CGATT=1) until GPRS attached
+  uint32_t cfunOffMs;           // AT+CFUN=0 or 4 until OK
+  uint32_t cfunOnMs;            // AT+CFUN=1 until OK
+  uint32_t wakeMs;              // DTR low until the UART works again after AT+CSCLK=1
+  uint32_t cmdMs;               // a simple command until its reply
+  uint32_t bearerMs;            // AT+SAPBR=1,1 until OK
+  uint32_t ciicrMs;             // AT+CIICR until OK
+  uint32_t shutMs;              // AT+CIPSHUT until SHUT OK
+  uint32_t connectMs;           // AT+CIPSTART until CONNECT OK
+  uint32_t sendMs;              // TCP data until SEND OK (or DATA ACCEPT)
+  uint32_t httpActionMs;        // AT+HTTPACTION until +HTTPACTION
+  uint32_t ftpOpenMs;           // AT+FTPPUT=1 until +FTPPUT: 1,1,<maxlength>
+  uint32_t ftpChunkMs;          // FTP data until the next +FTPPUT: 1,1,<maxlength>
+  uint32_t ftpCloseMs;          // AT+FTPPUT=2,0 until +FTPPUT: 1,0
+  uint32_t smsMs;               // ctrl-Z until +CMGS
+  uint16_t ftpMaxLength;
+};
+
+extern const SimProfile simSIM900;
+extern const SimProfile simSIM800;
+
+/*!
+ * \brief An emulated SIM900 or SIM800, as seen through its UART and pins
+ *
+ * Give it to gprsbee.init() as the Stream, it drives the status pin and
+ * watches the power pins through hostAttachDevice(). Time is the
+ * simulated clock of the host Arduino core: a byte written to the modem
+ * takes the UART byte time, a reply comes after the delay of the profile
+ * and its bytes become available one UART byte time apart.
+ *
+ * The model keeps the state that the driver cares about: power, sleep,
+ * radio (CFUN), registration, GPRS attach, the bearer, the TCP/IP stack,
+ * the HTTP and FTP services and SMS. A command it doesn't know is
+ * answered with ERROR and counted. The TCP peer is an echo server, in
+ * transparent mode (AT+CIPMODE=1) the echo comes straight back on the UART.
+ * With AT+CIPMUX=1 there is an echo server behind each link, its data
+ * comes as "+RECEIVE,<n>,<len>:".
+ *
+ * With loadTrace() the replies come from a recorded trace instead, with
+ * the recorded delays. The bytes that the driver sends are compared with
+ * the recording. When they differ the replay stops and the model takes
+ * over; it has followed the whole conversation so it knows the state.
+ */
+class SimModem : public Stream, public HostDevice
+{
+public:
+  SimModem(const SimProfile &profile, uint32_t baud=57600);
+
+  // The power key is pressed while its pin is HIGH (the Bee DTR),
+  // the supply pin switches the power (the Mbili JP2 or the Ndogo VBAT).
+  void setPins(int powerKeyPin, int supplyPin, int statusPin, int dtrPin=-1);
+  void setSignalQuality(uint8_t csq) { _csq = csq; }
+  void setHTTPBodyLength(size_t len) { _httpBodyLen = len; }
+  // The status code of the server for the next HTTP actions, default 200
+  void setHTTPStatus(uint16_t status) { _httpStatus = status; }
+  // The network drops the bearer (PDP context), e.g. after a long idle time
+  void dropBearer() { update(); _bearerOpen = false; }
+  // The next FTP data chunk fails with "+FTPPUT: 1,<code>", e.g. 61 (net error)
+  void setFTPError(uint16_t code) { _ftpError = code; }
+  // The link is lost after this many more bytes of FTP or HTTP data: the
+  // bytes before it arrive, the rest of the chunk or body is lost
+  void setLinkLoss(uint32_t afterBytes) { _linkLossLeft = afterBytes; }
+  // The FTP server no longer has the file, AT+FTPSIZE fails
+  void removeFTPFile() { _ftpFile.clear(); _ftpFileExists = false; }
+  // The TCP peer closes the connection, "CLOSED" comes out, also in the
+  // data mode of a transparent connection
+  void closeTCPByPeer();
+  // With AT+CIPMUX=1: the peer of a link sends data, ms from now. The next
+  // one comes right before the "> " of the next AT+CIPSEND, of any link.
+  void peerSend(uint8_t link, const std::string &data, uint32_t ms);
+  void peerSendAtPrompt(uint8_t link, const std::string &data);
+  const SimProfile &getProfile() const { return *_profile; }
+
+  bool loadTrace(const char *path, const char *section);
+  bool isReplaying() const { return _replaying; }
+  bool hasDiverged() const { return !_replayError.empty(); }
+  const char *getReplayError() const { return _replayError.c_str(); }
+
+  bool isPowered() { update(); return _powered; }
+  bool isSleeping() { update(); return _powered && _csclk == 1 && _dtrHigh; }
+  uint8_t getFunctionality() { update(); return _cfun; }
+  uint32_t getNrPowerUps() const { return _nrPowerUps; }
+  uint32_t getNrCommands() const { return _nrCommands; }
+  uint32_t getNrUnknownCommands() const { return _nrUnknown; }
+  const char *getLastUnknownCommand() const { return _lastUnknown.c_str(); }
+  uint32_t getFTPFileSize() const { return _ftpFile.size(); }
+  const std::string &getFTPFile() const { return _ftpFile; }
+  // The bodies of the accepted POSTs, put together with their Content-Range
+  const std::string &getHTTPUpload() const { return _httpUpload; }
+  // The bytes the TCP peer got on this connection
+  uint32_t getTCPSent() const { return _tcpSent; }
+  uint32_t getNrReceives() const { return _nrReceives; }
+  uint32_t getNrLinkLosses() const { return _nrLinkLosses; }
+
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t c);
+  using Print::write;
+
+  void pinWrite(uint8_t pin, uint8_t value);
+  int pinRead(uint8_t pin);
+
+private:
+  enum inputKind {
+    input_command,
+    input_count,                // a fixed number of data bytes
+    input_ctrlz,                // data up to ctrl-Z, e.g. the SMS text
+    input_transparent,          // the data mode of AT+CIPMODE=1, the UART is the connection
+  };
+  enum dataKind {
+    data_none,
+    data_http,
+    data_ftp,
+    data_tcp,
+    data_sms,
+  };
+  enum tagKind {
+    tag_none,
+    tag_radio,                  // cancelled when the radio goes off
+    tag_creg,                   // also cancelled by AT+CREG=
+    tag_peer,                   // data of the TCP peer, more can be added to it
+  };
+  struct Output {
+    uint64_t at;
+    std::string data;
+    uint8_t tag;
+  };
+  struct Segment {
+    char dir;
+    uint32_t ms;
+    std::string data;
+  };
+
+  uint64_t now() const { return hostNanos(); }
+  static uint64_t ms(uint32_t ms) { return (uint64_t)ms * 1000000; }
+  void update();
+  void powerUp(uint64_t at);
+  void powerDown();
+  bool isAwake();
+  bool isRegistered();
+  bool isAttached();
+  uint64_t attachedAt();
+  uint64_t registeredAt() const { return _radioOnAt + ms(_profile->registerMs); }
+  void radioOff();
+  void radioOn(uint64_t at);
+
+  void emit(uint64_t at, const std::string &data, uint8_t tag=tag_none);
+  void emitRaw(uint64_t at, const std::string &data, uint8_t tag=tag_none);
+  void reply(uint32_t delayMs, const std::string &data);
+  void replyOK(uint32_t delayMs) { reply(delayMs, "OK"); }
+  void replyError(uint32_t delayMs) { reply(delayMs, "ERROR"); }
+  std::string prefix(const char *name) const;
+
+  void receive(uint8_t c);
+  void command(const std::string &line);
+  void dataDone();
+  void transparent(uint8_t c);
+  void toPeer(uint8_t c);
+  void muxReceive(uint64_t at, uint8_t link, const std::string &data);
+  void httpUpload();
+  std::string httpBody(size_t start, size_t size) const;
+
+  bool replayByte(uint8_t c);
+  void replayReleaseReplies();
+  void replayDiverge(const std::string &why);
+
+  const SimProfile *_profile;
+  uint64_t _byteNs;
+
+  int _powerKeyPin;
+  int _supplyPin;
+  int _statusPin;
+  int _dtrPin;
+  bool _keyDown;
+  bool _keyDone;                // this press has done its toggle
+  uint64_t _keyDownAt;
+  bool _dtrHigh;
+  uint64_t _dtrLowAt;
+
+  bool _powered;
+  uint64_t _poweredAt;
+  uint64_t _offAt;              // pending power down, 0 if none
+  bool _echo;
+  uint8_t _csclk;
+  uint8_t _cfun;
+  uint64_t _radioOnAt;
+  uint8_t _cregMode;
+  uint64_t _cgattAt;            // AT+CGATT=1 attached at, 0 if not
+  bool _bearerOpen;
+  bool _ipActive;
+  bool _tcpConnected;
+  bool _quickSend;
+  bool _cipMode;                // transparent mode
+  uint32_t _tcpSent;
+  uint64_t _transLastRx;        // the last byte in data mode, for the escape guard time
+  uint8_t _escapePlus;          // the '+' of a possible escape, held back
+  bool _cipMux;                 // AT+CIPMUX=1
+  uint8_t _muxLinks;            // the connected links, one bit each
+  uint8_t _muxSendLink;         // the link of the current AT+CIPSEND
+  int _promptLink;              // peerSendAtPrompt(), -1 if none
+  std::string _promptData;
+  bool _httpInit;
+  size_t _httpDataLen;          // the last body from HTTPDATA
+  std::string _httpData;
+  std::string _httpUserData;    // AT+HTTPPARA="USERDATA"
+  std::string _httpUpload;
+  size_t _httpReplyLen;         // the body of the last HTTPACTION
+  bool _ftpPut;
+  bool _ftpAppend;
+  std::string _ftpFile;
+  bool _ftpFileExists;
+  uint16_t _ftpError;
+  uint8_t _csq;
+  size_t _httpBodyLen;
+  uint16_t _httpStatus;
+
+  enum inputKind _inputKind;
+  enum dataKind _dataKind;
+  size_t _dataLeft;
+  uint64_t _dataUntil;           // the end of the DOWNLOAD window, 0 if none
+  size_t _dataLen;
+  std::string _data;            // the FTP or HTTP data, up to a link loss
+  uint32_t _linkLossLeft;       // 0 if no link loss is coming
+  bool _linkLost;               // in the current data
+  std::string _line;
+
+  std::vector<Output> _out;     // sorted by time
+  std::deque<std::pair<uint64_t, uint8_t> > _rx;
+  uint64_t _txFree;             // when the UART of the modem is free again
+
+  bool _replaying;
+  bool _suppress;               // the trace has the answer to this byte
+  std::vector<Segment> _trace;
+  size_t _seg;
+  size_t _segOff;
+  std::string _replayError;
+
+  uint32_t _nrPowerUps;
+  uint32_t _nrLinkLosses;
+  uint32_t _nrReceives;
+  uint32_t _nrCommands;
+  uint32_t _nrUnknown;
+  std::string _lastUnknown;
+};
+
+#endif /* SIMMODEM_H_ */
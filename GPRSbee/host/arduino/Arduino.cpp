@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+// How far the clock moves each time a stream is polled in vain
+#define IDLE_STEP_NS    100000
+
+Serial_ Serial;
+Serial_ Serial1;
+Serial_ SerialUSB(stdout);
+
+static uint64_t simNanos;
+static uint8_t pinValues[NUM_PINS];
+static HostDevice *device;
+
+uint64_t hostNanos()
+{
+  return simNanos;
+}
+
+void hostAdvance(uint64_t ns)
+{
+  simNanos += ns;
+}
+
+void hostIdle()
+{
+  simNanos += IDLE_STEP_NS;
+}
+
+void hostAttachDevice(HostDevice *dev)
+{
+  device = dev;
+}
+
+uint32_t millis()
+{
+  return simNanos / 1000000;
+}
+
+uint32_t micros()
+{
+  return simNanos / 1000;
+}
+
+void delay(uint32_t ms)
+{
+  simNanos += (uint64_t)ms * 1000000;
+}
+
+void delayMicroseconds(uint32_t us)
+{
+  simNanos += (uint64_t)us * 1000;
+}
+
+void yield()
+{
+}
+
+void noInterrupts()
+{
+}
+
+void interrupts()
+{
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (pin >= NUM_PINS) {
+    return;
+  }
+  pinValues[pin] = value ? HIGH : LOW;
+  if (device) {
+    device->pinWrite(pin, pinValues[pin]);
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  if (pin >= NUM_PINS) {
+    return LOW;
+  }
+  if (device) {
+    int value = device->pinRead(pin);
+    if (value >= 0) {
+      return value;
+    }
+  }
+  return pinValues[pin];
+}
+
+size_t Serial_::write(uint8_t c)
+{
+  if (_out) {
+    fputc(c, _out);
+  }
+  return 1;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size-- > 0) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::print(long value, int base)
+{
+  if (value < 0 && base == DEC) {
+    return print('-') + printNumber(-(unsigned long)value, base);
+  }
+  return printNumber(value, base);
+}
+
+size_t Print::print(double value, int digits)
+{
+  char buf[40];
+  snprintf(buf, sizeof(buf), "%.*f", digits, value);
+  return write(buf);
+}
+
+size_t Print::printNumber(unsigned long value, int base)
+{
+  char buf[8 * sizeof(long) + 1];
+  char *ptr = &buf[sizeof(buf) - 1];
+  *ptr = '\0';
+  if (base < 2) {
+    base = 10;
+  }
+  do {
+    char digit = value % base;
+    *--ptr = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value > 0);
+  return write(ptr);
+}
+
+int Stream::timedRead()
+{
+  uint32_t start = millis();
+  do {
+    int c = read();
+    if (c >= 0) {
+      return c;
+    }
+    hostIdle();
+  } while (millis() - start < _timeout);
+  return -1;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+  size_t count = 0;
+  while (count < length) {
+    int c = timedRead();
+    if (c < 0) {
+      break;
+    }
+    *buffer++ = (char)c;
+    ++count;
+  }
+  return count;
+}
+
+void String::toCharArray(char *buf, unsigned int size) const
+{
+  if (size == 0) {
+    return;
+  }
+  strncpy(buf, _str.c_str(), size - 1);
+  buf[size - 1] = '\0';
+}
+
+void String::fromLong(long value, unsigned char base)
+{
+  if (value < 0 && base == 10) {
+    fromULong(-(unsigned long)value, base);
+    _str.insert(0, 1, '-');
+  } else {
+    fromULong(value, base);
+  }
+}
+
+void String::fromULong(unsigned long value, unsigned char base)
+{
+  _str.clear();
+  do {
+    char digit = value % base;
+    _str.insert(0, 1, digit < 10 ? '0' + digit : 'a' + digit - 10);
+    value /= base;
+  } while (value > 0);
+}
@@ -0,0 +1,135 @@
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Just enough of the Arduino core to build the GPRSbee driver on Linux
+ *
+ * Time is simulated. millis() only moves when the program waits: delay(),
+ * a write to the emulated modem (the UART byte time) or a poll of a
+ * stream that has nothing to read (see hostIdle()). A wait of two minutes
+ * takes a fraction of a second.
+ *
+ * PROGMEM is ordinary memory, the _P functions are the plain ones.
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strchr_P strchr
+#define strstr_P strstr
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+
+#define HIGH            1
+#define LOW             0
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+
+// The SODAQ Autonomo pins used by the sketches
+#define BEE_VCC         30
+#define CTS             31
+#define DTR             32
+#define SS              33
+#define NUM_PINS        64
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+void noInterrupts();
+void interrupts();
+
+/*
+ * Host only: the simulated clock and the device behind the pins
+ */
+uint64_t hostNanos();
+void hostAdvance(uint64_t ns);
+void hostIdle();
+
+class HostDevice
+{
+public:
+  virtual ~HostDevice() {}
+  virtual void pinWrite(uint8_t pin, uint8_t value) = 0;
+  // Return -1 if the device doesn't drive the pin
+  virtual int pinRead(uint8_t pin) = 0;
+};
+void hostAttachDevice(HostDevice *device);
+
+#include "Print.h"
+#include "Stream.h"
+
+/*
+ * A serial port that isn't connected to anything, except SerialUSB which
+ * writes to stdout
+ */
+class Serial_ : public Stream
+{
+public:
+  Serial_(FILE *out=0) : _out(out) {}
+  void begin(unsigned long) {}
+  void end() {}
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+  size_t write(uint8_t c);
+  using Print::write;
+  // Like the USB CDC of the SAMD, one packet
+  int availableForWrite() { return 63; }
+  operator bool() { return true; }
+private:
+  FILE *_out;
+};
+
+extern Serial_ Serial;
+extern Serial_ Serial1;
+extern Serial_ SerialUSB;
+
+#endif /* HOST_ARDUINO_H_ */
@@ -0,0 +1,68 @@
+#ifndef HOST_PRINT_H_
+#define HOST_PRINT_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "WString.h"
+
+#define DEC             10
+#define HEX             16
+#define OCT             8
+#define BIN             2
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+  size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+  virtual void flush() {}
+  // The bytes that can be written without blocking, 0 if unknown
+  virtual int availableForWrite() { return 0; }
+
+  size_t print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char *>(str)); }
+  size_t print(const String &str) { return write(str.c_str()); }
+  size_t print(const char *str) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char value, int base=DEC) { return printNumber(value, base); }
+  size_t print(int value, int base=DEC) { return print((long)value, base); }
+  size_t print(unsigned int value, int base=DEC) { return printNumber(value, base); }
+  size_t print(long value, int base=DEC);
+  size_t print(unsigned long value, int base=DEC) { return printNumber(value, base); }
+  size_t print(double value, int digits=2);
+
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+  template <typename T> size_t println(T value, int base) { size_t n = print(value, base); return n + println(); }
+
+private:
+  size_t printNumber(unsigned long value, int base);
+};
+
+#endif /* HOST_PRINT_H_ */
@@ -0,0 +1,61 @@
+#ifndef HOST_WSTRING_H_
+#define HOST_WSTRING_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <stdint.h>
+
+/*
+ * The part of the Arduino String that the driver and the harness use
+ */
+class String
+{
+public:
+  String(const char *str="") : _str(str ? str : "") {}
+  String(char c) : _str(1, c) {}
+  String(int value, unsigned char base=10) { fromLong(value, base); }
+  String(unsigned int value, unsigned char base=10) { fromULong(value, base); }
+  String(long value, unsigned char base=10) { fromLong(value, base); }
+  String(unsigned long value, unsigned char base=10) { fromULong(value, base); }
+
+  const char *c_str() const { return _str.c_str(); }
+  unsigned int length() const { return _str.size(); }
+  char operator[](unsigned int index) const { return index < _str.size() ? _str[index] : 0; }
+
+  String & operator+=(const String &rhs) { _str += rhs._str; return *this; }
+  String & operator+=(const char *rhs) { _str += rhs; return *this; }
+  String & operator+=(char c) { _str += c; return *this; }
+  String & concat(const String &rhs) { return *this += rhs; }
+  friend String operator+(const String &lhs, const String &rhs) { String s(lhs); s += rhs; return s; }
+  friend String operator+(const String &lhs, const char *rhs) { String s(lhs); s += rhs; return s; }
+
+  bool operator==(const String &rhs) const { return _str == rhs._str; }
+  bool operator==(const char *rhs) const { return _str == rhs; }
+  void toCharArray(char *buf, unsigned int size) const;
+
+private:
+  void fromLong(long value, unsigned char base);
+  void fromULong(unsigned long value, unsigned char base);
+
+  std::string _str;
+};
+
+#endif /* HOST_WSTRING_H_ */
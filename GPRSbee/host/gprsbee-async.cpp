@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-async: the non-blocking command engine (submitCommand() and
+ * poll()) against a scripted UART
+ *
+ *   gprsbee-async [-v]
+ *     -v  show the diagnostics of the driver
+ * The tests:
+ *  - reply          a command with an intermediate reply and OK
+ *  - partial lines  the reply comes in pieces, a line ends with CR only
+ *                   and its LF comes with the next piece
+ *  - error          +CME ERROR completes the command
+ *  - timeout        no reply in time; the next command must go out and
+ *                   the late reply of the first may not complete it
+ *  - urc            a URC comes before the reply of a pending command
+ *  - echo           echo is on, the first line that is not the echo is
+ *                   the reply
+ *  - queue          a full queue, the commands go out in order, one with
+ *                   a callback
+ * In each test poll() is called every millisecond, like from loop(). No
+ * call may wait for the SIMx00: the simulated clock may not move more than
+ * GPRSBEE_MAX_POLL_US in one call. The exit status is 1 if a test failed.
+ */
+
+#include <Arduino.h>
+#include <unistd.h>
+#include <string>
+
+#include "GPRSbee.h"
+#include "ScriptStream.h"
+
+// The longest time one poll() may take, reading a few lines at most
+#define GPRSBEE_MAX_POLL_US     1000
+
+static ScriptStream script;
+static uint32_t maxPollUs;
+
+static uint16_t nrCMTI;
+static std::string lastCMTI;
+
+static int8_t callbackHandle;
+static GPRSbeeClass::cmdStatusKind callbackStatus;
+static std::string callbackReply;
+
+static void onCMTI(const char *line)
+{
+  ++nrCMTI;
+  lastCMTI = line;
+}
+
+static void onDone(int8_t handle, GPRSbeeClass::cmdStatusKind status, const char *reply)
+{
+  callbackHandle = handle;
+  callbackStatus = status;
+  callbackReply = reply;
+}
+
+static void pollOnce()
+{
+  uint64_t start = hostNanos();
+  gprsbee.poll();
+  uint32_t us = (hostNanos() - start) / 1000;
+  if (us > maxPollUs) {
+    maxPollUs = us;
+  }
+  delay(1);
+}
+
+/*
+ * Poll until the command is done, or for at most ms
+ */
+static GPRSbeeClass::cmdStatusKind pollUntilDone(int8_t handle, uint32_t ms)
+{
+  uint32_t start = millis();
+  while (!gprsbee.isCommandDone(handle) && millis() - start < ms) {
+    pollOnce();
+  }
+  return gprsbee.getCommandStatus(handle);
+}
+
+static void pollFor(uint32_t ms)
+{
+  uint32_t start = millis();
+  while (millis() - start < ms) {
+    pollOnce();
+  }
+}
+
+static bool finish(int8_t handle, bool ok)
+{
+  gprsbee.releaseCommand(handle);
+  return ok && script.isDone() && script.getMismatches().empty() && gprsbee.isCommandQueueIdle();
+}
+
+static bool testReply()
+{
+  script.expect("AT+CSQ", 100, "\r\n+CSQ: 18,0\r\n\r\nOK\r\n");
+  int8_t h = gprsbee.submitCommand("AT+CSQ", "+CSQ:");
+  bool ok = h >= 0 && gprsbee.getCommandStatus(h) == GPRSbeeClass::cmdstat_queued;
+  ok = ok && pollUntilDone(h, 1000) == GPRSbeeClass::cmdstat_ok;
+  ok = ok && strcmp(gprsbee.getCommandReply(h), "+CSQ: 18,0") == 0;
+  return finish(h, ok);
+}
+
+static bool testPartialLines()
+{
+  script.expect("AT+CSQ", 50, "\r\n+CS");
+  script.thenReply(300, "Q: 18");
+  script.thenReply(600, ",0\r");
+  script.thenReply(900, "\n\r\nOK\r");
+  script.thenReply(1200, "\n");
+  int8_t h = gprsbee.submitCommand("AT+CSQ", "+CSQ:");
+  uint32_t start = millis();
+  bool ok = pollUntilDone(h, 2000) == GPRSbeeClass::cmdstat_ok;
+  uint32_t ms = millis() - start;
+  ok = ok && ms >= 900 && ms < 1000;
+  ok = ok && strcmp(gprsbee.getCommandReply(h), "+CSQ: 18,0") == 0;
+  // The LF that comes last is not another line for the next command
+  pollFor(500);
+  return finish(h, ok);
+}
+
+static bool testError()
+{
+  script.expect("AT+CPIN?", 100, "\r\n+CME ERROR: 10\r\n");
+  int8_t h = gprsbee.submitCommand("AT+CPIN?", "+CPIN:");
+  bool ok = pollUntilDone(h, 1000) == GPRSbeeClass::cmdstat_error;
+  ok = ok && gprsbee.getCommandReply(h)[0] == '\0';
+  return finish(h, ok);
+}
+
+static bool testTimeout()
+{
+  script.expect("AT+COPS?", 2000, "\r\n+COPS: 0,0,\"late\"\r\n\r\nOK\r\n");
+  script.expect("AT+CSQ", 100, "\r\n+CSQ: 20,0\r\n\r\nOK\r\n");
+  int8_t h1 = gprsbee.submitCommand("AT+COPS?", "+COPS:", 500);
+  int8_t h2 = gprsbee.submitCommand("AT+CSQ", "+CSQ:");
+  uint32_t start = millis();
+  bool ok = pollUntilDone(h1, 1000) == GPRSbeeClass::cmdstat_timeout;
+  uint32_t ms = millis() - start;
+  ok = ok && ms >= 500 && ms < 600;
+  ok = ok && pollUntilDone(h2, 1000) == GPRSbeeClass::cmdstat_ok;
+  ok = ok && strcmp(gprsbee.getCommandReply(h2), "+CSQ: 20,0") == 0;
+  gprsbee.releaseCommand(h2);
+  // The late reply comes when nobody waits for it
+  pollFor(2000);
+  ok = ok && gprsbee.getCommandReply(h1)[0] == '\0';
+  return finish(h1, ok);
+}
+
+static bool testURC()
+{
+  nrCMTI = 0;
+  script.expect("AT+CSQ", 100, "\r\n+CMTI: \"SM\",3\r\n");
+  script.thenReply(200, "\r\n+CSQ: 18,0\r\n\r\nOK\r\n");
+  int8_t h = gprsbee.submitCommand("AT+CSQ", "+CSQ:");
+  bool ok = pollUntilDone(h, 1000) == GPRSbeeClass::cmdstat_ok;
+  ok = ok && strcmp(gprsbee.getCommandReply(h), "+CSQ: 18,0") == 0;
+  ok = ok && nrCMTI == 1 && lastCMTI == "+CMTI: \"SM\",3";
+  return finish(h, ok);
+}
+
+static bool testEcho()
+{
+  script.setEcho(true);
+  script.expect("AT+CGMR", 100, "\r\nRevision:1137B01SIM900M64_ST\r\n\r\nOK\r\n");
+  int8_t h = gprsbee.submitCommand("AT+CGMR");
+  bool ok = pollUntilDone(h, 1000) == GPRSbeeClass::cmdstat_ok;
+  ok = ok && strcmp(gprsbee.getCommandReply(h), "Revision:1137B01SIM900M64_ST") == 0;
+  script.setEcho(false);
+  return finish(h, ok);
+}
+
+static bool testQueue()
+{
+  static const char * const cmds[] = { "AT", "AT+CREG?", "AT+CGATT?", "AT+CSQ" };
+  int8_t h[GPRSBEE_CMD_QUEUE_SIZE];
+  script.expect(cmds[0], 50, "\r\nOK\r\n");
+  script.expect(cmds[1], 50, "\r\n+CREG: 0,1\r\n\r\nOK\r\n");
+  script.expect(cmds[2], 50, "\r\n+CGATT: 1\r\n\r\nOK\r\n");
+  script.expect(cmds[3], 50, "\r\n+CSQ: 18,0\r\n\r\nOK\r\n");
+  size_t nrBefore = script.getCommands().size();
+  callbackHandle = -1;
+  bool ok = true;
+  for (int i = 0; i < GPRSBEE_CMD_QUEUE_SIZE; ++i) {
+    h[i] = gprsbee.submitCommand(cmds[i], 0, 4000, i == GPRSBEE_CMD_QUEUE_SIZE - 1 ? onDone : 0);
+    ok = ok && h[i] >= 0;
+  }
+  ok = ok && gprsbee.submitCommand("AT+COPS?") == -1;
+  // Only one command at a time is on the line
+  pollOnce();
+  ok = ok && script.getCommands().size() - nrBefore == 1;
+  ok = ok && gprsbee.getCommandStatus(h[1]) == GPRSbeeClass::cmdstat_queued;
+  pollFor(300);
+  ok = ok && gprsbee.getCommandStatus(h[0]) == GPRSbeeClass::cmdstat_ok;
+  ok = ok && strcmp(gprsbee.getCommandReply(h[1]), "+CREG: 0,1") == 0;
+  ok = ok && strcmp(gprsbee.getCommandReply(h[2]), "+CGATT: 1") == 0;
+  ok = ok && callbackHandle == h[3] && callbackStatus == GPRSbeeClass::cmdstat_ok;
+  ok = ok && callbackReply == "+CSQ: 18,0";
+  // The slot with the callback is free again, the others after release
+  ok = ok && gprsbee.getCommandStatus(h[3]) == GPRSbeeClass::cmdstat_free;
+  for (int i = 0; i < GPRSBEE_CMD_QUEUE_SIZE - 1; ++i) {
+    gprsbee.releaseCommand(h[i]);
+    ok = ok && gprsbee.getCommandStatus(h[i]) == GPRSbeeClass::cmdstat_free;
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    ok = ok && script.getCommands()[nrBefore + i] == cmds[i];
+  }
+  return finish(-1, ok);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "v")) != -1) {
+    if (opt == 'v') {
+      gprsbee.setDiag(SerialUSB);
+    } else {
+      fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  gprsbee.init(script, CTS, DTR);
+  gprsbee.addURCHandler_P(PSTR("+CMTI:"), onCMTI);
+
+  printf("submitCommand/poll against a scripted UART\n");
+  printf("%-14s %-6s %12s\n", "", "result", "max poll us");
+
+  static const struct {
+    const char *label;
+    bool (*test)();
+  } tests[] = {
+    { "reply", testReply },
+    { "partial lines", testPartialLines },
+    { "error", testError },
+    { "timeout", testTimeout },
+    { "urc", testURC },
+    { "echo", testEcho },
+    { "queue", testQueue },
+  };
+  int status = 0;
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+    maxPollUs = 0;
+    bool ok = tests[i].test();
+    ok = ok && maxPollUs <= GPRSBEE_MAX_POLL_US;
+    printf("%-14s %-6s %12lu\n", tests[i].label, ok ? "ok" : "FAILED", (unsigned long)maxPollUs);
+    if (!script.getMismatches().empty()) {
+      printf("  unexpected command %s\n", script.getMismatches()[0].c_str());
+    }
+    if (!ok) {
+      status = 1;
+    }
+    script.clear();
+  }
+  return status;
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-bench: the transactions of testBenchmark, on Linux against an
+ * emulated SIM900 or SIM800
+ *
+ * Build it with make in this directory and run it like this
+ *   gprsbee-bench [-m sim900|sim800] [-k] [-r trace] [-w trace] [-v]
+ *     -m  the modem to emulate, default sim900
+ *     -k  switch the modem with the power key instead of the supply
+ *     -r  take the replies from a recorded trace, one section per
+ *         transaction, e.g. the output of testBenchmark with TRACE set
+ *     -w  record the traces of this run
+ *     -v  show the diagnostics of the driver
+ * For each transaction it reports the simulated time, the number of AT
+ * commands and the bytes on the wire. The exit status is 1 if a
+ * transaction failed or if the driver did not follow the replayed trace.
+ */
+
+#include <Arduino.h>
+#include <unistd.h>
+
+#include "GPRSbee.h"
+#include "GPRSbeeTraceStream.h"
+#include "SimModem.h"
+
+#define APN             "internet"
+#define TCP_SERVER      "example.com"
+#define TCP_PORT        8500
+#define FTP_SERVER      "ftp.example.com"
+#define FTP_USERNAME    "anonymous"
+#define FTP_PASSWORD    ""
+#define SMS_NUMBER      "+31612345678"
+
+static SimModem *sim;
+
+class FilePrint : public Print
+{
+public:
+  FilePrint(FILE *fp) : _fp(fp) {}
+  size_t write(uint8_t c) { fputc(c, _fp); return 1; }
+  using Print::write;
+private:
+  FILE *_fp;
+};
+
+static bool doHTTPGET()
+{
+  char buffer[256];
+  return gprsbee.doHTTPGET(APN, "http://httpbin.org/get", buffer, sizeof(buffer));
+}
+
+static bool doHTTPPOSTWithReply()
+{
+  char buffer[256];
+  return gprsbee.doHTTPPOSTWithReply(APN, "http://httpbin.org/post",
+      "Some payload data...", 20, buffer, sizeof(buffer));
+}
+
+static bool openTCP()
+{
+  if (!gprsbee.openTCP(APN, TCP_SERVER, TCP_PORT)) {
+    return false;
+  }
+  gprsbee.closeTCP();
+  return true;
+}
+
+static bool sendTCPquick()
+{
+  uint8_t data[512];
+  bool ok = true;
+  memset(data, 'x', sizeof(data));
+  gprsbee.setQuickSend(true);
+  if (!gprsbee.openTCP(APN, TCP_SERVER, TCP_PORT)) {
+    gprsbee.setQuickSend(false);
+    return false;
+  }
+  for (int i = 0; ok && i < 8; ++i) {
+    ok = gprsbee.sendDataTCP(data, sizeof(data));
+  }
+  ok = ok && gprsbee.waitForTCPAck();
+  gprsbee.closeTCP();
+  gprsbee.setQuickSend(false);
+  return ok;
+}
+
+static bool openFTP()
+{
+  if (!gprsbee.openFTP(APN, FTP_SERVER, FTP_USERNAME, FTP_PASSWORD)) {
+    return false;
+  }
+  return gprsbee.closeFTP();
+}
+
+static bool uploadFTP()
+{
+  uint8_t data[4000];
+  for (size_t i = 0; i < sizeof(data); ++i) {
+    data[i] = 'A' + i % 26;
+  }
+  if (!gprsbee.openFTP(APN, FTP_SERVER, FTP_USERNAME, FTP_PASSWORD)) {
+    return false;
+  }
+  bool ok = gprsbee.openFTPfile("bench.txt", "/") &&
+      gprsbee.sendFTPdata(data, sizeof(data)) &&
+      gprsbee.closeFTPfile();
+  gprsbee.closeFTP();
+  return ok;
+}
+
+/*
+ * The server fails the last chunk, sendFTPdata() doesn't wait for that
+ * but closeFTPfile() must report it. This one is ok if the upload fails.
+ */
+static bool uploadFTPerror()
+{
+  uint8_t data[4000];
+  memset(data, 'x', sizeof(data));
+  if (!gprsbee.openFTP(APN, FTP_SERVER, FTP_USERNAME, FTP_PASSWORD)) {
+    return false;
+  }
+  bool ok = gprsbee.openFTPfile("bench.txt", "/") &&
+      gprsbee.sendFTPdata(data, 2 * 1360);
+  if (ok) {
+    sim->setFTPError(61);
+    ok = gprsbee.sendFTPdata(data + 2 * 1360, sizeof(data) - 2 * 1360) &&
+        !gprsbee.closeFTPfile();
+  }
+  gprsbee.closeFTP();
+  return ok;
+}
+
+static bool sendSMS()
+{
+  return gprsbee.sendSMS(SMS_NUMBER, "GPRSbee benchmark");
+}
+
+static const struct {
+  const char *label;
+  bool (*run)();
+} transactions[] = {
+  { "doHTTPGET", doHTTPGET },
+  { "doHTTPPOSTWithReply", doHTTPPOSTWithReply },
+  { "openTCP + closeTCP", openTCP },
+  { "openTCP + 8 quick sends", sendTCPquick },
+  { "openFTP + closeFTP", openFTP },
+  { "openFTP + upload 4000", uploadFTP },
+  { "upload, last chunk fails", uploadFTPerror },
+  { "sendSMS", sendSMS },
+};
+
+static char traceBuffer[256 * 1024];
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-m sim900|sim800] [-k] [-r trace] [-w trace] [-v]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  const SimProfile *profile = &simSIM900;
+  bool powerKey = false;
+  const char *replay = 0;
+  const char *record = 0;
+  bool verbose = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:kr:w:v")) != -1) {
+    switch (opt) {
+    case 'm':
+      if (strcmp(optarg, "sim900") == 0) {
+        profile = &simSIM900;
+      } else if (strcmp(optarg, "sim800") == 0) {
+        profile = &simSIM800;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'k':
+      powerKey = true;
+      break;
+    case 'r':
+      replay = optarg;
+      break;
+    case 'w':
+      record = optarg;
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  SimModem modem(*profile);
+  sim = &modem;
+  GPRSbeeTraceStream traceStream(modem);
+  FILE *recordFp = 0;
+  if (record) {
+    recordFp = fopen(record, "w");
+    if (!recordFp) {
+      perror(record);
+      return 2;
+    }
+  }
+  FilePrint recordOut(recordFp ? recordFp : stdout);
+  if (recordFp) {
+    fprintf(recordFp, "; recorded by gprsbee-bench from the emulated %s, not from a real modem\n",
+        profile->name);
+  }
+
+  gprsbee.init(traceStream, CTS, DTR);
+  if (powerKey) {
+    modem.setPins(DTR, -1, CTS);
+  } else {
+    modem.setPins(-1, DTR, CTS);
+    gprsbee.setPowerSwitchedOnOff(true);
+  }
+  if (verbose) {
+    gprsbee.setDiag(SerialUSB);
+  }
+
+  printf("%s%s%s\n", profile->name, replay ? ", replay of " : "", replay ? replay : "");
+  printf("%-26s %-6s %8s %8s %8s %8s\n", "", "result", "sim ms", "AT cmds", "sent", "received");
+
+  int status = 0;
+  for (size_t i = 0; i < sizeof(transactions) / sizeof(transactions[0]); ++i) {
+    const char *label = transactions[i].label;
+    if (replay && !modem.loadTrace(replay, label)) {
+      printf("%-26s no trace\n", label);
+      continue;
+    }
+    if (recordFp) {
+      traceStream.setTrace(traceBuffer, sizeof(traceBuffer));
+    }
+    traceStream.reset();
+    uint32_t commands = gprsbee.getCommandCount();
+    uint32_t unknown = modem.getNrUnknownCommands();
+    uint32_t start = millis();
+
+    bool ok = transactions[i].run();
+
+    printf("%-26s %-6s %8lu %8lu %8lu %8lu\n", label, ok ? "ok" : "FAILED",
+        (unsigned long)(millis() - start),
+        (unsigned long)(gprsbee.getCommandCount() - commands),
+        (unsigned long)traceStream.getNrBytesSent(),
+        (unsigned long)traceStream.getNrBytesReceived());
+    if (modem.getNrUnknownCommands() != unknown) {
+      printf("  the emulator doesn't know %s\n", modem.getLastUnknownCommand());
+    }
+    if (replay && modem.hasDiverged()) {
+      printf("  replay stopped at %s\n", modem.getReplayError());
+      status = 1;
+    }
+    if (!ok) {
+      status = 1;
+    }
+    if (recordFp) {
+      recordOut.print(F("# "));
+      recordOut.println(label);
+      traceStream.printTrace(recordOut);
+      traceStream.setTrace(0, 0);
+    }
+    // Give the modem time to go quiet, like testBenchmark does
+    delay(60000);
+  }
+
+  if (recordFp) {
+    fclose(recordFp);
+  }
+  return status;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-diag: GPRSbeeDiagSink with outputs that are slow or stalled,
+ * during the doHTTPGET of testDiagSink against an emulated SIM900
+ *
+ *   gprsbee-diag [-m sim900|sim800]
+ * The output takes its bytes at a fixed rate into a 64 byte buffer, like
+ * a UART, or not at all, like a SerialUSB without a serial monitor. The
+ * tests:
+ *  - direct       the diagnostics go straight to a Stream, the reference
+ *  - 57600 baud   through the sink, drained by the idle handler; the
+ *                 output must get the same text, except a last partial
+ *                 line that stays in the ring
+ *  - 300 baud     slower than the diagnostics, the same text must come
+ *                 out later
+ *  - stalled      the output is full and has no room during the GET,
+ *                 drain() must write nothing and the ring must drop; when
+ *                 the output opens, the drop report must come first
+ * In no test may drain() write more than the output has room for. The
+ * exit status is 1 if a test failed.
+ */
+
+#include <Arduino.h>
+#include <unistd.h>
+#include <string>
+
+#include "GPRSbee.h"
+#include "GPRSbeeDiagSink.h"
+#include "SimModem.h"
+
+#define APN             "internet"
+#define OUT_BUFFER      64
+
+/*
+ * An output with a buffer of OUT_BUFFER bytes that empties at a fixed
+ * rate, 0 for never
+ */
+class SlowOutput : public Stream
+{
+public:
+  SlowOutput(uint32_t bytesPerSecond, bool full=false) :
+    _rate(bytesPerSecond), _level(full ? OUT_BUFFER : 0), _at(0), _nrOverruns(0) {}
+  size_t write(uint8_t c)
+  {
+    if (availableForWrite() <= 0) {
+      // A real port would block here
+      ++_nrOverruns;
+    }
+    ++_level;
+    _text += (char)c;
+    return 1;
+  }
+  using Print::write;
+  void setRate(uint32_t bytesPerSecond) { availableForWrite(); _rate = bytesPerSecond; }
+  int availableForWrite()
+  {
+    if (_rate) {
+      uint64_t gone = (hostNanos() - _at) * _rate / 1000000000ULL;
+      if (gone > 0) {
+        _level = gone >= _level ? 0 : _level - gone;
+        _at = hostNanos();
+      }
+    } else {
+      _at = hostNanos();
+    }
+    return _level >= OUT_BUFFER ? 0 : OUT_BUFFER - _level;
+  }
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+
+  const std::string &getText() const { return _text; }
+  uint32_t getNrOverruns() const { return _nrOverruns; }
+
+private:
+  uint32_t _rate;
+  uint32_t _level;
+  uint64_t _at;
+  uint32_t _nrOverruns;
+  std::string _text;
+};
+
+static GPRSbeeDiagSink *sink;
+static uint32_t nrDrains;
+
+static void drainDiag()
+{
+  sink->drain();
+  ++nrDrains;
+}
+
+static bool doHTTPGET()
+{
+  char buffer[256];
+  return gprsbee.doHTTPGET(APN, "http://httpbin.org/get", buffer, sizeof(buffer));
+}
+
+/*
+ * The GET through a sink into an output of the given rate, then drain
+ * for a minute like the loop() of testDiagSink
+ */
+static bool runSink(SlowOutput &out, GPRSbeeDiagSink &diag, uint32_t *dropped)
+{
+  sink = &diag;
+  nrDrains = 0;
+  gprsbee.setDiag(diag);
+  gprsbee.setIdleHandler(drainDiag);
+  bool ok = doHTTPGET();
+  gprsbee.setIdleHandler(0);
+  gprsbee.setDiag(0);
+  for (int i = 0; i < 6000; ++i) {
+    diag.drain();
+    delay(10);
+  }
+  *dropped = diag.getNrDropped();
+  return ok && nrDrains > 0 && out.getNrOverruns() == 0;
+}
+
+int main(int argc, char *argv[])
+{
+  const SimProfile *profile = &simSIM900;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:")) != -1) {
+    if (opt == 'm' && strcmp(optarg, "sim900") == 0) {
+      profile = &simSIM900;
+    } else if (opt == 'm' && strcmp(optarg, "sim800") == 0) {
+      profile = &simSIM800;
+    } else {
+      fprintf(stderr, "usage: %s [-m sim900|sim800]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  SimModem modem(*profile);
+  gprsbee.init(modem, CTS, DTR);
+  modem.setPins(-1, DTR, CTS);
+  gprsbee.setPowerSwitchedOnOff(true);
+
+  printf("%s, doHTTPGET with diagnostics\n", profile->name);
+  printf("%-12s %-6s %8s %8s %8s\n", "", "result", "diag", "output", "dropped");
+
+  // The first transaction also asks the product id, the rest is the same
+  int status = doHTTPGET() ? 0 : 1;
+  delay(60000);
+
+  SlowOutput direct(0);
+  gprsbee.setDiag(direct);
+  bool ok = doHTTPGET();
+  gprsbee.setDiag(0);
+  printf("%-12s %-6s %8lu %8lu %8d\n", "direct", ok ? "ok" : "FAILED",
+      (unsigned long)direct.getText().size(), (unsigned long)direct.getText().size(), 0);
+  if (!ok) {
+    status = 1;
+  }
+  delay(60000);
+
+  static const struct {
+    const char *label;
+    uint32_t rate;
+  } outputs[] = {
+    { "57600 baud", 5760 },
+    { "300 baud", 30 },
+    { "stalled", 0 },
+  };
+  for (size_t i = 0; i < sizeof(outputs) / sizeof(outputs[0]); ++i) {
+    SlowOutput out(outputs[i].rate, outputs[i].rate == 0);
+    GPRSbeeDiagSink diag(&out);
+    uint32_t dropped;
+    ok = runSink(out, diag, &dropped);
+    if (outputs[i].rate) {
+      ok = ok && dropped == 0 &&
+          direct.getText().compare(0, out.getText().size(), out.getText()) == 0 &&
+          out.getText().size() + diag.getPending() == direct.getText().size();
+    } else {
+      ok = ok && dropped > 0 && out.getText().empty();
+      out.setRate(5760);
+      for (int n = 0; n < 100; ++n) {
+        diag.drain();
+        delay(10);
+      }
+      ok = ok && out.getText().compare(0, 16, "\r\n[diag dropped ") == 0;
+    }
+    printf("%-12s %-6s %8lu %8lu %8lu\n", outputs[i].label, ok ? "ok" : "FAILED",
+        (unsigned long)direct.getText().size(), (unsigned long)out.getText().size(),
+        (unsigned long)dropped);
+    if (out.getNrOverruns() > 0) {
+      printf("  %lu bytes written without room\n", (unsigned long)out.getNrOverruns());
+    }
+    if (!ok) {
+      status = 1;
+    }
+    delay(60000);
+  }
+  return status;
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-mux: GPRSbeeMux with two links against an emulated SIM900 or
+ * SIM800, an echo server behind each link
+ *
+ *   gprsbee-mux [-m sim900|sim800] [-v]
+ *     -m  the modem to emulate, default sim900
+ *     -v  show the diagnostics of the driver
+ * The tests:
+ *  - interleaved    both links send in turns, the echo of one comes while
+ *                   the driver sends on the other
+ *  - peer data      the peers send by themselves, between and during the
+ *                   commands
+ *  - at the prompt  a +RECEIVE for the other link comes right before the
+ *                   "> " of AT+CIPSEND, its data has a "> " and a line
+ *                   that looks like a reply
+ * Each link must get exactly its own data, in order, nothing dropped.
+ * The exit status is 1 if a test failed.
+ */
+
+#include <Arduino.h>
+#include <unistd.h>
+#include <string>
+
+#include "GPRSbee.h"
+#include "GPRSbeeMux.h"
+#include "SimModem.h"
+
+#define APN             "internet"
+#define SERVER          "echo.example.com"
+#define NR_LINKS        2
+
+static SimModem *modem;
+static GPRSbeeMux mux;
+static int8_t links[NR_LINKS];
+static std::string expected[NR_LINKS];
+static std::string got[NR_LINKS];
+
+static void readLinks()
+{
+  for (int i = 0; i < NR_LINKS; ++i) {
+    uint8_t buffer[32];
+    size_t n;
+    while ((n = mux.read(links[i], buffer, sizeof(buffer))) > 0) {
+      got[i].append((const char *)buffer, n);
+    }
+  }
+}
+
+static void pollFor(uint32_t ms)
+{
+  uint32_t start = millis();
+  while (millis() - start < ms) {
+    mux.poll();
+    readLinks();
+    delay(10);
+  }
+}
+
+static bool send(int i, const std::string &data)
+{
+  expected[i] += data;
+  bool ok = mux.write(links[i], (const uint8_t *)data.data(), data.size()) == data.size();
+  ok = ok && mux.flush(links[i]);
+  readLinks();
+  return ok;
+}
+
+static bool check()
+{
+  // Wait for the last echoes
+  pollFor(2000);
+  bool ok = true;
+  for (int i = 0; i < NR_LINKS; ++i) {
+    ok = ok && got[i] == expected[i] && mux.getNrDropped(links[i]) == 0;
+    ok = ok && mux.isConnected(links[i]);
+    expected[i].clear();
+    got[i].clear();
+  }
+  return ok && modem->getNrUnknownCommands() == 0;
+}
+
+static bool testInterleaved()
+{
+  bool ok = true;
+  for (int round = 0; round < 8 && ok; ++round) {
+    for (int i = 0; i < NR_LINKS && ok; ++i) {
+      std::string data;
+      for (int j = 0; j < 20 + round * 10; ++j) {
+        data += (char)('A' + i * 16 + (round + j) % 16);
+      }
+      ok = send(i, data);
+    }
+  }
+  return check() && ok;
+}
+
+static bool testPeerData()
+{
+  bool ok = true;
+  for (int round = 0; round < 4 && ok; ++round) {
+    std::string peer0 = "peer 0 round " + std::string(1, '0' + round) + "\r\n";
+    std::string peer1 = "peer 1, round " + std::string(1, '0' + round) + "\r\nOK\r\n";
+    modem->peerSend(links[0], peer0, 0);
+    modem->peerSend(links[1], peer1, 60);
+    expected[0] += peer0;
+    expected[1] += peer1;
+    // The first poll takes the data of link 0, the other arrives while
+    // link 0 sends; its echo comes after the data of link 1
+    mux.poll();
+    readLinks();
+    ok = send(0, "data " + std::string(1, 'a' + round));
+    pollFor(500);
+  }
+  return check() && ok;
+}
+
+static bool testAtPrompt()
+{
+  bool ok = true;
+  for (int i = 0; i < NR_LINKS && ok; ++i) {
+    int other = 1 - i;
+    std::string peer = "at the prompt> \r\n" + std::string(1, '0' + links[i]) + ", SEND OK\r\n";
+    modem->peerSendAtPrompt(links[other], peer);
+    expected[other] += peer;
+    ok = send(i, "after the prompt");
+    // The echo first, then the next prompt
+    pollFor(1000);
+  }
+  return check() && ok;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-m sim900|sim800] [-v]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  const SimProfile *profile = &simSIM900;
+  bool verbose = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:v")) != -1) {
+    switch (opt) {
+    case 'm':
+      if (strcmp(optarg, "sim900") == 0) {
+        profile = &simSIM900;
+      } else if (strcmp(optarg, "sim800") == 0) {
+        profile = &simSIM800;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  modem = new SimModem(*profile);
+  gprsbee.init(*modem, CTS, DTR);
+  modem->setPins(-1, DTR, CTS);
+  gprsbee.setPowerSwitchedOnOff(true);
+  if (verbose) {
+    gprsbee.setDiag(SerialUSB);
+  }
+
+  printf("%s, GPRSbeeMux with %d links\n", profile->name, NR_LINKS);
+  printf("%-14s %-6s %8s\n", "", "result", "receives");
+
+  if (!mux.begin(APN)) {
+    printf("begin() failed\n");
+    return 1;
+  }
+  for (int i = 0; i < NR_LINKS; ++i) {
+    links[i] = mux.open(false, SERVER, 7 + i);
+    if (links[i] < 0) {
+      printf("open() failed\n");
+      return 1;
+    }
+  }
+
+  static const struct {
+    const char *label;
+    bool (*test)();
+  } tests[] = {
+    { "interleaved", testInterleaved },
+    { "peer data", testPeerData },
+    { "at the prompt", testAtPrompt },
+  };
+  int status = 0;
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+    uint32_t receives = modem->getNrReceives();
+    bool ok = tests[i].test();
+    printf("%-14s %-6s %8lu\n", tests[i].label, ok ? "ok" : "FAILED",
+        (unsigned long)(modem->getNrReceives() - receives));
+    if (!ok) {
+      status = 1;
+    }
+  }
+
+  mux.end();
+  return status;
+}
@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-post: streamed HTTP POST bodies against an emulated SIM900 or
+ * SIM800, their peak RAM and their throughput
+ *
+ *   gprsbee-post [-m sim900|sim800] [-v]
+ *     -m  the modem to emulate, default sim900
+ *     -v  show the diagnostics of the driver
+ * The tests:
+ *  - buffer      the body from RAM, the reference
+ *  - pull        the body from a bodyPull callback
+ *  - stream      the body from a Stream
+ *  - pull short  the callback ends halfway; that POST must fail, and the
+ *                next POST in the same HTTP session must succeed, so the
+ *                rest of the body may not eat its commands
+ * The server must get exactly the body. The peak RAM is the stack used by
+ * the POST, the driver and the emulator below it, plus the body if it is
+ * in RAM. A streamed POST must not use more of it for the largest body
+ * than for the smallest. The throughput is the body size over the
+ * simulated time of doHTTPPOSTmiddle, at 57600 baud at most 5760 bytes/s.
+ * The exit status is 1 if a test failed.
+ */
+
+#include <Arduino.h>
+#include <unistd.h>
+#include <string>
+
+#include "GPRSbee.h"
+#include "SimModem.h"
+
+#define APN             "internet"
+#define URL             "http://example.com/upload"
+
+// The stack that is painted before and checked after each POST
+#define STACK_AREA      (64 * 1024)
+#define STACK_PAINT     0xA5
+
+static SimModem *sim;
+
+// The body, the callback and the Stream give at most bodyEnd bytes of it
+static std::string body;
+static uint32_t bodyAt;
+static uint32_t bodyEnd;
+
+static size_t pullBody(uint8_t *buffer, size_t size)
+{
+  if (size > bodyEnd - bodyAt) {
+    size = bodyEnd - bodyAt;
+  }
+  memcpy(buffer, body.data() + bodyAt, size);
+  bodyAt += size;
+  return size;
+}
+
+class BodyStream : public Stream
+{
+public:
+  int available() { return bodyEnd - bodyAt; }
+  int read() { return bodyAt < bodyEnd ? (uint8_t)body[bodyAt++] : -1; }
+  int peek() { return bodyAt < bodyEnd ? (uint8_t)body[bodyAt] : -1; }
+  size_t write(uint8_t c) { return 0; }
+  using Print::write;
+};
+
+static void newBody(uint32_t size)
+{
+  body.clear();
+  for (uint32_t i = 0; i < size; ++i) {
+    body += (char)('a' + i % 26);
+  }
+  bodyAt = 0;
+  bodyEnd = size;
+}
+
+/*
+ * Fill the stack below the caller with a pattern, and later see how
+ * deep it was used. Both must be called from the same function.
+ */
+static void __attribute__((noinline)) paintStack()
+{
+  volatile uint8_t area[STACK_AREA];
+  for (size_t i = 0; i < sizeof(area); ++i) {
+    area[i] = STACK_PAINT;
+  }
+}
+
+// Reading what paintStack() and the POST left there is the point
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+static size_t __attribute__((noinline)) stackUsed()
+{
+  volatile uint8_t area[STACK_AREA];
+  size_t i = 0;
+  while (i < sizeof(area) && area[i] == STACK_PAINT) {
+    ++i;
+  }
+  return sizeof(area) - i;
+}
+#pragma GCC diagnostic pop
+
+enum bodyKind { body_buffer, body_pull, body_stream };
+
+struct Result
+{
+  bool ok;
+  size_t ram;
+  uint32_t ms;
+};
+
+static void __attribute__((noinline)) doMiddle(enum bodyKind kind, uint32_t size, Result *result)
+{
+  BodyStream stream;
+  stream.setTimeout(0);
+  uint32_t start = millis();
+  switch (kind) {
+  case body_buffer:
+    result->ok = gprsbee.doHTTPPOSTmiddle(URL, body.data(), size);
+    break;
+  case body_pull:
+    result->ok = gprsbee.doHTTPPOSTmiddle(URL, pullBody, size);
+    break;
+  default:
+    result->ok = gprsbee.doHTTPPOSTmiddle(URL, stream, size);
+    break;
+  }
+  result->ms = millis() - start;
+}
+
+static void __attribute__((noinline)) measureMiddle(enum bodyKind kind, uint32_t size, Result *result)
+{
+  paintStack();
+  doMiddle(kind, size, result);
+  result->ram = stackUsed() + (kind == body_buffer ? size : 0);
+}
+
+static bool testPOST(enum bodyKind kind, uint32_t size, Result *result)
+{
+  newBody(size);
+  bool ok = gprsbee.on() && gprsbee.doHTTPprolog(APN);
+  if (ok) {
+    measureMiddle(kind, size, result);
+    ok = result->ok;
+  }
+  gprsbee.doHTTPepilog();
+  gprsbee.off();
+  return ok && sim->getHTTPUpload() == body && sim->getNrUnknownCommands() == 0;
+}
+
+static bool testShort(uint32_t size, Result *result)
+{
+  newBody(size);
+  bool ok = gprsbee.on() && gprsbee.doHTTPprolog(APN);
+  if (ok) {
+    bodyEnd = size / 2;
+    measureMiddle(body_pull, size, result);
+    ok = !result->ok;
+    newBody(size);
+    ok = ok && gprsbee.doHTTPPOSTmiddle(URL, pullBody, size);
+  }
+  gprsbee.doHTTPepilog();
+  gprsbee.off();
+  return ok && sim->getHTTPUpload() == body && sim->getNrUnknownCommands() == 0;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-m sim900|sim800] [-v]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  const SimProfile *profile = &simSIM900;
+  bool verbose = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:v")) != -1) {
+    switch (opt) {
+    case 'm':
+      if (strcmp(optarg, "sim900") == 0) {
+        profile = &simSIM900;
+      } else if (strcmp(optarg, "sim800") == 0) {
+        profile = &simSIM800;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  SimModem modem(*profile);
+  sim = &modem;
+  gprsbee.init(modem, CTS, DTR);
+  modem.setPins(-1, DTR, CTS);
+  gprsbee.setPowerSwitchedOnOff(true);
+  if (verbose) {
+    gprsbee.setDiag(SerialUSB);
+  }
+
+  printf("%s, HTTP POST bodies\n", profile->name);
+  printf("%-12s %8s %-6s %10s %8s %10s\n", "", "size", "result", "peak RAM", "sim ms", "bytes/s");
+
+  static const struct {
+    const char *label;
+    enum bodyKind kind;
+    uint32_t size;
+  } tests[] = {
+    { "buffer", body_buffer, 7 },
+    { "buffer", body_buffer, 3000 },
+    { "pull", body_pull, 7 },
+    { "pull", body_pull, 3000 },
+    { "pull", body_pull, 300000 },
+    { "stream", body_stream, 7 },
+    { "stream", body_stream, 300000 },
+    { "pull short", body_pull, 3000 },
+  };
+  int status = 0;
+  size_t smallest[3] = { 0, 0, 0 };
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+    Result result = Result();
+    bool ok;
+    if (strcmp(tests[i].label, "pull short") == 0) {
+      ok = testShort(tests[i].size, &result);
+    } else {
+      ok = testPOST(tests[i].kind, tests[i].size, &result);
+      if (tests[i].kind != body_buffer) {
+        if (smallest[tests[i].kind] == 0) {
+          smallest[tests[i].kind] = result.ram;
+        }
+        ok = ok && result.ram <= smallest[tests[i].kind];
+      }
+    }
+    printf("%-12s %8lu %-6s %10lu %8lu %10.0f\n", tests[i].label, (unsigned long)tests[i].size,
+        ok ? "ok" : "FAILED", (unsigned long)result.ram, (unsigned long)result.ms,
+        result.ms ? tests[i].size * 1000.0 / result.ms : 0.0);
+    if (!ok) {
+      status = 1;
+    }
+    delay(60000);
+  }
+  return status;
+}
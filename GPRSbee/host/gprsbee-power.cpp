@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-power: the policies of GPRSbeePowerManager against an emulated
+ * SIM900 or SIM800, with the state transition times of the SimModem
+ * profile
+ *
+ *   gprsbee-power [-m sim900|sim800] [-i interval] [-n count] [-v]
+ *     -m  the modem to emulate, default sim900
+ *     -i  seconds from one upload to the next, default 60
+ *     -n  the number of uploads per policy, default 4
+ *     -v  show the diagnostics of the driver
+ * For each policy it does the uploads of testPowerManager and checks that
+ * the SIMx00 is in the idle state of the policy after each of them. It
+ * reports the time of the first and of the later uploads, the measured
+ * wake-to-ready latency and the estimated charge. The exit status is 1 if
+ * an upload failed or the SIMx00 was not in the expected state.
+ */
+
+#include <Arduino.h>
+#include <unistd.h>
+
+#include "GPRSbee.h"
+#include "GPRSbeePowerManager.h"
+#include "SimModem.h"
+
+#define APN             "internet"
+
+// The MCU pin wired to DTR of the SIMx00, for policy_sleep
+#define SIM_DTR         34
+
+static const char * const policyNames[GPRSbeePowerManager::policy_count] = {
+  "off", "cfun0", "cfun4", "sleep"
+};
+
+static bool upload()
+{
+  const char *data = "Some payload data...";
+  return gprsbee.doHTTPPOST(APN, "http://httpbin.org/post", data, strlen(data));
+}
+
+/*
+ * Is the SIMx00 idle the way the policy wants it
+ */
+static bool checkIdle(SimModem &modem, enum GPRSbeePowerManager::policyKind policy)
+{
+  switch (policy) {
+  case GPRSbeePowerManager::policy_off:
+    return !modem.isPowered();
+  case GPRSbeePowerManager::policy_cfun0:
+    return modem.isPowered() && modem.getFunctionality() == 0;
+  case GPRSbeePowerManager::policy_cfun4:
+    return modem.isPowered() && modem.getFunctionality() == 4;
+  case GPRSbeePowerManager::policy_sleep:
+    return modem.isSleeping();
+  default:
+    return false;
+  }
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-m sim900|sim800] [-i interval] [-n count] [-v]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  const SimProfile *profile = &simSIM900;
+  uint32_t interval = 60;
+  int count = 4;
+  bool verbose = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:i:n:v")) != -1) {
+    switch (opt) {
+    case 'm':
+      if (strcmp(optarg, "sim900") == 0) {
+        profile = &simSIM900;
+      } else if (strcmp(optarg, "sim800") == 0) {
+        profile = &simSIM800;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'i':
+      interval = strtoul(optarg, 0, 10);
+      break;
+    case 'n':
+      count = atoi(optarg);
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (interval == 0 || count < 2) {
+    usage(argv[0]);
+  }
+
+  SimModem modem(*profile);
+  GPRSbeePowerManager power;
+
+  gprsbee.init(modem, CTS, DTR);
+  modem.setPins(-1, DTR, CTS, SIM_DTR);
+  gprsbee.setPowerSwitchedOnOff(true);
+  if (verbose) {
+    gprsbee.setDiag(SerialUSB);
+  }
+
+  printf("%s, %d uploads %lu s apart\n", profile->name, count, (unsigned long)interval);
+  printf("%-8s %-6s %8s %8s %8s %9s %10s\n", "", "result", "first ms", "next ms",
+      "wake ms", "power ups", "uAh/interv");
+
+  int status = 0;
+  for (uint8_t i = 0; i < GPRSbeePowerManager::policy_count; ++i) {
+    enum GPRSbeePowerManager::policyKind policy = (enum GPRSbeePowerManager::policyKind)i;
+    power.begin(SIM_DTR);
+    power.setPolicy(policy);
+
+    bool ok = true;
+    bool idleOk = true;
+    uint32_t first = 0;
+    uint32_t next = 0;
+    uint32_t powerUps = modem.getNrPowerUps();
+    for (int n = 0; n < count; ++n) {
+      uint32_t start = millis();
+      ok = upload() && ok;
+      uint32_t elapsed = millis() - start;
+      if (n == 0) {
+        first = elapsed;
+      } else {
+        next += elapsed;
+      }
+      if (!checkIdle(modem, policy)) {
+        idleOk = false;
+      }
+      if (elapsed < interval * 1000) {
+        delay(interval * 1000 - elapsed);
+      }
+    }
+    powerUps = modem.getNrPowerUps() - powerUps;
+    // Only policy_off should power up more than once
+    if (policy != GPRSbeePowerManager::policy_off && powerUps != 1) {
+      idleOk = false;
+    }
+
+    printf("%-8s %-6s %8lu %8lu %8lu %9lu %10lu\n", policyNames[i],
+        !ok ? "FAILED" : !idleOk ? "STATE" : "ok",
+        (unsigned long)first, (unsigned long)(next / (count - 1)),
+        (unsigned long)power.getWakeLatency(policy), (unsigned long)powerUps,
+        (unsigned long)(power.getEstimatedCharge(policy, interval) / 3600));
+    if (!ok || !idleOk) {
+      status = 1;
+    }
+
+    power.end();
+    if (modem.isPowered()) {
+      printf("  still powered after end()\n");
+      status = 1;
+    }
+    delay(interval * 1000);
+  }
+
+  printf("choosePolicy(%lu) picks %s\n", (unsigned long)interval,
+      policyNames[power.choosePolicy(interval)]);
+  return status;
+}
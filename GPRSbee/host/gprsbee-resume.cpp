@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-resume: GPRSbeeResumableUpload against an emulated SIM900 or
+ * SIM800 that loses the link
+ *
+ *   gprsbee-resume [-m sim900|sim800] [-s size] [-n runs] [-v]
+ *     -m  the modem to emulate, default sim900
+ *     -s  the size of the upload, default 20000
+ *     -n  the number of uploads per test with link losses, default 10
+ *     -v  show the diagnostics of the driver
+ * Each try is a fresh GPRSbeeResumableUpload with one attempt, as after a
+ * reset; the checkpoint store is a variable. Before a try the link is lost
+ * at a random byte, with a chance of one in two. The tests:
+ *  - ftp, http      the uploads with link losses, the server must end up
+ *                   with exactly the data
+ *  - ftp, file lost the server loses the file after a link loss, the
+ *                   upload must start over
+ *  - ftp, http, source short
+ *                   the source ends halfway, the upload must stop without
+ *                   sending anything that isn't the data
+ *  - ftp, source hole
+ *                   the source fails in the middle of a segment, the
+ *                   upload must stop and start over the next time
+ * It reports the simulated time, the link losses and the bytes sent per
+ * byte of data. The exit status is 1 if a test failed.
+ */
+
+#include <Arduino.h>
+#include <unistd.h>
+#include <string>
+
+#include "GPRSbee.h"
+#include "GPRSbeeResumableUpload.h"
+#include "SimModem.h"
+
+#define APN             "internet"
+#define FTP_SERVER      "ftp.example.com"
+#define FTP_USERNAME    "anonymous"
+#define FTP_PASSWORD    ""
+#define HTTP_URL        "http://example.com/upload"
+
+// Give up an upload after this many tries
+#define MAX_TRIES       20
+
+static SimModem *sim;
+
+// The data of the upload, the source gives at most srcEnd bytes of it,
+// and nothing from srcHole on, except the last byte of each segment
+static std::string data;
+static uint32_t srcEnd;
+static uint32_t srcHole;
+
+static GPRSbeeCheckpoint stored;
+static bool isStored;
+
+// xorshift32, the same runs every time
+static uint32_t seed = 1;
+static uint32_t nextRandom()
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static size_t readData(uint32_t offset, uint8_t *buffer, size_t size)
+{
+  if (offset >= srcEnd) {
+    return 0;
+  }
+  if (offset >= srcHole && (offset + 1) % GPRSBEE_RESUME_SEGMENT_SIZE != 0) {
+    return 0;
+  }
+  if (size > srcEnd - offset) {
+    size = srcEnd - offset;
+  }
+  memcpy(buffer, data.data() + offset, size);
+  return size;
+}
+
+static bool loadCheckpoint(GPRSbeeCheckpoint *checkpoint)
+{
+  *checkpoint = stored;
+  return isStored;
+}
+
+static void saveCheckpoint(const GPRSbeeCheckpoint *checkpoint)
+{
+  stored = *checkpoint;
+  isStored = true;
+}
+
+static void newData(uint32_t size)
+{
+  data.clear();
+  for (uint32_t i = 0; i < size; ++i) {
+    data += (char)nextRandom();
+  }
+  srcEnd = size;
+  srcHole = size;
+  isStored = false;
+}
+
+struct Result
+{
+  bool ok;
+  uint32_t nrTries;
+  uint32_t nrBytesSent;
+  bool sourceError;
+  uint32_t offset;
+};
+
+/*
+ * One try of the upload, after a reset
+ */
+static void tryUpload(bool ftp, uint32_t id, Result *result)
+{
+  GPRSbeeResumableUpload upload;
+  upload.setCheckpointStore(loadCheckpoint, saveCheckpoint);
+  upload.setMaxAttempts(1);
+  upload.begin(id, data.size(), readData);
+  if (ftp) {
+    result->ok = upload.sendFTP(APN, 0, 0, FTP_SERVER, FTP_USERNAME, FTP_PASSWORD,
+        "/", "resume.bin");
+  } else {
+    result->ok = upload.sendHTTP(APN, 0, 0, HTTP_URL);
+  }
+  ++result->nrTries;
+  result->nrBytesSent += upload.getNrBytesSent();
+  result->sourceError = upload.hasSourceError();
+  result->offset = upload.getOffset();
+}
+
+/*
+ * Upload until it is done, losing the link now and then
+ */
+static void uploadWithLosses(bool ftp, uint32_t id, Result *result)
+{
+  do {
+    sim->setLinkLoss(nextRandom() % 2 ? 1 + nextRandom() % data.size() : 0);
+    tryUpload(ftp, id, result);
+  } while (!result->ok && !result->sourceError && result->nrTries < MAX_TRIES);
+  sim->setLinkLoss(0);
+}
+
+static const std::string &serverData(bool ftp)
+{
+  return ftp ? sim->getFTPFile() : sim->getHTTPUpload();
+}
+
+static bool testLosses(bool ftp, uint32_t size, int nrRuns, Result *total)
+{
+  bool ok = true;
+  for (int run = 0; run < nrRuns; ++run) {
+    Result result = Result();
+    newData(size);
+    uploadWithLosses(ftp, run + 1, &result);
+    ok = ok && result.ok && serverData(ftp) == data;
+    total->nrTries += result.nrTries;
+    total->nrBytesSent += result.nrBytesSent;
+  }
+  return ok;
+}
+
+static bool testFTPfileLost(uint32_t size, Result *total)
+{
+  newData(size);
+  sim->setLinkLoss(size / 2);
+  tryUpload(true, 100, total);
+  sim->setLinkLoss(0);
+  sim->removeFTPFile();
+  tryUpload(true, 100, total);
+  return total->ok && sim->getFTPFile() == data;
+}
+
+/*
+ * The source ends halfway, what the server has must be the start of the
+ * data and the upload must stop at once
+ */
+static bool testSourceShort(bool ftp, uint32_t size, Result *total)
+{
+  GPRSbeeResumableUpload upload;
+  newData(size);
+  srcEnd = size / 2;
+  upload.setCheckpointStore(loadCheckpoint, saveCheckpoint);
+  upload.setMaxAttempts(3);
+  upload.begin(200, size, readData);
+  if (ftp) {
+    total->ok = upload.sendFTP(APN, 0, 0, FTP_SERVER, FTP_USERNAME, FTP_PASSWORD,
+        "/", "resume.bin");
+  } else {
+    total->ok = upload.sendHTTP(APN, 0, 0, HTTP_URL);
+  }
+  total->nrTries = upload.getNrAttempts();
+  total->nrBytesSent = upload.getNrBytesSent();
+  const std::string &server = serverData(ftp);
+  return !total->ok && upload.hasSourceError() && upload.getNrAttempts() == 1 &&
+      upload.getOffset() <= srcEnd && server.size() <= srcEnd &&
+      server.compare(0, server.size(), data, 0, server.size()) == 0;
+}
+
+/*
+ * The source fails in the middle of a segment, after its last byte was
+ * read. The upload must stop, and the next one must start over and finish.
+ */
+static bool testSourceHole(uint32_t size, Result *total)
+{
+  newData(size);
+  srcHole = GPRSBEE_RESUME_SEGMENT_SIZE + 100;
+  tryUpload(true, 300, total);
+  bool ok = !total->ok && total->sourceError && total->offset == 0;
+  srcHole = size;
+  uploadWithLosses(true, 300, total);
+  return ok && total->ok && sim->getFTPFile() == data;
+}
+
+static void report(const char *label, bool ok, uint32_t start, uint32_t losses,
+    const Result &result, uint32_t dataSize)
+{
+  printf("%-18s %-6s %9lu %6lu %6lu %8.2f\n", label, ok ? "ok" : "FAILED",
+      (unsigned long)(millis() - start), (unsigned long)result.nrTries,
+      (unsigned long)(sim->getNrLinkLosses() - losses),
+      dataSize ? (double)result.nrBytesSent / dataSize : 0.0);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-m sim900|sim800] [-s size] [-n runs] [-v]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  const SimProfile *profile = &simSIM900;
+  uint32_t size = 20000;
+  int nrRuns = 10;
+  bool verbose = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:s:n:v")) != -1) {
+    switch (opt) {
+    case 'm':
+      if (strcmp(optarg, "sim900") == 0) {
+        profile = &simSIM900;
+      } else if (strcmp(optarg, "sim800") == 0) {
+        profile = &simSIM800;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 's':
+      size = strtoul(optarg, 0, 10);
+      break;
+    case 'n':
+      nrRuns = atoi(optarg);
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (size < 2 * GPRSBEE_RESUME_SEGMENT_SIZE || nrRuns < 1) {
+    usage(argv[0]);
+  }
+
+  SimModem modem(*profile);
+  sim = &modem;
+  gprsbee.init(modem, CTS, DTR);
+  modem.setPins(-1, DTR, CTS);
+  gprsbee.setPowerSwitchedOnOff(true);
+  if (verbose) {
+    gprsbee.setDiag(SerialUSB);
+  }
+
+  printf("%s, uploads of %lu bytes\n", profile->name, (unsigned long)size);
+  printf("%-18s %-6s %9s %6s %6s %8s\n", "", "result", "sim ms", "tries", "losses", "sent/size");
+
+  int status = 0;
+  for (int test = 0; test < 6; ++test) {
+    static const char * const labels[] = {
+      "ftp", "http", "ftp, file lost", "ftp, source short", "http, source short",
+      "ftp, source hole"
+    };
+    Result result = Result();
+    uint32_t start = millis();
+    uint32_t losses = modem.getNrLinkLosses();
+    uint32_t dataSize = size;
+    bool ok;
+    switch (test) {
+    case 0:
+      ok = testLosses(true, size, nrRuns, &result);
+      dataSize = size * nrRuns;
+      break;
+    case 1:
+      ok = testLosses(false, size, nrRuns, &result);
+      dataSize = size * nrRuns;
+      break;
+    case 2:
+      ok = testFTPfileLost(size, &result);
+      break;
+    case 3:
+      ok = testSourceShort(true, size, &result);
+      break;
+    case 4:
+      ok = testSourceShort(false, size, &result);
+      break;
+    default:
+      ok = testSourceHole(size, &result);
+      break;
+    }
+    report(labels[test], ok, start, losses, result, dataSize);
+    if (!ok) {
+      status = 1;
+    }
+  }
+  return status;
+}
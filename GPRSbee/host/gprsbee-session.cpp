@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-session: the POSTs of testSession against an emulated SIM900 or
+ * SIM800, with and without GPRSbeeHTTPSession
+ *
+ *   gprsbee-session [-m sim900|sim800] [-n requests] [-v]
+ *     -m  the modem to emulate, default sim900
+ *     -n  the number of requests per test, default 5
+ *     -v  show the diagnostics of the driver
+ * The tests:
+ *  - without reuse   doHTTPPOST, each request powers up and attaches
+ *  - with reuse      the same requests in one session
+ *  - bearer dropped  the network drops the bearer halfway, the request
+ *                    gets a 601 from the SIMx00; the session must reopen
+ *                    once and all requests must succeed
+ *  - server 404      the server answers 404, the session must neither
+ *                    retry nor reopen
+ * It reports the simulated time and the AT commands per request. The exit
+ * status is 1 if a test failed.
+ */
+
+#include <Arduino.h>
+#include <unistd.h>
+
+#include "GPRSbee.h"
+#include "GPRSbeeHTTPSession.h"
+#include "SimModem.h"
+
+#define APN             "internet"
+#define URL             "http://httpbin.org/post"
+
+static const char data[] = "Some payload data...";
+
+static void report(const char *label, bool ok, uint32_t start, uint32_t commands, int nrRequests,
+    const GPRSbeeHTTPSession *session)
+{
+  printf("%-16s %-6s %8lu %8.1f", label, ok ? "ok" : "FAILED",
+      (unsigned long)(millis() - start) / nrRequests,
+      (double)(gprsbee.getCommandCount() - commands) / nrRequests);
+  if (session) {
+    printf(" %8u %10u", session->getNrRequests(), session->getNrReconnects());
+  }
+  printf("\n");
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-m sim900|sim800] [-n requests] [-v]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  const SimProfile *profile = &simSIM900;
+  int nrRequests = 5;
+  bool verbose = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:n:v")) != -1) {
+    switch (opt) {
+    case 'm':
+      if (strcmp(optarg, "sim900") == 0) {
+        profile = &simSIM900;
+      } else if (strcmp(optarg, "sim800") == 0) {
+        profile = &simSIM800;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'n':
+      nrRequests = atoi(optarg);
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (nrRequests < 2) {
+    usage(argv[0]);
+  }
+
+  SimModem modem(*profile);
+  gprsbee.init(modem, CTS, DTR);
+  modem.setPins(-1, DTR, CTS);
+  gprsbee.setPowerSwitchedOnOff(true);
+  if (verbose) {
+    gprsbee.setDiag(SerialUSB);
+  }
+
+  printf("%s, %d POSTs per test\n", profile->name, nrRequests);
+  printf("%-16s %-6s %8s %8s %8s %10s\n", "", "result", "ms/req", "AT/req", "requests",
+      "reconnects");
+
+  int status = 0;
+  uint32_t start = millis();
+  uint32_t commands = gprsbee.getCommandCount();
+  int nrOk = 0;
+  for (int i = 0; i < nrRequests; ++i) {
+    nrOk += gprsbee.doHTTPPOST(APN, URL, data, strlen(data));
+  }
+  report("without reuse", nrOk == nrRequests, start, commands, nrRequests, 0);
+  if (nrOk != nrRequests) {
+    status = 1;
+  }
+  delay(60000);
+
+  for (int test = 0; test < 3; ++test) {
+    static const char * const labels[] = { "with reuse", "bearer dropped", "server 404" };
+    GPRSbeeHTTPSession session;
+    start = millis();
+    commands = gprsbee.getCommandCount();
+    nrOk = 0;
+    bool ok = session.begin(APN);
+    if (test == 2) {
+      modem.setHTTPStatus(404);
+    }
+    for (int i = 0; ok && i < nrRequests; ++i) {
+      if (test == 1 && i == nrRequests / 2) {
+        modem.dropBearer();
+      }
+      nrOk += session.doHTTPPOST(URL, data, strlen(data));
+    }
+    session.end();
+    modem.setHTTPStatus(200);
+
+    switch (test) {
+    case 0:
+      ok = ok && nrOk == nrRequests && session.getNrReconnects() == 0;
+      break;
+    case 1:
+      ok = ok && nrOk == nrRequests && session.getNrReconnects() == 1 &&
+          session.getNrRequests() == nrRequests + 1;
+      break;
+    default:
+      ok = ok && nrOk == 0 && session.getNrReconnects() == 0 &&
+          session.getNrRequests() == nrRequests;
+      break;
+    }
+    report(labels[test], ok, start, commands, nrRequests, &session);
+    if (!ok) {
+      status = 1;
+    }
+    delay(60000);
+  }
+  return status;
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-tcp: GPRSbeeTCPStream against an emulated SIM900 or SIM800 with
+ * an echo server as the TCP peer
+ *
+ *   gprsbee-tcp [-m sim900|sim800] [-n bytes] [-v]
+ *     -m  the modem to emulate, default sim900
+ *     -n  the number of bytes of the echo test, default 20000
+ *     -v  show the diagnostics of the driver
+ * The tests:
+ *  - echo          write the bytes while the echo is read back, all of
+ *                  them must come back unchanged
+ *  - frames        writeFrame() and readFrame() of the echo
+ *  - look-alike    data that looks like the start of "CLOSED" is data
+ *  - peer closes   the peer closes after its echo: the echo comes in full
+ *                  without "CLOSED", connected() becomes false, readFrame()
+ *                  gives up at once and stop() sends no "+++"
+ * It reports the simulated throughput and the UART writes. The exit status
+ * is 1 if a test failed.
+ */
+
+#include <Arduino.h>
+#include <unistd.h>
+#include <string>
+
+#include "GPRSbee.h"
+#include "GPRSbeeTCPStream.h"
+#include "SimModem.h"
+
+#define APN             "internet"
+#define SERVER          "echo.example.com"
+#define PORT            7
+
+static SimModem *modem;
+static GPRSbeeTCPStream tcp;
+
+static void report(const char *label, bool ok, size_t nrBytes, uint32_t ms)
+{
+  static uint32_t nrWrites;
+  printf("%-12s %-6s %8lu %8lu %8lu %8lu\n", label, ok ? "ok" : "FAILED",
+      (unsigned long)nrBytes, (unsigned long)ms,
+      ms ? (unsigned long)((uint64_t)nrBytes * 1000 / ms) : 0UL,
+      (unsigned long)(tcp.getNrUARTWrites() - nrWrites));
+  nrWrites = tcp.getNrUARTWrites();
+}
+
+/*
+ * Read what is there, without waiting
+ */
+static void readAvailable(std::string &got)
+{
+  while (tcp.available() > 0) {
+    int c = tcp.read();
+    if (c < 0) {
+      break;
+    }
+    got += (char)c;
+  }
+}
+
+/*
+ * Read until there are size bytes, the connection is closed, or nothing
+ * came for ms
+ */
+static void readFor(std::string &got, size_t size, uint32_t ms)
+{
+  uint32_t last = millis();
+  while (got.size() < size && millis() - last < ms) {
+    int c = tcp.read();
+    if (c >= 0) {
+      got += (char)c;
+      last = millis();
+    } else if (!tcp.connected()) {
+      break;
+    }
+  }
+}
+
+static bool testEcho(size_t nrBytes, uint32_t &ms)
+{
+  std::string sent;
+  std::string got;
+  for (size_t i = 0; i < nrBytes; ++i) {
+    sent += (char)(i * 7 + 3);
+  }
+  if (!tcp.connect(APN, SERVER, PORT)) {
+    return false;
+  }
+  uint32_t start = millis();
+  for (size_t i = 0; i < nrBytes; i += 100) {
+    size_t n = nrBytes - i < 100 ? nrBytes - i : 100;
+    tcp.write((const uint8_t *)sent.data() + i, n);
+    readAvailable(got);
+  }
+  tcp.flush();
+  readFor(got, nrBytes, 2000);
+  ms = millis() - start;
+  bool ok = got == sent && tcp.connected();
+  tcp.stop();
+  return ok;
+}
+
+static bool testFrames(size_t &nrBytes)
+{
+  uint8_t frame[300];
+  uint8_t buffer[300];
+  if (!tcp.connect(APN, SERVER, PORT)) {
+    return false;
+  }
+  bool ok = true;
+  nrBytes = 0;
+  for (uint16_t size = 1; size <= sizeof(frame) && ok; size += 99) {
+    for (uint16_t i = 0; i < size; ++i) {
+      frame[i] = i ^ size;
+    }
+    ok = tcp.writeFrame(frame, size);
+    ok = ok && tcp.readFrame(buffer, sizeof(buffer)) == size;
+    ok = ok && memcmp(frame, buffer, size) == 0;
+    nrBytes += size + 2;
+  }
+  tcp.stop();
+  return ok;
+}
+
+static bool testLookAlike(size_t &nrBytes)
+{
+  // The last piece is the start of the message, without more after it
+  static const char * const pieces[] = {
+    "hello\r\n",
+    "\r\nCLOSE X\r\n",
+    "\r\n\r\nCLOSED\r\r\n",
+    "end\r\nCLOS",
+  };
+  std::string sent;
+  std::string got;
+  if (!tcp.connect(APN, SERVER, PORT)) {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); ++i) {
+    tcp.print(pieces[i]);
+    tcp.flush();
+    sent += pieces[i];
+    delay(200);
+    readAvailable(got);
+  }
+  readFor(got, sent.size(), 1000);
+  nrBytes = sent.size();
+  bool ok = got == sent && tcp.connected();
+  tcp.stop();
+  return ok && modem->getNrUnknownCommands() == 0;
+}
+
+static bool testPeerCloses(size_t &nrBytes, uint32_t &stopMs)
+{
+  std::string sent;
+  std::string got;
+  for (size_t i = 0; i < 500; ++i) {
+    sent += (char)('a' + i % 26);
+  }
+  if (!tcp.connect(APN, SERVER, PORT)) {
+    return false;
+  }
+  tcp.print(sent.c_str());
+  tcp.flush();
+  // The echo is still on its way
+  modem->closeTCPByPeer();
+  readFor(got, sent.size() + 100, 2000);
+  nrBytes = got.size();
+  bool ok = got == sent;
+  ok = ok && !tcp.connected() && tcp.read() == -1 && tcp.available() == 0;
+  ok = ok && tcp.write('x') == 0;
+  uint8_t buffer[16];
+  uint32_t start = millis();
+  ok = ok && tcp.readFrame(buffer, sizeof(buffer)) == -1 && millis() - start < 100;
+  uint32_t commands = modem->getNrCommands();
+  start = millis();
+  tcp.stop();
+  stopMs = millis() - start;
+  // Only the AT+CIPSHUT and the power off, a "+++" adds one and a half
+  // guard time
+  ok = ok && stopMs < GPRSBEE_ESCAPE_GUARD_TIME;
+  ok = ok && modem->getNrCommands() - commands <= 2;
+  return ok && modem->getNrUnknownCommands() == 0;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-m sim900|sim800] [-n bytes] [-v]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  const SimProfile *profile = &simSIM900;
+  size_t nrBytes = 20000;
+  bool verbose = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:n:v")) != -1) {
+    switch (opt) {
+    case 'm':
+      if (strcmp(optarg, "sim900") == 0) {
+        profile = &simSIM900;
+      } else if (strcmp(optarg, "sim800") == 0) {
+        profile = &simSIM800;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'n':
+      nrBytes = atoi(optarg);
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (nrBytes < 1) {
+    usage(argv[0]);
+  }
+
+  modem = new SimModem(*profile);
+  gprsbee.init(*modem, CTS, DTR);
+  modem->setPins(-1, DTR, CTS);
+  gprsbee.setPowerSwitchedOnOff(true);
+  if (verbose) {
+    gprsbee.setDiag(SerialUSB);
+  }
+
+  printf("%s, GPRSbeeTCPStream with an echo server\n", profile->name);
+  printf("%-12s %-6s %8s %8s %8s %8s\n", "", "result", "bytes", "ms", "bytes/s", "writes");
+
+  int status = 0;
+  bool ok;
+  uint32_t ms = 0;
+  size_t n = 0;
+
+  ok = testEcho(nrBytes, ms);
+  report("echo", ok, nrBytes, ms);
+  status |= !ok;
+
+  ok = testFrames(n);
+  report("frames", ok, n, 0);
+  status |= !ok;
+
+  ok = testLookAlike(n);
+  report("look-alike", ok, n, 0);
+  status |= !ok;
+
+  ok = testPeerCloses(n, ms);
+  report("peer closes", ok, n, 0);
+  printf("  stop() after the peer closed took %lu ms\n", (unsigned long)ms);
+  status |= !ok;
+
+  return status;
+}
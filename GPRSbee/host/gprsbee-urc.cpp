@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-urc: URC handlers with the blocking command functions, against a
+ * scripted UART where URCs and replies are mixed
+ *
+ *   gprsbee-urc [-v]
+ *     -v  show the diagnostics of the driver
+ * The tests:
+ *  - between commands  a URC comes while no command is running, the next
+ *                      command must not throw it away
+ *  - inside a reply    a URC comes before the reply of the command
+ *  - half a line       the next command starts while a URC is halfway
+ *  - a burst           several URCs between two commands
+ *  - removed           a removed handler is not called anymore
+ * Each URC must reach its handler exactly once, and each command must
+ * still get its own reply. The exit status is 1 if a test failed.
+ */
+
+#include <Arduino.h>
+#include <unistd.h>
+#include <string>
+
+#include "GPRSbee.h"
+#include "ScriptStream.h"
+
+static ScriptStream script;
+
+static uint16_t nrCMTI;
+static uint16_t nrRING;
+static uint16_t nrCREG;
+static std::string lastCMTI;
+
+static void onCMTI(const char *line)
+{
+  ++nrCMTI;
+  lastCMTI = line;
+}
+
+static void onRING(const char *line)
+{
+  ++nrRING;
+}
+
+static void onCREG(const char *line)
+{
+  ++nrCREG;
+}
+
+static bool finish(bool ok)
+{
+  return ok && script.isDone() && script.getMismatches().empty();
+}
+
+static bool testBetweenCommands()
+{
+  script.expect("AT", 50, "\r\nOK\r\n");
+  script.expect("AT+CSQ", 50, "\r\n+CSQ: 18,0\r\n\r\nOK\r\n");
+  bool ok = gprsbee.sendCommandWaitForOK("AT");
+  // The sketch does something else, meanwhile a message comes in
+  script.inject(50, "\r\n+CMTI: \"SM\",1\r\n");
+  delay(200);
+  ok = ok && gprsbee.sendCommandWaitForOK("AT+CSQ");
+  return finish(ok && nrCMTI == 1 && lastCMTI == "+CMTI: \"SM\",1");
+}
+
+static bool testInsideReply()
+{
+  char buffer[32];
+  // The first value function switches the echo off
+  script.expect("ATE0", 50, "\r\nOK\r\n");
+  script.expect("AT+COPS?", 100, "\r\n+CMTI: \"SM\",2\r\n");
+  script.thenReply(150, "\r\n+COPS: 0,0,\"KPN\"\r\n\r\nOK\r\n");
+  bool ok = gprsbee.getCOPS(buffer, sizeof(buffer));
+  ok = ok && strstr(buffer, "KPN") != 0;
+  return finish(ok && nrCMTI == 1 && lastCMTI == "+CMTI: \"SM\",2");
+}
+
+static bool testHalfLine()
+{
+  script.expect("AT", 50, "\r\nOK\r\n");
+  script.inject(0, "\r\n+CMTI: \"S");
+  script.inject(20, "M\",3\r\n");
+  delay(5);
+  bool ok = gprsbee.sendCommandWaitForOK("AT");
+  return finish(ok && nrCMTI == 1 && lastCMTI == "+CMTI: \"SM\",3");
+}
+
+static bool testBurst()
+{
+  script.expect("AT", 50, "\r\nOK\r\n");
+  script.expect("AT", 50, "\r\nOK\r\n");
+  bool ok = gprsbee.sendCommandWaitForOK("AT");
+  script.inject(10, "\r\nRING\r\n");
+  script.inject(20, "\r\n+CREG: 2\r\n");
+  script.inject(30, "\r\n+CREG: 1,\"00C3\",\"1234\"\r\n");
+  script.inject(40, "\r\n+CMTI: \"SM\",4\r\n");
+  script.inject(50, "\r\nRING\r\n");
+  delay(100);
+  ok = ok && gprsbee.sendCommandWaitForOK("AT");
+  return finish(ok && nrCMTI == 1 && nrRING == 2 && nrCREG == 2);
+}
+
+static bool testRemoved()
+{
+  script.expect("AT", 50, "\r\nOK\r\n");
+  script.expect("AT", 50, "\r\nOK\r\n");
+  bool ok = gprsbee.sendCommandWaitForOK("AT");
+  gprsbee.removeURCHandler(onCMTI);
+  script.inject(10, "\r\n+CMTI: \"SM\",5\r\n");
+  script.inject(20, "\r\nRING\r\n");
+  delay(100);
+  ok = ok && gprsbee.sendCommandWaitForOK("AT");
+  gprsbee.addURCHandler_P(PSTR("+CMTI:"), onCMTI);
+  return finish(ok && nrCMTI == 0 && nrRING == 1);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "v")) != -1) {
+    if (opt == 'v') {
+      gprsbee.setDiag(SerialUSB);
+    } else {
+      fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  gprsbee.init(script, CTS, DTR);
+  gprsbee.addURCHandler_P(PSTR("+CMTI:"), onCMTI);
+  gprsbee.addURCHandler_P(PSTR("RING"), onRING);
+  gprsbee.addURCHandler_P(PSTR("+CREG:"), onCREG);
+
+  printf("URCs mixed with blocking commands, against a scripted UART\n");
+  printf("%-18s %-6s %5s %5s %5s\n", "", "result", "CMTI", "RING", "CREG");
+
+  static const struct {
+    const char *label;
+    bool (*test)();
+  } tests[] = {
+    { "between commands", testBetweenCommands },
+    { "inside a reply", testInsideReply },
+    { "half a line", testHalfLine },
+    { "a burst", testBurst },
+    { "removed", testRemoved },
+  };
+  int status = 0;
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+    nrCMTI = 0;
+    nrRING = 0;
+    nrCREG = 0;
+    lastCMTI.clear();
+    bool ok = tests[i].test();
+    printf("%-18s %-6s %5u %5u %5u\n", tests[i].label, ok ? "ok" : "FAILED", nrCMTI, nrRING, nrCREG);
+    if (!script.getMismatches().empty()) {
+      printf("  unexpected command %s\n", script.getMismatches()[0].c_str());
+    }
+    if (!ok) {
+      status = 1;
+    }
+    script.clear();
+    delay(1000);
+  }
+  return status;
+}
@@ -0,0 +1,55 @@
+#include "GPRSbee.h"
+
+#define SENSOR_PIN A0
+
+int8_t csqHandle = -1;
+uint32_t lastSubmit = 0;
+uint32_t samples = 0;
+
+void setup()
+{
+  //Wait until the serial monitor is ready/open
+  while(!SerialUSB);
+
+  //Start the Bee Serial port initially
+  Serial1.begin(57600);
+
+  //Switch on the VCC for the Bee socket
+  digitalWrite(BEE_VCC, HIGH);
+
+  gprsbee.init(Serial1, CTS, DTR);
+  gprsbee.setDiag(SerialUSB);
+
+  //Comment out this line when used with GPRSbee Rev.4
+  gprsbee.setPowerSwitchedOnOff(true);
+
+  gprsbee.on();
+}
+
+void loop()
+{
+  //Let the command engine do its work, this never blocks
+  gprsbee.poll();
+
+  //Ask for the signal quality every 5 seconds
+  if (csqHandle < 0 && (millis() - lastSubmit) > 5000) {
+    csqHandle = gprsbee.submitCommand_P(PSTR("AT+CSQ"), PSTR("+CSQ:"));
+    lastSubmit = millis();
+  }
+
+  if (gprsbee.isCommandDone(csqHandle)) {
+    SerialUSB.print("CSQ status: ");
+    SerialUSB.print(gprsbee.getCommandStatus(csqHandle));
+    SerialUSB.print(" reply: ");
+    SerialUSB.print(gprsbee.getCommandReply(csqHandle));
+    SerialUSB.print(" samples meanwhile: ");
+    SerialUSB.println(samples);
+    gprsbee.releaseCommand(csqHandle);
+    csqHandle = -1;
+    samples = 0;
+  }
+
+  //Meanwhile we are free to sample sensors
+  analogRead(SENSOR_PIN);
+  samples++;
+}
@@ -0,0 +1,104 @@
+#define APN ""
+#define APN_USERNAME ""
+#define APN_PASSWORD ""
+
+#define TCP_SERVER "example.com"
+#define TCP_PORT 8500
+#define FTP_SERVER "ftp.example.com"
+#define FTP_USERNAME "anonymous"
+#define FTP_PASSWORD ""
+#define SMS_NUMBER ""
+
+//Set to 1 to record the AT conversation on SerialUSB, for replay by a modem emulator
+#define TRACE 0
+
+#include "GPRSbee.h"
+#include "GPRSbeeTraceStream.h"
+
+GPRSbeeTraceStream traceStream(Serial1);
+#if TRACE
+//The trace of one transaction, it is printed after the transaction
+char traceBuffer[8192];
+#endif
+uint32_t start;
+uint32_t startCommands;
+
+void begin()
+{
+  traceStream.reset();
+  startCommands = gprsbee.getCommandCount();
+  start = millis();
+}
+
+void report(const char *label, bool ok)
+{
+  uint32_t elapsed = millis() - start;
+  SerialUSB.println();
+  SerialUSB.println(String(label) + (ok ? " ok" : " FAILED"));
+  SerialUSB.println("  ms: " + String(elapsed, DEC));
+  SerialUSB.println("  AT commands: " + String(gprsbee.getCommandCount() - startCommands, DEC));
+  SerialUSB.println("  bytes sent: " + String(traceStream.getNrBytesSent(), DEC));
+  SerialUSB.println("  bytes received: " + String(traceStream.getNrBytesReceived(), DEC));
+#if TRACE
+  SerialUSB.println("# " + String(label));
+  traceStream.printTrace(SerialUSB);
+#endif
+  SerialUSB.println("--------------------");
+}
+
+void setup()
+{
+  //Wait until the serial monitor is ready/open
+  while(!SerialUSB);
+
+  //Open Serial1 for the GPRSbee
+  Serial1.begin(57600);
+
+  //Switch on the VCC for the Bee socket
+  digitalWrite(BEE_VCC, HIGH);
+
+  gprsbee.init(traceStream, CTS, DTR);
+#if TRACE
+  traceStream.setTrace(traceBuffer, sizeof(traceBuffer));
+#endif
+
+  //Comment out this line when used with GPRSbee Rev.4
+  gprsbee.setPowerSwitchedOnOff(true);
+}
+
+void loop()
+{
+  char buffer[256];
+  bool ok;
+
+  begin();
+  ok = gprsbee.doHTTPGET(APN, APN_USERNAME, APN_PASSWORD, "http://httpbin.org/get", buffer, sizeof(buffer));
+  report("doHTTPGET", ok);
+
+  begin();
+  ok = gprsbee.doHTTPPOSTWithReply(APN, APN_USERNAME, APN_PASSWORD,
+    "http://httpbin.org/post", "Some payload data...", 20, buffer, sizeof(buffer));
+  report("doHTTPPOSTWithReply", ok);
+
+  begin();
+  ok = gprsbee.openTCP(APN, APN_USERNAME, APN_PASSWORD, TCP_SERVER, TCP_PORT);
+  if (ok) {
+    gprsbee.closeTCP();
+  }
+  report("openTCP + closeTCP", ok);
+
+  begin();
+  ok = gprsbee.openFTP(APN, APN_USERNAME, APN_PASSWORD, FTP_SERVER, FTP_USERNAME, FTP_PASSWORD);
+  if (ok) {
+    gprsbee.closeFTP();
+  }
+  report("openFTP + closeFTP", ok);
+
+  if (SMS_NUMBER[0]) {
+    begin();
+    ok = gprsbee.sendSMS(SMS_NUMBER, "GPRSbee benchmark");
+    report("sendSMS", ok);
+  }
+
+  delay(60000);
+}
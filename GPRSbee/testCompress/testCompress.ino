@@ -0,0 +1,121 @@
+#define APN ""
+#define APN_USERNAME ""
+#define APN_PASSWORD ""
+
+//A TCP server that stores what it gets, e.g. "ncat -l 8500 -k > upload.lz"
+//Decompress it with "gprsbee-unlz upload.lz", see GPRSbee/tools
+#define TCP_SERVER "example.com"
+#define TCP_PORT 8500
+
+//Set to 1 to also upload the compressed records
+#define UPLOAD 0
+
+#define NR_RECORDS 1000
+
+#include "GPRSbee.h"
+#include "GPRSbeeLZ.h"
+#include "GPRSbeeTCPStream.h"
+
+//Only counts, to benchmark the compressor without the output
+class NullPrint : public Print
+{
+public:
+  size_t write(uint8_t) { return 1; }
+  size_t write(const uint8_t *, size_t size) { return size; }
+};
+
+GPRSbeeLZCompressor lz;
+GPRSbeeTCPStream tcp;
+NullPrint null;
+
+//A log record like the AirQuality sketch would keep, as text
+void printRecord(Print &out, int i)
+{
+  out.print(1463040000UL + i * 60UL);
+  out.print(',');
+  out.print(21.3 + (i % 50) * 0.02 - (i % 7) * 0.01, 2);
+  out.print(',');
+  out.print(45.0 + (i % 30) * 0.1, 1);
+  out.print(',');
+  out.print(analogRead(A0));
+  out.println(i % 17 == 0 ? ",High pollution!" : ",Fresh air");
+}
+
+void benchmark()
+{
+  uint32_t raw = 0;
+  uint32_t start;
+  uint32_t elapsed;
+
+  //The formatting of the records alone
+  start = micros();
+  for (int i=0; i<NR_RECORDS; i++) {
+    printRecord(null, i);
+  }
+  uint32_t formatting = micros() - start;
+
+  start = micros();
+  lz.begin(null);
+  for (int i=0; i<NR_RECORDS; i++) {
+    printRecord(lz, i);
+  }
+  lz.end();
+  elapsed = micros() - start - formatting;
+  raw = lz.getNrBytesIn();
+
+  SerialUSB.println("Records: " + String(NR_RECORDS, DEC));
+  SerialUSB.println("  bytes in: " + String(raw, DEC));
+  SerialUSB.println("  bytes out: " + String(lz.getNrBytesOut(), DEC));
+  SerialUSB.println("  ratio: " + String((float)raw / lz.getNrBytesOut(), 2));
+  SerialUSB.println("  compress us: " + String(elapsed, DEC));
+  SerialUSB.println("  kB/s: " + String(raw * 1000 / (elapsed ? elapsed : 1), DEC));
+  SerialUSB.println("  cycles/byte: " + String((uint32_t)((uint64_t)elapsed * (F_CPU / 1000000) / raw), DEC));
+  SerialUSB.println("--------------------");
+}
+
+void upload()
+{
+  if (!tcp.connect(APN, APN_USERNAME, APN_PASSWORD, TCP_SERVER, TCP_PORT)) {
+    SerialUSB.println("Connect failed");
+    return;
+  }
+  uint32_t start = millis();
+  lz.begin(tcp);
+  for (int i=0; i<NR_RECORDS; i++) {
+    printRecord(lz, i);
+  }
+  lz.end();
+  tcp.flush();
+  uint32_t elapsed = millis() - start;
+  tcp.stop();
+
+  SerialUSB.println("Uploaded " + String(lz.getNrBytesIn(), DEC) + " bytes as " + String(lz.getNrBytesOut(), DEC));
+  SerialUSB.println("  ms: " + String(elapsed, DEC));
+  SerialUSB.println("--------------------");
+}
+
+void setup()
+{
+  //Wait until the serial monitor is ready/open
+  while(!SerialUSB);
+
+  //Open Serial1 for the GPRSbee
+  Serial1.begin(57600);
+
+  //Switch on the VCC for the Bee socket
+  digitalWrite(BEE_VCC, HIGH);
+
+  gprsbee.init(Serial1, CTS, DTR);
+
+  //Comment out this line when used with GPRSbee Rev.4
+  gprsbee.setPowerSwitchedOnOff(true);
+
+  benchmark();
+#if UPLOAD
+  upload();
+#endif
+}
+
+void loop()
+{
+}
@@ -0,0 +1,57 @@
+#define APN ""
+#define APN_USERNAME ""
+#define APN_PASSWORD ""
+
+#include "GPRSbee.h"
+#include "GPRSbeeDiagSink.h"
+
+//The diagnostic output of gprsbee goes to the ring buffer, drainDiag() moves it to SerialUSB
+GPRSbeeDiagSink diagSink(&SerialUSB);
+
+//Called by gprsbee while it waits for the modem, so the ring doesn't fill up during a GET
+void drainDiag()
+{
+  diagSink.drain();
+}
+
+void setup()
+{
+  //Wait until the serial monitor is ready/open
+  while(!SerialUSB);
+
+  //Open Serial1 for the GPRSbee
+  Serial1.begin(57600);
+
+  //Switch on the VCC for the Bee socket
+  digitalWrite(BEE_VCC, HIGH);
+
+  gprsbee.init(Serial1, CTS, DTR);
+  gprsbee.setDiag(diagSink);
+  gprsbee.setIdleHandler(drainDiag);
+
+  //Comment out this line when used with GPRSbee Rev.4
+  gprsbee.setPowerSwitchedOnOff(true);
+}
+
+void loop()
+{
+  char buffer[256];
+
+  bool retval = gprsbee.doHTTPGET(APN, APN_USERNAME, APN_PASSWORD,
+    "http://httpbin.org/get", buffer, sizeof(buffer));
+
+  if (!retval) {
+    //Show what happened just before the failure
+    SerialUSB.println("GET failed, the last diagnostics:");
+    diagSink.dump(SerialUSB);
+    SerialUSB.println();
+    SerialUSB.println("Dropped diagnostic bytes: " + String(diagSink.getNrDropped(), DEC));
+  }
+
+  //Drain the diagnostics in small pieces while waiting for the next GET
+  uint32_t start = millis();
+  while (millis() - start < 60000) {
+    diagSink.drain();
+    delay(10);
+  }
+}
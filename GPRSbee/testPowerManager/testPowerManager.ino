@@ -0,0 +1,56 @@
+#define APN ""
+#define APN_USERNAME ""
+#define APN_PASSWORD ""
+
+//Seconds between two uploads
+#define INTERVAL 60
+
+//The MCU pin wired to DTR of the SIM900, -1 if there is none.
+//Without it the sleep policy is not available.
+#define SIM900_DTR -1
+
+#include "GPRSbee.h"
+#include "GPRSbeePowerManager.h"
+
+GPRSbeePowerManager power;
+
+void setup()
+{
+  //Wait until the serial monitor is ready/open
+  while(!SerialUSB);
+
+  //Open Serial1 for the GPRSbee
+  Serial1.begin(57600);
+
+  //Switch on the VCC for the Bee socket
+  digitalWrite(BEE_VCC, HIGH);
+
+  gprsbee.init(Serial1, CTS, DTR);
+
+  //Comment out this line when used with GPRSbee Rev.4
+  gprsbee.setPowerSwitchedOnOff(true);
+
+  power.begin(SIM900_DTR);
+}
+
+void loop()
+{
+  char* data="Some payload data...";
+
+  //Until the latencies are measured the choice is based on initial guesses
+  power.choosePolicy(INTERVAL);
+
+  uint32_t start = millis();
+  bool retval = gprsbee.doHTTPPOST(APN, APN_USERNAME, APN_PASSWORD,
+    "http://httpbin.org/post", data, strlen(data));
+
+  SerialUSB.print(retval ? "POST ok, ms: " : "POST failed, ms: ");
+  SerialUSB.println(millis() - start);
+  power.printReport(SerialUSB, INTERVAL);
+  SerialUSB.println("--------------------");
+
+  uint32_t elapsed = millis() - start;
+  if (elapsed < INTERVAL * 1000UL) {
+    delay(INTERVAL * 1000UL - elapsed);
+  }
+}
@@ -0,0 +1,66 @@
+#define APN ""
+#define APN_USERNAME ""
+#define APN_PASSWORD ""
+
+//Any TCP server that accepts data, e.g. "ncat -l 8500 -k > /dev/null"
+#define SERVER "example.com"
+#define PORT 8500
+
+#define NR_MESSAGES 20
+
+#include "GPRSbee.h"
+
+void benchmark(const char *label, bool quickSend)
+{
+  uint8_t msg[] = "temp=21.5 hum=40 seq=0000\n";
+  int ok = 0;
+
+  gprsbee.setQuickSend(quickSend);
+  if (!gprsbee.openTCP(APN, APN_USERNAME, APN_PASSWORD, SERVER, PORT)) {
+    SerialUSB.println("openTCP failed");
+    return;
+  }
+  uint32_t start = millis();
+  for (int i=0; i<NR_MESSAGES; i++) {
+    ok += gprsbee.sendDataTCP(msg, sizeof(msg) - 1);
+  }
+  if (quickSend) {
+    //Only count the messages that the server has really received
+    gprsbee.waitForTCPAck();
+  }
+  uint32_t elapsed = millis() - start;
+  gprsbee.closeTCP();
+
+  SerialUSB.print(label);
+  SerialUSB.print(" ok: ");
+  SerialUSB.print(ok);
+  SerialUSB.print("/");
+  SerialUSB.print(NR_MESSAGES);
+  SerialUSB.print(" messages/s: ");
+  SerialUSB.println(NR_MESSAGES * 1000.0 / elapsed);
+}
+
+void setup()
+{
+  //Wait until the serial monitor is ready/open
+  while(!SerialUSB);
+
+  //Start the Bee Serial port initially
+  Serial1.begin(57600);
+
+  //Switch on the VCC for the Bee socket
+  digitalWrite(BEE_VCC, HIGH);
+
+  gprsbee.init(Serial1, CTS, DTR);
+
+  //Comment out this line when used with GPRSbee Rev.4
+  gprsbee.setPowerSwitchedOnOff(true);
+}
+
+void loop()
+{
+  benchmark("SEND OK", false);
+  benchmark("Quick send", true);
+
+  delay(60000);
+}
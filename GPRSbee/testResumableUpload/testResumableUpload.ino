@@ -0,0 +1,97 @@
+#define APN ""
+#define APN_USERNAME ""
+#define APN_PASSWORD ""
+
+#define FTP_SERVER "ftp.example.com"
+#define FTP_USERNAME "anonymous"
+#define FTP_PASSWORD ""
+
+//The log to upload, LOG_SIZE bytes in the DataFlash from LOG_PAGE on,
+//written by the logger. Another LOG_ID starts a new upload.
+#define LOG_ID 1
+#define LOG_PAGE 100
+#define LOG_SIZE 60000UL
+
+//Sodaq_Checkpoint uses this page and the next one
+#define CHECKPOINT_PAGE 10
+
+//Sodaq_dataflash and Sodaq_checkpoint are in SPI/testDataFlash, copy
+//them to this sketch or install them as a library
+#include <SPI.h>
+#include "GPRSbee.h"
+#include "GPRSbeeResumableUpload.h"
+#include "Sodaq_dataflash.h"
+#include "Sodaq_checkpoint.h"
+
+Sodaq_Checkpoint checkpoint;
+GPRSbeeResumableUpload upload;
+
+//The checkpoint store of the upload, it survives a reset
+bool loadCheckpoint(GPRSbeeCheckpoint *cp)
+{
+  return checkpoint.load(cp, sizeof(*cp));
+}
+
+void saveCheckpoint(const GPRSbeeCheckpoint *cp)
+{
+  checkpoint.save(cp, sizeof(*cp));
+}
+
+//The source of the upload, any part of the log can be read again
+size_t readLog(uint32_t offset, uint8_t *buffer, size_t size)
+{
+  if (offset >= LOG_SIZE) {
+    return 0;
+  }
+  if (size > LOG_SIZE - offset) {
+    size = LOG_SIZE - offset;
+  }
+  dflash.readContinuous(LOG_PAGE + offset / dflash.getPageSize(),
+    offset % dflash.getPageSize(), buffer, size);
+  return size;
+}
+
+void setup()
+{
+  //Wait until the serial monitor is ready/open
+  while(!SerialUSB);
+
+  //Open Serial1 for the GPRSbee
+  Serial1.begin(57600);
+
+  //Switch on the VCC for the Bee socket
+  digitalWrite(BEE_VCC, HIGH);
+
+  gprsbee.init(Serial1, CTS, DTR);
+  gprsbee.setDiag(SerialUSB);
+
+  //Comment out this line when used with GPRSbee Rev.4
+  gprsbee.setPowerSwitchedOnOff(true);
+
+  dflash.init();
+  checkpoint.init(dflash, CHECKPOINT_PAGE);
+  upload.setCheckpointStore(loadCheckpoint, saveCheckpoint);
+}
+
+void loop()
+{
+  //After a reset this continues where the last upload stopped
+  upload.begin(LOG_ID, LOG_SIZE, readLog);
+  SerialUSB.println("Upload from offset " + String(upload.getOffset(), DEC));
+
+  bool retval = upload.sendFTP(APN, APN_USERNAME, APN_PASSWORD,
+    FTP_SERVER, FTP_USERNAME, FTP_PASSWORD, "/", "log.bin");
+
+  if (retval) {
+    SerialUSB.println("Upload done");
+  } else if (upload.hasSourceError()) {
+    SerialUSB.println("Upload aborted, the log can't be read");
+  } else {
+    SerialUSB.println("Upload stopped at offset " + String(upload.getOffset(), DEC));
+  }
+  SerialUSB.println("Bytes sent: " + String(upload.getNrBytesSent(), DEC) +
+    " in " + String(upload.getNrAttempts(), DEC) + " attempts");
+
+  //Try again in a minute, a finished upload just checks the server size
+  delay(60000);
+}
@@ -0,0 +1,71 @@
+#define APN ""
+#define APN_USERNAME ""
+#define APN_PASSWORD ""
+
+#define NR_REQUESTS 5
+
+#include "GPRSbee.h"
+#include "GPRSbeeHTTPSession.h"
+
+void report(const char *label, uint32_t start, uint32_t commands, int ok)
+{
+  SerialUSB.print(label);
+  SerialUSB.print(" ok: ");
+  SerialUSB.print(ok);
+  SerialUSB.print("/");
+  SerialUSB.print(NR_REQUESTS);
+  SerialUSB.print(" ms/request: ");
+  SerialUSB.print((millis() - start) / NR_REQUESTS);
+  SerialUSB.print(" AT commands/request: ");
+  SerialUSB.println((gprsbee.getCommandCount() - commands) / NR_REQUESTS);
+}
+
+void setup()
+{
+  //Wait until the serial monitor is ready/open
+  while(!SerialUSB);
+
+  //Start the Bee Serial port initially
+  Serial1.begin(57600);
+
+  //Switch on the VCC for the Bee socket
+  digitalWrite(BEE_VCC, HIGH);
+
+  gprsbee.init(Serial1, CTS, DTR);
+
+  //Comment out this line when used with GPRSbee Rev.4
+  gprsbee.setPowerSwitchedOnOff(true);
+}
+
+void loop()
+{
+  char* data="Some payload data...";
+  uint32_t start;
+  uint32_t commands;
+  int ok;
+
+  //One-shot requests, each one does the full power up and attach
+  start = millis();
+  commands = gprsbee.getCommandCount();
+  ok = 0;
+  for (int i=0; i<NR_REQUESTS; i++) {
+    ok += gprsbee.doHTTPPOST(APN, APN_USERNAME, APN_PASSWORD,
+      "http://httpbin.org/post", data, strlen(data));
+  }
+  report("Without reuse", start, commands, ok);
+
+  //The same requests in one session
+  GPRSbeeHTTPSession session;
+  start = millis();
+  commands = gprsbee.getCommandCount();
+  ok = 0;
+  if (session.begin(APN, APN_USERNAME, APN_PASSWORD)) {
+    for (int i=0; i<NR_REQUESTS; i++) {
+      ok += session.doHTTPPOST("http://httpbin.org/post", data, strlen(data));
+    }
+    session.end();
+  }
+  report("With reuse", start, commands, ok);
+
+  delay(60000);
+}
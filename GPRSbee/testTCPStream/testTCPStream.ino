@@ -0,0 +1,78 @@
+#define APN ""
+#define APN_USERNAME ""
+#define APN_PASSWORD ""
+
+//A TCP echo server, e.g. "ncat -l 8500 -k -c cat"
+#define ECHO_SERVER "example.com"
+#define ECHO_PORT 8500
+
+#define NR_LINES 500
+
+#include "GPRSbee.h"
+#include "GPRSbeeTCPStream.h"
+
+GPRSbeeTCPStream tcp;
+
+void setup()
+{
+  //Wait until the serial monitor is ready/open
+  while(!SerialUSB);
+
+  //Start the Bee Serial port initially
+  Serial1.begin(57600);
+
+  //Switch on the VCC for the Bee socket
+  digitalWrite(BEE_VCC, HIGH);
+
+  gprsbee.init(Serial1, CTS, DTR);
+
+  //Comment out this line when used with GPRSbee Rev.4
+  gprsbee.setPowerSwitchedOnOff(true);
+}
+
+void loop()
+{
+  uint32_t echoed = 0;
+
+  if (!tcp.connect(APN, APN_USERNAME, APN_PASSWORD, ECHO_SERVER, ECHO_PORT)) {
+    SerialUSB.println("Connect failed");
+    delay(60000);
+    return;
+  }
+
+  //Push telemetry lines, count the echo while sending
+  uint32_t start = millis();
+  for (int i=0; i<NR_LINES; i++) {
+    tcp.print("temp=");
+    tcp.print(analogRead(A0));
+    tcp.print(" seq=");
+    tcp.println(i);
+    while (tcp.available()) {
+      tcp.read();
+      echoed++;
+    }
+  }
+  tcp.flush();
+  uint32_t elapsed = millis() - start;
+
+  //Collect the rest of the echo
+  uint32_t ts = millis();
+  while (echoed < tcp.getNrBytesWritten() && millis() - ts < 10000) {
+    if (tcp.available()) {
+      tcp.read();
+      echoed++;
+    }
+  }
+  tcp.stop();
+
+  SerialUSB.print("Bytes: ");
+  SerialUSB.print(tcp.getNrBytesWritten());
+  SerialUSB.print(" UART writes: ");
+  SerialUSB.print(tcp.getNrUARTWrites());
+  SerialUSB.print(" bytes/s: ");
+  SerialUSB.print(tcp.getNrBytesWritten() * 1000 / (elapsed ? elapsed : 1));
+  SerialUSB.print(" echoed: ");
+  SerialUSB.println(echoed);
+
+  delay(60000);
+}
@@ -0,0 +1,92 @@
+#define APN ""
+#define APN_USERNAME ""
+#define APN_PASSWORD ""
+
+#include "GPRSbee.h"
+
+//Counters, filled in by the URC handlers
+uint16_t nrCREG = 0;
+uint16_t nrReady = 0;
+uint16_t nrOther = 0;
+
+void onCREG(const char *line)
+{
+  nrCREG++;
+}
+
+void onReady(const char *line)
+{
+  nrReady++;
+}
+
+void onOther(const char *line)
+{
+  nrOther++;
+}
+
+void setup()
+{
+  //Wait until the serial monitor is ready/open
+  while(!SerialUSB);
+
+  //Start the Bee Serial port initially
+  Serial1.begin(57600);
+
+  //Switch on the VCC for the Bee socket
+  digitalWrite(BEE_VCC, HIGH);
+
+  gprsbee.init(Serial1, CTS, DTR);
+  gprsbee.setDiag(SerialUSB);
+
+  //Comment out this line when used with GPRSbee Rev.4
+  gprsbee.setPowerSwitchedOnOff(true);
+
+  //The handlers see every line that starts with the prefix, also the
+  //lines that a blocking function skips
+  gprsbee.addURCHandler_P(PSTR("+CREG:"), onCREG);
+  gprsbee.addURCHandler_P(PSTR("Call Ready"), onReady);
+  gprsbee.addURCHandler_P(PSTR("SMS Ready"), onReady);
+  gprsbee.addURCHandler_P(PSTR("+CPIN:"), onOther);
+  gprsbee.addURCHandler_P(PSTR("RDY"), onOther);
+}
+
+void loop()
+{
+  gprsbee.on();
+  report("After on()");
+
+  //Leave the network and come back. AT+CFUN=1 returns right away, the
+  //registration follows a bit later. So the prolog below finds the SIMx00
+  //searching, enables the +CREG URC and waits for it. When nothing is
+  //heard for 10 seconds it asks AT+CREG? again.
+  gprsbee.setCFUN(4);
+  gprsbee.setCFUN(1);
+  uint32_t nrCommands = gprsbee.getCommandCount();
+  uint32_t start = millis();
+  bool registered = gprsbee.doHTTPprolog(APN, APN_USERNAME, APN_PASSWORD);
+  gprsbee.doHTTPepilog();
+  SerialUSB.println("Registered: " + String((int)registered, DEC)
+      + " after " + String(millis() - start, DEC) + " ms"
+      + " and " + String(gprsbee.getCommandCount() - nrCommands, DEC) + " commands");
+  report("After the prolog");
+
+  //A removed handler is not called anymore
+  gprsbee.removeURCHandler(onCREG);
+  uint16_t before = nrCREG;
+  gprsbee.sendCommandWaitForOK_P(PSTR("AT+CREG?"));
+  SerialUSB.println("Removed handler called: " + String((int)(nrCREG - before), DEC) + " times (expect 0)");
+  gprsbee.addURCHandler_P(PSTR("+CREG:"), onCREG);
+
+  gprsbee.off();
+  SerialUSB.println("--------------------");
+  delay(10000);
+}
+
+void report(const char *label)
+{
+  SerialUSB.println(String(label) + ":");
+  SerialUSB.println("  +CREG lines: " + String(nrCREG, DEC));
+  SerialUSB.println("  CREG status: " + String(gprsbee.getCREGStatus(), DEC));
+  SerialUSB.println("  Ready lines: " + String(nrReady, DEC));
+  SerialUSB.println("  Other lines: " + String(nrOther, DEC));
+}
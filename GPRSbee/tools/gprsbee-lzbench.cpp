@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-lzbench: ratio and throughput of GPRSbeeLZCompressor on the host
+ *
+ * It runs the compressor of the driver, built with the Arduino core of
+ * GPRSbee/host, on generated data shaped like our logs:
+ *  - records  the text records of testCompress.ino, with a drifting ADC value
+ *  - adc16    16 bit little endian ADC samples, a slow signal with some noise
+ *  - random   the worst case
+ * or on the files given on the command line, e.g. recorded datasets.
+ *
+ *   gprsbee-lzbench [-o dir] [file ...]
+ *     -o  write each input and its compressed stream to dir, as <name> and
+ *         <name>.lz, so that they can be checked with gprsbee-unlz
+ *
+ * The window is fixed at compile time, see GPRSBEE_LZ_WINDOW_BITS and the
+ * Makefile. The speed is that of the host. For the SAMD21 cycle budget run
+ * testCompress.ino on the board, it uses the same records.
+ */
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "GPRSbeeLZ.h"
+
+#define NR_RECORDS      2000
+#define NR_SAMPLES      20000
+#define RANDOM_SIZE     50000
+
+// At least this much CPU time per measurement, in ns
+#define MIN_BENCH_NS    200000000ULL
+
+class StringPrint : public Print
+{
+public:
+  size_t write(uint8_t c) { _str += (char)c; return 1; }
+  size_t write(const uint8_t *buffer, size_t size) { _str.append((const char *)buffer, size); return size; }
+  using Print::write;
+  std::string &str() { return _str; }
+private:
+  std::string _str;
+};
+
+// Only counts, like NullPrint in testCompress.ino
+class NullPrint : public Print
+{
+public:
+  size_t write(uint8_t) { return 1; }
+  size_t write(const uint8_t *, size_t size) { return size; }
+  using Print::write;
+};
+
+// A small LCG, the data must be the same on every run
+static uint32_t seed = 12345;
+static uint32_t nextRandom()
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static uint64_t nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// The same record as printRecord() in testCompress.ino
+static void printRecord(Print &out, int i, int adc)
+{
+  out.print(1463040000UL + i * 60UL);
+  out.print(',');
+  out.print(21.3 + (i % 50) * 0.02 - (i % 7) * 0.01, 2);
+  out.print(',');
+  out.print(45.0 + (i % 30) * 0.1, 1);
+  out.print(',');
+  out.print(adc);
+  out.println(i % 17 == 0 ? ",High pollution!" : ",Fresh air");
+}
+
+static std::string makeRecords()
+{
+  StringPrint out;
+  int adc = 512;
+  for (int i = 0; i < NR_RECORDS; ++i) {
+    adc += (int)(nextRandom() % 7) - 3;
+    printRecord(out, i, adc);
+  }
+  return out.str();
+}
+
+static std::string makeADC16()
+{
+  std::string data;
+  int level = 2000;
+  for (int i = 0; i < NR_SAMPLES; ++i) {
+    if (i % 200 == 0) {
+      level += (int)(nextRandom() % 201) - 100;
+    }
+    int sample = level + (int)(nextRandom() % 9) - 4;
+    data += (char)(sample & 0xFF);
+    data += (char)(sample >> 8);
+  }
+  return data;
+}
+
+static std::string makeRandom()
+{
+  std::string data;
+  for (int i = 0; i < RANDOM_SIZE; ++i) {
+    data += (char)nextRandom();
+  }
+  return data;
+}
+
+static bool readFile(const char *path, std::string &data)
+{
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    perror(path);
+    return false;
+  }
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    data.append(buf, n);
+  }
+  bool ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
+static bool writeFile(const std::string &path, const std::string &data)
+{
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (!fp) {
+    perror(path.c_str());
+    return false;
+  }
+  bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+  ok = fclose(fp) == 0 && ok;
+  return ok;
+}
+
+static GPRSbeeLZCompressor lz;
+
+/*
+ * Compress the data, in the pieces of a record logger (at most 64 bytes a
+ * write), and time it
+ */
+static bool bench(const char *name, const std::string &data, const char *dir)
+{
+  StringPrint out;
+  lz.begin(out);
+  for (size_t i = 0; i < data.size(); i += 64) {
+    size_t n = data.size() - i < 64 ? data.size() - i : 64;
+    lz.write((const uint8_t *)data.data() + i, n);
+  }
+  lz.end();
+
+  NullPrint null;
+  uint32_t rounds = 0;
+  uint64_t start = nowNs();
+  uint64_t elapsed;
+  do {
+    lz.begin(null);
+    for (size_t i = 0; i < data.size(); i += 64) {
+      size_t n = data.size() - i < 64 ? data.size() - i : 64;
+      lz.write((const uint8_t *)data.data() + i, n);
+    }
+    lz.end();
+    ++rounds;
+    elapsed = nowNs() - start;
+  } while (elapsed < MIN_BENCH_NS);
+
+  double nsPerByte = (double)elapsed / rounds / data.size();
+  printf("%-12s %8lu %8lu %6.2f %8.1f %8.2f\n", name,
+      (unsigned long)data.size(), (unsigned long)out.str().size(),
+      (double)data.size() / out.str().size(), 1000.0 / nsPerByte, nsPerByte);
+
+  if (dir) {
+    std::string path = std::string(dir) + "/" + name;
+    return writeFile(path, data) && writeFile(path + ".lz", out.str());
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *dir = 0;
+  int i = 1;
+
+  if (i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+    dir = argv[i + 1];
+    i += 2;
+  }
+  if (i < argc && argv[i][0] == '-') {
+    fprintf(stderr, "Usage: %s [-o dir] [file ...]\n", argv[0]);
+    return 2;
+  }
+
+  printf("window %d bytes, chain %d\n", 1 << GPRSBEE_LZ_WINDOW_BITS, GPRSBEE_LZ_MAX_CHAIN);
+  printf("%-12s %8s %8s %6s %8s %8s\n", "data", "in", "out", "ratio", "MB/s", "ns/byte");
+
+  bool ok = true;
+  if (i == argc) {
+    ok = bench("records", makeRecords(), dir) && ok;
+    ok = bench("adc16", makeADC16(), dir) && ok;
+    ok = bench("random", makeRandom(), dir) && ok;
+  }
+  for (; i < argc; ++i) {
+    std::string data;
+    const char *name = strrchr(argv[i], '/');
+    if (!readFile(argv[i], data)) {
+      ok = false;
+      continue;
+    }
+    ok = bench(name ? name + 1 : argv[i], data, dir) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of GPRSbee.
+ *
+ * GPRSbee is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * GPRSbee is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GPRSbee.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * gprsbee-unlz: decompress what GPRSbeeLZCompressor produced
+ *
+ * This is for the server side (ingestion), it does not use Arduino.
+ * Build and use it like this
+ *   g++ -O2 -o gprsbee-unlz gprsbee-unlz.cpp
+ *   gprsbee-unlz [-v] [file] > output
+ * Without a file it reads stdin. Streams that were appended to one file,
+ * e.g. several uploads, are decompressed one after the other.
+ * With -v the sizes and the ratio are written to stderr.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// See GPRSbeeLZ.h
+#define LZ_VERSION              1
+#define LZ_MIN_MATCH            3
+#define LZ_END_MARKER           0xFFFF
+
+static const char *progname = "gprsbee-unlz";
+
+static bool readAll(FILE *fp, std::vector<uint8_t> &data)
+{
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  return !ferror(fp);
+}
+
+/*
+ * Decompress one stream, starting at in[*pos]
+ *
+ * The output is appended to out (matches refer to this stream only).
+ * Returns an error message, or NULL if all is well.
+ */
+static const char *decompress(const std::vector<uint8_t> &in, size_t *pos, std::vector<uint8_t> &out)
+{
+  size_t ix = *pos;
+  size_t start = out.size();
+
+  if (in.size() - ix < 4 || in[ix] != 'L' || in[ix + 1] != 'Z') {
+    return "not a GPRSbee LZ stream";
+  }
+  if (in[ix + 2] != LZ_VERSION) {
+    return "unknown version";
+  }
+  if (in[ix + 3] < 9 || in[ix + 3] > 12) {
+    return "invalid window size";
+  }
+  ix += 4;
+
+  while (true) {
+    if (ix >= in.size()) {
+      return "truncated stream (no end marker)";
+    }
+    uint8_t flags = in[ix++];
+    for (int bit = 0; bit < 8; ++bit) {
+      if ((flags & (1 << bit)) == 0) {
+        if (ix >= in.size()) {
+          return "truncated stream";
+        }
+        out.push_back(in[ix++]);
+        continue;
+      }
+      if (in.size() - ix < 2) {
+        return "truncated stream";
+      }
+      uint16_t code = (in[ix] << 8) | in[ix + 1];
+      ix += 2;
+      if (code == LZ_END_MARKER) {
+        *pos = ix;
+        return NULL;
+      }
+      size_t dist = (code >> 4) + 1;
+      size_t len = (code & 0xF) + LZ_MIN_MATCH;
+      if (dist > out.size() - start) {
+        return "corrupt stream (distance)";
+      }
+      // Byte by byte, the match may overlap what it produces
+      size_t src = out.size() - dist;
+      for (size_t i = 0; i < len; ++i) {
+        out.push_back(out[src + i]);
+      }
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  bool verbose = false;
+  const char *fname = NULL;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      fprintf(stderr, "Usage: %s [-v] [file]\n", progname);
+      return 2;
+    } else {
+      fname = argv[i];
+    }
+  }
+
+  FILE *fp = stdin;
+  if (fname && strcmp(fname, "-") != 0) {
+    fp = fopen(fname, "rb");
+    if (!fp) {
+      perror(fname);
+      return 1;
+    }
+  }
+  std::vector<uint8_t> in;
+  bool ok = readAll(fp, in);
+  if (fp != stdin) {
+    fclose(fp);
+  }
+  if (!ok) {
+    fprintf(stderr, "%s: read error\n", progname);
+    return 1;
+  }
+
+  std::vector<uint8_t> out;
+  size_t pos = 0;
+  int nrStreams = 0;
+  do {
+    const char *err = decompress(in, &pos, out);
+    if (err) {
+      fprintf(stderr, "%s: %s, in the stream at offset %lu\n", progname, err, (unsigned long)pos);
+      return 1;
+    }
+    ++nrStreams;
+  } while (pos < in.size());
+
+  if (fwrite(out.data(), 1, out.size(), stdout) != out.size()) {
+    fprintf(stderr, "%s: write error\n", progname);
+    return 1;
+  }
+  if (verbose) {
+    fprintf(stderr, "%d stream(s), %lu -> %lu bytes, ratio %.2f\n", nrStreams,
+        (unsigned long)in.size(), (unsigned long)out.size(),
+        in.size() ? (double)out.size() / in.size() : 0.0);
+  }
+  return 0;
+}
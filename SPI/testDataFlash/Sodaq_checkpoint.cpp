@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "Sodaq_crc8.h"
+#include "Sodaq_checkpoint.h"
+
+#define MAGIC0                  'C'
+#define MAGIC1                  'P'
+// magic(2) seq(4) len(1)
+#define HDR_SIZE                7
+
+/*
+ * Use the pages firstPage and firstPage + 1
+ *
+ * The DataFlash must already be initialized.
+ */
+bool Sodaq_Checkpoint::init(Sodaq_Dataflash &df, uint16_t firstPage)
+{
+  if (firstPage + 2 > df.getNrPages()) {
+    return false;
+  }
+  _df = &df;
+  _firstPage = firstPage;
+
+  // Continue with the sequence of the newest slot
+  _seq = 0;
+  for (uint8_t slot = 0; slot < 2; ++slot) {
+    uint32_t seq;
+    if (readSlot(slot, &seq, 0, 0) && seq > _seq) {
+      _seq = seq;
+    }
+  }
+  return true;
+}
+
+/*
+ * Read the newest valid blob
+ *
+ * Returns false if there is none, or if its size is not the given size.
+ */
+bool Sodaq_Checkpoint::load(void *data, uint8_t size)
+{
+  uint32_t seq[2];
+  bool valid[2];
+
+  for (uint8_t slot = 0; slot < 2; ++slot) {
+    valid[slot] = readSlot(slot, &seq[slot], 0, size);
+  }
+  if (!valid[0] && !valid[1]) {
+    return false;
+  }
+  uint8_t slot = !valid[0] || (valid[1] && seq[1] > seq[0]) ? 1 : 0;
+  return readSlot(slot, &seq[slot], (uint8_t *)data, size);
+}
+
+/*
+ * Save a new version of the blob, in the slot of the oldest version
+ */
+bool Sodaq_Checkpoint::save(const void *data, uint8_t size)
+{
+  uint8_t buf[HDR_SIZE + CHECKPOINT_MAX_SIZE + 1];
+
+  if (size > CHECKPOINT_MAX_SIZE) {
+    return false;
+  }
+  ++_seq;
+  buf[0] = MAGIC0;
+  buf[1] = MAGIC1;
+  buf[2] = _seq;
+  buf[3] = _seq >> 8;
+  buf[4] = _seq >> 16;
+  buf[5] = _seq >> 24;
+  buf[6] = size;
+  memcpy(buf + HDR_SIZE, data, size);
+  buf[HDR_SIZE + size] = crc8(buf, HDR_SIZE + size, 0);
+
+  // Buffer 2, buffer 1 may hold a page of Sodaq_UplinkQueue
+  _df->writeStrBuf2(0, buf, HDR_SIZE + size + 1);
+  _df->writeBuf2ToPage(_firstPage + (_seq & 1));
+  return true;
+}
+
+/*
+ * Forget the blob, load() will fail until the next save()
+ */
+void Sodaq_Checkpoint::clear()
+{
+  _df->pageErase(_firstPage);
+  _df->pageErase(_firstPage + 1);
+}
+
+/*
+ * Check one slot, and read its data if data is not NULL
+ *
+ * With a size of 0 any size is accepted.
+ */
+bool Sodaq_Checkpoint::readSlot(uint8_t slot, uint32_t *seq, uint8_t *data, uint8_t size)
+{
+  uint8_t buf[HDR_SIZE + CHECKPOINT_MAX_SIZE + 1];
+
+  _df->readPage(_firstPage + slot, 0, buf, HDR_SIZE);
+  if (buf[0] != MAGIC0 || buf[1] != MAGIC1 || buf[6] > CHECKPOINT_MAX_SIZE) {
+    return false;
+  }
+  uint8_t len = buf[6];
+  if (size != 0 && len != size) {
+    return false;
+  }
+  _df->readPage(_firstPage + slot, HDR_SIZE, buf + HDR_SIZE, len + 1);
+  if (crc8(buf, HDR_SIZE + len, 0) != buf[HDR_SIZE + len]) {
+    return false;
+  }
+  *seq = buf[2] | ((uint32_t)buf[3] << 8) | ((uint32_t)buf[4] << 16) | ((uint32_t)buf[5] << 24);
+  if (data) {
+    memcpy(data, buf + HDR_SIZE, len);
+  }
+  return true;
+}
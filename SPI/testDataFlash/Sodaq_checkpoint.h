@@ -0,0 +1,57 @@
+#ifndef SODAQ_CHECKPOINT_H
+#define SODAQ_CHECKPOINT_H
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Sodaq_dataflash.h"
+
+// The largest blob that can be saved
+#define CHECKPOINT_MAX_SIZE     64
+
+/*
+ * A small blob of state that survives a reset, e.g. the progress of an upload
+ *
+ * It is kept in two DataFlash pages that are written alternately, each
+ * with a sequence number and a CRC. If the power fails during a save(),
+ * load() still finds the previous version in the other page.
+ *
+ * Layout: magic(2) seq(4) len(1) <len bytes> crc(1)
+ */
+class Sodaq_Checkpoint
+{
+public:
+  bool init(Sodaq_Dataflash &df, uint16_t firstPage);
+
+  bool load(void *data, uint8_t size);
+  bool save(const void *data, uint8_t size);
+  void clear();
+
+private:
+  bool readSlot(uint8_t slot, uint32_t *seq, uint8_t *data, uint8_t size);
+
+  Sodaq_Dataflash *_df;
+  uint16_t _firstPage;
+  uint32_t _seq;
+};
+
+#endif // SODAQ_CHECKPOINT_H
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "Sodaq_crc8.h"
+
+uint8_t crc8(const uint8_t *data, size_t len, uint8_t crc)
+{
+  while (len--) {
+    uint8_t b = *data++;
+    for (uint8_t i = 0; i < 8; ++i) {
+      uint8_t mix = (crc ^ b) & 0x01;
+      crc >>= 1;
+      if (mix) {
+        crc ^= 0x8C;
+      }
+      b >>= 1;
+    }
+  }
+  return crc;
+}
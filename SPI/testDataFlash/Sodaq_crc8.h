@@ -0,0 +1,34 @@
+#ifndef SODAQ_CRC8_H
+#define SODAQ_CRC8_H
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-8/MAXIM (polynomial x^8 + x^5 + x^4 + 1)
+ *
+ * Start with crc 0, pass the previous result to continue over more data.
+ */
+uint8_t crc8(const uint8_t *data, size_t len, uint8_t crc);
+
+#endif // SODAQ_CRC8_H
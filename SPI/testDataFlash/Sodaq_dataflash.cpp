@@ -31,6 +31,7 @@
 
 //Dataflash commands
 #define FlashPageRead           0xD2    // Main memory page read
+#define ContArrayRead           0x0B    // Continuous array read (high frequency)
 #define StatusReg               0xD7    // Status register
 #define ReadMfgID               0x9F    // Read Manufacturer and Device ID
 #define PageErase               0x81    // Page erase
@@ -46,23 +47,111 @@
 #define Buf2ToFlashWE           0x86    // Buffer 2 to main memory page program with built-in erase
 #define Buf2Write               0x87    // Buffer 2 write
 
+#define ManufacturerAtmel       0x1F
+
+// Geometry of the AT45DB devices, for the standard page size (264/528).
+// With the "power of 2" page size the page is 256/512 and there is one
+// bit less for the byte address.
+struct DeviceGeometry
+{
+  uint8_t deviceId;             // Device ID byte 1, density code
+  uint8_t pageBits;
+  uint16_t pageSize;
+  uint16_t nrPages;
+};
+static const DeviceGeometry deviceTable[] = {
+  { 0x24,  9, 264, 2048 },      // AT45DB041D
+  { 0x25,  9, 264, 4096 },      // AT45DB081D
+  { 0x26, 10, 528, 4096 },      // AT45DB161D
+  { 0x27, 10, 528, 8192 },      // AT45DB321D
+};
+
+// The backend that is used if setSPI() wasn't called
+static Sodaq_DataflashSPI defaultSPI;
+
+Sodaq_Dataflash::Sodaq_Dataflash()
+{
+  _csPin = SS;
+  _deviceId = 0;
+  _powerOfTwo = false;
+  _pageBits = DF_PAGE_BITS;
+  _pageSize = DF_PAGE_SIZE;
+  _nrPages = DF_NR_PAGES;
+  _spi = 0;
+  _streamPage = 0;
+  _streamOffset = 0;
+  _streamBuf = 0;
+  _busy = false;
+}
 
 void Sodaq_Dataflash::init(uint8_t csPin)
 {
   // Setup the slave select pin
   _csPin = csPin;
-  
-  // Call the standard SPI initialisation
-  SPI.begin();
+  _busy = false;
+
+  if (!_spi) {
+    _spi = &defaultSPI;
+  }
+  _spi->begin();
 
   // This is used when CS != SS
   pinMode(_csPin, OUTPUT);
 
-#if DF_VARIANT == DF_AT45DB081D
-  _pageAddrShift = 1;
-#elif DF_VARIANT == DF_AT45DB161D
-  _pageAddrShift = 1;
-#endif
+  setGeometry();
+}
+
+/*
+ * Identify the device and set up the page size, the number of pages, and
+ * the number of address bits in a page
+ *
+ * The address computation is just a shift with _pageBits, in standard
+ * mode as well as in "power of 2" mode.
+ */
+void Sodaq_Dataflash::setGeometry()
+{
+  uint8_t id[4];
+  readID(id);
+
+  _deviceId = 0;
+  _pageBits = DF_PAGE_BITS;
+  _pageSize = DF_PAGE_SIZE;
+  _nrPages = DF_NR_PAGES;
+  if (id[0] == ManufacturerAtmel) {
+    for (size_t i = 0; i < sizeof(deviceTable) / sizeof(deviceTable[0]); ++i) {
+      if (deviceTable[i].deviceId == id[1]) {
+        _deviceId = id[1];
+        _pageBits = deviceTable[i].pageBits;
+        _pageSize = deviceTable[i].pageSize;
+        _nrPages = deviceTable[i].nrPages;
+        break;
+      }
+    }
+  }
+
+  // Bit 0 of the status register tells if "power of 2" is configured
+  _powerOfTwo = readStatus() & 0x01;
+  if (_powerOfTwo) {
+    _pageBits -= 1;
+    _pageSize = 1 << _pageBits;
+  }
+}
+
+/*
+ * Configure the device for the "power of 2" page size (256/512 bytes)
+ *
+ * Beware, this is a one-time programmable setting, it can not be undone.
+ * It takes effect after the device is power cycled.
+ */
+void Sodaq_Dataflash::configurePowerOfTwo()
+{
+  activate();
+  transmit(0x3D);
+  transmit(0x2A);
+  transmit(0x80);
+  transmit(0xA6);
+  deactivate();
+  waitTillReady();
 }
 
 void Sodaq_Dataflash::init(uint8_t misoPin, uint8_t mosiPin, uint8_t sckPin, uint8_t ssPin)
@@ -72,8 +161,7 @@ void Sodaq_Dataflash::init(uint8_t misoPin, uint8_t mosiPin, uint8_t sckPin, uin
 
 uint8_t Sodaq_Dataflash::transmit(uint8_t data)
 {
-  // Call the standard SPI transfer method
-  return SPI.transfer(data);
+  return _spi->transfer(data);
 }
 
 uint8_t Sodaq_Dataflash::readStatus()
@@ -94,6 +182,15 @@ void Sodaq_Dataflash::waitTillReady()
   while (!(readStatus() & 0x80)) {
     // WDT reset maybe??
   }
+  _busy = false;
+}
+
+// Wait for a page program that the streaming writer left running
+void Sodaq_Dataflash::waitIfBusy()
+{
+  if (_busy) {
+    waitTillReady();
+  }
 }
 
 void Sodaq_Dataflash::readID(uint8_t *data)
@@ -115,19 +212,14 @@ void Sodaq_Dataflash::readSecurityReg(uint8_t *data, size_t size)
     transmit(0x00);
     transmit(0x00);
     transmit(0x00);
-    for (size_t i = 0; i < size; i++) {
-      *data++ = transmit(0x00);
-    }
+    _spi->transfer(NULL, data, size);
     deactivate();
 }
 
 // Transfers a page from flash to Dataflash SRAM buffer
 void Sodaq_Dataflash::readPageToBuf1(uint16_t pageAddr)
 {
-  activate();
-  transmit(FlashToBuf1Transfer);
-  setPageAddr(pageAddr);
-  deactivate();
+  pageCommand(FlashToBuf1Transfer, pageAddr);
   waitTillReady();
 }
 
@@ -150,16 +242,20 @@ uint8_t Sodaq_Dataflash::readByteBuf1(uint16_t addr)
 
 // Reads a number of bytes from one of the Dataflash internal SRAM buffer 1
 void Sodaq_Dataflash::readStrBuf1(uint16_t addr, uint8_t *data, size_t size)
+{
+  readStrBuf(Buf1Read, addr, data, size);
+}
+
+// Reads a number of bytes from one of the Dataflash internal SRAM buffers
+void Sodaq_Dataflash::readStrBuf(uint8_t cmd, uint16_t addr, uint8_t *data, size_t size)
 {
   activate();
-  transmit(Buf1Read);
+  transmit(cmd);
   transmit(0x00);               //don't care
   transmit((uint8_t) (addr >> 8));
   transmit((uint8_t) (addr));
   transmit(0x00);               //don't care
-  for (size_t i = 0; i < size; i++) {
-    *data++ = transmit(0x00);
-  }
+  _spi->transfer(NULL, data, size);
   deactivate();
 }
 
@@ -177,34 +273,179 @@ void Sodaq_Dataflash::writeByteBuf1(uint16_t addr, uint8_t data)
 
 // Writes a number of bytes to one of the Dataflash internal SRAM buffer 1
 void Sodaq_Dataflash::writeStrBuf1(uint16_t addr, uint8_t *data, size_t size)
+{
+  writeStrBuf(Buf1Write, addr, data, size);
+}
+
+// Writes a number of bytes to one of the Dataflash internal SRAM buffers
+void Sodaq_Dataflash::writeStrBuf(uint8_t cmd, uint16_t addr, const uint8_t *data, size_t size)
 {
   activate();
-  transmit(Buf1Write);
+  transmit(cmd);
   transmit(0x00);               //don't care
   transmit((uint8_t) (addr >> 8));
   transmit((uint8_t) (addr));
-  for (size_t i = 0; i < size; i++) {
-    transmit(*data++);
-  }
+  _spi->transfer(data, NULL, size);
   deactivate();
 }
 
 // Transfers Dataflash SRAM buffer 1 to flash page
 void Sodaq_Dataflash::writeBuf1ToPage(uint16_t pageAddr)
 {
+  pageCommand(Buf1ToFlashWE, pageAddr);
+  waitTillReady();
+}
+
+// Reads a number of bytes from one of the Dataflash internal SRAM buffer 2
+void Sodaq_Dataflash::readStrBuf2(uint16_t addr, uint8_t *data, size_t size)
+{
+  readStrBuf(Buf2Read, addr, data, size);
+}
+
+// Writes a number of bytes to one of the Dataflash internal SRAM buffer 2
+void Sodaq_Dataflash::writeStrBuf2(uint16_t addr, uint8_t *data, size_t size)
+{
+  writeStrBuf(Buf2Write, addr, data, size);
+}
+
+// Transfers Dataflash SRAM buffer 2 to flash page
+void Sodaq_Dataflash::writeBuf2ToPage(uint16_t pageAddr)
+{
+  pageCommand(Buf2ToFlashWE, pageAddr);
+  waitTillReady();
+}
+
+// Transfers a page from flash to Dataflash SRAM buffer 2
+void Sodaq_Dataflash::readPageToBuf2(uint16_t pageAddr)
+{
+  pageCommand(FlashToBuf2Transfer, pageAddr);
+  waitTillReady();
+}
+
+// Sends a command with a page address, does not wait for completion
+void Sodaq_Dataflash::pageCommand(uint8_t cmd, uint16_t pageAddr)
+{
+  waitIfBusy();
   activate();
-  transmit(Buf1ToFlashWE);
+  transmit(cmd);
   setPageAddr(pageAddr);
   deactivate();
-  waitTillReady();
 }
 
-void Sodaq_Dataflash::pageErase(uint16_t pageAddr)
+/*
+ * Reads bytes directly from a main memory page, the buffers are not used
+ *
+ * The read wraps around at the end of the page. If the streaming writer
+ * is still programming a page then this waits for it first.
+ */
+void Sodaq_Dataflash::readPage(uint16_t pageAddr, uint16_t offset, uint8_t *data, size_t size)
 {
+  waitIfBusy();
   activate();
-  transmit(PageErase);
-  setPageAddr(pageAddr);
+  transmit(FlashPageRead);
+  setByteAddr(pageAddr, offset);
+  // Four don't care bytes
+  transmit(0x00);
+  transmit(0x00);
+  transmit(0x00);
+  transmit(0x00);
+  _spi->transfer(NULL, data, size);
+  deactivate();
+}
+
+/*
+ * Reads an arbitrary range of bytes from main memory
+ *
+ * This is a single transaction, without buffer transfer. It only waits
+ * if the streaming writer is still programming a page. At the end of a
+ * page the read continues with the next page.
+ */
+void Sodaq_Dataflash::readContinuous(uint16_t pageAddr, uint16_t offset, uint8_t *data, size_t size)
+{
+  waitIfBusy();
+  activate();
+  transmit(ContArrayRead);
+  setByteAddr(pageAddr, offset);
+  transmit(0x00);               //don't care
+  _spi->transfer(NULL, data, size);
   deactivate();
+}
+
+/*
+ * Start writing a stream of data to consecutive pages
+ *
+ * The streaming writer alternates between the two SRAM buffers. While one
+ * buffer is programmed into its page, the next page is filled in the other
+ * buffer. It only waits for the device when a buffer is full and the
+ * previous page is not yet finished.
+ *
+ * The pages are programmed with built-in erase, no need to erase them first.
+ */
+void Sodaq_Dataflash::beginStreamWrite(uint16_t pageAddr)
+{
+  _streamPage = pageAddr;
+  _streamOffset = 0;
+  _streamBuf = 0;
+}
+
+void Sodaq_Dataflash::streamWrite(const uint8_t *data, size_t size)
+{
+  while (size > 0) {
+    size_t n = _pageSize - _streamOffset;
+    if (n > size) {
+      n = size;
+    }
+    // The other buffer may still be busy programming, but that's allowed.
+    writeStrBuf(_streamBuf ? Buf2Write : Buf1Write, _streamOffset, data, n);
+    data += n;
+    size -= n;
+    _streamOffset += n;
+    if (_streamOffset >= _pageSize) {
+      streamFlush();
+    }
+  }
+}
+
+/*
+ * Finish the stream. A partly filled page is padded with 0xFF.
+ *
+ * Returns the next page after the stream, e.g. to continue later on.
+ */
+uint16_t Sodaq_Dataflash::endStreamWrite()
+{
+  if (_streamOffset > 0) {
+    uint8_t pad[16];
+    memset(pad, 0xFF, sizeof(pad));
+    while (_streamOffset < _pageSize) {
+      size_t n = _pageSize - _streamOffset;
+      if (n > sizeof(pad)) {
+        n = sizeof(pad);
+      }
+      writeStrBuf(_streamBuf ? Buf2Write : Buf1Write, _streamOffset, pad, n);
+      _streamOffset += n;
+    }
+    streamFlush();
+  }
+  waitTillReady();
+  return _streamPage;
+}
+
+// Program the current buffer into its page and switch to the other buffer
+void Sodaq_Dataflash::streamFlush()
+{
+  // Only one program operation at a time
+  waitTillReady();
+  pageCommand(_streamBuf ? Buf2ToFlashWE : Buf1ToFlashWE, _streamPage);
+  // The device is programming now, see waitIfBusy()
+  _busy = true;
+  _streamPage = (_streamPage + 1) % _nrPages;
+  _streamOffset = 0;
+  _streamBuf ^= 1;
+}
+
+void Sodaq_Dataflash::pageErase(uint16_t pageAddr)
+{
+  pageCommand(PageErase, pageAddr);
   waitTillReady();
 }
 
@@ -227,19 +468,17 @@ void Sodaq_Dataflash::settings(SPISettings settings)
 void Sodaq_Dataflash::deactivate()
 {
     digitalWrite(_csPin,HIGH);
-    SPI.endTransaction();
+    _spi->endTransaction();
 }
 void Sodaq_Dataflash::activate()
 {
-    SPI.beginTransaction(_settings);
+    _spi->beginTransaction(_settings);
     digitalWrite(_csPin,LOW);
 }
 
 void Sodaq_Dataflash::setPageAddr(unsigned int pageAddr)
 {
-  transmit(getPageAddrByte0(pageAddr));
-  transmit(getPageAddrByte1(pageAddr));
-  transmit(getPageAddrByte2(pageAddr));
+  setByteAddr(pageAddr, 0);
 }
 
 /*
@@ -255,21 +494,16 @@ void Sodaq_Dataflash::setPageAddr(unsigned int pageAddr)
  *    followed by three address bytes consist of 2 don’t care bits, 12 page
  *    address bits (PA11 - PA0) that specify the page in the main memory to
  *    be written and 10 don’t care bits."
+ *
+ * So the 24 bits address is the page shifted by _pageBits, with the byte
+ * address in the lower bits.
  */
-uint8_t Sodaq_Dataflash::getPageAddrByte0(uint16_t pageAddr)
-{
-  // More correct would be to use a 24 bits number
-  // shift to the left by number of bits. But the uint16_t can be considered
-  // as if it was already shifted by 8.
-  return (pageAddr << (DF_PAGE_BITS - 8)) >> 8;
-}
-uint8_t Sodaq_Dataflash::getPageAddrByte1(uint16_t page)
-{
-  return page << (DF_PAGE_BITS - 8);
-}
-uint8_t Sodaq_Dataflash::getPageAddrByte2(uint16_t page)
+void Sodaq_Dataflash::setByteAddr(uint16_t pageAddr, uint16_t offset)
 {
-  return 0;
+  uint32_t addr = ((uint32_t)pageAddr << _pageBits) | offset;
+  transmit(addr >> 16);
+  transmit(addr >> 8);
+  transmit(addr);
 }
 
 // Use a single common instance
@@ -23,9 +23,16 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "Sodaq_dataflash_spi.h"
+
 #define DF_AT45DB081D   1
 #define DF_AT45DB161D   2
 
+/*
+ * The device is identified at init() with the Manufacturer and Device ID
+ * and its geometry is taken from a table, see getPageSize(), getNrPages().
+ * DF_VARIANT is only used when the device is not recognized.
+ */
 #define DF_VARIANT      DF_AT45DB161D
 
 #if DF_VARIANT == DF_AT45DB081D
@@ -59,12 +66,25 @@
 #endif
 #define DF_NR_PAGES     (1 << DF_PAGE_ADDR_BITS)
 
+// The biggest page of the devices in the geometry table, use it for buffers
+#define DF_MAX_PAGE_SIZE        528
+
 class Sodaq_Dataflash
 {
 public:
+  Sodaq_Dataflash();
   void init(uint8_t csPin=SS);
   void init(uint8_t misoPin, uint8_t mosiPin, uint8_t sckPin, uint8_t ssPin) __attribute__((deprecated("Use: void init(uint8_t csPin=SS)")));
   void readID(uint8_t *data);
+
+  // The geometry of the device, known after init()
+  uint16_t getPageSize() const { return _pageSize; }
+  uint16_t getNrPages() const { return _nrPages; }
+  uint8_t getPageBits() const { return _pageBits; }
+  uint8_t getDeviceId() const { return _deviceId; }
+  bool isPowerOfTwo() const { return _powerOfTwo; }
+  void configurePowerOfTwo();
+
   void readSecurityReg(uint8_t *data, size_t size);
 
   uint8_t readByteBuf1(uint16_t pageAddr);
@@ -75,25 +95,53 @@ public:
   void writeBuf1ToPage(uint16_t pageAddr);
   void readPageToBuf1(uint16_t PageAdr);
 
+  void readStrBuf2(uint16_t addr, uint8_t *data, size_t size);
+  void writeStrBuf2(uint16_t addr, uint8_t *data, size_t size);
+  void writeBuf2ToPage(uint16_t pageAddr);
+  void readPageToBuf2(uint16_t PageAdr);
+
+  void readPage(uint16_t pageAddr, uint16_t offset, uint8_t *data, size_t size);
+  void readContinuous(uint16_t pageAddr, uint16_t offset, uint8_t *data, size_t size);
+
+  void beginStreamWrite(uint16_t pageAddr);
+  void streamWrite(const uint8_t *data, size_t size);
+  uint16_t endStreamWrite();
+
   void pageErase(uint16_t pageAddr);
   void chipErase();
 
   void settings(SPISettings settings);
+  void setSPI(Sodaq_DataflashSPI &spi) { _spi = &spi; }
 
 private:
   uint8_t readStatus();
   void waitTillReady();
+  void waitIfBusy();
+  void readStrBuf(uint8_t cmd, uint16_t addr, uint8_t *data, size_t size);
+  void writeStrBuf(uint8_t cmd, uint16_t addr, const uint8_t *data, size_t size);
+  void pageCommand(uint8_t cmd, uint16_t pageAddr);
+  void streamFlush();
   uint8_t transmit(uint8_t data);
   void activate();
   void deactivate();
   void setPageAddr(unsigned int PageAdr);
-  uint8_t getPageAddrByte0(uint16_t pageAddr);
-  uint8_t getPageAddrByte1(uint16_t pageAddr);
-  uint8_t getPageAddrByte2(uint16_t pageAddr);
+  void setByteAddr(uint16_t pageAddr, uint16_t offset);
+  void setGeometry();
 
   uint8_t _csPin;
-  size_t _pageAddrShift;
+  uint8_t _deviceId;            // the first Device ID byte, 0 if not recognized
+  bool _powerOfTwo;             // the device is configured for "power of 2" page size
+  uint8_t _pageBits;            // the number of bits of the byte address in a page
+  uint16_t _pageSize;
+  uint16_t _nrPages;
   SPISettings _settings;
+  Sodaq_DataflashSPI *_spi;
+
+  // State of the streaming writer
+  uint16_t _streamPage;         // the page that the current buffer goes to
+  uint16_t _streamOffset;       // the fill level of the current buffer
+  uint8_t _streamBuf;           // the current buffer, 0 = buffer 1, 1 = buffer 2
+  bool _busy;                   // a page program was started and not waited for
 };
 
 extern Sodaq_Dataflash dflash;
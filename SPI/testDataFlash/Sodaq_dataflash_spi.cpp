@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "Sodaq_dataflash_spi.h"
+
+#if defined(ARDUINO_SODAQ_AUTONOMO)
+// The SERCOM behind the SPI class, see variant.h
+#define DF_SPI_SERCOM           SERCOM3
+#define DF_SPI_DMAC_ID_TX       SERCOM3_DMAC_ID_TX
+#define DF_SPI_DMAC_ID_RX       SERCOM3_DMAC_ID_RX
+#endif
+
+void Sodaq_DataflashSPI::begin()
+{
+  // Call the standard SPI initialisation
+  SPI.begin();
+}
+
+void Sodaq_DataflashSPI::beginTransaction(SPISettings settings)
+{
+  SPI.beginTransaction(settings);
+}
+
+void Sodaq_DataflashSPI::endTransaction()
+{
+  SPI.endTransaction();
+}
+
+uint8_t Sodaq_DataflashSPI::transfer(uint8_t data)
+{
+  // Call the standard SPI transfer method
+  return SPI.transfer(data);
+}
+
+void Sodaq_DataflashSPI::transfer(const uint8_t *tx, uint8_t *rx, size_t size)
+{
+#if defined(DF_SPI_SERCOM)
+  // Keep the SERCOM busy: the next byte is written as soon as the data
+  // register is empty, but never more than two bytes ahead of what has
+  // been received, so that the receiver can't overflow.
+  Sercom *sercom = DF_SPI_SERCOM;
+  size_t txIx = 0;
+  size_t rxIx = 0;
+  while (rxIx < size) {
+    if (txIx < size && (txIx - rxIx) < 2 && sercom->SPI.INTFLAG.bit.DRE) {
+      sercom->SPI.DATA.reg = tx ? tx[txIx] : 0x00;
+      ++txIx;
+    }
+    if (sercom->SPI.INTFLAG.bit.RXC) {
+      uint8_t c = sercom->SPI.DATA.reg;
+      if (rx) {
+        rx[rxIx] = c;
+      }
+      ++rxIx;
+    }
+  }
+#else
+  for (size_t i = 0; i < size; i++) {
+    uint8_t c = SPI.transfer(tx ? tx[i] : 0x00);
+    if (rx) {
+      rx[i] = c;
+    }
+  }
+#endif
+}
+
+void Sodaq_DataflashCountingSPI::beginTransaction(SPISettings settings)
+{
+  ++_nrTransactions;
+  Sodaq_DataflashSPI::beginTransaction(settings);
+}
+
+uint8_t Sodaq_DataflashCountingSPI::transfer(uint8_t data)
+{
+  ++_nrBytes;
+  return Sodaq_DataflashSPI::transfer(data);
+}
+
+void Sodaq_DataflashCountingSPI::transfer(const uint8_t *tx, uint8_t *rx, size_t size)
+{
+  _nrBytes += size;
+  ++_nrBlockTransfers;
+  Sodaq_DataflashSPI::transfer(tx, rx, size);
+}
+
+#if defined(ARDUINO_SODAQ_AUTONOMO)
+
+#define DF_DMA_TX_CHANNEL       0
+#define DF_DMA_RX_CHANNEL       1
+// Below this size setting up the DMA costs more than it saves
+#define DF_DMA_MIN_SIZE         16
+
+// The DMAC wants the descriptor of channel N at BASEADDR + N
+static DmacDescriptor dfDescriptors[2] __attribute__((aligned(16)));
+static DmacDescriptor dfWriteback[2] __attribute__((aligned(16)));
+static uint8_t dfZero;
+static uint8_t dfDummy;
+
+static void setupChannel(uint8_t channel, uint8_t trigger)
+{
+  DMAC->CHID.reg = DMAC_CHID_ID(channel);
+  DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+  while (DMAC->CHCTRLA.reg & DMAC_CHCTRLA_SWRST) {
+    /* Wait for the reset */
+  }
+  DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) |
+          DMAC_CHCTRLB_TRIGSRC(trigger) |
+          DMAC_CHCTRLB_TRIGACT_BEAT;
+}
+
+void Sodaq_DataflashDMASPI::begin()
+{
+  Sodaq_DataflashSPI::begin();
+
+  PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+  PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+
+  DMAC->CTRL.reg &= ~DMAC_CTRL_DMAENABLE;
+  DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+  while (DMAC->CTRL.reg & DMAC_CTRL_SWRST) {
+    /* Wait for the reset */
+  }
+  DMAC->BASEADDR.reg = (uint32_t)dfDescriptors;
+  DMAC->WRBADDR.reg = (uint32_t)dfWriteback;
+  DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+
+  setupChannel(DF_DMA_TX_CHANNEL, DF_SPI_DMAC_ID_TX);
+  setupChannel(DF_DMA_RX_CHANNEL, DF_SPI_DMAC_ID_RX);
+}
+
+void Sodaq_DataflashDMASPI::transfer(const uint8_t *tx, uint8_t *rx, size_t size)
+{
+  if (size < DF_DMA_MIN_SIZE) {
+    Sodaq_DataflashSPI::transfer(tx, rx, size);
+    return;
+  }
+
+  // With address increment the DMAC wants the address after the last beat
+  DmacDescriptor *desc = &dfDescriptors[DF_DMA_RX_CHANNEL];
+  desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE |
+          (rx ? DMAC_BTCTRL_DSTINC : 0);
+  desc->BTCNT.reg = size;
+  desc->SRCADDR.reg = (uint32_t)&DF_SPI_SERCOM->SPI.DATA.reg;
+  desc->DSTADDR.reg = rx ? (uint32_t)(rx + size) : (uint32_t)&dfDummy;
+  desc->DESCADDR.reg = 0;
+
+  desc = &dfDescriptors[DF_DMA_TX_CHANNEL];
+  desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE |
+          (tx ? DMAC_BTCTRL_SRCINC : 0);
+  desc->BTCNT.reg = size;
+  desc->SRCADDR.reg = tx ? (uint32_t)(tx + size) : (uint32_t)&dfZero;
+  desc->DSTADDR.reg = (uint32_t)&DF_SPI_SERCOM->SPI.DATA.reg;
+  desc->DESCADDR.reg = 0;
+
+  // Start the receiver first, so that nothing is missed
+  DMAC->CHID.reg = DMAC_CHID_ID(DF_DMA_RX_CHANNEL);
+  DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+  DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+  DMAC->CHID.reg = DMAC_CHID_ID(DF_DMA_TX_CHANNEL);
+  DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+  DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+
+  // The transfer is done when the last byte is received
+  DMAC->CHID.reg = DMAC_CHID_ID(DF_DMA_RX_CHANNEL);
+  while (!(DMAC->CHINTFLAG.reg & (DMAC_CHINTFLAG_TCMPL | DMAC_CHINTFLAG_TERR))) {
+    /* Wait for the DMA */
+  }
+}
+
+#endif
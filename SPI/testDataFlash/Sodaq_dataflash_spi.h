@@ -0,0 +1,85 @@
+#ifndef SODAQ_DATAFLASH_SPI_H
+#define SODAQ_DATAFLASH_SPI_H
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <SPI.h>
+
+/*
+ * The SPI backend of Sodaq_Dataflash
+ *
+ * The default implementation uses the Arduino SPI class, except for the
+ * block transfer which talks to the SERCOM directly on boards where we
+ * know which SERCOM is used (SODAQ Autonomo: SERCOM3). A different backend
+ * can be given to the driver with dflash.setSPI(), before dflash.init().
+ */
+class Sodaq_DataflashSPI
+{
+public:
+  virtual void begin();
+  virtual void beginTransaction(SPISettings settings);
+  virtual void endTransaction();
+  virtual uint8_t transfer(uint8_t data);
+  // Send size bytes from tx (0x00 if tx is NULL), store the received bytes in rx (if not NULL)
+  virtual void transfer(const uint8_t *tx, uint8_t *rx, size_t size);
+};
+
+/*
+ * A backend that counts transactions and bytes, e.g. to compute the
+ * throughput per page
+ */
+class Sodaq_DataflashCountingSPI : public Sodaq_DataflashSPI
+{
+public:
+  Sodaq_DataflashCountingSPI() { reset(); }
+  void reset() { _nrTransactions = 0; _nrBytes = 0; _nrBlockTransfers = 0; }
+
+  void beginTransaction(SPISettings settings);
+  uint8_t transfer(uint8_t data);
+  void transfer(const uint8_t *tx, uint8_t *rx, size_t size);
+
+  uint32_t getNrTransactions() const { return _nrTransactions; }
+  uint32_t getNrBytes() const { return _nrBytes; }
+  uint32_t getNrBlockTransfers() const { return _nrBlockTransfers; }
+
+private:
+  uint32_t _nrTransactions;
+  uint32_t _nrBytes;
+  uint32_t _nrBlockTransfers;
+};
+
+#if defined(ARDUINO_SODAQ_AUTONOMO)
+/*
+ * A backend that does the block transfers with DMA (DMAC channels 0 and 1)
+ *
+ * Only use it if nothing else in the sketch uses the DMAC.
+ */
+class Sodaq_DataflashDMASPI : public Sodaq_DataflashSPI
+{
+public:
+  void begin();
+  using Sodaq_DataflashSPI::transfer;
+  void transfer(const uint8_t *tx, uint8_t *rx, size_t size);
+};
+#endif
+
+#endif // SODAQ_DATAFLASH_SPI_H
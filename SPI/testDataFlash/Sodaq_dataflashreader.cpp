@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "Sodaq_dataflashreader.h"
+
+Sodaq_DataflashReader::Sodaq_DataflashReader()
+{
+  _df = 0;
+  _page = 0;
+  _offset = 0;
+  _remaining = 0;
+  _cacheIx = 0;
+  _cacheLen = 0;
+}
+
+Sodaq_DataflashReader::Sodaq_DataflashReader(Sodaq_Dataflash &df, uint16_t pageAddr, uint16_t offset, uint32_t size)
+{
+  init(df, pageAddr, offset, size);
+}
+
+void Sodaq_DataflashReader::init(Sodaq_Dataflash &df, uint16_t pageAddr, uint16_t offset, uint32_t size)
+{
+  _df = &df;
+  _page = pageAddr;
+  _offset = offset;
+  _remaining = size;
+  _cacheIx = 0;
+  _cacheLen = 0;
+}
+
+int Sodaq_DataflashReader::available()
+{
+  uint32_t n = getRemaining();
+  return n > 0x7FFF ? 0x7FFF : n;
+}
+
+int Sodaq_DataflashReader::read()
+{
+  if (!fillCache()) {
+    return -1;
+  }
+  return _cache[_cacheIx++];
+}
+
+int Sodaq_DataflashReader::peek()
+{
+  if (!fillCache()) {
+    return -1;
+  }
+  return _cache[_cacheIx];
+}
+
+/*
+ * Make sure there is at least one byte in the cache
+ *
+ * The device continues with the next page by itself, and after the last
+ * page with page 0. Only our own page and offset have to follow, the same
+ * way as streamWrite() wraps.
+ */
+bool Sodaq_DataflashReader::fillCache()
+{
+  if (_cacheIx < _cacheLen) {
+    return true;
+  }
+  if (_remaining == 0) {
+    return false;
+  }
+  _cacheLen = _remaining < sizeof(_cache) ? _remaining : sizeof(_cache);
+  _cacheIx = 0;
+  _df->readContinuous(_page, _offset, _cache, _cacheLen);
+  _remaining -= _cacheLen;
+  _offset += _cacheLen;
+  while (_offset >= _df->getPageSize()) {
+    _offset -= _df->getPageSize();
+    _page = (_page + 1) % _df->getNrPages();
+  }
+  return true;
+}
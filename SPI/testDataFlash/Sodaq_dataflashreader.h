@@ -0,0 +1,66 @@
+#ifndef SODAQ_DATAFLASHREADER_H
+#define SODAQ_DATAFLASHREADER_H
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include "Sodaq_dataflash.h"
+
+/*
+ * A Stream that reads a range of DataFlash bytes, e.g. what was written
+ * with beginStreamWrite()/streamWrite()
+ *
+ * The range starts at a page and offset and may cross any number of pages.
+ * After the last page it continues with page 0, like streamWrite(). It is
+ * read with Continuous Array Read, a small cache at a time, so a big range
+ * can be passed to anything that takes a Stream, for example:
+ *   Sodaq_DataflashReader reader(dflash, firstPage, 0, size);
+ *   gprsbee.doHTTPPOST(apn, apnuser, apnpwd, url, reader, size);
+ *
+ * The Stream is read-only, write() does nothing.
+ */
+class Sodaq_DataflashReader : public Stream
+{
+public:
+  Sodaq_DataflashReader();
+  Sodaq_DataflashReader(Sodaq_Dataflash &df, uint16_t pageAddr, uint16_t offset, uint32_t size);
+  void init(Sodaq_Dataflash &df, uint16_t pageAddr, uint16_t offset, uint32_t size);
+  uint32_t getRemaining() const { return _remaining + (_cacheLen - _cacheIx); }
+
+  int available();
+  int read();
+  int peek();
+  void flush() {}
+  size_t write(uint8_t) { return 0; }
+
+private:
+  bool fillCache();
+
+  Sodaq_Dataflash *_df;
+  uint16_t _page;               // the next byte to go into the cache
+  uint16_t _offset;
+  uint32_t _remaining;          // bytes not yet in the cache
+  uint8_t _cache[32];
+  uint8_t _cacheIx;
+  uint8_t _cacheLen;
+};
+
+#endif // SODAQ_DATAFLASHREADER_H
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "Sodaq_crc8.h"
+#include "Sodaq_logstore.h"
+
+#define PAGE_MAGIC              0xA5
+
+/*
+ * Mount the log in the pages firstPage .. firstPage + nrPages - 1
+ *
+ * The DataFlash must already be initialized. All page headers are read
+ * to find the oldest and the newest page. If there is no valid page the
+ * log starts empty.
+ */
+bool Sodaq_LogStore::mount(Sodaq_Dataflash &df, uint16_t firstPage, uint16_t nrPages)
+{
+  if (nrPages < 2 || firstPage + nrPages > df.getNrPages()) {
+    return false;
+  }
+  _df = &df;
+  _pageSize = df.getPageSize();
+  _firstPage = firstPage;
+  _nrPages = nrPages;
+  _maxRecordSize = LOGSTORE_MAX_RECORD_SIZE;
+  if (LOGSTORE_PAGE_HDR_SIZE + 2 + _maxRecordSize > _pageSize) {
+    _maxRecordSize = _pageSize - LOGSTORE_PAGE_HDR_SIZE - 2;
+  }
+  _minWear = 0xFFFF;
+  _maxWear = 0;
+
+  bool found = false;
+  uint32_t minSeq = 0;
+  for (uint16_t page = 0; page < _nrPages; ++page) {
+    uint32_t seq;
+    uint16_t wear;
+    if (!readPageHeader(page, &seq, &wear)) {
+      _minWear = 0;
+      continue;
+    }
+    updateWear(wear);
+    if (!found || seq < minSeq) {
+      minSeq = seq;
+      _headPage = page;
+    }
+    if (!found || seq > _tailSeq) {
+      _tailSeq = seq;
+      _tailPage = page;
+    }
+    found = true;
+  }
+
+  if (found) {
+    // Continue in the newest page
+    _df->readPageToBuf1(absPage(_tailPage));
+    findTailOffset();
+    _tailDirty = false;
+  } else {
+    _tailSeq = 0;
+    _headPage = 0;
+    startPage(0);
+  }
+  rewind();
+  return true;
+}
+
+/*
+ * Erase all pages of the log, it will be empty after the next mount()
+ *
+ * This takes a while, it erases page by page.
+ */
+void Sodaq_LogStore::format()
+{
+  for (uint16_t page = 0; page < _nrPages; ++page) {
+    _df->pageErase(absPage(page));
+  }
+  mount(*_df, _firstPage, _nrPages);
+}
+
+/*
+ * Append a record to the log
+ *
+ * The record goes into DataFlash buffer 1, only a full page is programmed.
+ * Returns false if the record is too big, see getMaxRecordSize().
+ */
+bool Sodaq_LogStore::append(const uint8_t *data, uint8_t len)
+{
+  if (len == 0 || len > _maxRecordSize) {
+    return false;
+  }
+
+  if (_tailOffset + 2 + len > _pageSize) {
+    sync();
+    uint16_t next = nextPage(_tailPage);
+    if (next == _headPage) {
+      // The log is full, drop the oldest page
+      _headPage = nextPage(_headPage);
+    }
+    startPage(next);
+  }
+
+  uint8_t hdr[2];
+  hdr[0] = len;
+  hdr[1] = crc8(data, len, crc8(hdr, 1, 0));
+  _df->writeStrBuf1(_tailOffset, hdr, sizeof(hdr));
+  _df->writeStrBuf1(_tailOffset + 2, (uint8_t *)data, len);
+  _tailOffset += 2 + len;
+  _tailDirty = true;
+  return true;
+}
+
+/*
+ * Program the newest page, so that its records survive a power failure
+ */
+void Sodaq_LogStore::sync()
+{
+  if (!_tailDirty) {
+    return;
+  }
+  // Make sure the unused part doesn't contain old data of buffer 1
+  uint8_t pad[16];
+  memset(pad, 0xFF, sizeof(pad));
+  for (uint16_t offset = _tailOffset; offset < _pageSize; offset += sizeof(pad)) {
+    size_t n = _pageSize - offset;
+    if (n > sizeof(pad)) {
+      n = sizeof(pad);
+    }
+    _df->writeStrBuf1(offset, pad, n);
+  }
+  _df->writeBuf1ToPage(absPage(_tailPage));
+  _tailDirty = false;
+}
+
+/*
+ * Move the scan cursor to the oldest record
+ */
+void Sodaq_LogStore::rewind()
+{
+  _rdPage = _headPage;
+  _rdOffset = LOGSTORE_PAGE_HDR_SIZE;
+  _rdDone = false;
+}
+
+/*
+ * Read the next record of a sequential scan
+ *
+ * At most size bytes are copied. Records with a bad CRC are skipped.
+ * Returns the length of the record, or -1 at the end of the log.
+ */
+int Sodaq_LogStore::readNext(uint8_t *buffer, size_t size)
+{
+  uint8_t hdr[2];
+  while (!_rdDone) {
+    if (!readRecordHeader(_rdPage, _rdOffset, hdr)) {
+      if (_rdPage == _tailPage) {
+        _rdDone = true;
+        break;
+      }
+      _rdPage = nextPage(_rdPage);
+      _rdOffset = LOGSTORE_PAGE_HDR_SIZE;
+      continue;
+    }
+    uint8_t len = hdr[0];
+    uint16_t offset = _rdOffset + 2;
+    _rdOffset += 2 + len;
+
+    uint8_t data[LOGSTORE_MAX_RECORD_SIZE];
+    readData(_rdPage, offset, data, len);
+    if (crc8(data, len, crc8(hdr, 1, 0)) != hdr[1]) {
+      continue;
+    }
+    memcpy(buffer, data, len < size ? len : size);
+    return len;
+  }
+  return -1;
+}
+
+/*
+ * The number of pages with records, including the newest page
+ */
+uint16_t Sodaq_LogStore::getNrUsedPages() const
+{
+  return (_tailPage + _nrPages - _headPage) % _nrPages + 1;
+}
+
+bool Sodaq_LogStore::readPageHeader(uint16_t page, uint32_t *seq, uint16_t *wear)
+{
+  uint8_t hdr[LOGSTORE_PAGE_HDR_SIZE];
+  _df->readPage(absPage(page), 0, hdr, sizeof(hdr));
+  if (hdr[0] != PAGE_MAGIC || crc8(hdr, sizeof(hdr) - 1, 0) != hdr[sizeof(hdr) - 1]) {
+    return false;
+  }
+  *seq = hdr[1] | ((uint32_t)hdr[2] << 8) | ((uint32_t)hdr[3] << 16) | ((uint32_t)hdr[4] << 24);
+  *wear = hdr[5] | ((uint16_t)hdr[6] << 8);
+  return true;
+}
+
+/*
+ * Take a page into use as the newest page, in buffer 1
+ *
+ * Nothing is programmed yet. The wear of the page is taken from its old
+ * header (if it has one).
+ */
+void Sodaq_LogStore::startPage(uint16_t page)
+{
+  uint32_t seq;
+  uint16_t wear;
+  if (!readPageHeader(page, &seq, &wear)) {
+    wear = 0;
+  }
+  ++wear;
+  updateWear(wear);
+
+  ++_tailSeq;
+  _tailPage = page;
+  uint8_t hdr[LOGSTORE_PAGE_HDR_SIZE];
+  hdr[0] = PAGE_MAGIC;
+  hdr[1] = _tailSeq;
+  hdr[2] = _tailSeq >> 8;
+  hdr[3] = _tailSeq >> 16;
+  hdr[4] = _tailSeq >> 24;
+  hdr[5] = wear;
+  hdr[6] = wear >> 8;
+  hdr[7] = crc8(hdr, sizeof(hdr) - 1, 0);
+  _df->writeStrBuf1(0, hdr, sizeof(hdr));
+  _tailOffset = LOGSTORE_PAGE_HDR_SIZE;
+  _tailDirty = true;
+}
+
+/*
+ * Find the end of the records in the newest page
+ */
+void Sodaq_LogStore::findTailOffset()
+{
+  uint8_t hdr[2];
+  _tailOffset = LOGSTORE_PAGE_HDR_SIZE;
+  while (true) {
+    // The newest page is in buffer 1, readRecordHeader looks there
+    // as long as the offset is below _tailOffset. Here we want to look
+    // beyond it, so read buffer 1 directly.
+    if (_tailOffset + 2 > _pageSize) {
+      break;
+    }
+    _df->readStrBuf1(_tailOffset, hdr, 2);
+    if (hdr[0] == 0xFF || hdr[0] == 0 || _tailOffset + 2 + hdr[0] > _pageSize) {
+      break;
+    }
+    _tailOffset += 2 + hdr[0];
+  }
+}
+
+/*
+ * Read a record header, return false if there is no (plausible) record
+ *
+ * The newest page is read from buffer 1, the others directly from flash.
+ */
+bool Sodaq_LogStore::readRecordHeader(uint16_t page, uint16_t offset, uint8_t *hdr)
+{
+  if (page == _tailPage && offset >= _tailOffset) {
+    return false;
+  }
+  if (offset + 2 > _pageSize) {
+    return false;
+  }
+  readData(page, offset, hdr, 2);
+  if (hdr[0] == 0xFF || hdr[0] == 0 || hdr[0] > _maxRecordSize
+      || offset + 2 + hdr[0] > _pageSize) {
+    return false;
+  }
+  return true;
+}
+
+void Sodaq_LogStore::readData(uint16_t page, uint16_t offset, uint8_t *data, size_t size)
+{
+  if (page == _tailPage) {
+    _df->readStrBuf1(offset, data, size);
+  } else {
+    _df->readPage(absPage(page), offset, data, size);
+  }
+}
+
+void Sodaq_LogStore::updateWear(uint16_t wear)
+{
+  if (wear < _minWear) {
+    _minWear = wear;
+  }
+  if (wear > _maxWear) {
+    _maxWear = wear;
+  }
+}
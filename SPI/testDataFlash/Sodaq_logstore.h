@@ -0,0 +1,105 @@
+#ifndef SODAQ_LOGSTORE_H
+#define SODAQ_LOGSTORE_H
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Sodaq_dataflash.h"
+
+// The header at the start of each page: magic(1) seq(4) wear(2) crc(1)
+#define LOGSTORE_PAGE_HDR_SIZE  8
+// The upper limit of the record size. A record must also fit in a page,
+// together with the page header and its own 2 bytes header, see
+// getMaxRecordSize().
+#define LOGSTORE_MAX_RECORD_SIZE        250
+
+/*
+ * An append-only log of records in a range of DataFlash pages
+ *
+ * The pages are used round robin. When the log is full the oldest page
+ * is dropped to make room, so every page gets the same number of program
+ * cycles and there is no meta data page that is rewritten all the time.
+ *
+ * Each page starts with a header with a sequence number and the number
+ * of times the page was taken into use (its wear). mount() reads all the
+ * page headers and rebuilds the index in RAM: the oldest page, the newest
+ * page and the fill level of the newest page.
+ *
+ * The newest page is kept in DataFlash buffer 1 and is programmed when it
+ * is full, or when sync() is called. Records that were not yet synced are
+ * lost on a power failure.
+ *
+ * Record layout: <len> <crc8> <len bytes of data>
+ *
+ * The wear statistics are collected by mount() and updated when a page is
+ * taken into use. The minimum is only exact right after mount().
+ */
+class Sodaq_LogStore
+{
+public:
+  bool mount(Sodaq_Dataflash &df, uint16_t firstPage, uint16_t nrPages);
+  void format();
+
+  bool append(const uint8_t *data, uint8_t len);
+  void sync();
+
+  void rewind();
+  int readNext(uint8_t *buffer, size_t size);
+
+  uint8_t getMaxRecordSize() const { return _maxRecordSize; }
+  uint16_t getNrPages() const { return _nrPages; }
+  uint16_t getNrUsedPages() const;
+  uint16_t getMinWear() const { return _minWear; }
+  uint16_t getMaxWear() const { return _maxWear; }
+
+private:
+  bool readPageHeader(uint16_t page, uint32_t *seq, uint16_t *wear);
+  void startPage(uint16_t page);
+  void findTailOffset();
+  bool readRecordHeader(uint16_t page, uint16_t offset, uint8_t *hdr);
+  void readData(uint16_t page, uint16_t offset, uint8_t *data, size_t size);
+  void updateWear(uint16_t wear);
+  uint16_t nextPage(uint16_t page) const { return (page + 1) % _nrPages; }
+  uint16_t absPage(uint16_t page) const { return _firstPage + page; }
+
+  Sodaq_Dataflash *_df;
+  uint16_t _pageSize;
+  uint16_t _firstPage;
+  uint16_t _nrPages;
+  uint8_t _maxRecordSize;
+
+  // The index
+  uint16_t _headPage;           // the oldest page
+  uint16_t _tailPage;           // the newest page, it is in buffer 1
+  uint16_t _tailOffset;         // the fill level of the newest page
+  uint32_t _tailSeq;
+  bool _tailDirty;              // buffer 1 has records that are not programmed yet
+  uint16_t _minWear;
+  uint16_t _maxWear;
+
+  // The scan cursor
+  uint16_t _rdPage;
+  uint16_t _rdOffset;
+  bool _rdDone;
+};
+
+#endif // SODAQ_LOGSTORE_H
@@ -0,0 +1,455 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "Sodaq_timeseries.h"
+
+#define NO_WINDOW               0xFF
+
+// Write bits MSB first, or only count them if there is no buffer
+struct BitWriter
+{
+  uint8_t *buf;
+  uint32_t pos;
+
+  void put(uint32_t value, uint8_t n)
+  {
+    while (n-- > 0) {
+      if (buf) {
+        uint8_t mask = 0x80 >> (pos & 7);
+        if ((value >> n) & 1) {
+          buf[pos >> 3] |= mask;
+        } else {
+          buf[pos >> 3] &= ~mask;
+        }
+      }
+      ++pos;
+    }
+  }
+
+  void putVarint(uint32_t value)
+  {
+    while (value >= 0x80) {
+      put((value & 0x7F) | 0x80, 8);
+      value >>= 7;
+    }
+    put(value, 8);
+  }
+};
+
+static uint32_t zigzag(uint32_t value)
+{
+  return (value << 1) ^ (uint32_t)((int32_t)value >> 31);
+}
+
+static uint32_t unzigzag(uint32_t value)
+{
+  return (value >> 1) ^ (0 - (value & 1));
+}
+
+static uint8_t varintSize(uint32_t value)
+{
+  uint8_t n = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++n;
+  }
+  return n;
+}
+
+static uint8_t leadingZeros(uint32_t value)
+{
+  uint8_t n = 0;
+  while ((value & 0x80000000UL) == 0) {
+    value <<= 1;
+    ++n;
+  }
+  return n;
+}
+
+static uint8_t trailingZeros(uint32_t value)
+{
+  uint8_t n = 0;
+  while ((value & 1) == 0) {
+    value >>= 1;
+    ++n;
+  }
+  return n;
+}
+
+/*
+ * Encode one value of a column, rowIx is the row of the value
+ *
+ * The state is updated the same way as the reader does it.
+ */
+template <typename Column>
+static void encodeValue(Column &c, uint8_t type, uint8_t rowIx, uint32_t value, BitWriter &w)
+{
+  uint32_t delta = value - c.prev;
+
+  switch (type) {
+  case TIMESERIES_TIME:
+    if (rowIx == 0) {
+      w.putVarint(value);
+    } else if (rowIx == 1) {
+      w.putVarint(zigzag(delta));
+    } else {
+      w.putVarint(zigzag(delta - c.prevDelta));
+    }
+    c.prevDelta = delta;
+    break;
+
+  case TIMESERIES_INT:
+    w.putVarint(zigzag(rowIx == 0 ? value : delta));
+    break;
+
+  case TIMESERIES_FLOAT:
+    if (rowIx == 0) {
+      w.put(value, 32);
+      c.lead = NO_WINDOW;
+    } else {
+      uint32_t x = value ^ c.prev;
+      if (x == 0) {
+        w.put(0, 1);
+      } else {
+        uint8_t lead = leadingZeros(x);
+        uint8_t trail = trailingZeros(x);
+        if (c.lead != NO_WINDOW && lead >= c.lead && trail >= c.trail) {
+          w.put(2, 2);
+          w.put(x >> c.trail, 32 - c.lead - c.trail);
+        } else {
+          uint8_t n = 32 - lead - trail;
+          w.put(3, 2);
+          w.put(lead, 5);
+          w.put(n - 1, 5);
+          w.put(x >> trail, n);
+          c.lead = lead;
+          c.trail = trail;
+        }
+      }
+    }
+    break;
+  }
+  c.prev = value;
+}
+
+/*
+ * Start a new block, with the given schema
+ *
+ * The maximum block size is the limit for append(), e.g. the maximum
+ * record size of the log.
+ */
+bool Sodaq_TimeSeries::begin(uint8_t schemaId, const uint8_t *types, uint8_t nrColumns, size_t maxBlockSize)
+{
+  if (nrColumns == 0 || nrColumns > TIMESERIES_MAX_COLUMNS) {
+    return false;
+  }
+  for (uint8_t i = 0; i < nrColumns; ++i) {
+    if (types[i] < TIMESERIES_TIME || types[i] > TIMESERIES_FLOAT) {
+      return false;
+    }
+    _types[i] = types[i];
+    _row[i] = 0;
+  }
+  _schemaId = schemaId;
+  _nrColumns = nrColumns;
+  _maxBlockSize = maxBlockSize;
+  clear();
+  return true;
+}
+
+void Sodaq_TimeSeries::set(uint8_t col, uint32_t value)
+{
+  if (col < _nrColumns) {
+    _row[col] = value;
+  }
+}
+
+void Sodaq_TimeSeries::set(uint8_t col, float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  set(col, bits);
+}
+
+/*
+ * Add the row that was set to the block
+ *
+ * Return false if the block is full, either because the row doesn't fit
+ * in the maximum size or because the block has TIMESERIES_MAX_ROWS rows.
+ * The row is kept, it can be appended again after encode().
+ */
+bool Sodaq_TimeSeries::append()
+{
+  if (_nrRows >= TIMESERIES_MAX_ROWS) {
+    return false;
+  }
+
+  Column cols[TIMESERIES_MAX_COLUMNS];
+  memcpy(cols, _cols, sizeof(cols));
+  for (uint8_t i = 0; i < _nrColumns; ++i) {
+    BitWriter w = { 0, cols[i].nrBits };
+    encodeValue(cols[i], _types[i], _nrRows, _row[i], w);
+    cols[i].nrBits = w.pos;
+  }
+  if (blockSize(cols) > _maxBlockSize) {
+    return false;
+  }
+
+  memcpy(_cols, cols, sizeof(_cols));
+  memcpy(_rows[_nrRows], _row, sizeof(_row));
+  ++_nrRows;
+  return true;
+}
+
+/*
+ * The exact size that encode() needs for the rows so far
+ */
+size_t Sodaq_TimeSeries::getBlockSize() const
+{
+  return blockSize(_cols);
+}
+
+size_t Sodaq_TimeSeries::blockSize(const Column *cols) const
+{
+  size_t size = 5 + _nrColumns;
+  for (uint8_t i = 0; i < _nrColumns; ++i) {
+    uint16_t len = (cols[i].nrBits + 7) / 8;
+    size += varintSize(len) + len;
+  }
+  return size;
+}
+
+/*
+ * Write the block to the buffer and start a new block
+ *
+ * Return the size of the block, or 0 if there are no rows or if the
+ * buffer is too small (the rows are kept then).
+ */
+size_t Sodaq_TimeSeries::encode(uint8_t *buffer, size_t size)
+{
+  size_t blockSize = getBlockSize();
+  if (_nrRows == 0 || size < blockSize) {
+    return 0;
+  }
+
+  BitWriter w = { buffer, 0 };
+  w.put(TIMESERIES_MAGIC, 8);
+  w.put(TIMESERIES_VERSION, 8);
+  w.put(_schemaId, 8);
+  w.put(_nrColumns, 8);
+  w.put(_nrRows, 8);
+  for (uint8_t i = 0; i < _nrColumns; ++i) {
+    w.put(_types[i], 8);
+  }
+  for (uint8_t i = 0; i < _nrColumns; ++i) {
+    w.putVarint((_cols[i].nrBits + 7) / 8);
+  }
+
+  for (uint8_t i = 0; i < _nrColumns; ++i) {
+    Column c;
+    memset(&c, 0, sizeof(c));
+    for (uint8_t r = 0; r < _nrRows; ++r) {
+      encodeValue(c, _types[i], r, _rows[r][i], w);
+    }
+    // Pad the column to a whole byte
+    w.put(0, (8 - (w.pos & 7)) & 7);
+  }
+
+  clear();
+  return blockSize;
+}
+
+void Sodaq_TimeSeries::clear()
+{
+  _nrRows = 0;
+  memset(_cols, 0, sizeof(_cols));
+}
+
+/*
+ * Start reading a block, the block must stay available while reading
+ *
+ * Return false if it is not a valid block.
+ */
+bool Sodaq_TimeSeriesReader::init(const uint8_t *block, size_t len)
+{
+  _nrRows = 0;
+  _rowIx = 0;
+  if (len < 5 || block[0] != TIMESERIES_MAGIC || block[1] != TIMESERIES_VERSION
+      || block[3] == 0 || block[3] > TIMESERIES_MAX_COLUMNS) {
+    return false;
+  }
+  _block = block;
+  _schemaId = block[2];
+  _nrColumns = block[3];
+
+  // The header is read with the first column as a plain byte cursor
+  Column &c = _cols[0];
+  c.pos = 5 * 8;
+  c.end = len * 8;
+  for (uint8_t i = 0; i < _nrColumns; ++i) {
+    uint32_t type;
+    if (!readBits(0, 8, &type) || type < TIMESERIES_TIME || type > TIMESERIES_FLOAT) {
+      return false;
+    }
+    _types[i] = type;
+  }
+  uint32_t lens[TIMESERIES_MAX_COLUMNS];
+  for (uint8_t i = 0; i < _nrColumns; ++i) {
+    if (!readVarint(0, &lens[i])) {
+      return false;
+    }
+  }
+
+  uint32_t pos = c.pos;
+  for (uint8_t i = 0; i < _nrColumns; ++i) {
+    if (lens[i] > len) {
+      return false;
+    }
+    memset(&_cols[i], 0, sizeof(_cols[i]));
+    _cols[i].pos = pos;
+    pos += lens[i] * 8;
+    _cols[i].end = pos;
+  }
+  if (pos > len * 8) {
+    return false;
+  }
+  _nrRows = block[4];
+  return true;
+}
+
+/*
+ * Decode the next row
+ *
+ * Return false at the end of the block, or if the block is corrupt.
+ */
+bool Sodaq_TimeSeriesReader::next()
+{
+  if (_rowIx >= _nrRows) {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < _nrColumns; ++i) {
+    Column &c = _cols[i];
+    uint32_t value;
+
+    switch (_types[i]) {
+    case TIMESERIES_TIME:
+      if (!readVarint(i, &value)) {
+        goto corrupt;
+      }
+      if (_rowIx == 0) {
+        c.prevDelta = 0;
+        c.prev = value;
+      } else {
+        c.prevDelta = (_rowIx == 1 ? 0 : c.prevDelta) + unzigzag(value);
+        c.prev += c.prevDelta;
+      }
+      break;
+
+    case TIMESERIES_INT:
+      if (!readVarint(i, &value)) {
+        goto corrupt;
+      }
+      c.prev = (_rowIx == 0 ? 0 : c.prev) + unzigzag(value);
+      break;
+
+    case TIMESERIES_FLOAT:
+      if (_rowIx == 0) {
+        if (!readBits(i, 32, &c.prev)) {
+          goto corrupt;
+        }
+        c.lead = NO_WINDOW;
+        break;
+      }
+      if (!readBits(i, 1, &value)) {
+        goto corrupt;
+      }
+      if (value == 0) {
+        break;
+      }
+      if (!readBits(i, 1, &value)) {
+        goto corrupt;
+      }
+      if (value == 1) {
+        uint32_t lead;
+        uint32_t n;
+        if (!readBits(i, 5, &lead) || !readBits(i, 5, &n) || lead + n + 1 > 32) {
+          goto corrupt;
+        }
+        c.lead = lead;
+        c.trail = 32 - lead - (n + 1);
+      } else if (c.lead == NO_WINDOW) {
+        goto corrupt;
+      }
+      if (!readBits(i, 32 - c.lead - c.trail, &value)) {
+        goto corrupt;
+      }
+      c.prev ^= value << c.trail;
+      break;
+    }
+  }
+  ++_rowIx;
+  return true;
+
+corrupt:
+  _nrRows = 0;
+  return false;
+}
+
+float Sodaq_TimeSeriesReader::getFloat(uint8_t col) const
+{
+  float value;
+  memcpy(&value, &_cols[col].prev, sizeof(value));
+  return value;
+}
+
+bool Sodaq_TimeSeriesReader::readBits(uint8_t col, uint8_t n, uint32_t *value)
+{
+  Column &c = _cols[col];
+  if (c.pos + n > c.end) {
+    return false;
+  }
+  uint32_t v = 0;
+  while (n-- > 0) {
+    v = (v << 1) | ((_block[c.pos >> 3] >> (7 - (c.pos & 7))) & 1);
+    ++c.pos;
+  }
+  *value = v;
+  return true;
+}
+
+bool Sodaq_TimeSeriesReader::readVarint(uint8_t col, uint32_t *value)
+{
+  uint32_t v = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    uint32_t b;
+    if (!readBits(col, 8, &b)) {
+      return false;
+    }
+    v |= (b & 0x7F) << shift;
+    if ((b & 0x80) == 0) {
+      *value = v;
+      return true;
+    }
+  }
+  return false;
+}
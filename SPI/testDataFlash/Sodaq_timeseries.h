@@ -0,0 +1,165 @@
+#ifndef SODAQ_TIMESERIES_H
+#define SODAQ_TIMESERIES_H
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The maximum number of columns, including the time column(s)
+#ifndef TIMESERIES_MAX_COLUMNS
+#define TIMESERIES_MAX_COLUMNS  5
+#endif
+// The maximum number of rows in one block, the encoder keeps them in RAM
+#ifndef TIMESERIES_MAX_ROWS
+#define TIMESERIES_MAX_ROWS     64
+#endif
+
+#define TIMESERIES_MAGIC        'T'
+#define TIMESERIES_VERSION      1
+
+// Column types
+#define TIMESERIES_TIME         1       // uint32_t, delta-of-delta, zigzag varint
+#define TIMESERIES_INT          2       // int32_t, delta, zigzag varint
+#define TIMESERIES_FLOAT        3       // float, XOR with the previous value
+
+/*
+ * A compact, columnar encoding of a block of sensor samples
+ *
+ * Each row has the same columns, as given by a schema: a list of column
+ * types and a schema id that the application chooses (the receiver uses it
+ * to know what the columns are). A block is self-contained, so it can be
+ * stored as one Sodaq_LogStore or Sodaq_UplinkQueue record, or be (part of)
+ * an upload.
+ *
+ * Block layout:
+ *   'T' <version> <schema id> <nr columns> <nr rows>
+ *   <type of each column>
+ *   <byte length of each column, varint>
+ *   <the data of each column>
+ *
+ * Column data, for each row:
+ *   TIME   the first value as varint, then the delta (zigzag varint), then
+ *          the change of the delta (zigzag varint). A regular interval
+ *          costs 1 byte per row.
+ *   INT    the first value, then the delta, both zigzag varint
+ *   FLOAT  the first value (32 bits), then the XOR with the previous value
+ *          as a bit stream: '0' for the same value, '10' + the meaningful
+ *          bits if they fit in the previous window of leading and trailing
+ *          zeros, else '11' + 5 bits leading zeros + 5 bits length - 1 + the
+ *          meaningful bits. The column is padded to a whole byte.
+ *
+ * The encoder keeps the rows of a block in RAM and knows the exact encoded
+ * size at each append(), so the block can be kept below a maximum size:
+ *   const uint8_t types[] = { TIMESERIES_TIME, TIMESERIES_FLOAT, TIMESERIES_INT };
+ *   ts.begin(1, types, sizeof(types), logStore.getMaxRecordSize());
+ *   ...
+ *   ts.set(0, now);
+ *   ts.set(1, temperature);
+ *   ts.set(2, (int32_t)analogRead(A0));
+ *   if (!ts.append()) {
+ *     // The block is full, store it and append the row to a new block
+ *     len = ts.encode(buffer, sizeof(buffer));
+ *     logStore.append(buffer, len);
+ *     ts.append();
+ *   }
+ *
+ * This is plain C++, the same code decodes the blocks on the server.
+ */
+class Sodaq_TimeSeries
+{
+public:
+  bool begin(uint8_t schemaId, const uint8_t *types, uint8_t nrColumns, size_t maxBlockSize);
+
+  void set(uint8_t col, uint32_t value);
+  void set(uint8_t col, int32_t value) { set(col, (uint32_t)value); }
+  void set(uint8_t col, float value);
+  bool append();
+
+  uint8_t getNrRows() const { return _nrRows; }
+  size_t getBlockSize() const;
+  size_t encode(uint8_t *buffer, size_t size);
+  void clear();
+
+private:
+  uint32_t _row[TIMESERIES_MAX_COLUMNS];                        // the row being set
+  uint32_t _rows[TIMESERIES_MAX_ROWS][TIMESERIES_MAX_COLUMNS];
+  uint8_t _types[TIMESERIES_MAX_COLUMNS];
+  uint8_t _nrColumns;
+  uint8_t _nrRows;
+  uint8_t _schemaId;
+  size_t _maxBlockSize;
+
+  // Encoder state of each column, to know the exact size
+  struct Column {
+    uint32_t prev;
+    uint32_t prevDelta;
+    uint8_t lead;               // the window of meaningful bits of FLOAT
+    uint8_t trail;
+    uint16_t nrBits;
+  } _cols[TIMESERIES_MAX_COLUMNS];
+
+  size_t blockSize(const Column *cols) const;
+};
+
+/*
+ * Decode a block of Sodaq_TimeSeries, a row at a time
+ *   reader.init(block, len);
+ *   while (reader.next()) {
+ *     reader.getUInt(0), reader.getFloat(1), ...
+ *   }
+ */
+class Sodaq_TimeSeriesReader
+{
+public:
+  bool init(const uint8_t *block, size_t len);
+
+  uint8_t getSchemaId() const { return _schemaId; }
+  uint8_t getNrColumns() const { return _nrColumns; }
+  uint8_t getType(uint8_t col) const { return _types[col]; }
+  uint8_t getNrRows() const { return _nrRows; }
+
+  bool next();
+  uint32_t getUInt(uint8_t col) const { return _cols[col].prev; }
+  int32_t getInt(uint8_t col) const { return (int32_t)_cols[col].prev; }
+  float getFloat(uint8_t col) const;
+
+private:
+  bool readBits(uint8_t col, uint8_t n, uint32_t *value);
+  bool readVarint(uint8_t col, uint32_t *value);
+
+  const uint8_t *_block;
+  uint8_t _types[TIMESERIES_MAX_COLUMNS];
+  uint8_t _nrColumns;
+  uint8_t _nrRows;
+  uint8_t _schemaId;
+  uint8_t _rowIx;
+
+  struct Column {
+    uint32_t prev;
+    uint32_t prevDelta;
+    uint8_t lead;
+    uint8_t trail;
+    uint32_t pos;               // the next bit
+    uint32_t end;               // the end of the column, in bits
+  } _cols[TIMESERIES_MAX_COLUMNS];
+};
+
+#endif // SODAQ_TIMESERIES_H
@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "Sodaq_crc8.h"
+#include "Sodaq_uplinkqueue.h"
+
+#define META_MAGIC0             'U'
+#define META_MAGIC1             'Q'
+// magic(2) seq(4) headPage(2) headOffset(2) tailPage(2) tailOffset(2) crc(1)
+#define META_SIZE               15
+
+#define NO_PAGE                 0xFFFF
+
+static void put16(uint8_t *ptr, uint16_t val)
+{
+  ptr[0] = val;
+  ptr[1] = val >> 8;
+}
+
+static uint16_t get16(const uint8_t *ptr)
+{
+  return ptr[0] | ((uint16_t)ptr[1] << 8);
+}
+
+/*
+ * Initialize the queue in the pages firstPage .. firstPage + nrPages - 1
+ *
+ * The DataFlash must already be initialized. If the pages contain a valid
+ * queue then that is picked up, else the queue starts empty.
+ */
+bool Sodaq_UplinkQueue::init(Sodaq_Dataflash &df, uint16_t firstPage, uint16_t nrPages)
+{
+  if (nrPages < 3 || firstPage + nrPages > df.getNrPages()) {
+    // We need two meta pages and at least one data page
+    return false;
+  }
+  _df = &df;
+  _pageSize = df.getPageSize();
+  _metaPage = firstPage;
+  _dataPage = firstPage + 2;
+  _nrDataPages = nrPages - 2;
+  _buf1Page = NO_PAGE;
+  _nrBadRecords = 0;
+  _maxBytes = 0;
+  _maxAge = 0;
+
+  if (loadMeta()) {
+    recoverTail();
+  } else {
+    // Start with an empty queue
+    _metaSeq = 0;
+    _headPage = 0;
+    _headOffset = 0;
+    _tailPage = 0;
+    _tailOffset = 0;
+    _df->pageErase(absPage(_tailPage));
+    writeMeta();
+  }
+  scanPending();
+  _oldestTs = millis();
+  rewind();
+  return true;
+}
+
+/*
+ * Check if one of the thresholds (size or age) has been reached
+ */
+bool Sodaq_UplinkQueue::isDrainDue() const
+{
+  if (_pendingRecords == 0) {
+    return false;
+  }
+  if (_maxBytes > 0 && _pendingBytes >= _maxBytes) {
+    return true;
+  }
+  if (_maxAge > 0 && (millis() - _oldestTs) >= _maxAge) {
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Append a record at the tail of the queue
+ *
+ * The record is programmed into the flash right away. Returns false if
+ * the record is too big or if the queue is full.
+ */
+bool Sodaq_UplinkQueue::append(const uint8_t *data, uint8_t len)
+{
+  if (len == 0 || len > UPLINKQUEUE_MAX_RECORD_SIZE) {
+    return false;
+  }
+
+  if (_tailOffset + 2 + len > _pageSize) {
+    // Move to the next page, but never into the head page
+    uint16_t next = nextPage(_tailPage);
+    if (next == _headPage) {
+      return false;
+    }
+    _tailPage = next;
+    _tailOffset = 0;
+    _df->pageErase(absPage(_tailPage));
+    _buf1Page = NO_PAGE;
+    writeMeta();
+  }
+
+  uint8_t hdr[2];
+  hdr[0] = len;
+  hdr[1] = crc8(data, len, crc8(hdr, 1, 0));
+
+  loadPage(_tailPage);
+  _df->writeStrBuf1(_tailOffset, hdr, sizeof(hdr));
+  _df->writeStrBuf1(_tailOffset + 2, (uint8_t *)data, len);
+  _df->writeBuf1ToPage(absPage(_tailPage));
+  _tailOffset += 2 + len;
+
+  if (_pendingRecords == 0) {
+    _oldestTs = millis();
+  }
+  _pendingBytes += 2 + len;
+  ++_pendingRecords;
+  return true;
+}
+
+/*
+ * Move the drain cursor back to the head of the queue
+ */
+void Sodaq_UplinkQueue::rewind()
+{
+  _rdPage = _headPage;
+  _rdOffset = _headOffset;
+  _rdRemain = 0;
+  _rdBytes = 0;
+  _rdRecords = 0;
+  _rdCacheIx = 0;
+  _rdCacheLen = 0;
+}
+
+/*
+ * Copy as many whole records as fit in the buffer
+ *
+ * The records are copied with their headers, see the stream format in
+ * the header file. Records with a bad CRC are skipped.
+ * Returns the number of bytes in the buffer.
+ */
+size_t Sodaq_UplinkQueue::readRecords(uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  uint8_t hdr[2];
+
+  while (peekRecord(hdr) && n + 2 + hdr[0] <= size) {
+    uint8_t len = hdr[0];
+    loadPage(_rdPage);
+    _df->readStrBuf1(_rdOffset, buffer + n, 2 + len);
+    _rdOffset += 2 + len;
+    if (crc8(buffer + n + 2, len, crc8(hdr, 1, 0)) != hdr[1]) {
+      ++_nrBadRecords;
+      continue;
+    }
+    n += 2 + len;
+    _rdBytes += 2 + len;
+    ++_rdRecords;
+  }
+  return n;
+}
+
+/*
+ * Read the next byte of the records, to be used as the read function
+ * of GPRSbeeClass::sendFTPdata()
+ *
+ * The bytes are the same as readRecords() gives: the records with their
+ * headers, without the records that have a bad CRC.
+ * Returns 0 when there is no more data.
+ */
+uint8_t Sodaq_UplinkQueue::read()
+{
+  while (_rdRemain == 0) {
+    uint8_t hdr[2];
+    if (!peekRecord(hdr)) {
+      return 0;
+    }
+    uint8_t len = hdr[0];
+    uint16_t offset = _rdOffset;
+    _rdOffset += 2 + len;
+    if (recordCrc(_rdPage, offset, len) != hdr[1]) {
+      ++_nrBadRecords;
+      continue;
+    }
+    _rdPos = offset;
+    _rdRemain = 2 + len;
+    _rdBytes += 2 + len;
+    ++_rdRecords;
+    _rdCacheIx = 0;
+    _rdCacheLen = 0;
+  }
+
+  if (_rdCacheIx >= _rdCacheLen) {
+    _rdCacheLen = _rdRemain < sizeof(_rdCache) ? _rdRemain : sizeof(_rdCache);
+    _rdCacheIx = 0;
+    loadPage(_rdPage);
+    _df->readStrBuf1(_rdPos, _rdCache, _rdCacheLen);
+  }
+  --_rdRemain;
+  ++_rdPos;
+  return _rdCache[_rdCacheIx++];
+}
+
+/*
+ * Remove the records that were read since rewind() from the queue
+ */
+void Sodaq_UplinkQueue::commit()
+{
+  _headPage = _rdPage;
+  _headOffset = _rdOffset;
+  _pendingBytes -= _rdBytes;
+  _pendingRecords -= _rdRecords;
+  writeMeta();
+  rewind();
+  if (_pendingRecords == 0) {
+    _oldestTs = millis();
+  }
+}
+
+/*
+ * Find the newest valid meta page
+ */
+bool Sodaq_UplinkQueue::loadMeta()
+{
+  bool found = false;
+  uint8_t meta[META_SIZE];
+
+  for (uint8_t i = 0; i < 2; ++i) {
+    loadAbsPage(_metaPage + i);
+    _df->readStrBuf1(0, meta, sizeof(meta));
+    if (meta[0] != META_MAGIC0 || meta[1] != META_MAGIC1
+        || crc8(meta, META_SIZE - 1, 0) != meta[META_SIZE - 1]) {
+      continue;
+    }
+    uint32_t seq = get16(meta + 2) | ((uint32_t)get16(meta + 4) << 16);
+    uint16_t headPage = get16(meta + 6);
+    uint16_t headOffset = get16(meta + 8);
+    uint16_t tailPage = get16(meta + 10);
+    uint16_t tailOffset = get16(meta + 12);
+    if (headPage >= _nrDataPages || tailPage >= _nrDataPages
+        || headOffset > _pageSize || tailOffset > _pageSize) {
+      // It was written with a different page range
+      continue;
+    }
+    if (found && seq < _metaSeq) {
+      continue;
+    }
+    found = true;
+    _metaSeq = seq;
+    _headPage = headPage;
+    _headOffset = headOffset;
+    _tailPage = tailPage;
+    _tailOffset = tailOffset;
+  }
+  return found;
+}
+
+/*
+ * Persist head and tail, alternating between the two meta pages
+ */
+void Sodaq_UplinkQueue::writeMeta()
+{
+  uint8_t meta[META_SIZE];
+
+  ++_metaSeq;
+  meta[0] = META_MAGIC0;
+  meta[1] = META_MAGIC1;
+  put16(meta + 2, _metaSeq);
+  put16(meta + 4, _metaSeq >> 16);
+  put16(meta + 6, _headPage);
+  put16(meta + 8, _headOffset);
+  put16(meta + 10, _tailPage);
+  put16(meta + 12, _tailOffset);
+  meta[META_SIZE - 1] = crc8(meta, META_SIZE - 1, 0);
+
+  uint16_t page = _metaPage + (_metaSeq & 1);
+  _df->writeStrBuf1(0, meta, sizeof(meta));
+  _df->writeBuf1ToPage(page);
+  // The rest of buffer 1 was left as is, so it equals the page now.
+  _buf1Page = page;
+}
+
+/*
+ * Skip the records that were appended after the last meta write
+ */
+void Sodaq_UplinkQueue::recoverTail()
+{
+  uint8_t hdr[2];
+  while (readHeader(_tailPage, _tailOffset, hdr)) {
+    if (recordCrc(_tailPage, _tailOffset, hdr[0]) != hdr[1]) {
+      // Most likely a record that was only partly written
+      break;
+    }
+    _tailOffset += 2 + hdr[0];
+  }
+}
+
+/*
+ * Count the records and bytes between head and tail
+ *
+ * Records with a bad CRC are not counted, the drain skips them.
+ */
+void Sodaq_UplinkQueue::scanPending()
+{
+  _pendingBytes = 0;
+  _pendingRecords = 0;
+  rewind();
+  uint8_t hdr[2];
+  while (peekRecord(hdr)) {
+    uint8_t len = hdr[0];
+    if (recordCrc(_rdPage, _rdOffset, len) == hdr[1]) {
+      _pendingBytes += 2 + len;
+      ++_pendingRecords;
+    }
+    _rdOffset += 2 + len;
+  }
+}
+
+/*
+ * Position the drain cursor at the next record, if there is one, and
+ * read its header
+ */
+bool Sodaq_UplinkQueue::peekRecord(uint8_t *hdr)
+{
+  while (true) {
+    if (_rdPage == _tailPage && _rdOffset >= _tailOffset) {
+      return false;
+    }
+    if (readHeader(_rdPage, _rdOffset, hdr)) {
+      return true;
+    }
+    if (_rdPage == _tailPage) {
+      return false;
+    }
+    // The rest of this page is unused
+    _rdPage = nextPage(_rdPage);
+    _rdOffset = 0;
+  }
+}
+
+/*
+ * Read a record header, return false if there is no (plausible) record
+ */
+bool Sodaq_UplinkQueue::readHeader(uint16_t page, uint16_t offset, uint8_t *hdr)
+{
+  if (offset + 2 > _pageSize) {
+    return false;
+  }
+  loadPage(page);
+  _df->readStrBuf1(offset, hdr, 2);
+  if (hdr[0] == 0xFF || hdr[0] == 0 || offset + 2 + hdr[0] > _pageSize) {
+    return false;
+  }
+  return true;
+}
+
+uint8_t Sodaq_UplinkQueue::recordCrc(uint16_t page, uint16_t offset, uint8_t len)
+{
+  uint8_t buf[32];
+  uint8_t crc = crc8(&len, 1, 0);
+
+  loadPage(page);
+  offset += 2;
+  while (len > 0) {
+    uint8_t n = len < sizeof(buf) ? len : sizeof(buf);
+    _df->readStrBuf1(offset, buf, n);
+    crc = crc8(buf, n, crc);
+    offset += n;
+    len -= n;
+  }
+  return crc;
+}
+
+/*
+ * Make sure the (absolute) page is in DataFlash buffer 1
+ */
+void Sodaq_UplinkQueue::loadAbsPage(uint16_t page)
+{
+  if (_buf1Page != page) {
+    _df->readPageToBuf1(page);
+    _buf1Page = page;
+  }
+}
@@ -0,0 +1,141 @@
+#ifndef SODAQ_UPLINKQUEUE_H
+#define SODAQ_UPLINKQUEUE_H
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published bythe Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Sodaq_dataflash.h"
+
+// A record must fit in a page, together with its 2 bytes header
+#define UPLINKQUEUE_MAX_RECORD_SIZE     250
+
+/*
+ * A store-and-forward queue of records in a range of DataFlash pages
+ *
+ * Records are appended at the tail and drained from the head, in batches,
+ * e.g. as one HTTP POST body or as one FTP upload. The queue survives a
+ * reset: the head and tail are persisted in two alternating meta pages
+ * (the first two pages of the range) and each record has a CRC.
+ *
+ * The meta data is only written when the tail moves to a new page and
+ * when a drain is committed. Records appended after that are found back
+ * at init() by scanning the tail page.
+ *
+ * Record layout: <len> <crc8> <len bytes of data>
+ * Records do not cross page boundaries. The CRC is CRC-8/MAXIM over the
+ * length byte and the data.
+ *
+ * The drained data (readRecords() and read()) is the records in this same
+ * layout, so the server can split the upload into records again and check
+ * them. getPendingSize() includes the headers.
+ *
+ * Draining goes like this:
+ *   queue.rewind();
+ *   n = queue.readRecords(buffer, sizeof(buffer));
+ *   if (gprsbee.doHTTPPOSTmiddle(url, (char *)buffer, n)) {
+ *     queue.commit();
+ *   }
+ * or, without a buffer in RAM, with a pull callback that calls read()
+ *   size_t pullQueue(uint8_t *buffer, size_t size)
+ *   {
+ *     for (size_t i = 0; i < size; ++i) {
+ *       buffer[i] = queue.read();
+ *     }
+ *     return size;
+ *   }
+ *   ...
+ *   queue.rewind();
+ *   if (gprsbee.doHTTPPOSTmiddle(url, pullQueue, queue.getPendingSize())) {
+ *     queue.commit();
+ *   }
+ * or, for FTP, with uint8_t readQueue() { return queue.read(); }
+ *   queue.rewind();
+ *   size = queue.getPendingSize();
+ *   if (gprsbee.sendFTPdata(readQueue, size)) {
+ *     queue.commit();
+ *   }
+ */
+class Sodaq_UplinkQueue
+{
+public:
+  bool init(Sodaq_Dataflash &df, uint16_t firstPage, uint16_t nrPages);
+  void setThresholds(size_t maxBytes, uint32_t maxAge) { _maxBytes = maxBytes; _maxAge = maxAge; }
+
+  bool append(const uint8_t *data, uint8_t len);
+
+  bool isEmpty() const { return _pendingRecords == 0; }
+  bool isDrainDue() const;
+  size_t getPendingSize() const { return _pendingBytes; }
+  uint16_t getPendingRecords() const { return _pendingRecords; }
+  uint16_t getNrBadRecords() const { return _nrBadRecords; }
+
+  void rewind();
+  size_t readRecords(uint8_t *buffer, size_t size);
+  uint8_t read();
+  void commit();
+
+private:
+  bool loadMeta();
+  void writeMeta();
+  void recoverTail();
+  void scanPending();
+  bool peekRecord(uint8_t *hdr);
+  bool readHeader(uint16_t page, uint16_t offset, uint8_t *hdr);
+  uint8_t recordCrc(uint16_t page, uint16_t offset, uint8_t len);
+  void loadPage(uint16_t page) { loadAbsPage(absPage(page)); }
+  void loadAbsPage(uint16_t page);
+  uint16_t nextPage(uint16_t page) const { return (page + 1) % _nrDataPages; }
+  uint16_t absPage(uint16_t page) const { return _dataPage + page; }
+
+  Sodaq_Dataflash *_df;
+  uint16_t _pageSize;
+  uint16_t _metaPage;           // the first of the two meta pages
+  uint16_t _dataPage;           // the first data page
+  uint16_t _nrDataPages;
+  uint16_t _buf1Page;           // which (absolute) page is in DataFlash buffer 1
+  uint32_t _metaSeq;
+
+  uint16_t _headPage;           // data pages are relative to _dataPage
+  uint16_t _headOffset;
+  uint16_t _tailPage;
+  uint16_t _tailOffset;
+
+  size_t _pendingBytes;         // including the record headers
+  uint16_t _pendingRecords;
+  uint16_t _nrBadRecords;
+  size_t _maxBytes;
+  uint32_t _maxAge;
+  uint32_t _oldestTs;           // millis() of the oldest pending record (or of init)
+
+  // The drain cursor
+  uint16_t _rdPage;
+  uint16_t _rdOffset;           // the next record
+  uint16_t _rdPos;              // the next byte for read()
+  uint16_t _rdRemain;           // bytes left in the current record for read()
+  size_t _rdBytes;
+  uint16_t _rdRecords;
+  uint8_t _rdCache[32];
+  uint8_t _rdCacheIx;
+  uint8_t _rdCacheLen;
+};
+
+#endif // SODAQ_UPLINKQUEUE_H
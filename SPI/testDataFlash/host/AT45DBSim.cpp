@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "AT45DBSim.h"
+
+// AT45DB161D: Manufacturer ID, Device ID byte 1 and 2, extended info length
+static const uint8_t deviceId[] = { 0x1F, 0x26, 0x00, 0x00 };
+// The density code of the status register, bits 5..2
+#define STATUS_DENSITY          0x2C
+#define STATUS_RDY              0x80
+
+const AT45DBTiming at45dbTypical = {
+  200,                          // tXFR
+  14000,                        // tEP
+  13000,                        // tPE
+  12000000,                     // tCE, roughly
+};
+
+AT45DBSim::AT45DBSim(const AT45DBTiming &timing)
+{
+  _timing = timing;
+  _pageSize = 528;
+  _nrPages = 4096;
+  _pageBits = 10;
+  _mem.assign((size_t)_nrPages * _pageSize, 0xFF);
+  _buf[0].assign(_pageSize, 0xFF);
+  _buf[1].assign(_pageSize, 0xFF);
+  clearCycles();
+  _busyUntil = 0;
+  _busyBuf = -1;
+  _selected = false;
+  _ignored = false;
+  _pos = 0;
+  resetCounters();
+}
+
+void AT45DBSim::resetCounters()
+{
+  _busyNs = 0;
+  _nrViolations = 0;
+  _lastViolation.clear();
+}
+
+uint32_t AT45DBSim::getMinCycles(uint16_t firstPage, uint16_t nrPages) const
+{
+  uint32_t cycles = 0xFFFFFFFF;
+  for (uint16_t page = firstPage; page < firstPage + nrPages; ++page) {
+    if (_cycles[page] < cycles) {
+      cycles = _cycles[page];
+    }
+  }
+  return cycles;
+}
+
+uint32_t AT45DBSim::getMaxCycles(uint16_t firstPage, uint16_t nrPages) const
+{
+  uint32_t cycles = 0;
+  for (uint16_t page = firstPage; page < firstPage + nrPages; ++page) {
+    if (_cycles[page] > cycles) {
+      cycles = _cycles[page];
+    }
+  }
+  return cycles;
+}
+
+void AT45DBSim::select(bool active)
+{
+  if (active) {
+    _selected = true;
+    _ignored = false;
+    _pos = 0;
+    return;
+  }
+  if (_selected && !_ignored) {
+    execute();
+  }
+  _selected = false;
+}
+
+uint8_t AT45DBSim::transfer(uint8_t data)
+{
+  if (!_selected || _ignored) {
+    return 0xFF;
+  }
+  uint32_t pos = _pos++;
+  if (pos < sizeof(_cmd)) {
+    _cmd[pos] = data;
+  }
+  uint8_t cmd = _cmd[0];
+  if (pos == 0) {
+    if (isBusy()) {
+      // Only the status and the other buffer can be used
+      int buf = cmd == 0xD4 || cmd == 0x84 ? 0 : cmd == 0xD6 || cmd == 0x87 ? 1 : -1;
+      if (cmd != 0xD7 && (buf < 0 || buf == _busyBuf)) {
+        violation("command while busy");
+        _ignored = true;
+      }
+    }
+    return 0xFF;
+  }
+  if (pos == 3) {
+    decodeAddr();
+  }
+
+  switch (cmd) {
+  case 0xD7:                    // Status Register Read
+    return (isBusy() ? 0 : STATUS_RDY) | STATUS_DENSITY;
+  case 0x9F:                    // Manufacturer and Device ID Read
+    return pos <= sizeof(deviceId) ? deviceId[pos - 1] : 0x00;
+  case 0x77:                    // Security Register Read
+    return pos >= 4 ? (uint8_t)(pos - 4) : 0xFF;
+  case 0xD4:                    // Buffer 1 or 2 Read
+  case 0xD6:
+    if (pos >= 5) {
+      return _buf[cmd == 0xD6][(_offset + pos - 5) % _pageSize];
+    }
+    break;
+  case 0x84:                    // Buffer 1 or 2 Write
+  case 0x87:
+    if (pos >= 4) {
+      _buf[cmd == 0x87][(_offset + pos - 4) % _pageSize] = data;
+    }
+    break;
+  case 0xD2:                    // Main Memory Page Read, wraps in the page
+    if (pos >= 8) {
+      return getPage(_page)[(_offset + pos - 8) % _pageSize];
+    }
+    break;
+  case 0x0B:                    // Continuous Array Read, on to the next page
+    if (pos >= 5) {
+      uint32_t addr = ((uint32_t)_page * _pageSize + _offset + pos - 5) % _mem.size();
+      return _mem[addr];
+    }
+    break;
+  default:
+    break;
+  }
+  return 0xFF;
+}
+
+/*
+ * The three address bytes: the page and the byte in it
+ */
+void AT45DBSim::decodeAddr()
+{
+  uint32_t addr = ((uint32_t)_cmd[1] << 16) | ((uint32_t)_cmd[2] << 8) | _cmd[3];
+  _page = (addr >> _pageBits) % _nrPages;
+  _offset = (addr & ((1 << _pageBits) - 1)) % _pageSize;
+}
+
+/*
+ * The operations that start when the chip select goes high
+ */
+void AT45DBSim::execute()
+{
+  if (_pos < 4) {
+    return;
+  }
+  uint8_t *page = &_mem[(size_t)_page * _pageSize];
+  switch (_cmd[0]) {
+  case 0x53:                    // Main Memory Page to Buffer 1 or 2 Transfer
+  case 0x55:
+    memcpy(&_buf[_cmd[0] == 0x55][0], page, _pageSize);
+    startBusy(_timing.xfrUs, _cmd[0] == 0x55);
+    break;
+  case 0x83:                    // Buffer 1 or 2 to Main Memory Page Program with Built-in Erase
+  case 0x86:
+    memcpy(page, &_buf[_cmd[0] == 0x86][0], _pageSize);
+    ++_cycles[_page];
+    startBusy(_timing.programUs, _cmd[0] == 0x86);
+    break;
+  case 0x81:                    // Page Erase
+    memset(page, 0xFF, _pageSize);
+    ++_cycles[_page];
+    startBusy(_timing.eraseUs, -1);
+    break;
+  case 0xC7:                    // Chip Erase
+    if (_cmd[1] == 0x94 && _cmd[2] == 0x80 && _cmd[3] == 0x9A) {
+      _mem.assign(_mem.size(), 0xFF);
+      for (size_t i = 0; i < _cycles.size(); ++i) {
+        ++_cycles[i];
+      }
+      startBusy(_timing.chipEraseUs, -1);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void AT45DBSim::startBusy(uint32_t us, int buf)
+{
+  _busyUntil = hostNanos() + (uint64_t)us * 1000;
+  _busyBuf = buf;
+  _busyNs += (uint64_t)us * 1000;
+}
+
+void AT45DBSim::violation(const char *what)
+{
+  char text[64];
+  snprintf(text, sizeof(text), "%s: 0x%02X", what, _cmd[0]);
+  _lastViolation = text;
+  ++_nrViolations;
+}
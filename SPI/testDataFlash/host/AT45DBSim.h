@@ -0,0 +1,120 @@
+#ifndef AT45DBSIM_H_
+#define AT45DBSIM_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <Arduino.h>
+
+/*
+ * The busy times of the device, in microseconds
+ *
+ * The defaults are the typical figures of the AT45DB161D data sheet, not
+ * measurements.
+ */
+struct AT45DBTiming
+{
+  uint32_t xfrUs;               // page to buffer transfer (0x53, 0x55)
+  uint32_t programUs;           // buffer to page program with built-in erase (0x83, 0x86)
+  uint32_t eraseUs;             // page erase (0x81)
+  uint32_t chipEraseUs;         // chip erase (0xC7 0x94 0x80 0x9A)
+};
+
+extern const AT45DBTiming at45dbTypical;
+
+// The endurance of a page of the AT45DB161D data sheet, in program/erase cycles
+#define AT45DB_ENDURANCE        100000
+
+/*!
+ * \brief An emulated AT45DB161D on the SPI bus of the host
+ *
+ * It decodes the commands that Sodaq_Dataflash uses and keeps the main
+ * memory and the two SRAM buffers. A page program, erase or transfer
+ * starts when the chip select goes high and keeps the device busy for
+ * the time of the AT45DBTiming; the RDY bit of the status register is 0
+ * until then.
+ *
+ * While the device is busy it only accepts a status read, and a read or
+ * write of the buffer that is not being programmed. Any other command is
+ * ignored, like the real device does, and counted as a violation: the
+ * driver should have waited.
+ *
+ * Each page counts its program/erase cycles: a program with built-in
+ * erase, a page erase and a chip erase each add one. Compare them with
+ * AT45DB_ENDURANCE.
+ */
+class AT45DBSim : public HostSPIDevice
+{
+public:
+  AT45DBSim(const AT45DBTiming &timing=at45dbTypical);
+
+  // Put it on the SPI bus, with this chip select pin
+  void attach(uint8_t csPin=SS) { hostSetSPIDevice(this, csPin); }
+
+  uint16_t getPageSize() const { return _pageSize; }
+  uint16_t getNrPages() const { return _nrPages; }
+  const uint8_t *getPage(uint16_t page) const { return &_mem[(size_t)page * _pageSize]; }
+  bool isBusy() const { return hostNanos() < _busyUntil; }
+  // The time the device was busy with programs, erases and transfers
+  uint64_t getBusyNs() const { return _busyNs; }
+
+  uint32_t getCycles(uint16_t page) const { return _cycles[page]; }
+  uint32_t getMinCycles(uint16_t firstPage, uint16_t nrPages) const;
+  uint32_t getMaxCycles(uint16_t firstPage, uint16_t nrPages) const;
+  void clearCycles() { _cycles.assign(_nrPages, 0); }
+
+  uint32_t getNrViolations() const { return _nrViolations; }
+  const char *getLastViolation() const { return _lastViolation.c_str(); }
+  void resetCounters();
+
+  void select(bool active);
+  uint8_t transfer(uint8_t data);
+
+private:
+  void decodeAddr();
+  void execute();
+  void startBusy(uint32_t us, int buf);
+  void violation(const char *what);
+
+  AT45DBTiming _timing;
+  uint16_t _pageSize;
+  uint16_t _nrPages;
+  uint8_t _pageBits;
+  std::vector<uint8_t> _mem;
+  std::vector<uint8_t> _buf[2];
+  std::vector<uint32_t> _cycles;
+
+  uint64_t _busyUntil;
+  int _busyBuf;                 // the buffer of the running operation, -1 if none
+  uint64_t _busyNs;
+
+  bool _selected;
+  bool _ignored;                // this command came while busy
+  uint32_t _pos;                // the number of bytes in this transaction
+  uint8_t _cmd[4];
+  uint16_t _page;
+  uint16_t _offset;
+  uint32_t _nrViolations;
+  std::string _lastViolation;
+};
+
+#endif /* AT45DBSIM_H_ */
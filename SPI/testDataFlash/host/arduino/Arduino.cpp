@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+SPIClass SPI;
+
+static uint64_t nanos;
+static HostSPIDevice *spiDevice;
+static uint8_t spiCsPin;
+
+uint64_t hostNanos()
+{
+  return nanos;
+}
+
+void hostAdvance(uint64_t ns)
+{
+  nanos += ns;
+}
+
+uint32_t millis()
+{
+  return nanos / 1000000;
+}
+
+uint32_t micros()
+{
+  return nanos / 1000;
+}
+
+void delay(uint32_t ms)
+{
+  nanos += (uint64_t)ms * 1000000;
+}
+
+void delayMicroseconds(uint32_t us)
+{
+  nanos += (uint64_t)us * 1000;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (spiDevice && pin == spiCsPin) {
+    spiDevice->select(value == LOW);
+  }
+}
+
+void hostSetSPIDevice(HostSPIDevice *device, uint8_t csPin)
+{
+  spiDevice = device;
+  spiCsPin = csPin;
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+  nanos += _byteNs;
+  return spiDevice ? spiDevice->transfer(data) : 0xFF;
+}
@@ -0,0 +1,74 @@
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Just enough of the Arduino core to build the DataFlash driver on Linux
+ *
+ * Time is simulated. micros() only moves with delay() and with the bytes
+ * on the SPI bus, see SPI.h. The device on the bus (AT45DBSim) sees the
+ * chip select through hostSetSPIDevice().
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIGH            1
+#define LOW             0
+#define INPUT           0
+#define OUTPUT          1
+
+// The SODAQ Autonomo chip select of the DataFlash
+#define SS              10
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+/*
+ * A device on the SPI bus of the host
+ */
+class HostSPIDevice
+{
+public:
+  virtual ~HostSPIDevice() {}
+  // The chip select pin went low (true) or high (false)
+  virtual void select(bool active) = 0;
+  virtual uint8_t transfer(uint8_t data) = 0;
+};
+
+void hostSetSPIDevice(HostSPIDevice *device, uint8_t csPin);
+
+// The simulated time in nanoseconds
+uint64_t hostNanos();
+void hostAdvance(uint64_t ns);
+
+#endif /* HOST_ARDUINO_H_ */
@@ -0,0 +1,54 @@
+#ifndef HOST_SPI_H_
+#define HOST_SPI_H_
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#define MSBFIRST        1
+#define SPI_MODE0       0x00
+
+class SPISettings
+{
+public:
+  SPISettings() : clock(4000000) {}
+  SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) : clock(clock) {}
+  uint32_t clock;
+};
+
+/*
+ * The SPI bus, a byte takes 8 clocks of the current transaction
+ */
+class SPIClass
+{
+public:
+  SPIClass() : _byteNs(2000) {}
+  void begin() {}
+  void beginTransaction(SPISettings settings) { _byteNs = 8000000000ULL / settings.clock; }
+  void endTransaction() {}
+  uint8_t transfer(uint8_t data);
+
+private:
+  uint64_t _byteNs;
+};
+
+extern SPIClass SPI;
+
+#endif /* HOST_SPI_H_ */
@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * dataflash-test: Sodaq_Dataflash against an emulated AT45DB161D
+ *
+ *   dataflash-test [-b]
+ *     -b  also run the benchmark
+ *
+ * The tests:
+ *  - buffers     write both SRAM buffers, program them, read them back
+ *  - stream      the streaming writer with odd chunk sizes over many
+ *                pages; every page must hold its data and the driver may
+ *                never send a command that the busy device ignores
+ *  - block       the buffer, page, continuous and security register
+ *                reads and the buffer write send their data with one
+ *                block transfer of the SPI backend
+ *
+ * The first benchmark logs records of RECORD_SIZE bytes with a fixed
+ * amount of work of the sketch before each record, once with buffer 1
+ * only (writeStrBuf1, then writeBuf1ToPage when the page is full) and once
+ * with the streaming writer that alternates the buffers.
+ *
+ * The second one reads and writes BENCH_PAGES pages like testDataFlash.ino
+ * does, through a counting SPI backend. It shows the SPI transactions, the
+ * calls of the backend and the bytes per page, with the block transfers
+ * and with a backend that sends each byte with its own call, as the
+ * driver did before it had block transfers.
+ *
+ * The times are simulated: the SPI bytes at 4 MHz, the busy times of
+ * AT45DBSim and the work of the sketch. The host clock has no cost per
+ * call of the backend, so the block transfers only show in the calls per
+ * page, not in the times. The exit status is 1 if a test failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "Sodaq_dataflash.h"
+#include "AT45DBSim.h"
+
+#define STREAM_PAGE     100
+#define STREAM_PAGES    20
+#define BENCH_PAGE      200
+#define BENCH_PAGES     64
+#define RECORD_SIZE     32
+
+/*
+ * Counts the calls of the backend as well
+ *
+ * With perByte the block transfer is done with a call of transfer(uint8_t)
+ * for each byte.
+ */
+class HostCountingSPI : public Sodaq_DataflashCountingSPI
+{
+public:
+  HostCountingSPI() : perByte(false), _nrCalls(0) {}
+  void reset() { Sodaq_DataflashCountingSPI::reset(); _nrCalls = 0; }
+  uint32_t getNrCalls() const { return _nrCalls; }
+
+  uint8_t transfer(uint8_t data)
+  {
+    ++_nrCalls;
+    return Sodaq_DataflashCountingSPI::transfer(data);
+  }
+
+  void transfer(const uint8_t *tx, uint8_t *rx, size_t size)
+  {
+    if (!perByte) {
+      ++_nrCalls;
+      Sodaq_DataflashCountingSPI::transfer(tx, rx, size);
+      return;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      uint8_t c = transfer(tx ? tx[i] : 0x00);
+      if (rx) {
+        rx[i] = c;
+      }
+    }
+  }
+
+  bool perByte;
+
+private:
+  uint32_t _nrCalls;
+};
+
+static AT45DBSim sim;
+static HostCountingSPI countingSPI;
+static int nrFailures;
+
+static void report(const char *label, bool ok)
+{
+  ok = ok && sim.getNrViolations() == 0;
+  printf("%-12s %s\n", label, ok ? "ok" : "FAILED");
+  if (sim.getNrViolations() > 0) {
+    printf("  %lu violations, the last: %s\n", (unsigned long)sim.getNrViolations(),
+        sim.getLastViolation());
+  }
+  if (!ok) {
+    ++nrFailures;
+  }
+  sim.resetCounters();
+}
+
+static uint8_t pattern(uint32_t i)
+{
+  return (i * 7) ^ (i >> 9);
+}
+
+static bool readPageBack(uint16_t page, uint8_t *data)
+{
+  dflash.readPageToBuf1(page);
+  dflash.readStrBuf1(0, data, DF_PAGE_SIZE);
+  return memcmp(data, sim.getPage(page), DF_PAGE_SIZE) == 0;
+}
+
+static bool testBuffers()
+{
+  uint8_t data[DF_PAGE_SIZE];
+  uint8_t back[DF_PAGE_SIZE];
+  bool ok = true;
+  for (int buf = 0; buf < 2; ++buf) {
+    for (size_t i = 0; i < sizeof(data); ++i) {
+      data[i] = pattern(i + buf * 1000);
+    }
+    if (buf == 0) {
+      dflash.writeStrBuf1(0, data, sizeof(data));
+      dflash.readStrBuf1(0, back, sizeof(back));
+      dflash.writeBuf1ToPage(10);
+    } else {
+      dflash.writeStrBuf2(0, data, sizeof(data));
+      dflash.readStrBuf2(0, back, sizeof(back));
+      dflash.writeBuf2ToPage(11);
+    }
+    ok = ok && memcmp(data, back, sizeof(data)) == 0;
+    ok = ok && memcmp(data, sim.getPage(10 + buf), sizeof(data)) == 0;
+  }
+  // Through the other buffer
+  dflash.readPageToBuf2(10);
+  dflash.readStrBuf2(0, back, sizeof(back));
+  ok = ok && memcmp(sim.getPage(10), back, sizeof(back)) == 0;
+  return ok;
+}
+
+static bool testStream()
+{
+  uint32_t size = (uint32_t)STREAM_PAGES * DF_PAGE_SIZE - 100;
+  uint8_t chunk[61];
+  dflash.beginStreamWrite(STREAM_PAGE);
+  uint32_t done = 0;
+  for (size_t n = 1; done < size; n = n % sizeof(chunk) + 1) {
+    if (n > size - done) {
+      n = size - done;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      chunk[i] = pattern(done + i);
+    }
+    dflash.streamWrite(chunk, n);
+    done += n;
+  }
+  bool ok = dflash.endStreamWrite() == STREAM_PAGE + STREAM_PAGES;
+
+  uint8_t page[DF_PAGE_SIZE];
+  for (uint16_t p = 0; p < STREAM_PAGES && ok; ++p) {
+    ok = readPageBack(STREAM_PAGE + p, page);
+    for (uint16_t i = 0; i < DF_PAGE_SIZE && ok; ++i) {
+      uint32_t ix = (uint32_t)p * DF_PAGE_SIZE + i;
+      ok = page[i] == (ix < size ? pattern(ix) : 0xFF);
+    }
+  }
+  return ok;
+}
+
+/*
+ * The data of a command goes in one block transfer, only the command and
+ * address bytes go one by one
+ */
+static bool checkBlock(uint32_t nrCmdBytes, uint32_t nrDataBytes)
+{
+  bool ok = countingSPI.getNrBlockTransfers() == 1;
+  ok = ok && countingSPI.getNrBytes() == nrCmdBytes + nrDataBytes;
+  ok = ok && countingSPI.getNrCalls() == nrCmdBytes + 1;
+  countingSPI.reset();
+  return ok;
+}
+
+static bool testBlock()
+{
+  uint8_t data[DF_PAGE_SIZE];
+  uint8_t secReg[64];
+  // Program the pages first, the reads must not wait for the device
+  memset(data, 0x5A, sizeof(data));
+  dflash.writeStrBuf1(0, data, sizeof(data));
+  dflash.writeBuf1ToPage(20);
+  dflash.writeBuf1ToPage(21);
+
+  countingSPI.reset();
+  dflash.writeStrBuf1(0, data, sizeof(data));
+  bool ok = checkBlock(4, sizeof(data));
+  dflash.readStrBuf1(0, data, sizeof(data));
+  ok = ok && checkBlock(5, sizeof(data));
+  dflash.readPage(20, 0, data, sizeof(data));
+  ok = ok && checkBlock(8, sizeof(data));
+  ok = ok && memcmp(data, sim.getPage(20), sizeof(data)) == 0;
+  dflash.readContinuous(20, 100, data, sizeof(data));
+  ok = ok && checkBlock(5, sizeof(data));
+  ok = ok && memcmp(data, sim.getPage(20) + 100, DF_PAGE_SIZE - 100) == 0;
+  ok = ok && memcmp(data + DF_PAGE_SIZE - 100, sim.getPage(21), 100) == 0;
+  dflash.readSecurityReg(secReg, sizeof(secReg));
+  ok = ok && checkBlock(4, sizeof(secReg));
+  return ok;
+}
+
+/*
+ * Log the records with buffer 1 only, a full page is programmed and
+ * waited for
+ */
+static uint32_t logBuffer1(uint32_t nrRecords, uint32_t workUs)
+{
+  uint8_t record[RECORD_SIZE];
+  uint16_t page = BENCH_PAGE;
+  uint16_t offset = 0;
+  uint32_t start = micros();
+  for (uint32_t r = 0; r < nrRecords; ++r) {
+    delayMicroseconds(workUs);
+    memset(record, r, sizeof(record));
+    size_t done = 0;
+    while (done < sizeof(record)) {
+      size_t n = DF_PAGE_SIZE - offset;
+      if (n > sizeof(record) - done) {
+        n = sizeof(record) - done;
+      }
+      dflash.writeStrBuf1(offset, record + done, n);
+      done += n;
+      offset += n;
+      if (offset == DF_PAGE_SIZE) {
+        dflash.writeBuf1ToPage(page++);
+        offset = 0;
+      }
+    }
+  }
+  return micros() - start;
+}
+
+/*
+ * Log the records with the streaming writer
+ */
+static uint32_t logStream(uint32_t nrRecords, uint32_t workUs)
+{
+  uint8_t record[RECORD_SIZE];
+  uint32_t start = micros();
+  dflash.beginStreamWrite(BENCH_PAGE);
+  for (uint32_t r = 0; r < nrRecords; ++r) {
+    delayMicroseconds(workUs);
+    memset(record, r, sizeof(record));
+    dflash.streamWrite(record, sizeof(record));
+  }
+  dflash.endStreamWrite();
+  return micros() - start;
+}
+
+static void reportSPI(const char *label, uint64_t ns)
+{
+  printf("%-16s %9lu %8lu %8.2f %8.1f %8.1f\n", label,
+      (unsigned long)(ns / 1000 / BENCH_PAGES),
+      (unsigned long)((uint64_t)BENCH_PAGES * DF_PAGE_SIZE * 1000000 / ns),
+      (double)countingSPI.getNrTransactions() / BENCH_PAGES,
+      (double)countingSPI.getNrCalls() / BENCH_PAGES,
+      (double)countingSPI.getNrBytes() / BENCH_PAGES);
+  countingSPI.reset();
+}
+
+/*
+ * The read and write paths of testDataFlash.ino
+ */
+static void benchmarkSPI(bool perByte)
+{
+  static uint8_t pages[BENCH_PAGES * DF_PAGE_SIZE];
+  uint64_t start;
+
+  countingSPI.perByte = perByte;
+  printf("\n%u pages, %s\n", BENCH_PAGES,
+      perByte ? "a backend call for each byte" : "block transfers");
+  printf("%-16s %9s %8s %8s %8s %8s\n", "", "us/page", "kB/s", "trans", "calls", "bytes");
+
+  countingSPI.reset();
+  start = hostNanos();
+  for (uint16_t i = 0; i < BENCH_PAGES; ++i) {
+    dflash.readPageToBuf1(BENCH_PAGE + i);
+    dflash.readStrBuf1(0, pages, DF_PAGE_SIZE);
+  }
+  reportSPI("via buffer 1", hostNanos() - start);
+
+  start = hostNanos();
+  for (uint16_t i = 0; i < BENCH_PAGES; ++i) {
+    dflash.readPage(BENCH_PAGE + i, 0, pages + i * DF_PAGE_SIZE, DF_PAGE_SIZE);
+  }
+  reportSPI("page read", hostNanos() - start);
+
+  start = hostNanos();
+  dflash.readContinuous(BENCH_PAGE, 0, pages, sizeof(pages));
+  reportSPI("continuous read", hostNanos() - start);
+  if (memcmp(pages, sim.getPage(BENCH_PAGE), sizeof(pages)) != 0) {
+    printf("  continuous read FAILED\n");
+    ++nrFailures;
+  }
+
+  // Only the SPI part of a page write, the page program time is not included
+  start = hostNanos();
+  for (uint16_t i = 0; i < BENCH_PAGES; ++i) {
+    dflash.writeStrBuf1(0, pages + i * DF_PAGE_SIZE, DF_PAGE_SIZE);
+  }
+  reportSPI("buffer 1 write", hostNanos() - start);
+
+  start = hostNanos();
+  for (uint16_t i = 0; i < BENCH_PAGES; ++i) {
+    dflash.writeStrBuf1(0, pages + i * DF_PAGE_SIZE, DF_PAGE_SIZE);
+    dflash.writeBuf1ToPage(BENCH_PAGE + i);
+  }
+  reportSPI("page write", hostNanos() - start);
+  countingSPI.perByte = false;
+}
+
+static void benchmark()
+{
+  static const uint32_t works[] = { 0, 100, 200, 500, 1000, 2000 };
+  uint32_t nrRecords = (uint32_t)BENCH_PAGES * DF_PAGE_SIZE / RECORD_SIZE;
+
+  printf("\n%lu records of %u bytes in %u pages, AT45DB161D with typical busy times\n",
+      (unsigned long)nrRecords, RECORD_SIZE, BENCH_PAGES);
+  printf("%8s %12s %12s %8s %10s\n", "work us", "buffer 1 ms", "stream ms", "speed-up",
+      "violations");
+  for (size_t i = 0; i < sizeof(works) / sizeof(works[0]); ++i) {
+    uint32_t buf1Us = logBuffer1(nrRecords, works[i]);
+    uint32_t streamUs = logStream(nrRecords, works[i]);
+    printf("%8lu %12.1f %12.1f %8.2f %10lu\n", (unsigned long)works[i], buf1Us / 1000.0,
+        streamUs / 1000.0, (double)buf1Us / streamUs, (unsigned long)sim.getNrViolations());
+    if (sim.getNrViolations() > 0) {
+      ++nrFailures;
+    }
+    sim.resetCounters();
+  }
+
+  benchmarkSPI(false);
+  benchmarkSPI(true);
+  if (sim.getNrViolations() > 0) {
+    ++nrFailures;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  bool bench = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-b") == 0) {
+      bench = true;
+    } else {
+      fprintf(stderr, "Usage: %s [-b]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  sim.attach();
+  dflash.setSPI(countingSPI);
+  dflash.init();
+
+  report("buffers", testBuffers());
+  report("stream", testStream());
+  report("block", testBlock());
+  if (bench) {
+    benchmark();
+  }
+  return nrFailures ? 1 : 0;
+}
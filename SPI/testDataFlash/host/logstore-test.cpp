@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * logstore-test: Sodaq_LogStore against an emulated AT45DB161D
+ *
+ *   logstore-test [-b]
+ *     -b  also run the wear benchmark
+ *
+ * The tests:
+ *  - round trip  append records of all sizes, a scan gives them back
+ *  - remount     a new mount finds the same records and appends after them
+ *  - unsynced    records that were not synced are gone after a remount, the
+ *                synced ones are still there, and so are the ones of a
+ *                page that was programmed because it was full
+ *  - full        a full log drops its oldest page, the scan starts at the
+ *                oldest record that is left
+ *  - wear        after many rounds the wear of the page headers differs at
+ *                most one between the pages, and so do the program cycles
+ *                of the emulated device
+ *
+ * The benchmark logs records of RECORD_SIZE bytes with a sync() after each
+ * record, or after each SYNC_EVERY records. It compares the program/erase
+ * cycles of the pages with a sketch that keeps its records in one fixed
+ * page, like PAGE in testDataFlash.ino, and programs that page on each
+ * sync. The appends until the first page reaches the endurance of the data
+ * sheet are extrapolated from the highest number of cycles. The exit
+ * status is 1 if a test failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Sodaq_dataflash.h"
+#include "Sodaq_logstore.h"
+#include "AT45DBSim.h"
+
+#define LOG_PAGE        300
+#define LOG_PAGES       32
+#define HOT_PAGE        5
+#define RECORD_SIZE     24
+#define BENCH_RECORDS   4000
+#define SYNC_EVERY      10
+
+static AT45DBSim sim;
+static int nrFailures;
+
+static void report(const char *label, bool ok)
+{
+  ok = ok && sim.getNrViolations() == 0;
+  printf("%-12s %s\n", label, ok ? "ok" : "FAILED");
+  if (sim.getNrViolations() > 0) {
+    printf("  %lu violations, the last: %s\n", (unsigned long)sim.getNrViolations(),
+        sim.getLastViolation());
+  }
+  if (!ok) {
+    ++nrFailures;
+  }
+  sim.resetCounters();
+}
+
+/*
+ * Record i has its own length and contents
+ */
+static uint8_t makeRecord(uint32_t i, uint8_t *data, uint8_t maxLen)
+{
+  uint8_t len = 1 + (i * 37) % maxLen;
+  for (uint8_t j = 0; j < len; ++j) {
+    data[j] = i * 13 + j;
+  }
+  return len;
+}
+
+/*
+ * Scan the whole log, it must hold the records first .. end - 1
+ */
+static bool scan(Sodaq_LogStore &log, uint32_t first, uint32_t end)
+{
+  uint8_t expected[LOGSTORE_MAX_RECORD_SIZE];
+  uint8_t data[LOGSTORE_MAX_RECORD_SIZE];
+  log.rewind();
+  for (uint32_t i = first; i < end; ++i) {
+    uint8_t len = makeRecord(i, expected, log.getMaxRecordSize());
+    if (log.readNext(data, sizeof(data)) != len || memcmp(data, expected, len) != 0) {
+      return false;
+    }
+  }
+  return log.readNext(data, sizeof(data)) == -1;
+}
+
+static bool append(Sodaq_LogStore &log, uint32_t first, uint32_t end)
+{
+  uint8_t data[LOGSTORE_MAX_RECORD_SIZE];
+  bool ok = true;
+  for (uint32_t i = first; i < end && ok; ++i) {
+    ok = log.append(data, makeRecord(i, data, log.getMaxRecordSize()));
+  }
+  return ok;
+}
+
+static bool testRoundTrip()
+{
+  Sodaq_LogStore log;
+  bool ok = log.mount(dflash, LOG_PAGE, LOG_PAGES);
+  log.format();
+  ok = ok && log.getNrUsedPages() == 1 && scan(log, 0, 0);
+  ok = ok && append(log, 0, 20);
+  // The newest page is still in buffer 1
+  ok = ok && scan(log, 0, 20);
+  log.sync();
+  ok = ok && scan(log, 0, 20);
+  uint8_t big[LOGSTORE_MAX_RECORD_SIZE + 1];
+  ok = ok && !log.append(big, 0) && !log.append(big, log.getMaxRecordSize() + 1);
+  return ok;
+}
+
+static bool testRemount()
+{
+  Sodaq_LogStore log;
+  bool ok = log.mount(dflash, LOG_PAGE, LOG_PAGES);
+  ok = ok && scan(log, 0, 20);
+  ok = ok && append(log, 20, 50);
+  log.sync();
+
+  Sodaq_LogStore again;
+  ok = ok && again.mount(dflash, LOG_PAGE, LOG_PAGES);
+  ok = ok && again.getNrUsedPages() == log.getNrUsedPages();
+  ok = ok && scan(again, 0, 50);
+  return ok;
+}
+
+static bool testUnsynced()
+{
+  Sodaq_LogStore log;
+  bool ok = log.mount(dflash, LOG_PAGE, LOG_PAGES);
+  ok = ok && append(log, 50, 55);
+  log.sync();
+  uint32_t synced = 55;
+  for (uint32_t i = 55; i < 58 && ok; ++i) {
+    uint16_t nrUsed = log.getNrUsedPages();
+    ok = append(log, i, i + 1);
+    if (log.getNrUsedPages() != nrUsed) {
+      // The full page was programmed before record i went into a new one
+      synced = i;
+    }
+  }
+  // Power failure: buffer 1 is lost
+  dflash.readPageToBuf1(0);
+
+  Sodaq_LogStore again;
+  ok = ok && again.mount(dflash, LOG_PAGE, LOG_PAGES);
+  ok = ok && scan(again, 0, synced);
+  ok = ok && append(again, synced, 60);
+  again.sync();
+  ok = ok && scan(again, 0, 60);
+  return ok;
+}
+
+static bool testFull()
+{
+  Sodaq_LogStore log;
+  bool ok = log.mount(dflash, LOG_PAGE, LOG_PAGES);
+  log.format();
+  // Fill all pages, then some more
+  uint32_t end = 0;
+  while (log.getNrUsedPages() < LOG_PAGES && ok) {
+    ok = append(log, end, end + 1);
+    ++end;
+  }
+  ok = ok && append(log, end, end + 200);
+  end += 200;
+  log.sync();
+  ok = ok && log.getNrUsedPages() == LOG_PAGES;
+
+  // The records of the dropped pages are gone, find the first one left
+  uint8_t data[LOGSTORE_MAX_RECORD_SIZE];
+  uint8_t expected[LOGSTORE_MAX_RECORD_SIZE];
+  log.rewind();
+  int len = log.readNext(data, sizeof(data));
+  uint32_t first = 0;
+  while (first < end && (len != makeRecord(first, expected, log.getMaxRecordSize())
+      || memcmp(data, expected, len) != 0)) {
+    ++first;
+  }
+  ok = ok && first > 0 && first < end && scan(log, first, end);
+
+  Sodaq_LogStore again;
+  ok = ok && again.mount(dflash, LOG_PAGE, LOG_PAGES);
+  ok = ok && scan(again, first, end);
+  return ok;
+}
+
+static bool testWear()
+{
+  Sodaq_LogStore log;
+  bool ok = log.mount(dflash, LOG_PAGE, LOG_PAGES);
+  log.format();
+  sim.clearCycles();
+  uint8_t data[LOGSTORE_MAX_RECORD_SIZE];
+  memset(data, 0x33, sizeof(data));
+  // Full pages only, ten rounds over the log
+  uint32_t perPage = (dflash.getPageSize() - LOGSTORE_PAGE_HDR_SIZE) / 102;
+  for (uint32_t i = 0; i < 10 * LOG_PAGES * perPage && ok; ++i) {
+    ok = log.append(data, 100);
+  }
+  log.sync();
+
+  Sodaq_LogStore again;
+  ok = ok && again.mount(dflash, LOG_PAGE, LOG_PAGES);
+  ok = ok && again.getMaxWear() - again.getMinWear() <= 1;
+  ok = ok && sim.getMaxCycles(LOG_PAGE, LOG_PAGES) - sim.getMinCycles(LOG_PAGE, LOG_PAGES) <= 1;
+  return ok;
+}
+
+static void reportWear(const char *label, uint16_t firstPage, uint16_t nrPages)
+{
+  uint32_t maxCycles = sim.getMaxCycles(firstPage, nrPages);
+  printf("%-18s %6u %8lu %8lu %12lu\n", label, nrPages,
+      (unsigned long)sim.getMinCycles(firstPage, nrPages), (unsigned long)maxCycles,
+      (unsigned long)((uint64_t)BENCH_RECORDS * AT45DB_ENDURANCE / maxCycles));
+}
+
+/*
+ * The records in one fixed page, programmed on each sync
+ */
+static void logHotPage(uint32_t syncEvery)
+{
+  uint8_t data[RECORD_SIZE];
+  uint16_t offset = 0;
+  memset(data, 0x44, sizeof(data));
+  sim.clearCycles();
+  for (uint32_t i = 0; i < BENCH_RECORDS; ++i) {
+    if (offset + sizeof(data) > dflash.getPageSize()) {
+      // The page is full, the sketch sends it and starts again
+      offset = 0;
+    }
+    dflash.writeStrBuf1(offset, data, sizeof(data));
+    offset += sizeof(data);
+    if ((i + 1) % syncEvery == 0) {
+      dflash.writeBuf1ToPage(HOT_PAGE);
+    }
+  }
+}
+
+static void logStore(uint32_t syncEvery)
+{
+  Sodaq_LogStore log;
+  uint8_t data[RECORD_SIZE];
+  memset(data, 0x55, sizeof(data));
+  log.mount(dflash, LOG_PAGE, LOG_PAGES);
+  log.format();
+  sim.clearCycles();
+  for (uint32_t i = 0; i < BENCH_RECORDS; ++i) {
+    log.append(data, sizeof(data));
+    if ((i + 1) % syncEvery == 0) {
+      log.sync();
+    }
+  }
+  log.sync();
+}
+
+static void benchmark()
+{
+  static const uint32_t syncs[] = { 1, SYNC_EVERY };
+
+  for (size_t i = 0; i < sizeof(syncs) / sizeof(syncs[0]); ++i) {
+    printf("\n%u records of %u bytes, a sync after %lu records\n", BENCH_RECORDS,
+        RECORD_SIZE, (unsigned long)syncs[i]);
+    printf("%-18s %6s %8s %8s %12s\n", "", "pages", "min", "max", "appends");
+    logHotPage(syncs[i]);
+    reportWear("fixed page", HOT_PAGE, 1);
+    logStore(syncs[i]);
+    reportWear("log store", LOG_PAGE, LOG_PAGES);
+    if (sim.getNrViolations() > 0) {
+      ++nrFailures;
+    }
+    sim.resetCounters();
+  }
+  printf("appends: until a page has %u program/erase cycles\n", AT45DB_ENDURANCE);
+}
+
+int main(int argc, char *argv[])
+{
+  bool bench = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-b") == 0) {
+      bench = true;
+    } else {
+      fprintf(stderr, "Usage: %s [-b]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  sim.attach();
+  dflash.init();
+
+  report("round trip", testRoundTrip());
+  report("remount", testRemount());
+  report("unsynced", testUnsynced());
+  report("full", testFull());
+  report("wear", testWear());
+  if (bench) {
+    benchmark();
+  }
+  return nrFailures ? 1 : 0;
+}
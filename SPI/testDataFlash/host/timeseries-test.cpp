@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2016 Kees Bakker.  All rights reserved.
+ *
+ * This file is part of Sodaq_dataflash.
+ *
+ * Sodaq_dataflash is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or(at your option) any later version.
+ *
+ * Sodaq_dataflash is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Sodaq_dataflash.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * timeseries-test: round trip tests and a benchmark of Sodaq_TimeSeries on
+ * the host
+ *
+ *   timeseries-test [-n sets] [-b]
+ *     -n  the number of random blocks for the round trip, default 3000
+ *     -b  also run the benchmark
+ *
+ * Each random block has a random schema, row count, maximum size and
+ * values, with the special cases mixed in: the int32 limits, NaN, inf,
+ * -0, wrapping timestamps. It is encoded, checked against
+ * getBlockSize(), decoded and compared bit for bit. Then every truncation
+ * of the block and a number of bit flips are decoded; that must not read
+ * outside the block (build with -fsanitize=address,undefined, see the
+ * Makefile) and a truncated block must not give all the rows.
+ *
+ * The benchmark encodes and decodes the rows of benchmarkTimeSeries() in
+ * testDataFlash.ino, in blocks of one 528 byte page, and compares the
+ * size with the same rows as text.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "Sodaq_timeseries.h"
+
+#define PAGE_SIZE       528
+#define BENCH_ROWS      100000
+
+static uint32_t seed = 1;
+static uint32_t nextRandom()
+{
+  // xorshift32, the same sets on every run
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static uint32_t floatBits(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static int nrFailures;
+
+static void fail(int set, const char *what)
+{
+  if (nrFailures++ < 20) {
+    printf("set %d: %s\n", set, what);
+  }
+}
+
+/*
+ * A random value for the column, mostly well behaved series with now and
+ * then an extreme
+ */
+static uint32_t randomValue(uint8_t type, uint32_t prev, int row)
+{
+  uint32_t r = nextRandom();
+  if (r % 16 == 0) {
+    static const float specials[] = { NAN, INFINITY, -INFINITY, -0.0f, 0.0f, 3.4e38f, 1e-45f };
+    static const uint32_t ints[] = { 0, 1, 0xFFFFFFFFUL, 0x7FFFFFFFUL, 0x80000000UL };
+    if (type == TIMESERIES_FLOAT) {
+      return floatBits(specials[nextRandom() % (sizeof(specials) / sizeof(specials[0]))]);
+    }
+    return ints[nextRandom() % (sizeof(ints) / sizeof(ints[0]))];
+  }
+  if (r % 16 == 1) {
+    return nextRandom();
+  }
+  switch (type) {
+  case TIMESERIES_TIME:
+    return row == 0 ? 1463040000UL + nextRandom() % 100000 : prev + 60 + nextRandom() % 3 - 1;
+  case TIMESERIES_INT:
+    return row == 0 ? nextRandom() % 1024 : prev + nextRandom() % 9 - 4;
+  default: {
+    float value;
+    memcpy(&value, &prev, sizeof(value));
+    if (row == 0 || value != value || fabsf(value) > 1e6f) {
+      value = 20.0f;
+    }
+    return floatBits(value + (float)(nextRandom() % 5) * 0.01f - 0.02f);
+  }
+  }
+}
+
+/*
+ * Decode a copy of the block in a buffer of exactly len bytes, so that
+ * the sanitizer sees a read past the end. Return the number of rows.
+ */
+static int decodeCopy(const uint8_t *block, size_t len, bool *valid)
+{
+  uint8_t *copy = (uint8_t *)malloc(len ? len : 1);
+  memcpy(copy, block, len);
+  Sodaq_TimeSeriesReader reader;
+  int rows = 0;
+  *valid = reader.init(copy, len);
+  if (*valid) {
+    while (reader.next()) {
+      for (uint8_t i = 0; i < reader.getNrColumns(); ++i) {
+        (void)reader.getUInt(i);
+      }
+      ++rows;
+    }
+  }
+  free(copy);
+  return rows;
+}
+
+static void roundTrip(int set)
+{
+  static Sodaq_TimeSeries ts;
+  uint8_t types[TIMESERIES_MAX_COLUMNS];
+  uint8_t nrColumns = 1 + nextRandom() % TIMESERIES_MAX_COLUMNS;
+  for (uint8_t i = 0; i < nrColumns; ++i) {
+    types[i] = TIMESERIES_TIME + nextRandom() % 3;
+  }
+  size_t maxSize = nextRandom() % 4 == 0 ? 20 + nextRandom() % 100 : PAGE_SIZE;
+  uint8_t schemaId = nextRandom();
+  if (!ts.begin(schemaId, types, nrColumns, maxSize)) {
+    fail(set, "begin failed");
+    return;
+  }
+
+  // The rows that went into the block
+  std::vector<std::vector<uint32_t> > rows;
+  std::vector<uint32_t> row(nrColumns, 0);
+  int nrRows = 1 + nextRandom() % TIMESERIES_MAX_ROWS;
+  for (int r = 0; r < nrRows; ++r) {
+    for (uint8_t i = 0; i < nrColumns; ++i) {
+      row[i] = randomValue(types[i], row[i], r);
+      ts.set(i, row[i]);
+    }
+    if (!ts.append()) {
+      break;
+    }
+    rows.push_back(row);
+  }
+  if (rows.empty()) {
+    // Not even one row fits in a tiny maximum size
+    if (ts.getBlockSize() > maxSize) {
+      fail(set, "empty block above the maximum size");
+    }
+    return;
+  }
+  if (ts.getNrRows() != rows.size()) {
+    fail(set, "wrong number of rows");
+  }
+
+  size_t expected = ts.getBlockSize();
+  if (expected > maxSize) {
+    fail(set, "block above the maximum size");
+  }
+  uint8_t buffer[1024];
+  if (ts.encode(buffer, expected - 1) != 0) {
+    fail(set, "encode into a too small buffer");
+  }
+  size_t len = ts.encode(buffer, sizeof(buffer));
+  if (len != expected) {
+    fail(set, "encode size differs from getBlockSize()");
+    return;
+  }
+  if (ts.getNrRows() != 0) {
+    fail(set, "encode did not start a new block");
+  }
+
+  Sodaq_TimeSeriesReader reader;
+  if (!reader.init(buffer, len)) {
+    fail(set, "init of the reader failed");
+    return;
+  }
+  if (reader.getSchemaId() != schemaId || reader.getNrColumns() != nrColumns ||
+      reader.getNrRows() != rows.size()) {
+    fail(set, "wrong header");
+    return;
+  }
+  for (size_t r = 0; r < rows.size(); ++r) {
+    if (!reader.next()) {
+      fail(set, "next failed");
+      return;
+    }
+    for (uint8_t i = 0; i < nrColumns; ++i) {
+      if (reader.getType(i) != types[i] || reader.getUInt(i) != rows[r][i]) {
+        fail(set, "value differs");
+        return;
+      }
+    }
+  }
+  if (reader.next()) {
+    fail(set, "a row too many");
+  }
+
+  // Truncated, all the rows must not come out
+  for (size_t n = 0; n < len; ++n) {
+    bool valid;
+    int got = decodeCopy(buffer, n, &valid);
+    if (got == (int)rows.size() && n < len - 1) {
+      // Only the padding of the last column may be missing
+      fail(set, "a truncated block decoded completely");
+      break;
+    }
+  }
+
+  // Bit flips, anything may come out but nothing outside the block is read
+  for (int i = 0; i < 16; ++i) {
+    uint8_t copy[1024];
+    memcpy(copy, buffer, len);
+    copy[nextRandom() % len] ^= 1 << (nextRandom() % 8);
+    bool valid;
+    decodeCopy(copy, len, &valid);
+  }
+}
+
+static double seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The rows of benchmarkTimeSeries() in testDataFlash.ino
+static void benchmark()
+{
+  static Sodaq_TimeSeries ts;
+  const uint8_t types[] = { TIMESERIES_TIME, TIMESERIES_FLOAT, TIMESERIES_INT };
+  std::vector<uint8_t> blocks;
+  std::vector<size_t> lens;
+  uint8_t block[PAGE_SIZE];
+  size_t textBytes = 0;
+  int32_t adc = 512;
+
+  double start = seconds();
+  ts.begin(1, types, sizeof(types), PAGE_SIZE);
+  for (int i = 0; i < BENCH_ROWS; ++i) {
+    uint32_t now = 1463040000UL + i * 60UL;
+    float temperature = 21.3 + (i % 50) * 0.02;
+    adc += (int32_t)(nextRandom() % 7) - 3;
+    char text[40];
+    textBytes += snprintf(text, sizeof(text), "%lu,%.2f,%ld\r\n", (unsigned long)now,
+        temperature, (long)adc);
+
+    ts.set(0, now);
+    ts.set(1, temperature);
+    ts.set(2, adc);
+    if (!ts.append()) {
+      size_t len = ts.encode(block, sizeof(block));
+      blocks.insert(blocks.end(), block, block + len);
+      lens.push_back(len);
+      ts.append();
+    }
+  }
+  size_t len = ts.encode(block, sizeof(block));
+  blocks.insert(blocks.end(), block, block + len);
+  lens.push_back(len);
+  double encodeTime = seconds() - start;
+
+  start = seconds();
+  size_t pos = 0;
+  int rows = 0;
+  uint32_t sum = 0;
+  for (size_t i = 0; i < lens.size(); ++i) {
+    Sodaq_TimeSeriesReader reader;
+    reader.init(&blocks[pos], lens[i]);
+    while (reader.next()) {
+      sum += reader.getUInt(0) + reader.getUInt(2);
+      ++rows;
+    }
+    pos += lens[i];
+  }
+  double decodeTime = seconds() - start;
+
+  printf("benchmark, %d rows (time, float, int) in %lu blocks of at most %d bytes\n",
+      BENCH_ROWS, (unsigned long)lens.size(), PAGE_SIZE);
+  printf("  text bytes/row:  %.2f\n", (double)textBytes / BENCH_ROWS);
+  printf("  codec bytes/row: %.2f\n", (double)blocks.size() / BENCH_ROWS);
+  printf("  rows per %d byte page: %.1f\n", PAGE_SIZE, (double)BENCH_ROWS / lens.size());
+  printf("  encode: %.0f ns/row\n", encodeTime * 1e9 / BENCH_ROWS);
+  printf("  decode: %.0f ns/row%s\n", decodeTime * 1e9 / BENCH_ROWS,
+      rows == BENCH_ROWS && sum != 0 ? "" : " (decoded rows differ!)");
+  if (rows != BENCH_ROWS) {
+    ++nrFailures;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int nrSets = 3000;
+  bool bench = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      nrSets = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-b") == 0) {
+      bench = true;
+    } else {
+      fprintf(stderr, "Usage: %s [-n sets] [-b]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  for (int set = 0; set < nrSets; ++set) {
+    roundTrip(set);
+  }
+  printf("round trip of %d blocks, with truncations and bit flips: %s\n", nrSets,
+      nrFailures ? "FAILED" : "ok");
+  if (bench) {
+    benchmark();
+  }
+  return nrFailures ? 1 : 0;
+}
@@ -1,9 +1,41 @@
 #include <SPI.h> 
 #include "Sodaq_dataflash.h"
+#include "Sodaq_dataflashreader.h"
+#include "Sodaq_timeseries.h"
 
-#define PAGE 5 // PAGE < DF_NR_PAGES
-#define BLANK_PAGE 36 // BLANK_PAGE < DF_NR_PAGES
-#define ADDR 12 // (ADDR + Length(DATA) < DF_PAGE_SIZE
+#define PAGE 5 // PAGE < dflash.getNrPages()
+#define BLANK_PAGE 36 // BLANK_PAGE < dflash.getNrPages()
+#define ADDR 12 // (ADDR + Length(DATA) < dflash.getPageSize()
+#define BENCH_PAGES 64 // BENCH_PAGES < dflash.getNrPages()
+#define TS_ROWS 500
+
+//Counts the SPI transactions and bytes of the dataflash driver
+//A received block larger than the rolling buffer size overwrites the start
+//of the buffer again, so that a read of many pages fits in one page of RAM.
+class RollingCountingSPI : public Sodaq_DataflashCountingSPI
+{
+public:
+  RollingCountingSPI() : _rollSize(0) {}
+  void setRollSize(size_t size) { _rollSize = size; }
+
+  using Sodaq_DataflashCountingSPI::transfer;
+  void transfer(const uint8_t *tx, uint8_t *rx, size_t size)
+  {
+    while (rx && _rollSize && size > _rollSize) {
+      Sodaq_DataflashCountingSPI::transfer(tx, rx, _rollSize);
+      if (tx) {
+        tx += _rollSize;
+      }
+      size -= _rollSize;
+    }
+    Sodaq_DataflashCountingSPI::transfer(tx, rx, size);
+  }
+
+private:
+  size_t _rollSize;
+};
+
+RollingCountingSPI countingSPI;
 
 void setup() 
 {
@@ -12,7 +44,10 @@ void setup()
   SerialUSB.begin(57600);
   
   SerialUSB.println("Initialising Flash...");
+  dflash.setSPI(countingSPI);
   dflash.init(); 
+  SerialUSB.println("Device ID: 0x" + String(dflash.getDeviceId(), HEX));
+  SerialUSB.println("Pages: " + String(dflash.getNrPages(), DEC) + " of " + String(dflash.getPageSize(), DEC) + " bytes");
   
   //Erase both pages
   dflash.pageErase(PAGE);
@@ -46,6 +81,126 @@ void setup()
   SerialUSB.println("Reading data back...");
   SerialUSB.println(buffer);
   SerialUSB.println("--------------------");
+
+  //Read the same data directly from the main memory
+  memset(buffer, 0, sizeof(buffer));
+  dflash.readPage(PAGE, ADDR, (uint8_t*)buffer, length);
+  SerialUSB.println("Reading data back without buffer...");
+  SerialUSB.println(buffer);
+  SerialUSB.println("--------------------");
+
+  testReaderWrap();
+  benchmarkRead();
+  benchmarkTimeSeries();
+}
+
+//Stream a range over the end of the flash, it continues at page 0, and read it back
+//with Sodaq_DataflashReader. This overwrites the last two pages and page 0.
+void testReaderWrap()
+{
+  uint16_t firstPage = dflash.getNrPages() - 2;
+  uint32_t size = 3UL * dflash.getPageSize() - 10;
+  uint8_t chunk[40];
+
+  dflash.beginStreamWrite(firstPage);
+  for (uint32_t i = 0; i < size; i += sizeof(chunk)) {
+    size_t n = size - i < sizeof(chunk) ? size - i : sizeof(chunk);
+    for (size_t j = 0; j < n; j++) {
+      chunk[j] = (i + j) * 7;
+    }
+    dflash.streamWrite(chunk, n);
+  }
+  dflash.endStreamWrite();
+
+  Sodaq_DataflashReader reader(dflash, firstPage, 0, size);
+  uint32_t errors = 0;
+  for (uint32_t i = 0; i < size; i++) {
+    if (reader.read() != (uint8_t)(i * 7)) {
+      errors++;
+    }
+  }
+  if (reader.read() != -1) {
+    errors++;
+  }
+  SerialUSB.println("Reader over the end of the flash: " + String(errors == 0 ? "ok" : "FAILED"));
+  SerialUSB.println("--------------------");
+}
+
+//Compare the buffer based read path with a continuous array read
+void benchmarkRead()
+{
+  uint8_t page[DF_MAX_PAGE_SIZE];
+  uint16_t pageSize = dflash.getPageSize();
+  uint32_t start;
+
+  countingSPI.reset();
+  start = micros();
+  for (int i=0; i<BENCH_PAGES; i++) {
+    dflash.readPageToBuf1(i);
+    dflash.readStrBuf1(0, page, pageSize);
+  }
+  report("Via buffer 1", micros() - start);
+
+  //One continuous read across all pages, into a rolling buffer of one page
+  countingSPI.setRollSize(pageSize);
+  countingSPI.reset();
+  start = micros();
+  dflash.readContinuous(0, 0, page, (size_t)BENCH_PAGES * pageSize);
+  report("Continuous read", micros() - start);
+  countingSPI.setRollSize(0);
+
+  //Only the SPI part of a page write, the page program time is not included
+  countingSPI.reset();
+  start = micros();
+  for (int i=0; i<BENCH_PAGES; i++) {
+    dflash.writeStrBuf1(0, page, pageSize);
+  }
+  report("Buffer 1 write", micros() - start);
+}
+
+//Compare sensor records as text with the time series codec, in blocks of one page
+void benchmarkTimeSeries()
+{
+  const uint8_t types[] = { TIMESERIES_TIME, TIMESERIES_FLOAT, TIMESERIES_INT };
+  static Sodaq_TimeSeries ts;
+  uint8_t block[DF_MAX_PAGE_SIZE];
+  uint32_t textBytes = 0;
+  uint32_t codecBytes = 0;
+  uint32_t start = micros();
+
+  ts.begin(1, types, sizeof(types), dflash.getPageSize());
+  for (int i=0; i<TS_ROWS; i++) {
+    uint32_t now = 1463040000UL + i * 60UL;
+    float temperature = 21.3 + (i % 50) * 0.02;
+    int32_t adc = analogRead(A0);
+    textBytes += String(String(now) + "," + String(temperature) + "," + String(adc)).length() + 2;
+
+    ts.set(0, now);
+    ts.set(1, temperature);
+    ts.set(2, adc);
+    if (!ts.append()) {
+      codecBytes += ts.encode(block, sizeof(block));
+      ts.append();
+    }
+  }
+  codecBytes += ts.encode(block, sizeof(block));
+  uint32_t elapsed = micros() - start;
+
+  SerialUSB.println("Time series, " + String(TS_ROWS, DEC) + " rows");
+  SerialUSB.println("  text bytes/row: " + String((float)textBytes / TS_ROWS));
+  SerialUSB.println("  codec bytes/row: " + String((float)codecBytes / TS_ROWS));
+  SerialUSB.println("  us/row (text and codec): " + String(elapsed / TS_ROWS, DEC));
+  SerialUSB.println("--------------------");
+}
+
+void report(const char *label, uint32_t elapsed)
+{
+  SerialUSB.println(String(label) + ", " + String(BENCH_PAGES, DEC) + " pages");
+  SerialUSB.println("  us/page: " + String(elapsed / BENCH_PAGES, DEC));
+  SerialUSB.println("  kB/s: " + String((uint32_t)BENCH_PAGES * dflash.getPageSize() * 1000 / elapsed, DEC));
+  SerialUSB.println("  SPI transactions/page: " + String(countingSPI.getNrTransactions() / BENCH_PAGES, DEC));
+  SerialUSB.println("  SPI bytes/page: " + String(countingSPI.getNrBytes() / BENCH_PAGES, DEC));
+  SerialUSB.println("--------------------");
 }
 
 void loop() 